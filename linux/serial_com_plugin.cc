@@ -2,21 +2,173 @@
 
 #include <flutter_linux/flutter_linux.h>
 #include <gtk/gtk.h>
-#include <fcntl.h>
-#include <termios.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include <atomic>
 #include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include "autobaud.h"
+#include "batch_runner.h"
+#include "capture_file.h"
+#include "decimator.h"
+#include "drain_worker.h"
+#include "file_sender.h"
+#include "frame_filter.h"
+#include "io_loop.h"
+#include "link_codec.h"
+#include "link_tester.h"
+#include "mapped_file.h"
+#include "modem_lines.h"
+#include "port_config.h"
+#include "posix_serial_port.h"
+#include "record_decoder.h"
+#include "rs485.h"
+#include "serial_bridge.h"
 #include "serial_com_plugin_private.h"
+#include "stream_subscribers.h"
+#include "thread_tuning.h"
+#include "trace_buffer.h"
+#include "transmit_pacer.h"
+#include "upload_engine.h"
 
 #define SERIAL_COM_PLUGIN(obj) \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), serial_com_plugin_get_type(), \
                               SerialComPlugin))
 
+// How long readFromPort waits for data before returning an empty string.
+// This matches the VTIME the core configures ports with.
+static const guint kReadTimeoutMs = 500;
+
+// Decoded records held per port between readRecords calls; later records
+// are dropped and counted.
+static const size_t kMaxBufferedRecords = 1 << 16;
+
+// Frames held per subscriber between readFrames calls; later frames are
+// dropped and counted.
+static const size_t kMaxQueuedFrames = 4096;
+
+// The longest runLinkTest throughput run; what comes back is held in
+// memory until it is compared.
+static const size_t kMaxLinkTestBytes = 64 << 20;
+
+// Trace events kept between startTracing and stopTracing; older ones are
+// overwritten.
+static const size_t kTraceCapacity = 1 << 16;
+
+struct OpenPort;
+struct UploadState;
+struct LinkTestState;
+struct AutobaudState;
+struct FileSendState;
+struct ModemMonitorState;
+struct BatchState;
+struct BreakRequest;
+
+enum class PendingReadKind {
+  // readFromPort: raw bytes.
+  kBytes,
+  // readRecords: decoded records.
+  kRecords,
+  // readFrames: one subscriber's filtered frames.
+  kFrames,
+  // readStream: one stream subscriber's bytes.
+  kStream,
+};
+
+// A readFromPort, readRecords, readFrames or readStream call waiting for
+// data to arrive.
+struct PendingRead {
+  OpenPort* port;
+  FlMethodCall* method_call;
+  PendingReadKind kind;
+  int max_length;
+  // For kFrames and kStream.
+  int subscription;
+  guint timeout_source;
+};
+
+// A port opened through openPort. Only touched on the main thread.
+struct OpenPort {
+  std::shared_ptr<serial_com::IoPort> io;
+  serial_com::IoLoop* loop;
+  // The settings openPort applied.
+  serial_com::PortConfig config;
+  std::deque<PendingRead*> pending_reads;
+  // Set once pacing has been requested; writes then go through it instead
+  // of the I/O loop.
+  std::unique_ptr<serial_com::TransmitPacer> pacer;
+  // Set when the port was opened in RS-485 mode. Its writes then all go
+  // through |pacer|, which turns the line around for each in software mode
+  // and times the turnarounds; |rs485_sink| sees the replies arrive.
+  std::shared_ptr<serial_com::Rs485Stats> rs485;
+  serial_com::Rs485Mode rs485_mode = serial_com::Rs485Mode::kAuto;
+  int rs485_sink = -1;
+  // Set when the port was opened with a codec; writes are encoded on the
+  // main thread and reads decoded on the I/O thread.
+  std::shared_ptr<serial_com::LinkCodecStats> codec_stats;
+  // Set by setRecordSchema; received bytes are then cut into records and
+  // decoded into columns on the I/O thread instead of being buffered.
+  std::shared_ptr<serial_com::RecordDecoder> records;
+  // Set by setDecimation; readRecords then returns the reduced series.
+  std::unique_ptr<serial_com::Decimator> decimator;
+  // Set by setFraming; received bytes are then cut into frames on the I/O
+  // thread and only those matching a subscriber's filter are kept.
+  std::shared_ptr<serial_com::FrameRouter> frames;
+  // Set while uploadFirmware runs. The engine owns the receive path until
+  // it finishes.
+  std::unique_ptr<serial_com::UploadEngine> upload;
+  std::shared_ptr<UploadState> upload_state;
+  // Set while runLinkTest runs; like an upload, it owns the receive path.
+  std::unique_ptr<serial_com::LinkTester> link_test;
+  std::shared_ptr<LinkTestState> link_test_state;
+  // Set while autobaud switches the port through candidate rates. The
+  // port's receive is held meanwhile, since the search reads the tty.
+  std::shared_ptr<AutobaudState> autobaud;
+  // Set while sendFile runs. A direct send writes to the tty itself, so
+  // writeToPort calls made meanwhile wait in |deferred_writes|.
+  std::shared_ptr<serial_com::FileSender> file_send;
+  std::shared_ptr<FileSendState> file_send_state;
+  bool file_send_direct = false;
+  std::deque<FlMethodCall*> deferred_writes;
+  // Set by startModemMonitor; input line changes are sent as events.
+  std::unique_ptr<serial_com::ModemMonitor> modem_monitor;
+  std::shared_ptr<ModemMonitorState> modem_monitor_state;
+  // Set while sendBreak holds the line in break.
+  BreakRequest* pending_break = nullptr;
+  // Created by the first drainPort call.
+  std::shared_ptr<serial_com::DrainWorker> drainer;
+  // Set by startBridge; serves the port to TCP clients.
+  std::unique_ptr<serial_com::SerialBridge> bridge;
+  // Created by the first subscribeStream call.
+  std::unique_ptr<serial_com::StreamSubscribers> streams;
+  // Set while an executeBatch call operates on the port.
+  std::shared_ptr<BatchState> batch;
+};
+
 struct _SerialComPlugin {
   GObject parent_instance;
+
+  // Backend for ports whose openPort call does not name one.
+  serial_com::IoBackendKind io_backend;
+  // I/O loops by requested backend, created on first use.
+  std::map<serial_com::IoBackendKind, std::unique_ptr<serial_com::IoLoop>>*
+      io_loops;
+  // Open ports by fd.
+  std::map<int, std::shared_ptr<OpenPort>>* ports;
+  // Applied to every I/O loop, including ones created later.
+  serial_com::ThreadTuning* thread_tuning;
+
+  // Progress and completion events, as maps with an "event" key.
+  FlEventChannel* events;
+  gboolean events_listening;
 };
 
 G_DEFINE_TYPE(SerialComPlugin, serial_com_plugin, g_object_get_type())
@@ -29,21 +181,94 @@ static void serial_com_plugin_handle_method_call(
 
   const gchar* method = fl_method_call_get_name(method_call);
 
-  if (strcmp(method, "openPort") == 0) {
-    response = handle_open_port(method_call);
+  if (strcmp(method, "initialize") == 0) {
+    response = handle_initialize(self, method_call);
+  } else if (strcmp(method, "openPort") == 0) {
+    response = handle_open_port(self, method_call);
   } else if (strcmp(method, "closePort") == 0) {
-    response = handle_close_port(method_call);
+    response = handle_close_port(self, method_call);
   } else if (strcmp(method, "writeToPort") == 0) {
-    response = handle_write_to_port(method_call);
+    response = handle_write_to_port(self, method_call);
+  } else if (strcmp(method, "writeMany") == 0) {
+    response = handle_write_many(self, method_call);
   } else if (strcmp(method, "readFromPort") == 0) {
-    response = handle_read_from_port(method_call);
+    response = handle_read_from_port(self, method_call);
+  } else if (strcmp(method, "drainPort") == 0) {
+    response = handle_drain_port(self, method_call);
+  } else if (strcmp(method, "flushPort") == 0) {
+    response = handle_flush_port(self, method_call);
+  } else if (strcmp(method, "setReceiveBuffer") == 0) {
+    response = handle_set_receive_buffer(self, method_call);
+  } else if (strcmp(method, "setPacing") == 0) {
+    response = handle_set_pacing(self, method_call);
+  } else if (strcmp(method, "setWriteLanes") == 0) {
+    response = handle_set_write_lanes(self, method_call);
+  } else if (strcmp(method, "setReadSizing") == 0) {
+    response = handle_set_read_sizing(self, method_call);
+  } else if (strcmp(method, "setRecordSchema") == 0) {
+    response = handle_set_record_schema(self, method_call);
+  } else if (strcmp(method, "setDecimation") == 0) {
+    response = handle_set_decimation(self, method_call);
+  } else if (strcmp(method, "setFraming") == 0) {
+    response = handle_set_framing(self, method_call);
+  } else if (strcmp(method, "subscribeFrames") == 0) {
+    response = handle_subscribe_frames(self, method_call);
+  } else if (strcmp(method, "unsubscribeFrames") == 0) {
+    response = handle_unsubscribe_frames(self, method_call);
+  } else if (strcmp(method, "readFrames") == 0) {
+    response = handle_read_frames(self, method_call);
+  } else if (strcmp(method, "readRecords") == 0) {
+    response = handle_read_records(self, method_call);
+  } else if (strcmp(method, "uploadFirmware") == 0) {
+    response = handle_upload_firmware(self, method_call);
+  } else if (strcmp(method, "cancelUpload") == 0) {
+    response = handle_cancel_upload(self, method_call);
+  } else if (strcmp(method, "runLinkTest") == 0) {
+    response = handle_run_link_test(self, method_call);
+  } else if (strcmp(method, "autobaud") == 0) {
+    response = handle_autobaud(self, method_call);
+  } else if (strcmp(method, "sendFile") == 0) {
+    response = handle_send_file(self, method_call);
+  } else if (strcmp(method, "cancelSendFile") == 0) {
+    response = handle_cancel_send_file(self, method_call);
+  } else if (strcmp(method, "startModemMonitor") == 0) {
+    response = handle_start_modem_monitor(self, method_call);
+  } else if (strcmp(method, "stopModemMonitor") == 0) {
+    response = handle_stop_modem_monitor(self, method_call);
+  } else if (strcmp(method, "getModemLines") == 0) {
+    response = handle_get_modem_lines(self, method_call);
+  } else if (strcmp(method, "setModemLines") == 0) {
+    response = handle_set_modem_lines(self, method_call);
+  } else if (strcmp(method, "sendBreak") == 0) {
+    response = handle_send_break(self, method_call);
+  } else if (strcmp(method, "startBridge") == 0) {
+    response = handle_start_bridge(self, method_call);
+  } else if (strcmp(method, "stopBridge") == 0) {
+    response = handle_stop_bridge(self, method_call);
+  } else if (strcmp(method, "subscribeStream") == 0) {
+    response = handle_subscribe_stream(self, method_call);
+  } else if (strcmp(method, "unsubscribeStream") == 0) {
+    response = handle_unsubscribe_stream(self, method_call);
+  } else if (strcmp(method, "readStream") == 0) {
+    response = handle_read_stream(self, method_call);
+  } else if (strcmp(method, "executeBatch") == 0) {
+    response = handle_execute_batch(self, method_call);
+  } else if (strcmp(method, "startTracing") == 0) {
+    response = handle_start_tracing(method_call);
+  } else if (strcmp(method, "stopTracing") == 0) {
+    response = handle_stop_tracing(method_call);
+  } else if (strcmp(method, "getPortStats") == 0) {
+    response = handle_get_port_stats(self, method_call);
   } else if (strcmp(method, "requestPermission") == 0) {
     response = handle_request_permission(method_call);
   } else {
     response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
   }
 
-  fl_method_call_respond(method_call, response, nullptr);
+  // Handlers that complete later respond themselves.
+  if (response != nullptr) {
+    fl_method_call_respond(method_call, response, nullptr);
+  }
 }
 
 FlMethodResponse* get_platform_version() {
@@ -54,7 +279,28 @@ FlMethodResponse* get_platform_version() {
   return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
+static void close_open_port(OpenPort* port);
+static void finish_break(BreakRequest* request);
+static void cancel_batch(BatchState* state);
+static void stop_autobaud(AutobaudState* state);
+
 static void serial_com_plugin_dispose(GObject* object) {
+  SerialComPlugin* self = SERIAL_COM_PLUGIN(object);
+
+  if (self->ports != nullptr) {
+    for (auto& it : *self->ports) {
+      close_open_port(it.second.get());
+      close(it.first);
+    }
+    delete self->ports;
+    self->ports = nullptr;
+  }
+  delete self->io_loops;
+  self->io_loops = nullptr;
+  delete self->thread_tuning;
+  self->thread_tuning = nullptr;
+  g_clear_object(&self->events);
+
   G_OBJECT_CLASS(serial_com_plugin_parent_class)->dispose(object);
 }
 
@@ -62,7 +308,15 @@ static void serial_com_plugin_class_init(SerialComPluginClass* klass) {
   G_OBJECT_CLASS(klass)->dispose = serial_com_plugin_dispose;
 }
 
-static void serial_com_plugin_init(SerialComPlugin* self) {}
+static void serial_com_plugin_init(SerialComPlugin* self) {
+  self->io_backend = serial_com::IoBackendKind::kEpoll;
+  self->io_loops = new std::map<serial_com::IoBackendKind,
+                                std::unique_ptr<serial_com::IoLoop>>();
+  self->ports = new std::map<int, std::shared_ptr<OpenPort>>();
+  self->thread_tuning = new serial_com::ThreadTuning();
+  self->events = nullptr;
+  self->events_listening = FALSE;
+}
 
 static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
                            gpointer user_data) {
@@ -70,6 +324,26 @@ static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
   serial_com_plugin_handle_method_call(plugin, method_call);
 }
 
+static FlMethodErrorResponse* events_listen_cb(FlEventChannel* channel,
+                                               FlValue* args,
+                                               gpointer user_data) {
+  SERIAL_COM_PLUGIN(user_data)->events_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* events_cancel_cb(FlEventChannel* channel,
+                                               FlValue* args,
+                                               gpointer user_data) {
+  SERIAL_COM_PLUGIN(user_data)->events_listening = FALSE;
+  return nullptr;
+}
+
+// Sends |event| on the event channel if Dart is listening.
+static void send_event(SerialComPlugin* self, FlValue* event) {
+  if (self->events == nullptr || !self->events_listening) return;
+  fl_event_channel_send(self->events, event, nullptr, nullptr);
+}
+
 void serial_com_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
   SerialComPlugin* plugin = SERIAL_COM_PLUGIN(
       g_object_new(serial_com_plugin_get_type(), nullptr));
@@ -83,55 +357,629 @@ void serial_com_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
                                             g_object_ref(plugin),
                                             g_object_unref);
 
+  plugin->events = fl_event_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), "serial_com/events",
+      FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->events, events_listen_cb,
+                                       events_cancel_cb, plugin, nullptr);
+
   g_object_unref(plugin);
 }
 
 // New functions for serial communication
 
-FlMethodResponse* handle_open_port(FlMethodCall* method_call) {
+// Returns the loop for |kind|, creating it on first use. io_uring requests
+// fall back to epoll when the kernel cannot provide it.
+static serial_com::IoLoop* get_io_loop(SerialComPlugin* self,
+                                       serial_com::IoBackendKind kind) {
+  auto it = self->io_loops->find(kind);
+  if (it != self->io_loops->end()) return it->second.get();
+  std::unique_ptr<serial_com::IoLoop> loop = serial_com::IoLoop::Create(kind);
+  serial_com::IoLoop* result = loop.get();
+  if (loop) {
+    // The same tuning already succeeded on the existing loops, so a failure
+    // here is not worth failing the port over.
+    loop->Tune(*self->thread_tuning);
+    (*self->io_loops)[kind] = std::move(loop);
+  }
+  return result;
+}
+
+// Reads an optional "ioBackend" argument. Returns false if it is present but
+// not a backend name.
+static gboolean lookup_io_backend(FlValue* args,
+                                  serial_com::IoBackendKind* kind) {
+  FlValue* value = fl_value_lookup_string(args, "ioBackend");
+  if (value == nullptr || fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+    return TRUE;
+  }
+  return fl_value_get_type(value) == FL_VALUE_TYPE_STRING &&
+         serial_com::ParseIoBackendKind(fl_value_get_string(value), kind);
+}
+
+// The trace buffer shared by every port. It is never freed, so I/O and
+// pacer threads may record into it at any time.
+static serial_com::TraceBuffer& plugin_trace() {
+  static serial_com::TraceBuffer* trace =
+      new serial_com::TraceBuffer(kTraceCapacity);
+  return *trace;
+}
+
+static OpenPort* lookup_open_port(SerialComPlugin* self, int fd) {
+  auto it = self->ports->find(fd);
+  return it == self->ports->end() ? nullptr : it->second.get();
+}
+
+static void respond_read(FlMethodCall* method_call, OpenPort* port,
+                         int max_length) {
+  std::vector<uint8_t> buffer(max_length + 1);
+  std::vector<uint64_t> chunks;
+  size_t bytes_read = port->io->Read(buffer.data(), max_length, &chunks);
+  buffer[bytes_read] = '\0';
+  g_autoptr(FlValue) result =
+      fl_value_new_string(reinterpret_cast<const gchar*>(buffer.data()));
+  serial_com::TraceBuffer& trace = plugin_trace();
+  const int fd = port->io->fd();
+  for (uint64_t chunk : chunks) {
+    trace.Record(serial_com::TraceStage::kEncoded, fd, chunk, bytes_read);
+  }
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  fl_method_call_respond(method_call, response, nullptr);
+  for (uint64_t chunk : chunks) {
+    trace.Record(serial_com::TraceStage::kResponded, fd, chunk, bytes_read);
+  }
+}
+
+static FlValue* new_column_value(const serial_com::Column& column,
+                                 size_t rows) {
+  switch (column.type) {
+    case serial_com::ColumnType::kInt32:
+      return fl_value_new_int32_list(column.values<int32_t>(), rows);
+    case serial_com::ColumnType::kInt64:
+      return fl_value_new_int64_list(column.values<int64_t>(), rows);
+    case serial_com::ColumnType::kFloat32:
+      return fl_value_new_float32_list(column.values<float>(), rows);
+    case serial_com::ColumnType::kFloat64:
+      return fl_value_new_float_list(column.values<double>(), rows);
+  }
+  return fl_value_new_null();
+}
+
+// Responds with every record decoded since the last readRecords call, as
+// {rows, dropped, columns: {name: typed list}}. With decimation the columns
+// hold the points those records completed, which may be none.
+static void respond_records(FlMethodCall* method_call, OpenPort* port) {
+  serial_com::RecordBatch batch;
+  if (port->records) batch = port->records->TakeBatch();
+  if (port->decimator) batch = port->decimator->Process(batch);
+  g_autoptr(FlValue) columns = fl_value_new_map();
+  for (const serial_com::Column& column : batch.columns) {
+    fl_value_set_string_take(columns, column.name.c_str(),
+                             new_column_value(column, batch.rows));
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "rows", fl_value_new_int(batch.rows));
+  fl_value_set_string_take(result, "dropped", fl_value_new_int(batch.dropped));
+  fl_value_set_string(result, "columns", columns);
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+// Responds with the frames subscriber |subscription| has received since
+// its last readFrames call, as {frames: [Uint8List], dropped}.
+static void respond_frames(FlMethodCall* method_call, OpenPort* port,
+                           int subscription) {
+  std::vector<std::vector<uint8_t>> frames;
+  uint64_t dropped = 0;
+  if (port->frames) port->frames->Take(subscription, &frames, &dropped);
+  g_autoptr(FlValue) list = fl_value_new_list();
+  for (const std::vector<uint8_t>& frame : frames) {
+    fl_value_append_take(list,
+                         fl_value_new_uint8_list(frame.data(), frame.size()));
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string(result, "frames", list);
+  fl_value_set_string_take(result, "dropped", fl_value_new_int(dropped));
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+// Responds with up to |max_length| of stream subscriber |subscription|'s
+// bytes, as a Uint8List.
+static void respond_stream(FlMethodCall* method_call, OpenPort* port,
+                           int subscription, int max_length) {
+  std::vector<uint8_t> buffer(max_length);
+  size_t bytes_read = 0;
+  if (port->streams) {
+    bytes_read =
+        port->streams->Read(subscription, buffer.data(), buffer.size());
+  }
+  g_autoptr(FlValue) result =
+      fl_value_new_uint8_list(buffer.data(), bytes_read);
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+static gboolean pending_read_ready(PendingRead* pending) {
+  OpenPort* port = pending->port;
+  switch (pending->kind) {
+    case PendingReadKind::kBytes:
+      return port->io->Available() > 0;
+    case PendingReadKind::kRecords:
+      return port->records && port->records->rows() > 0;
+    case PendingReadKind::kFrames:
+      return port->frames && port->frames->Queued(pending->subscription) > 0;
+    case PendingReadKind::kStream:
+      return port->streams && port->streams->Queued(pending->subscription) > 0;
+  }
+  return FALSE;
+}
+
+static void finish_pending_read(PendingRead* pending) {
+  if (pending->timeout_source != 0) g_source_remove(pending->timeout_source);
+  switch (pending->kind) {
+    case PendingReadKind::kBytes:
+      respond_read(pending->method_call, pending->port, pending->max_length);
+      break;
+    case PendingReadKind::kRecords:
+      respond_records(pending->method_call, pending->port);
+      break;
+    case PendingReadKind::kFrames:
+      respond_frames(pending->method_call, pending->port,
+                     pending->subscription);
+      break;
+    case PendingReadKind::kStream:
+      respond_stream(pending->method_call, pending->port,
+                     pending->subscription, pending->max_length);
+      break;
+  }
+  g_object_unref(pending->method_call);
+  delete pending;
+}
+
+static gboolean pending_read_timeout_cb(gpointer user_data) {
+  PendingRead* pending = static_cast<PendingRead*>(user_data);
+  std::deque<PendingRead*>& queue = pending->port->pending_reads;
+  for (auto it = queue.begin(); it != queue.end(); ++it) {
+    if (*it == pending) {
+      queue.erase(it);
+      break;
+    }
+  }
+  pending->timeout_source = 0;
+  finish_pending_read(pending);
+  return G_SOURCE_REMOVE;
+}
+
+static void add_pending_read(OpenPort* port, FlMethodCall* method_call,
+                             PendingReadKind kind, int max_length,
+                             int subscription) {
+  PendingRead* pending = new PendingRead();
+  pending->port = port;
+  pending->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  pending->kind = kind;
+  pending->max_length = max_length;
+  pending->subscription = subscription;
+  pending->timeout_source =
+      g_timeout_add(kReadTimeoutMs, pending_read_timeout_cb, pending);
+  port->pending_reads.push_back(pending);
+}
+
+// Whether a read of |kind| (for |subscription|, with kFrames or kStream)
+// is already waiting, in which case a new one has to queue behind it.
+static gboolean has_pending_read(OpenPort* port, PendingReadKind kind,
+                                 int subscription) {
+  for (PendingRead* pending : port->pending_reads) {
+    if (pending->kind == kind &&
+        ((kind != PendingReadKind::kFrames &&
+          kind != PendingReadKind::kStream) ||
+         pending->subscription == subscription)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Runs on the main thread after the I/O thread announced new data.
+static gboolean port_data_cb(gpointer user_data) {
+  std::weak_ptr<OpenPort>* weak_port =
+      static_cast<std::weak_ptr<OpenPort>*>(user_data);
+  std::shared_ptr<OpenPort> port = weak_port->lock();
+  if (!port) return G_SOURCE_REMOVE;
+  // Reads of different kinds (or for different subscribers) do not wait
+  // behind each other; reads of the same kind are answered in order.
+  std::deque<PendingRead*>& queue = port->pending_reads;
+  for (auto it = queue.begin(); it != queue.end();) {
+    if (!pending_read_ready(*it)) {
+      ++it;
+      continue;
+    }
+    PendingRead* pending = *it;
+    it = queue.erase(it);
+    finish_pending_read(pending);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void delete_weak_port(gpointer user_data) {
+  delete static_cast<std::weak_ptr<OpenPort>*>(user_data);
+}
+
+// Fails the writeToPort calls held back by a direct file send.
+static void cancel_deferred_writes(OpenPort* port) {
+  while (!port->deferred_writes.empty()) {
+    FlMethodCall* method_call = port->deferred_writes.front();
+    port->deferred_writes.pop_front();
+    g_autofree gchar* error_msg =
+        g_strdup_printf("Error writing to port: %s", strerror(ECANCELED));
+    g_autoptr(FlMethodResponse) response = FL_METHOD_RESPONSE(
+        fl_method_error_response_new("WRITE_ERROR", error_msg, nullptr));
+    fl_method_call_respond(method_call, response, nullptr);
+    g_object_unref(method_call);
+  }
+}
+
+// Answers outstanding reads and detaches the port from its I/O loop. The
+// caller closes the fd.
+static void close_open_port(OpenPort* port) {
+  while (!port->pending_reads.empty()) {
+    PendingRead* pending = port->pending_reads.front();
+    port->pending_reads.pop_front();
+    finish_pending_read(pending);
+  }
+  if (port->upload) {
+    // Aborts the upload; its call is answered once the result reaches the
+    // main thread.
+    port->io->SetFrameCallback(nullptr, nullptr);
+    port->upload.reset();
+  }
+  // Likewise for a link test.
+  if (port->link_test) {
+    port->io->SetFrameCallback(nullptr, nullptr);
+    port->link_test.reset();
+  }
+  // And for a file send.
+  port->file_send.reset();
+  // Autobaud stops within a poll interval; it must be done with the fd
+  // before the caller closes it.
+  if (port->autobaud) stop_autobaud(port->autobaud.get());
+  cancel_deferred_writes(port);
+  port->pacer.reset();
+  if (port->rs485) {
+    port->io->receive_fanout()->RemoveSink(port->rs485_sink);
+    if (port->rs485_mode == serial_com::Rs485Mode::kKernel) {
+      serial_com::DisableKernelRs485(port->io->fd());
+    }
+  }
+  port->modem_monitor.reset();
+  port->modem_monitor_state.reset();
+  if (port->pending_break != nullptr) finish_break(port->pending_break);
+  // Disconnects the clients before the fd goes away under the bridge.
+  port->bridge.reset();
+  port->streams.reset();
+  if (port->batch) cancel_batch(port->batch.get());
+  port->loop->RemovePort(port->io);
+  // Fails drains still waiting for the queued writes.
+  port->drainer.reset();
+}
+
+static FlMethodResponse* status_error_response(
+    const serial_com::Status& status) {
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      status.code(), status.message().c_str(), nullptr));
+}
+
+// Reads an optional non-negative integer argument into |value|. Returns
+// false if it is present but not one.
+static gboolean lookup_size_arg(FlValue* map, const char* key, size_t* value) {
+  FlValue* entry = fl_value_lookup_string(map, key);
+  if (entry == nullptr || fl_value_get_type(entry) == FL_VALUE_TYPE_NULL) {
+    return TRUE;
+  }
+  if (fl_value_get_type(entry) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(entry) < 0) {
+    return FALSE;
+  }
+  *value = fl_value_get_int(entry);
+  return TRUE;
+}
+
+// Reads |key| as bytes from a Uint8List or a string.
+static gboolean lookup_bytes_arg(FlValue* map, const char* key,
+                                 std::vector<uint8_t>* bytes) {
+  FlValue* value = fl_value_lookup_string(map, key);
+  if (value == nullptr) return FALSE;
+  if (fl_value_get_type(value) == FL_VALUE_TYPE_UINT8_LIST) {
+    const uint8_t* data = fl_value_get_uint8_list(value);
+    bytes->assign(data, data + fl_value_get_length(value));
+    return TRUE;
+  }
+  if (fl_value_get_type(value) == FL_VALUE_TYPE_STRING) {
+    const char* text = fl_value_get_string(value);
+    bytes->assign(text, text + strlen(text));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Reads the optional "cpuAffinity" (list of CPU numbers) and
+// "realtimePriority" (SCHED_FIFO priority, 0 for none) arguments into
+// |tuning|. Returns false if either is malformed.
+static gboolean lookup_thread_tuning(FlValue* args,
+                                     serial_com::ThreadTuning* tuning) {
+  FlValue* cpus = fl_value_lookup_string(args, "cpuAffinity");
+  if (cpus != nullptr && fl_value_get_type(cpus) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(cpus) != FL_VALUE_TYPE_LIST) return FALSE;
+    tuning->cpus.clear();
+    for (size_t i = 0; i < fl_value_get_length(cpus); i++) {
+      FlValue* cpu = fl_value_get_list_value(cpus, i);
+      if (fl_value_get_type(cpu) != FL_VALUE_TYPE_INT ||
+          fl_value_get_int(cpu) < 0 || fl_value_get_int(cpu) > G_MAXINT) {
+        return FALSE;
+      }
+      tuning->cpus.push_back(static_cast<int>(fl_value_get_int(cpu)));
+    }
+  }
+  FlValue* priority = fl_value_lookup_string(args, "realtimePriority");
+  if (priority != nullptr &&
+      fl_value_get_type(priority) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(priority) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(priority) < 0 ||
+        fl_value_get_int(priority) > G_MAXINT) {
+      return FALSE;
+    }
+    tuning->realtime_priority = static_cast<int>(fl_value_get_int(priority));
+  }
+  return TRUE;
+}
+
+FlMethodResponse* handle_initialize(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
   FlValue* args = fl_method_call_get_args(method_call);
-  const char* port_name = fl_value_get_string(fl_value_lookup_string(args, "port"));
-  int baud_rate = fl_value_get_int(fl_value_lookup_string(args, "baudRate"));
+  serial_com::IoBackendKind kind = self->io_backend;
+  serial_com::ThreadTuning tuning = *self->thread_tuning;
+  gboolean lock_memory = FALSE;
+  if (fl_value_get_type(args) == FL_VALUE_TYPE_MAP) {
+    if (!lookup_io_backend(args, &kind)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", "Unknown ioBackend", nullptr));
+    }
+    if (!lookup_thread_tuning(args, &tuning)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", "Invalid cpuAffinity or realtimePriority",
+          nullptr));
+    }
+    FlValue* lock = fl_value_lookup_string(args, "lockMemory");
+    lock_memory = lock != nullptr &&
+                  fl_value_get_type(lock) == FL_VALUE_TYPE_BOOL &&
+                  fl_value_get_bool(lock);
+  }
+  serial_com::Status status = serial_com::ValidateThreadTuning(tuning);
+  if (!status.ok()) return status_error_response(status);
 
-  int fd = open(port_name, O_RDWR | O_NOCTTY | O_SYNC);
-  if (fd < 0) {
-    g_autofree gchar *error_msg = g_strdup_printf("Error opening port: %s", strerror(errno));
-    return FL_METHOD_RESPONSE(fl_method_error_response_new("OPEN_ERROR", error_msg, nullptr));
+  serial_com::IoLoop* loop = get_io_loop(self, kind);
+  if (loop == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INIT_ERROR", "Could not start the I/O thread", nullptr));
   }
+  self->io_backend = kind;
 
-  struct termios tty;
-  memset(&tty, 0, sizeof tty);
-  if (tcgetattr(fd, &tty) != 0) {
-    close(fd);
-    return FL_METHOD_RESPONSE(fl_method_error_response_new("CONFIG_ERROR", "Error from tcgetattr", nullptr));
+  // Every I/O thread gets the tuning. If one refuses it (typically with
+  // PERMISSION_ERROR), all of them go back to the previous tuning.
+  for (auto& it : *self->io_loops) {
+    status = it.second->Tune(tuning);
+    if (!status.ok()) {
+      for (auto& tuned : *self->io_loops) {
+        tuned.second->Tune(*self->thread_tuning);
+      }
+      return status_error_response(status);
+    }
+  }
+  *self->thread_tuning = tuning;
+  if (lock_memory) {
+    // Keeps the port buffers, which grow on demand, resident as well.
+    status = serial_com::LockProcessMemory();
+    if (!status.ok()) return status_error_response(status);
+  }
+
+  // Report what the kernel actually gave us.
+  g_autoptr(FlValue) result =
+      fl_value_new_string(serial_com::IoBackendKindName(loop->kind()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Fills |config| from the openPort arguments. Everything but the port and
+// baud rate is optional and defaults to 8N1 without flow control.
+static gboolean parse_port_config(FlValue* args,
+                                  serial_com::PortConfig* config) {
+  config->path = fl_value_get_string(fl_value_lookup_string(args, "port"));
+  config->baud_rate = fl_value_get_int(fl_value_lookup_string(args, "baudRate"));
+
+  FlValue* value = fl_value_lookup_string(args, "dataBits");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->data_bits = fl_value_get_int(value);
+  }
+  value = fl_value_lookup_string(args, "stopBits");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->stop_bits = fl_value_get_int(value) == 2 ? serial_com::StopBits::kTwo
+                                                     : serial_com::StopBits::kOne;
   }
+  value = fl_value_lookup_string(args, "parity");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_STRING &&
+      !serial_com::ParseParity(fl_value_get_string(value), &config->parity)) {
+    return FALSE;
+  }
+  value = fl_value_lookup_string(args, "flowControl");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_STRING &&
+      !serial_com::ParseFlowControl(fl_value_get_string(value),
+                                    &config->flow_control)) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Fills |config| from the optional interByteGapUs, interFrameGapUs and
+// maxBytesPerSecond arguments. Returns false if any of them is negative.
+static gboolean parse_pacing_config(FlValue* args,
+                                    serial_com::PacingConfig* config) {
+  FlValue* value = fl_value_lookup_string(args, "interByteGapUs");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->inter_byte_gap_us = fl_value_get_int(value);
+  }
+  value = fl_value_lookup_string(args, "interFrameGapUs");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->inter_frame_gap_us = fl_value_get_int(value);
+  }
+  value = fl_value_lookup_string(args, "maxBytesPerSecond");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->max_bytes_per_second = fl_value_get_int(value);
+  }
+  return serial_com::IsValidPacingConfig(*config);
+}
 
-  cfsetospeed(&tty, baud_rate);
-  cfsetispeed(&tty, baud_rate);
+// Fills |config| and |mode| from the optional rs485 argument, a map with
+// mode ("auto", "kernel" or "software"), rtsOnSend, delayBeforeSendUs,
+// delayAfterSendUs and rxDuringTx, all optional. Sets |enabled| if it was
+// given. Returns false if it is malformed.
+static gboolean parse_rs485_config(FlValue* args, gboolean* enabled,
+                                   serial_com::Rs485Config* config,
+                                   serial_com::Rs485Mode* mode) {
+  FlValue* rs485 = fl_value_lookup_string(args, "rs485");
+  *enabled = rs485 != nullptr && fl_value_get_type(rs485) != FL_VALUE_TYPE_NULL;
+  if (!*enabled) return TRUE;
+  if (fl_value_get_type(rs485) != FL_VALUE_TYPE_MAP) return FALSE;
+  FlValue* value = fl_value_lookup_string(rs485, "mode");
+  if (value != nullptr &&
+      (fl_value_get_type(value) != FL_VALUE_TYPE_STRING ||
+       !serial_com::ParseRs485Mode(fl_value_get_string(value), mode))) {
+    return FALSE;
+  }
+  value = fl_value_lookup_string(rs485, "rtsOnSend");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_BOOL) {
+    config->rts_on_send = fl_value_get_bool(value);
+  }
+  value = fl_value_lookup_string(rs485, "delayBeforeSendUs");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->delay_before_send_us = fl_value_get_int(value);
+  }
+  value = fl_value_lookup_string(rs485, "delayAfterSendUs");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    config->delay_after_send_us = fl_value_get_int(value);
+  }
+  value = fl_value_lookup_string(rs485, "rxDuringTx");
+  if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_BOOL) {
+    config->rx_during_tx = fl_value_get_bool(value);
+  }
+  return serial_com::IsValidRs485Config(*config);
+}
+
+FlMethodResponse* handle_open_port(SerialComPlugin* self,
+                                   FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
 
-  tty.c_cflag = (tty.c_cflag & ~CSIZE) | CS8;
-  tty.c_iflag &= ~IGNBRK;
-  tty.c_lflag = 0;
-  tty.c_oflag = 0;
-  tty.c_cc[VMIN]  = 0;
-  tty.c_cc[VTIME] = 5;
+  serial_com::PortConfig config;
+  serial_com::PacingConfig pacing;
+  serial_com::IoBackendKind kind = self->io_backend;
+  serial_com::LinkCodec codec = serial_com::LinkCodec::kNone;
+  FlValue* codec_value = fl_value_lookup_string(args, "codec");
+  if (codec_value != nullptr &&
+      (fl_value_get_type(codec_value) != FL_VALUE_TYPE_STRING ||
+       !serial_com::ParseLinkCodec(fl_value_get_string(codec_value), &codec))) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Unknown codec", nullptr));
+  }
+  gboolean rs485 = FALSE;
+  serial_com::Rs485Config rs485_config;
+  serial_com::Rs485Mode rs485_mode = serial_com::Rs485Mode::kAuto;
+  if (!parse_port_config(args, &config) || !parse_pacing_config(args, &pacing) ||
+      !lookup_io_backend(args, &kind) ||
+      !parse_rs485_config(args, &rs485, &rs485_config, &rs485_mode)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid port settings", nullptr));
+  }
 
-  tty.c_iflag &= ~(IXON | IXOFF | IXANY);
-  tty.c_cflag |= (CLOCAL | CREAD);
+  int fd = -1;
+  serial_com::Status status = serial_com::OpenPosixPort(config, &fd);
+  if (!status.ok()) return status_error_response(status);
+  if (rs485) {
+    status = serial_com::EnableRs485(fd, rs485_config, rs485_mode, &rs485_mode);
+    if (!status.ok()) {
+      close(fd);
+      return status_error_response(status);
+    }
+  }
 
-  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+  serial_com::IoLoop* loop = get_io_loop(self, kind);
+  std::shared_ptr<OpenPort> port = std::make_shared<OpenPort>();
+  port->io = std::make_shared<serial_com::IoPort>(fd);
+  port->io->SetTraceBuffer(&plugin_trace());
+  port->loop = loop;
+  port->config = config;
+  std::weak_ptr<OpenPort> weak_port = port;
+  port->io->SetDataCallback([weak_port]() {
+    g_idle_add_full(G_PRIORITY_DEFAULT, port_data_cb,
+                    new std::weak_ptr<OpenPort>(weak_port), delete_weak_port);
+  });
+  if (codec == serial_com::LinkCodec::kLz4) {
+    port->codec_stats = std::make_shared<serial_com::LinkCodecStats>();
+    port->io->SetDecoder(std::unique_ptr<serial_com::Framer>(
+        new serial_com::Lz4FrameDecoder(port->codec_stats)));
+  }
+  if (loop == nullptr || !loop->AddPort(port->io)) {
+    if (rs485_mode == serial_com::Rs485Mode::kKernel) {
+      serial_com::DisableKernelRs485(fd);
+    }
     close(fd);
-    return FL_METHOD_RESPONSE(fl_method_error_response_new("CONFIG_ERROR", "Error from tcsetattr", nullptr));
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "OPEN_ERROR", "Could not start I/O on the port", nullptr));
   }
+  if (pacing.enabled() || rs485) {
+    port->pacer.reset(
+        new serial_com::TransmitPacer(fd, pacing, &port->io->stats()));
+  }
+  if (rs485) {
+    port->rs485 = std::make_shared<serial_com::Rs485Stats>();
+    port->rs485_mode = rs485_mode;
+    serial_com::HalfDuplexConfig half_duplex;
+    half_duplex.enabled = true;
+    // The kernel switches RTS itself, with its own delays; the pacer only
+    // drains and times.
+    if (rs485_mode == serial_com::Rs485Mode::kSoftware) {
+      half_duplex.set_direction = [fd, rs485_config](bool transmit) {
+        return serial_com::SetRs485Direction(fd, rs485_config, transmit);
+      };
+      half_duplex.delay_before_send_us = rs485_config.delay_before_send_us;
+    }
+    half_duplex.delay_after_send_us = rs485_config.delay_after_send_us;
+    half_duplex.stats = port->rs485;
+    port->pacer->SetHalfDuplex(std::move(half_duplex));
+    std::shared_ptr<serial_com::Rs485Stats> stats = port->rs485;
+    port->rs485_sink = port->io->receive_fanout()->AddSink(
+        [stats](const serial_com::SharedChunk&) {
+          stats->OnReceived(serial_com::Rs485Stats::Clock::now());
+        });
+  }
+  (*self->ports)[fd] = port;
 
   g_autoptr(FlValue) result = fl_value_new_int(fd);
   return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
-FlMethodResponse* handle_close_port(FlMethodCall* method_call) {
+FlMethodResponse* handle_close_port(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
   FlValue* args = fl_method_call_get_args(method_call);
   int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
 
+  auto it = self->ports->find(fd);
+  if (it != self->ports->end()) {
+    close_open_port(it->second.get());
+    self->ports->erase(it);
+  }
+
   if (close(fd) < 0) {
     g_autofree gchar *error_msg = g_strdup_printf("Error closing port: %s", strerror(errno));
     return FL_METHOD_RESPONSE(fl_method_error_response_new("CLOSE_ERROR", error_msg, nullptr));
@@ -140,37 +988,2459 @@ FlMethodResponse* handle_close_port(FlMethodCall* method_call) {
   return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
 }
 
-FlMethodResponse* handle_write_to_port(FlMethodCall* method_call) {
+struct WriteCompletion {
+  FlMethodCall* method_call;
+  ssize_t result;
+  // What to report on success when the bytes on the wire differ from what
+  // the caller wrote, i.e. with a codec. -1 reports |result|.
+  ssize_t reported_length;
+  int fd;
+  // Filled in by the handler after queueing, which is always before this
+  // completion reaches the main thread.
+  std::shared_ptr<uint64_t> trace_chunk;
+};
+
+static gboolean write_complete_cb(gpointer user_data) {
+  WriteCompletion* completion = static_cast<WriteCompletion*>(user_data);
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (completion->result < 0) {
+    g_autofree gchar *error_msg = g_strdup_printf("Error writing to port: %s", strerror(-completion->result));
+    response = FL_METHOD_RESPONSE(fl_method_error_response_new("WRITE_ERROR", error_msg, nullptr));
+  } else {
+    g_autoptr(FlValue) result = fl_value_new_int(
+        completion->reported_length >= 0 ? completion->reported_length
+                                         : completion->result);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  fl_method_call_respond(completion->method_call, response, nullptr);
+  plugin_trace().Record(serial_com::TraceStage::kWriteResponded,
+                        completion->fd, *completion->trace_chunk,
+                        completion->result > 0 ? completion->result : 0);
+  g_object_unref(completion->method_call);
+  delete completion;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_write_to_port(SerialComPlugin* self,
+                                       FlMethodCall* method_call) {
   FlValue* args = fl_method_call_get_args(method_call);
   int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
   const char* data = fl_value_get_string(fl_value_lookup_string(args, "data"));
 
-  ssize_t bytes_written = write(fd, data, strlen(data));
-  if (bytes_written < 0) {
-    g_autofree gchar *error_msg = g_strdup_printf("Error writing to port: %s", strerror(errno));
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    g_autofree gchar *error_msg = g_strdup_printf("Error writing to port: %s", strerror(EBADF));
     return FL_METHOD_RESPONSE(fl_method_error_response_new("WRITE_ERROR", error_msg, nullptr));
   }
+  serial_com::WriteLane lane = serial_com::WriteLane::kNormal;
+  FlValue* lane_value = fl_value_lookup_string(args, "lane");
+  if (lane_value != nullptr &&
+      fl_value_get_type(lane_value) != FL_VALUE_TYPE_NULL &&
+      (fl_value_get_type(lane_value) != FL_VALUE_TYPE_STRING ||
+       !serial_com::ParseWriteLane(fl_value_get_string(lane_value), &lane))) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Unknown write lane", nullptr));
+  }
+  // The pacer sends in order, so an urgent write would still queue behind
+  // bulk traffic.
+  if (port->pacer && lane != serial_com::WriteLane::kNormal) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Paced ports only have the normal write lane",
+        nullptr));
+  }
+  if (port->file_send_direct) {
+    // Sent once the file is, so the two do not interleave on the wire.
+    port->deferred_writes.push_back(FL_METHOD_CALL(g_object_ref(method_call)));
+    return nullptr;
+  }
 
-  g_autoptr(FlValue) result = fl_value_new_int(bytes_written);
-  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  // The I/O thread (or the pacer's thread) performs the write; the call
+  // completes once all of the data has been handed to the tty.
+  FlMethodCall* pending_call = FL_METHOD_CALL(g_object_ref(method_call));
+  const size_t length = strlen(data);
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(data);
+  std::vector<uint8_t> bytes;
+  ssize_t reported_length = -1;
+  if (port->codec_stats) {
+    serial_com::EncodeLz4Frames(raw, length, &bytes, port->codec_stats.get());
+    reported_length = length;
+  } else {
+    bytes.assign(raw, raw + length);
+  }
+  auto trace_chunk = std::make_shared<uint64_t>(0);
+  if (port->pacer) {
+    serial_com::TraceBuffer& trace = plugin_trace();
+    const uint64_t chunk = trace.NewChunk();
+    *trace_chunk = chunk;
+    trace.Record(serial_com::TraceStage::kWriteQueued, fd, chunk,
+                 bytes.size());
+    port->pacer->Write(
+        std::move(bytes),
+        [pending_call, reported_length, fd, chunk, trace_chunk](
+            int64_t result) {
+          plugin_trace().Record(serial_com::TraceStage::kWriteDone, fd, chunk,
+                                result > 0 ? result : 0);
+          g_idle_add(write_complete_cb,
+                     new WriteCompletion{pending_call,
+                                         static_cast<ssize_t>(result),
+                                         reported_length, fd, trace_chunk});
+        });
+  } else {
+    *trace_chunk = port->loop->Write(
+        port->io, std::move(bytes),
+        [pending_call, reported_length, fd, trace_chunk](ssize_t result) {
+          g_idle_add(write_complete_cb,
+                     new WriteCompletion{pending_call, result, reported_length,
+                                         fd, trace_chunk});
+        },
+        lane);
+  }
+  return nullptr;
+}
+
+// A writeMany call waiting for every port to finish.
+struct BroadcastCompletion {
+  FlMethodCall* method_call;
+  std::vector<int> fds;
+  // Entries for ports that could not be written to, by index into |fds|.
+  std::map<size_t, serial_com::Status> refused;
+  // Indexes into |fds| of the ports written to, in broadcast order.
+  std::vector<size_t> written;
+  serial_com::BroadcastResult result;
+};
+
+static gboolean broadcast_complete_cb(gpointer user_data) {
+  BroadcastCompletion* completion =
+      static_cast<BroadcastCompletion*>(user_data);
+  std::vector<FlValue*> entries(completion->fds.size(), nullptr);
+  for (const auto& it : completion->refused) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "error",
+                             fl_value_new_string(it.second.code()));
+    fl_value_set_string_take(
+        entry, "message", fl_value_new_string(it.second.message().c_str()));
+    entries[it.first] = entry;
+  }
+  const serial_com::BroadcastResult& result = completion->result;
+  for (size_t i = 0; i < completion->written.size(); i++) {
+    FlValue* entry = fl_value_new_map();
+    if (result.results[i] < 0) {
+      g_autofree gchar* error_msg = g_strdup_printf(
+          "Error writing to port: %s",
+          strerror(static_cast<int>(-result.results[i])));
+      fl_value_set_string_take(entry, "error",
+                               fl_value_new_string("WRITE_ERROR"));
+      fl_value_set_string_take(entry, "message",
+                               fl_value_new_string(error_msg));
+    } else {
+      fl_value_set_string_take(entry, "bytes",
+                               fl_value_new_int(result.results[i]));
+      fl_value_set_string_take(
+          entry, "finishedUs",
+          fl_value_new_int(result.finished_ns[i] / 1000));
+    }
+    entries[completion->written[i]] = entry;
+  }
+  g_autoptr(FlValue) results = fl_value_new_list();
+  for (size_t i = 0; i < entries.size(); i++) {
+    fl_value_set_string_take(entries[i], "fd",
+                             fl_value_new_int(completion->fds[i]));
+    fl_value_append_take(results, entries[i]);
+  }
+  g_autoptr(FlValue) value = fl_value_new_map();
+  fl_value_set_string(value, "results", results);
+  fl_value_set_string_take(value, "skewUs",
+                           fl_value_new_int(result.skew_ns / 1000));
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  fl_method_call_respond(completion->method_call, response, nullptr);
+  g_object_unref(completion->method_call);
+  delete completion;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_write_many(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  FlValue* fds = fl_value_lookup_string(args, "fds");
+  std::vector<uint8_t> bytes;
+  if (fds == nullptr || fl_value_get_type(fds) != FL_VALUE_TYPE_LIST ||
+      !lookup_bytes_arg(args, "data", &bytes)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Expected fds and data", nullptr));
+  }
+
+  BroadcastCompletion* completion = new BroadcastCompletion();
+  std::vector<serial_com::IoLoop::WriteTarget> targets;
+  for (size_t i = 0; i < fl_value_get_length(fds); i++) {
+    FlValue* entry = fl_value_get_list_value(fds, i);
+    if (fl_value_get_type(entry) != FL_VALUE_TYPE_INT) {
+      delete completion;
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", "Expected fds and data", nullptr));
+    }
+    int fd = static_cast<int>(fl_value_get_int(entry));
+    completion->fds.push_back(fd);
+    OpenPort* port = lookup_open_port(self, fd);
+    if (port == nullptr) {
+      completion->refused.emplace(
+          i, serial_com::Status::Error("WRITE_ERROR", strerror(EBADF)));
+      continue;
+    }
+    // The shared payload goes to the I/O loops as it is, so ports that
+    // encode, pace or hold back writes take writeToPort instead. A batch's
+    // writes would interleave with it.
+    if (port->codec_stats || port->pacer || port->file_send_direct ||
+        port->batch) {
+      completion->refused.emplace(
+          i, serial_com::Status::Error(
+                 "CONFIG_ERROR",
+                 "Port is paced, encoded, sending a file or in a batch"));
+      continue;
+    }
+    completion->written.push_back(i);
+    targets.push_back(serial_com::IoLoop::WriteTarget{port->loop, port->io});
+  }
+
+  completion->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  // One buffer serves every port.
+  serial_com::IoLoop::WriteMany(
+      targets,
+      std::make_shared<const std::vector<uint8_t>>(std::move(bytes)),
+      [completion](const serial_com::BroadcastResult& result) {
+        completion->result = result;
+        g_idle_add(broadcast_complete_cb, completion);
+      });
+  return nullptr;
+}
+
+struct DrainCompletion {
+  FlMethodCall* method_call;
+  int error;
+};
+
+static gboolean drain_complete_cb(gpointer user_data) {
+  DrainCompletion* completion = static_cast<DrainCompletion*>(user_data);
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (completion->error != 0) {
+    g_autofree gchar* error_msg = g_strdup_printf(
+        "Error draining port: %s", strerror(completion->error));
+    response = FL_METHOD_RESPONSE(
+        fl_method_error_response_new("DRAIN_ERROR", error_msg, nullptr));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  fl_method_call_respond(completion->method_call, response, nullptr);
+  g_object_unref(completion->method_call);
+  delete completion;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_drain_port(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    g_autofree gchar* error_msg =
+        g_strdup_printf("Error draining port: %s", strerror(EBADF));
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("DRAIN_ERROR", error_msg, nullptr));
+  }
+  if (!port->drainer) {
+    port->drainer = std::make_shared<serial_com::DrainWorker>(fd);
+  }
+
+  // An empty write completes once every write queued before it has reached
+  // the tty; tcdrain then waits for the UART to send it. The bulk lane only
+  // moves once the others are empty, so it covers every lane.
+  FlMethodCall* call = FL_METHOD_CALL(g_object_ref(method_call));
+  std::weak_ptr<serial_com::DrainWorker> weak_drainer = port->drainer;
+  auto written = [call, weak_drainer](int64_t result) {
+    std::shared_ptr<serial_com::DrainWorker> drainer = weak_drainer.lock();
+    if (result < 0 || !drainer) {
+      int error = result < 0 ? static_cast<int>(-result) : ECANCELED;
+      g_idle_add(drain_complete_cb, new DrainCompletion{call, error});
+      return;
+    }
+    drainer->Drain([call](int error) {
+      g_idle_add(drain_complete_cb, new DrainCompletion{call, error});
+    });
+  };
+  if (port->pacer) {
+    port->pacer->Write(std::vector<uint8_t>(), written);
+  } else {
+    port->loop->Write(port->io, std::vector<uint8_t>(),
+                      [written](ssize_t result) { written(result); },
+                      serial_com::WriteLane::kBulk);
+  }
+  return nullptr;
+}
+
+FlMethodResponse* handle_flush_port(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    g_autofree gchar* error_msg =
+        g_strdup_printf("Error flushing port: %s", strerror(EBADF));
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("FLUSH_ERROR", error_msg, nullptr));
+  }
+  serial_com::FlushQueue queue = serial_com::FlushQueue::kBoth;
+  FlValue* value = fl_value_lookup_string(args, "queue");
+  if (value != nullptr && fl_value_get_type(value) != FL_VALUE_TYPE_NULL &&
+      (fl_value_get_type(value) != FL_VALUE_TYPE_STRING ||
+       !serial_com::ParseFlushQueue(fl_value_get_string(value), &queue))) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "queue must be rx, tx or both", nullptr));
+  }
+
+  if (queue != serial_com::FlushQueue::kReceive) {
+    // Writes that have not reached the tty yet are dropped with it; their
+    // calls fail with ECANCELED. A write already being transmitted
+    // finishes.
+    if (port->pacer) port->pacer->CancelQueued();
+    port->io->CancelQueuedWrites(ECANCELED);
+    cancel_deferred_writes(port);
+  }
+  serial_com::Status status = serial_com::FlushPosixPort(fd, queue);
+  if (!status.ok()) return status_error_response(status);
+  if (queue != serial_com::FlushQueue::kTransmit) {
+    // Everything received and not yet read, in whatever form it is held.
+    port->io->DiscardReceived();
+    if (port->records) port->records->TakeBatch();
+    if (port->frames) port->frames->DiscardQueued();
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_set_receive_buffer(SerialComPlugin* self,
+                                            FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  size_t memory_limit = 0;
+  FlValue* directory = fl_value_lookup_string(args, "spillDirectory");
+  if (!lookup_size_arg(args, "memoryLimit", &memory_limit) ||
+      (directory != nullptr &&
+       fl_value_get_type(directory) != FL_VALUE_TYPE_NULL &&
+       fl_value_get_type(directory) != FL_VALUE_TYPE_STRING)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid receive buffer settings", nullptr));
+  }
+  std::string spill_directory;
+  if (directory != nullptr &&
+      fl_value_get_type(directory) == FL_VALUE_TYPE_STRING) {
+    spill_directory = fl_value_get_string(directory);
+  }
+  serial_com::Status status =
+      port->io->SetReceiveLimit(memory_limit, spill_directory);
+  if (!status.ok()) return status_error_response(status);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Lets a new pacer start once the I/O loop's writes are out.
+static gboolean release_pacer_cb(gpointer user_data) {
+  std::shared_ptr<OpenPort> port =
+      static_cast<std::weak_ptr<OpenPort>*>(user_data)->lock();
+  if (port && port->pacer) port->pacer->Release();
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_set_pacing(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  auto it = self->ports->find(fd);
+  if (it == self->ports->end()) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  std::shared_ptr<OpenPort> port = it->second;
+  serial_com::PacingConfig pacing;
+  if (!parse_pacing_config(args, &pacing)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Pacing values must not be negative", nullptr));
+  }
+
+  // Once a port has a pacer it keeps it, even with every rule cleared, so
+  // writes never overtake each other by switching paths.
+  if (port->pacer) {
+    port->pacer->SetConfig(pacing);
+  } else if (pacing.enabled()) {
+    // These write through the I/O loop for as long as they run, which
+    // would interleave with the pacer's writes.
+    if (port->file_send || port->batch || port->upload || port->link_test ||
+        port->bridge) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "CONFIG_ERROR", "Port is busy", nullptr));
+    }
+    port->pacer.reset(
+        new serial_com::TransmitPacer(fd, pacing, &port->io->stats()));
+    // Paced writes start once the loop's are out. The bulk lane only
+    // moves once the others are empty, so it covers every lane.
+    port->pacer->Hold();
+    std::weak_ptr<OpenPort> weak_port = port;
+    port->loop->Write(
+        port->io, std::vector<uint8_t>(),
+        [weak_port](ssize_t) {
+          g_idle_add_full(G_PRIORITY_DEFAULT, release_pacer_cb,
+                          new std::weak_ptr<OpenPort>(weak_port),
+                          delete_weak_port);
+        },
+        serial_com::WriteLane::kBulk);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_set_write_lanes(SerialComPlugin* self,
+                                         FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  FlValue* frame_size = fl_value_lookup_string(args, "bulkFrameSize");
+  if (frame_size == nullptr ||
+      fl_value_get_type(frame_size) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(frame_size) < 0) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid bulk frame size", nullptr));
+  }
+  port->io->SetBulkFrameSize(fl_value_get_int(frame_size));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_set_read_sizing(SerialComPlugin* self,
+                                         FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  serial_com::ReadSizer& sizer = port->io->read_sizer();
+  size_t min_size = sizer.min_read_size();
+  size_t max_size = sizer.max_read_size();
+  if (!lookup_size_arg(args, "minReadSize", &min_size) ||
+      !lookup_size_arg(args, "maxReadSize", &max_size) || min_size == 0 ||
+      max_size < min_size || max_size > G_MAXINT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid read sizes", nullptr));
+  }
+  sizer.SetLimits(min_size, max_size);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
 }
 
-FlMethodResponse* handle_read_from_port(FlMethodCall* method_call) {
+FlMethodResponse* handle_read_from_port(SerialComPlugin* self,
+                                        FlMethodCall* method_call) {
   FlValue* args = fl_method_call_get_args(method_call);
   int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
   int max_length = fl_value_get_int(fl_value_lookup_string(args, "maxLength"));
 
-  char* buffer = (char*)malloc(max_length + 1);
-  ssize_t bytes_read = read(fd, buffer, max_length);
-  if (bytes_read < 0) {
-    free(buffer);
-    g_autofree gchar *error_msg = g_strdup_printf("Error reading from port: %s", strerror(errno));
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    g_autofree gchar *error_msg = g_strdup_printf("Error reading from port: %s", strerror(EBADF));
     return FL_METHOD_RESPONSE(fl_method_error_response_new("READ_ERROR", error_msg, nullptr));
   }
 
-  buffer[bytes_read] = '\0';
-  g_autoptr(FlValue) result = fl_value_new_string(buffer);
-  free(buffer);
+  // Serve straight from the receive buffer when possible, otherwise wait
+  // for the I/O thread to deliver something.
+  if (!has_pending_read(port, PendingReadKind::kBytes, 0) &&
+      port->io->Available() > 0) {
+    respond_read(method_call, port, max_length);
+    return nullptr;
+  }
+
+  add_pending_read(port, method_call, PendingReadKind::kBytes, max_length, 0);
+  return nullptr;
+}
+
+// Parses a setRecordSchema field list: [{name, type, offset, bigEndian}].
+static gboolean parse_record_fields(FlValue* fields,
+                                    serial_com::RecordSchema* schema) {
+  if (fl_value_get_type(fields) != FL_VALUE_TYPE_LIST) return FALSE;
+  for (size_t i = 0; i < fl_value_get_length(fields); i++) {
+    FlValue* entry = fl_value_get_list_value(fields, i);
+    if (fl_value_get_type(entry) != FL_VALUE_TYPE_MAP) return FALSE;
+    FlValue* name = fl_value_lookup_string(entry, "name");
+    FlValue* type = fl_value_lookup_string(entry, "type");
+    FlValue* offset = fl_value_lookup_string(entry, "offset");
+    FlValue* big_endian = fl_value_lookup_string(entry, "bigEndian");
+    if (name == nullptr || fl_value_get_type(name) != FL_VALUE_TYPE_STRING ||
+        type == nullptr || fl_value_get_type(type) != FL_VALUE_TYPE_STRING ||
+        offset == nullptr || fl_value_get_type(offset) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(offset) < 0) {
+      return FALSE;
+    }
+    serial_com::RecordField field;
+    field.name = fl_value_get_string(name);
+    if (!serial_com::ParseFieldType(fl_value_get_string(type), &field.type)) {
+      return FALSE;
+    }
+    field.offset = fl_value_get_int(offset);
+    field.big_endian = big_endian != nullptr &&
+                       fl_value_get_type(big_endian) == FL_VALUE_TYPE_BOOL &&
+                       fl_value_get_bool(big_endian);
+    schema->fields.push_back(field);
+  }
+  return TRUE;
+}
+
+FlMethodResponse* receive_mode_busy_response(const ReceiveSessions& sessions) {
+  if (sessions.upload || sessions.link_test || sessions.batch ||
+      sessions.autobaud) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is busy", nullptr));
+  }
+  return nullptr;
+}
+
+static ReceiveSessions receive_sessions(const OpenPort* port) {
+  ReceiveSessions sessions;
+  sessions.upload = port->upload != nullptr;
+  sessions.link_test = port->link_test != nullptr;
+  sessions.batch = port->batch != nullptr;
+  sessions.autobaud = port->autobaud != nullptr;
+  return sessions;
+}
+
+FlMethodResponse* handle_set_record_schema(SerialComPlugin* self,
+                                           FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  auto it = self->ports->find(fd);
+  if (it == self->ports->end()) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  std::shared_ptr<OpenPort> port = it->second;
+  FlMethodResponse* busy =
+      receive_mode_busy_response(receive_sessions(port.get()));
+  if (busy != nullptr) return busy;
+
+  // Without fields the port goes back to delivering raw bytes, unless it
+  // is in setFraming's mode, which is not this call's to end.
+  FlValue* fields = fl_value_lookup_string(args, "fields");
+  if (fields == nullptr || fl_value_get_type(fields) == FL_VALUE_TYPE_NULL) {
+    if (port->records) {
+      port->io->SetFrameCallback(nullptr, nullptr);
+      port->records.reset();
+      port->decimator.reset();
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+
+  serial_com::RecordSchema schema;
+  FlValue* record_size = fl_value_lookup_string(args, "recordSize");
+  if (record_size != nullptr &&
+      fl_value_get_type(record_size) == FL_VALUE_TYPE_INT &&
+      fl_value_get_int(record_size) > 0) {
+    schema.record_size = fl_value_get_int(record_size);
+  }
+  if (!parse_record_fields(fields, &schema) ||
+      !serial_com::IsValidRecordSchema(schema)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid record schema", nullptr));
+  }
+
+  size_t record_size_bytes = schema.record_size;
+  auto records = std::make_shared<serial_com::RecordDecoder>(
+      std::move(schema), kMaxBufferedRecords);
+  std::weak_ptr<OpenPort> weak_port = port;
+  port->io->SetFrameCallback(
+      std::unique_ptr<serial_com::Framer>(
+          new serial_com::FixedLengthFramer(record_size_bytes)),
+      [records, weak_port](const uint8_t* record, size_t length) {
+        // Wake readRecords once per batch rather than once per record.
+        if (records->Decode(record, length)) {
+          g_idle_add_full(G_PRIORITY_DEFAULT, port_data_cb,
+                          new std::weak_ptr<OpenPort>(weak_port),
+                          delete_weak_port);
+        }
+      });
+  port->records = records;
+  port->frames.reset();
+  // Decimation is configured against a schema, so it starts over too.
+  port->decimator.reset();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_set_decimation(SerialComPlugin* self,
+                                        FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->records) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port has no record schema", nullptr));
+  }
+
+  // A mode of "none" (or none at all) returns full-rate records.
+  std::unique_ptr<serial_com::Decimator> decimator;
+  FlValue* mode = fl_value_lookup_string(args, "mode");
+  if (mode != nullptr && fl_value_get_type(mode) == FL_VALUE_TYPE_STRING &&
+      strcmp(fl_value_get_string(mode), "none") != 0) {
+    serial_com::DecimationConfig config;
+    FlValue* window = fl_value_lookup_string(args, "window");
+    FlValue* x_field = fl_value_lookup_string(args, "xField");
+    if (window != nullptr && fl_value_get_type(window) == FL_VALUE_TYPE_INT &&
+        fl_value_get_int(window) > 0) {
+      config.window = fl_value_get_int(window);
+    } else {
+      config.window = 0;
+    }
+    if (x_field != nullptr &&
+        fl_value_get_type(x_field) == FL_VALUE_TYPE_STRING) {
+      config.x_field = fl_value_get_string(x_field);
+    }
+    if (!serial_com::ParseDecimationMode(fl_value_get_string(mode),
+                                         &config.mode) ||
+        !serial_com::IsValidDecimationConfig(config,
+                                             port->records->schema())) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", "Invalid decimation", nullptr));
+    }
+    decimator.reset(
+        new serial_com::Decimator(port->records->schema(), config));
+  }
+
+  // The capture file receives the raw records at full rate.
+  std::unique_ptr<serial_com::CaptureFile> capture;
+  FlValue* capture_path = fl_value_lookup_string(args, "capturePath");
+  if (capture_path != nullptr &&
+      fl_value_get_type(capture_path) == FL_VALUE_TYPE_STRING) {
+    capture = serial_com::CaptureFile::Open(fl_value_get_string(capture_path));
+    if (!capture) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "CONFIG_ERROR", strerror(errno), nullptr));
+    }
+  }
+
+  port->records->SetCapture(std::move(capture));
+  port->decimator = std::move(decimator);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_read_records(SerialComPlugin* self,
+                                      FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->records) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "READ_ERROR", "Port has no record schema", nullptr));
+  }
+
+  if (!has_pending_read(port, PendingReadKind::kRecords, 0) &&
+      port->records->rows() > 0) {
+    respond_records(method_call, port);
+    return nullptr;
+  }
+  add_pending_read(port, method_call, PendingReadKind::kRecords, 0, 0);
+  return nullptr;
+}
+
+// Parses subscribeFrames filters: masks [{offset, mask, value}] with
+// Uint8List mask and value, and idRanges [{offset, size, bigEndian, min,
+// max}].
+static gboolean parse_frame_filter(FlValue* args,
+                                   serial_com::FrameFilterSpec* spec) {
+  FlValue* masks = fl_value_lookup_string(args, "masks");
+  if (masks != nullptr && fl_value_get_type(masks) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(masks) != FL_VALUE_TYPE_LIST) return FALSE;
+    for (size_t i = 0; i < fl_value_get_length(masks); i++) {
+      FlValue* entry = fl_value_get_list_value(masks, i);
+      if (fl_value_get_type(entry) != FL_VALUE_TYPE_MAP) return FALSE;
+      FlValue* mask = fl_value_lookup_string(entry, "mask");
+      FlValue* value = fl_value_lookup_string(entry, "value");
+      serial_com::MaskMatch match;
+      if (!lookup_size_arg(entry, "offset", &match.offset) ||
+          mask == nullptr ||
+          fl_value_get_type(mask) != FL_VALUE_TYPE_UINT8_LIST ||
+          value == nullptr ||
+          fl_value_get_type(value) != FL_VALUE_TYPE_UINT8_LIST) {
+        return FALSE;
+      }
+      const uint8_t* mask_bytes = fl_value_get_uint8_list(mask);
+      const uint8_t* value_bytes = fl_value_get_uint8_list(value);
+      match.mask.assign(mask_bytes, mask_bytes + fl_value_get_length(mask));
+      match.value.assign(value_bytes,
+                         value_bytes + fl_value_get_length(value));
+      spec->masks.push_back(std::move(match));
+    }
+  }
+
+  FlValue* ranges = fl_value_lookup_string(args, "idRanges");
+  if (ranges != nullptr && fl_value_get_type(ranges) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(ranges) != FL_VALUE_TYPE_LIST) return FALSE;
+    for (size_t i = 0; i < fl_value_get_length(ranges); i++) {
+      FlValue* entry = fl_value_get_list_value(ranges, i);
+      if (fl_value_get_type(entry) != FL_VALUE_TYPE_MAP) return FALSE;
+      serial_com::IdRange range;
+      size_t min = 0;
+      size_t max = 0;
+      if (!lookup_size_arg(entry, "offset", &range.offset) ||
+          !lookup_size_arg(entry, "size", &range.size) ||
+          !lookup_size_arg(entry, "min", &min) ||
+          !lookup_size_arg(entry, "max", &max) || min > UINT32_MAX ||
+          max > UINT32_MAX) {
+        return FALSE;
+      }
+      FlValue* big_endian = fl_value_lookup_string(entry, "bigEndian");
+      range.big_endian = big_endian != nullptr &&
+                         fl_value_get_type(big_endian) == FL_VALUE_TYPE_BOOL &&
+                         fl_value_get_bool(big_endian);
+      range.min = static_cast<uint32_t>(min);
+      range.max = static_cast<uint32_t>(max);
+      spec->id_ranges.push_back(range);
+    }
+  }
+  return serial_com::IsValidFrameFilterSpec(*spec);
+}
+
+FlMethodResponse* handle_set_framing(SerialComPlugin* self,
+                                     FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  auto it = self->ports->find(fd);
+  if (it == self->ports->end()) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  std::shared_ptr<OpenPort> port = it->second;
+  FlMethodResponse* busy =
+      receive_mode_busy_response(receive_sessions(port.get()));
+  if (busy != nullptr) return busy;
+
+  // Without a framing the port goes back to delivering raw bytes, unless
+  // it is decoding records, which setRecordSchema owns.
+  FlValue* framing = fl_value_lookup_string(args, "framing");
+  if (framing == nullptr || fl_value_get_type(framing) != FL_VALUE_TYPE_STRING ||
+      strcmp(fl_value_get_string(framing), "none") == 0) {
+    if (port->frames) {
+      port->io->SetFrameCallback(nullptr, nullptr);
+      port->frames.reset();
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+
+  std::unique_ptr<serial_com::Framer> framer;
+  size_t delimiter = '\n';
+  size_t frame_length = 0;
+  size_t max_frame_length = 4096;
+  if (!lookup_size_arg(args, "delimiter", &delimiter) ||
+      !lookup_size_arg(args, "frameLength", &frame_length) ||
+      !lookup_size_arg(args, "maxFrameLength", &max_frame_length)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid framing", nullptr));
+  }
+  if (strcmp(fl_value_get_string(framing), "delimiter") == 0 &&
+      delimiter <= 0xFF && max_frame_length > 0) {
+    framer.reset(new serial_com::DelimiterFramer(
+        static_cast<uint8_t>(delimiter), max_frame_length));
+  } else if (strcmp(fl_value_get_string(framing), "fixed") == 0 &&
+             frame_length > 0) {
+    framer.reset(new serial_com::FixedLengthFramer(frame_length));
+  } else {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid framing", nullptr));
+  }
+
+  auto frames = std::make_shared<serial_com::FrameRouter>(kMaxQueuedFrames);
+  std::weak_ptr<OpenPort> weak_port = port;
+  port->io->SetFrameCallback(
+      std::move(framer),
+      [frames, weak_port](const uint8_t* frame, size_t length) {
+        // Frames no subscriber wants are dropped here, before any copy.
+        if (frames->Route(frame, length)) {
+          g_idle_add_full(G_PRIORITY_DEFAULT, port_data_cb,
+                          new std::weak_ptr<OpenPort>(weak_port),
+                          delete_weak_port);
+        }
+      });
+  port->frames = frames;
+  port->records.reset();
+  port->decimator.reset();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_subscribe_frames(SerialComPlugin* self,
+                                          FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->frames) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port has no framing", nullptr));
+  }
+  serial_com::FrameFilterSpec spec;
+  if (!parse_frame_filter(args, &spec)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid frame filter", nullptr));
+  }
+  g_autoptr(FlValue) result =
+      fl_value_new_int(port->frames->Subscribe(spec));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* handle_unsubscribe_frames(SerialComPlugin* self,
+                                            FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+  int subscription =
+      fl_value_get_int(fl_value_lookup_string(args, "subscription"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->frames ||
+      !port->frames->Unsubscribe(subscription)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "No such subscription", nullptr));
+  }
+  // Waiting readFrames calls for the subscription return empty.
+  std::deque<PendingRead*>& queue = port->pending_reads;
+  for (auto it = queue.begin(); it != queue.end();) {
+    PendingRead* pending = *it;
+    if (pending->kind != PendingReadKind::kFrames ||
+        pending->subscription != subscription) {
+      ++it;
+      continue;
+    }
+    it = queue.erase(it);
+    finish_pending_read(pending);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_read_frames(SerialComPlugin* self,
+                                     FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+  int subscription =
+      fl_value_get_int(fl_value_lookup_string(args, "subscription"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->frames) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "READ_ERROR", "Port has no framing", nullptr));
+  }
+
+  if (!has_pending_read(port, PendingReadKind::kFrames, subscription) &&
+      port->frames->Queued(subscription) > 0) {
+    respond_frames(method_call, port, subscription);
+    return nullptr;
+  }
+  add_pending_read(port, method_call, PendingReadKind::kFrames, 0,
+                   subscription);
+  return nullptr;
+}
+
+// Shared between an upload's engine thread callbacks and the main thread.
+struct UploadState {
+  SerialComPlugin* plugin;
+  int fd;
+  FlMethodCall* method_call;
+
+  std::mutex mutex;
+  serial_com::UploadProgress progress;
+  // Whether a progress event is already on its way to the main thread.
+  bool progress_scheduled = false;
+
+  ~UploadState() {
+    g_object_unref(method_call);
+    g_object_unref(plugin);
+  }
+};
+
+struct UploadResult {
+  std::shared_ptr<UploadState> state;
+  serial_com::UploadStatus status;
+  serial_com::UploadProgress progress;
+};
+
+static FlValue* new_upload_event(const char* name, int fd,
+                                 const serial_com::UploadProgress& progress) {
+  FlValue* event = fl_value_new_map();
+  fl_value_set_string_take(event, "event", fl_value_new_string(name));
+  fl_value_set_string_take(event, "fd", fl_value_new_int(fd));
+  fl_value_set_string_take(event, "bytesSent",
+                           fl_value_new_int(progress.bytes_sent));
+  fl_value_set_string_take(event, "totalBytes",
+                           fl_value_new_int(progress.total_bytes));
+  fl_value_set_string_take(event, "blocksSent",
+                           fl_value_new_int(progress.blocks_sent));
+  fl_value_set_string_take(event, "retransmits",
+                           fl_value_new_int(progress.retransmits));
+  return event;
+}
+
+// Sends the latest progress. However fast blocks are acknowledged, at most
+// one progress event per upload is queued on the main loop at a time.
+static gboolean upload_progress_cb(gpointer user_data) {
+  std::shared_ptr<UploadState>* state =
+      static_cast<std::shared_ptr<UploadState>*>(user_data);
+  serial_com::UploadProgress progress;
+  {
+    std::lock_guard<std::mutex> lock((*state)->mutex);
+    progress = (*state)->progress;
+    (*state)->progress_scheduled = false;
+  }
+  g_autoptr(FlValue) event =
+      new_upload_event("uploadProgress", (*state)->fd, progress);
+  send_event((*state)->plugin, event);
+  return G_SOURCE_REMOVE;
+}
+
+static void delete_upload_state(gpointer user_data) {
+  delete static_cast<std::shared_ptr<UploadState>*>(user_data);
+}
+
+static gboolean upload_done_cb(gpointer user_data) {
+  UploadResult* result = static_cast<UploadResult*>(user_data);
+  UploadState* state = result->state.get();
+
+  g_autoptr(FlValue) value =
+      new_upload_event("uploadDone", state->fd, result->progress);
+  fl_value_set_string_take(
+      value, "status",
+      fl_value_new_string(serial_com::UploadStatusName(result->status)));
+  send_event(state->plugin, value);
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  fl_method_call_respond(state->method_call, response, nullptr);
+
+  // Hand the receive path back unless the port was closed (or reused)
+  // meanwhile.
+  OpenPort* port = lookup_open_port(state->plugin, state->fd);
+  if (port != nullptr && port->upload_state == result->state) {
+    port->io->SetFrameCallback(nullptr, nullptr);
+    port->upload.reset();
+    port->upload_state.reset();
+  }
+  delete result;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_upload_firmware(SerialComPlugin* self,
+                                         FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  if (port->upload || port->file_send || port->link_test || port->batch ||
+      port->autobaud) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "A transfer is already running", nullptr));
+  }
+  // Bootloaders speak the raw protocol.
+  if (port->codec_stats) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Uploads need a port without a codec", nullptr));
+  }
+
+  serial_com::UploadOptions options;
+  FlValue* path = fl_value_lookup_string(args, "path");
+  FlValue* protocol = fl_value_lookup_string(args, "protocol");
+  FlValue* file_name = fl_value_lookup_string(args, "fileName");
+  size_t start_timeout_ms = options.start_timeout_ms;
+  size_t response_timeout_ms = options.response_timeout_ms;
+  size_t max_retries = options.max_retries;
+  if (path == nullptr || fl_value_get_type(path) != FL_VALUE_TYPE_STRING ||
+      protocol == nullptr ||
+      fl_value_get_type(protocol) != FL_VALUE_TYPE_STRING ||
+      !serial_com::ParseUploadProtocol(fl_value_get_string(protocol),
+                                       &options.protocol) ||
+      !lookup_size_arg(args, "startTimeoutMs", &start_timeout_ms) ||
+      !lookup_size_arg(args, "responseTimeoutMs", &response_timeout_ms) ||
+      !lookup_size_arg(args, "maxRetries", &max_retries) ||
+      start_timeout_ms > G_MAXINT || response_timeout_ms > G_MAXINT ||
+      max_retries == 0 || max_retries > G_MAXINT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid upload", nullptr));
+  }
+  options.start_timeout_ms = start_timeout_ms;
+  options.response_timeout_ms = response_timeout_ms;
+  options.max_retries = max_retries;
+  if (file_name != nullptr &&
+      fl_value_get_type(file_name) == FL_VALUE_TYPE_STRING) {
+    options.file_name = fl_value_get_string(file_name);
+  } else {
+    g_autofree gchar* base = g_path_get_basename(fl_value_get_string(path));
+    options.file_name = base;
+  }
+
+  std::unique_ptr<serial_com::MappedFile> image =
+      serial_com::MappedFile::Open(fl_value_get_string(path));
+  if (!image) {
+    g_autofree gchar* error_msg =
+        g_strdup_printf("Error opening image: %s", strerror(errno));
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("OPEN_ERROR", error_msg, nullptr));
+  }
+
+  auto state = std::make_shared<UploadState>();
+  state->plugin = SERIAL_COM_PLUGIN(g_object_ref(self));
+  state->fd = fd;
+  state->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+
+  // The engine takes over the receive path: framing, record decoding and
+  // frame subscriptions end here.
+  port->records.reset();
+  port->decimator.reset();
+  port->frames.reset();
+
+  // Paced ports upload paced, as bootloaders behind them need.
+  serial_com::TransmitPacer* pacer = port->pacer.get();
+  serial_com::IoLoop* loop = port->loop;
+  std::shared_ptr<serial_com::IoPort> io = port->io;
+  port->upload.reset(new serial_com::UploadEngine(
+      std::move(image), options,
+      [pacer, loop, io](std::vector<uint8_t> data,
+                        serial_com::UploadEngine::WriteDone done) {
+        if (pacer != nullptr) {
+          pacer->Write(std::move(data), done);
+        } else {
+          loop->Write(io, std::move(data),
+                      [done](ssize_t result) { done(result); },
+                      serial_com::WriteLane::kBulk);
+        }
+      },
+      [state](const serial_com::UploadProgress& progress) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->progress = progress;
+        if (state->progress_scheduled) return;
+        state->progress_scheduled = true;
+        g_idle_add_full(G_PRIORITY_DEFAULT, upload_progress_cb,
+                        new std::shared_ptr<UploadState>(state),
+                        delete_upload_state);
+      },
+      [state](serial_com::UploadStatus status,
+              const serial_com::UploadProgress& progress) {
+        g_idle_add(upload_done_cb, new UploadResult{state, status, progress});
+      }));
+  port->upload_state = state;
+  serial_com::UploadEngine* engine = port->upload.get();
+  port->io->SetFrameCallback(
+      std::unique_ptr<serial_com::Framer>(new serial_com::PassThroughFramer()),
+      [engine](const uint8_t* data, size_t length) {
+        engine->OnReceived(data, length);
+      });
+  // A 'C' or NAK left from before would start the transfer early.
+  port->io->DiscardReceived();
+  engine->Start();
+  return nullptr;
+}
+
+FlMethodResponse* handle_cancel_upload(SerialComPlugin* self,
+                                       FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->upload) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "No upload is running", nullptr));
+  }
+  // uploadFirmware completes with status "aborted".
+  port->upload->Abort();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Shared between a link test's thread and the main thread.
+struct LinkTestState {
+  SerialComPlugin* plugin;
+  int fd;
+  FlMethodCall* method_call;
+
+  ~LinkTestState() {
+    g_object_unref(method_call);
+    g_object_unref(plugin);
+  }
+};
+
+struct LinkTestResult {
+  std::shared_ptr<LinkTestState> state;
+  serial_com::LinkTestReport report;
+};
+
+static gboolean link_test_done_cb(gpointer user_data) {
+  LinkTestResult* result = static_cast<LinkTestResult*>(user_data);
+  LinkTestState* state = result->state.get();
+  const serial_com::LinkTestReport& report = result->report;
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (!report.status.ok()) {
+    response = status_error_response(report.status);
+  } else {
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "bytesSent",
+                             fl_value_new_int(report.bytes_sent));
+    fl_value_set_string_take(value, "bytesReceived",
+                             fl_value_new_int(report.bytes_received));
+    fl_value_set_string_take(value, "byteErrors",
+                             fl_value_new_int(report.errors.byte_errors));
+    fl_value_set_string_take(value, "bitErrors",
+                             fl_value_new_int(report.errors.bit_errors));
+    fl_value_set_string_take(value, "droppedBytes",
+                             fl_value_new_int(report.errors.dropped_bytes));
+    fl_value_set_string_take(value, "extraBytes",
+                             fl_value_new_int(report.errors.extra_bytes));
+    fl_value_set_string_take(value, "bitErrorRate",
+                             fl_value_new_float(report.bit_error_rate));
+    fl_value_set_string_take(value, "elapsedUs",
+                             fl_value_new_int(report.elapsed_us));
+    fl_value_set_string_take(value, "bytesPerSecond",
+                             fl_value_new_float(report.bytes_per_second));
+    fl_value_set_string_take(value, "probesSent",
+                             fl_value_new_int(report.probes_sent));
+    fl_value_set_string_take(value, "probesLost",
+                             fl_value_new_int(report.probes_lost));
+    fl_value_set_string_take(value, "minLatencyUs",
+                             fl_value_new_int(report.min_latency_us));
+    fl_value_set_string_take(value, "meanLatencyUs",
+                             fl_value_new_int(report.mean_latency_us));
+    fl_value_set_string_take(value, "p50LatencyUs",
+                             fl_value_new_int(report.p50_latency_us));
+    fl_value_set_string_take(value, "p99LatencyUs",
+                             fl_value_new_int(report.p99_latency_us));
+    fl_value_set_string_take(value, "maxLatencyUs",
+                             fl_value_new_int(report.max_latency_us));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  }
+  fl_method_call_respond(state->method_call, response, nullptr);
+
+  // Hand the receive path back unless the port was closed (or reused)
+  // meanwhile.
+  OpenPort* port = lookup_open_port(state->plugin, state->fd);
+  if (port != nullptr && port->link_test_state == result->state) {
+    port->io->SetFrameCallback(nullptr, nullptr);
+    port->link_test.reset();
+    port->link_test_state.reset();
+  }
+  delete result;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_run_link_test(SerialComPlugin* self,
+                                       FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  if (port->upload || port->file_send || port->link_test || port->batch ||
+      port->autobaud) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "A transfer is already running", nullptr));
+  }
+  // The pattern must cross the wire as generated.
+  if (port->codec_stats) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Link tests need a port without a codec", nullptr));
+  }
+
+  serial_com::LinkTestOptions options;
+  FlValue* pattern = fl_value_lookup_string(args, "pattern");
+  size_t probes = options.probes;
+  size_t timeout_ms = options.timeout_ms;
+  if ((pattern != nullptr &&
+       fl_value_get_type(pattern) != FL_VALUE_TYPE_NULL &&
+       (fl_value_get_type(pattern) != FL_VALUE_TYPE_STRING ||
+        !serial_com::ParseLinkTestPattern(fl_value_get_string(pattern),
+                                          &options.pattern))) ||
+      !lookup_size_arg(args, "bytes", &options.bytes) ||
+      !lookup_size_arg(args, "chunkSize", &options.chunk_size) ||
+      !lookup_size_arg(args, "probes", &probes) ||
+      !lookup_size_arg(args, "probeSize", &options.probe_size) ||
+      !lookup_size_arg(args, "timeoutMs", &timeout_ms) ||
+      options.bytes == 0 || options.bytes > kMaxLinkTestBytes ||
+      options.chunk_size == 0 || options.probe_size == 0 ||
+      probes > G_MAXINT || timeout_ms > G_MAXINT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid link test", nullptr));
+  }
+  options.probes = probes;
+  options.timeout_ms = timeout_ms;
+
+  auto state = std::make_shared<LinkTestState>();
+  state->plugin = SERIAL_COM_PLUGIN(g_object_ref(self));
+  state->fd = fd;
+  state->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+
+  // The tester takes over the receive path: framing, record decoding and
+  // frame subscriptions end here.
+  port->records.reset();
+  port->decimator.reset();
+  port->frames.reset();
+
+  // Paced ports are tested as paced.
+  serial_com::TransmitPacer* pacer = port->pacer.get();
+  serial_com::IoLoop* loop = port->loop;
+  std::shared_ptr<serial_com::IoPort> io = port->io;
+  port->link_test.reset(new serial_com::LinkTester(
+      options,
+      [pacer, loop, io](std::vector<uint8_t> data,
+                        serial_com::LinkTester::WriteDone done) {
+        if (pacer != nullptr) {
+          pacer->Write(std::move(data), done);
+        } else {
+          loop->Write(io, std::move(data),
+                      [done](ssize_t result) { done(result); });
+        }
+      },
+      [state](const serial_com::LinkTestReport& report) {
+        g_idle_add(link_test_done_cb, new LinkTestResult{state, report});
+      }));
+  port->link_test_state = state;
+  serial_com::LinkTester* tester = port->link_test.get();
+  port->io->SetFrameCallback(
+      std::unique_ptr<serial_com::Framer>(new serial_com::PassThroughFramer()),
+      [tester](const uint8_t* data, size_t length) {
+        tester->OnReceived(data, length);
+      });
+  // Whatever was buffered before is not part of the test.
+  port->io->DiscardReceived();
+  tester->Start();
+  return nullptr;
+}
+
+// Shared between an autobaud search thread and the main thread.
+struct AutobaudState {
+  SerialComPlugin* plugin;
+  int fd;
+  FlMethodCall* method_call;
+  std::atomic<bool> cancelled{false};
+  std::thread thread;
+
+  ~AutobaudState() {
+    g_object_unref(method_call);
+    g_object_unref(plugin);
+  }
+};
+
+struct AutobaudDone {
+  std::shared_ptr<AutobaudState> state;
+  serial_com::Status status;
+  serial_com::AutobaudResult result;
+};
+
+// Ends |state|'s search and waits for its thread. Its call is still
+// answered, with CANCELLED, once the result reaches the main thread.
+static void stop_autobaud(AutobaudState* state) {
+  state->cancelled = true;
+  if (state->thread.joinable()) state->thread.join();
+}
+
+static FlValue* autobaud_sample_value(
+    const serial_com::AutobaudSample& sample) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "baudRate",
+                           fl_value_new_int(sample.baud_rate));
+  fl_value_set_string_take(value, "bytes", fl_value_new_int(sample.bytes));
+  fl_value_set_string_take(value, "textBytes",
+                           fl_value_new_int(sample.text_bytes));
+  fl_value_set_string_take(value, "countersAvailable",
+                           fl_value_new_bool(sample.counters));
+  fl_value_set_string_take(value, "framingErrors",
+                           fl_value_new_int(sample.framing_errors));
+  fl_value_set_string_take(value, "parityErrors",
+                           fl_value_new_int(sample.parity_errors));
+  fl_value_set_string_take(value, "breaks", fl_value_new_int(sample.breaks));
+  fl_value_set_string_take(value, "overruns",
+                           fl_value_new_int(sample.overruns));
+  fl_value_set_string_take(value, "score", fl_value_new_float(sample.score));
+  return value;
+}
+
+static gboolean autobaud_done_cb(gpointer user_data) {
+  AutobaudDone* done = static_cast<AutobaudDone*>(user_data);
+  AutobaudState* state = done->state.get();
+
+  // Give the port back unless it was closed (or reused) meanwhile.
+  OpenPort* port = lookup_open_port(state->plugin, state->fd);
+  if (port != nullptr && port->autobaud == done->state) {
+    stop_autobaud(state);
+    port->autobaud.reset();
+    if (done->result.baud_rate > 0) {
+      port->config.baud_rate = done->result.baud_rate;
+    }
+    // A read posted before the hold began may have picked up bytes at a
+    // candidate rate.
+    port->io->DiscardReceived();
+    port->loop->SetReceiveHeld(port->io, false);
+  }
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (!done->status.ok()) {
+    response = status_error_response(done->status);
+  } else {
+    const serial_com::AutobaudResult& result = done->result;
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "baudRate",
+                             fl_value_new_int(result.baud_rate));
+    fl_value_set_string_take(value, "score", fl_value_new_float(result.score));
+    fl_value_set_string_take(value, "elapsedUs",
+                             fl_value_new_int(result.elapsed_us));
+    FlValue* samples = fl_value_new_list();
+    for (const serial_com::AutobaudSample& sample : result.samples) {
+      fl_value_append_take(samples, autobaud_sample_value(sample));
+    }
+    fl_value_set_string_take(value, "samples", samples);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  }
+  fl_method_call_respond(state->method_call, response, nullptr);
+  delete done;
+  return G_SOURCE_REMOVE;
+}
+
+// Reads the optional autobaud arguments into |options|. Returns false if
+// any is malformed.
+static gboolean parse_autobaud_options(FlValue* args,
+                                       serial_com::AutobaudOptions* options) {
+  FlValue* candidates = fl_value_lookup_string(args, "candidates");
+  if (candidates != nullptr &&
+      fl_value_get_type(candidates) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(candidates) != FL_VALUE_TYPE_LIST) return FALSE;
+    for (size_t i = 0; i < fl_value_get_length(candidates); i++) {
+      FlValue* rate = fl_value_get_list_value(candidates, i);
+      if (fl_value_get_type(rate) != FL_VALUE_TYPE_INT ||
+          fl_value_get_int(rate) <= 0 || fl_value_get_int(rate) > G_MAXINT) {
+        return FALSE;
+      }
+      options->candidates.push_back(static_cast<int>(fl_value_get_int(rate)));
+    }
+  }
+  size_t window_ms = options->window_ms;
+  if (!lookup_size_arg(args, "windowMs", &window_ms) || window_ms == 0 ||
+      window_ms > G_MAXINT ||
+      !lookup_size_arg(args, "minBytes", &options->min_bytes)) {
+    return FALSE;
+  }
+  options->window_ms = window_ms;
+  FlValue* probe = fl_value_lookup_string(args, "probe");
+  if (probe != nullptr && fl_value_get_type(probe) != FL_VALUE_TYPE_NULL &&
+      !lookup_bytes_arg(args, "probe", &options->probe)) {
+    return FALSE;
+  }
+  FlValue* content = fl_value_lookup_string(args, "content");
+  if (content != nullptr && fl_value_get_type(content) != FL_VALUE_TYPE_NULL &&
+      (fl_value_get_type(content) != FL_VALUE_TYPE_STRING ||
+       !serial_com::ParseAutobaudContent(fl_value_get_string(content),
+                                         &options->content))) {
+    return FALSE;
+  }
+  FlValue* accept = fl_value_lookup_string(args, "acceptScore");
+  if (accept != nullptr && fl_value_get_type(accept) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(accept) != FL_VALUE_TYPE_FLOAT) return FALSE;
+    options->accept_score = fl_value_get_float(accept);
+  }
+  return TRUE;
+}
+
+FlMethodResponse* handle_autobaud(SerialComPlugin* self,
+                                  FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  // Stream subscribers hold and release the receive path themselves, and a
+  // bridge forwards everything it reads to its peer.
+  if (port->upload || port->file_send || port->link_test || port->batch ||
+      port->autobaud || port->streams || port->bridge) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is busy", nullptr));
+  }
+  serial_com::AutobaudOptions options;
+  if (!parse_autobaud_options(args, &options)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid autobaud options", nullptr));
+  }
+
+  auto state = std::make_shared<AutobaudState>();
+  state->plugin = SERIAL_COM_PLUGIN(g_object_ref(self));
+  state->fd = fd;
+  state->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  port->autobaud = state;
+
+  // The search reads the tty itself; the loop stays out of its way until
+  // it is done, and what it had buffered was received at the old rate.
+  port->loop->SetReceiveHeld(port->io, true);
+  port->io->DiscardReceived();
+  int port_fd = port->io->fd();
+  state->thread = std::thread([state, port_fd, options]() {
+    AutobaudDone* done = new AutobaudDone{state, serial_com::Status::Ok(), {}};
+    done->status = serial_com::DetectBaudRate(port_fd, options,
+                                              state->cancelled, &done->result);
+    g_idle_add(autobaud_done_cb, done);
+  });
+  return nullptr;
+}
+
+// Shared between a sendFile's sender thread callbacks and the main thread.
+struct FileSendState {
+  SerialComPlugin* plugin;
+  int fd;
+  FlMethodCall* method_call;
+
+  std::mutex mutex;
+  serial_com::FileSendProgress progress;
+  bool progress_scheduled = false;
+
+  ~FileSendState() {
+    g_object_unref(method_call);
+    g_object_unref(plugin);
+  }
+};
+
+struct FileSendResult {
+  std::shared_ptr<FileSendState> state;
+  int64_t result;
+  serial_com::FileSendProgress progress;
+};
+
+static FlValue* new_file_send_event(
+    const char* name, int fd, const serial_com::FileSendProgress& progress) {
+  FlValue* event = fl_value_new_map();
+  fl_value_set_string_take(event, "event", fl_value_new_string(name));
+  fl_value_set_string_take(event, "fd", fl_value_new_int(fd));
+  fl_value_set_string_take(event, "bytesSent",
+                           fl_value_new_int(progress.bytes_sent));
+  fl_value_set_string_take(event, "totalBytes",
+                           fl_value_new_int(progress.total_bytes));
+  fl_value_set_string_take(event, "spliced",
+                           fl_value_new_bool(progress.spliced));
+  return event;
+}
+
+// Like upload_progress_cb, at most one event per send is queued at a time.
+static gboolean file_send_progress_cb(gpointer user_data) {
+  std::shared_ptr<FileSendState>* state =
+      static_cast<std::shared_ptr<FileSendState>*>(user_data);
+  serial_com::FileSendProgress progress;
+  {
+    std::lock_guard<std::mutex> lock((*state)->mutex);
+    progress = (*state)->progress;
+    (*state)->progress_scheduled = false;
+  }
+  g_autoptr(FlValue) event =
+      new_file_send_event("sendFileProgress", (*state)->fd, progress);
+  send_event((*state)->plugin, event);
+  return G_SOURCE_REMOVE;
+}
+
+static void delete_file_send_state(gpointer user_data) {
+  delete static_cast<std::shared_ptr<FileSendState>*>(user_data);
+}
+
+static gboolean file_send_done_cb(gpointer user_data) {
+  FileSendResult* result = static_cast<FileSendResult*>(user_data);
+  FileSendState* state = result->state.get();
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (result->result < 0) {
+    g_autofree gchar* error_msg = g_strdup_printf(
+        "Error sending file: %s", strerror(-result->result));
+    response = FL_METHOD_RESPONSE(
+        fl_method_error_response_new("WRITE_ERROR", error_msg, nullptr));
+  } else {
+    g_autoptr(FlValue) value =
+        new_file_send_event("sendFileDone", state->fd, result->progress);
+    send_event(state->plugin, value);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  }
+  fl_method_call_respond(state->method_call, response, nullptr);
+
+  OpenPort* port = lookup_open_port(state->plugin, state->fd);
+  if (port != nullptr && port->file_send_state == result->state) {
+    port->file_send.reset();
+    port->file_send_state.reset();
+    port->file_send_direct = false;
+    // Writes made during the send go out now, in order.
+    std::deque<FlMethodCall*> deferred;
+    deferred.swap(port->deferred_writes);
+    for (FlMethodCall* method_call : deferred) {
+      g_autoptr(FlMethodResponse) write_response =
+          handle_write_to_port(state->plugin, method_call);
+      if (write_response != nullptr) {
+        fl_method_call_respond(method_call, write_response, nullptr);
+      }
+      g_object_unref(method_call);
+    }
+  }
+  delete result;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_send_file(SerialComPlugin* self,
+                                   FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    g_autofree gchar* error_msg =
+        g_strdup_printf("Error writing to port: %s", strerror(EBADF));
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("WRITE_ERROR", error_msg, nullptr));
+  }
+  if (port->upload || port->file_send || port->link_test || port->batch ||
+      port->autobaud) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "A transfer is already running", nullptr));
+  }
+
+  FlValue* path = fl_value_lookup_string(args, "path");
+  size_t offset = 0;
+  size_t length = 0;
+  if (path == nullptr || fl_value_get_type(path) != FL_VALUE_TYPE_STRING ||
+      !lookup_size_arg(args, "offset", &offset) ||
+      !lookup_size_arg(args, "length", &length)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid file region", nullptr));
+  }
+  std::shared_ptr<serial_com::FileSender> sender =
+      serial_com::FileSender::Open(fl_value_get_string(path), offset, length);
+  if (!sender) {
+    g_autofree gchar* error_msg =
+        g_strdup_printf("Error opening file: %s", strerror(errno));
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("OPEN_ERROR", error_msg, nullptr));
+  }
+
+  auto state = std::make_shared<FileSendState>();
+  state->plugin = SERIAL_COM_PLUGIN(g_object_ref(self));
+  state->fd = fd;
+  state->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  serial_com::FileSender::ProgressFn progress =
+      [state](const serial_com::FileSendProgress& progress) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->progress = progress;
+        if (state->progress_scheduled) return;
+        state->progress_scheduled = true;
+        g_idle_add_full(G_PRIORITY_DEFAULT, file_send_progress_cb,
+                        new std::shared_ptr<FileSendState>(state),
+                        delete_file_send_state);
+      };
+  serial_com::FileSender::DoneFn done =
+      [state](int64_t result, const serial_com::FileSendProgress& progress) {
+        g_idle_add(file_send_done_cb,
+                   new FileSendResult{state, result, progress});
+      };
+  port->file_send = sender;
+  port->file_send_state = state;
+
+  if (port->pacer || port->codec_stats) {
+    // Pacing and the codec apply per write, so the file goes through the
+    // ordinary write path in chunks.
+    serial_com::TransmitPacer* pacer = port->pacer.get();
+    serial_com::IoLoop* loop = port->loop;
+    std::shared_ptr<serial_com::IoPort> io = port->io;
+    std::shared_ptr<serial_com::LinkCodecStats> codec_stats =
+        port->codec_stats;
+    sender->StartChunked(
+        [pacer, loop, io, codec_stats](
+            std::vector<uint8_t> data,
+            serial_com::FileSender::WriteDone write_done) {
+          if (codec_stats) {
+            std::vector<uint8_t> encoded;
+            serial_com::EncodeLz4Frames(data.data(), data.size(), &encoded,
+                                        codec_stats.get());
+            data.swap(encoded);
+          }
+          if (pacer != nullptr) {
+            pacer->Write(std::move(data), write_done);
+          } else {
+            loop->Write(io, std::move(data),
+                        [write_done](ssize_t result) { write_done(result); },
+                        serial_com::WriteLane::kBulk);
+          }
+        },
+        progress, done);
+    return nullptr;
+  }
+
+  // Direct sends start once the writes already queued, in every lane, have
+  // gone out.
+  port->file_send_direct = true;
+  std::weak_ptr<serial_com::FileSender> weak_sender = sender;
+  serial_com::PortStats* stats = &port->io->stats();
+  port->loop->Write(
+      port->io, std::vector<uint8_t>(),
+      [weak_sender, fd, stats, progress, done](ssize_t result) {
+        std::shared_ptr<serial_com::FileSender> sender = weak_sender.lock();
+        if (sender) sender->StartDirect(fd, stats, progress, done);
+      },
+      serial_com::WriteLane::kBulk);
+  return nullptr;
+}
+
+FlMethodResponse* handle_cancel_send_file(SerialComPlugin* self,
+                                          FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->file_send) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "No file is being sent", nullptr));
+  }
+  // sendFile fails with ECANCELED.
+  port->file_send->Abort();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+struct ModemMonitorState {
+  SerialComPlugin* plugin;
+  int fd;
+
+  ~ModemMonitorState() { g_object_unref(plugin); }
+};
+
+struct ModemLinesEvent {
+  std::shared_ptr<ModemMonitorState> state;
+  serial_com::ModemLineEvent event;
+};
+
+// Adds the state of every line in |lines| to |map|.
+static void set_modem_line_values(FlValue* map, uint32_t lines) {
+  static const uint32_t kLines[] = {
+      serial_com::kLineDtr, serial_com::kLineRts, serial_com::kLineCts,
+      serial_com::kLineDsr, serial_com::kLineDcd, serial_com::kLineRi,
+  };
+  for (uint32_t line : kLines) {
+    fl_value_set_string_take(map, serial_com::ModemLineName(line),
+                             fl_value_new_bool((lines & line) != 0));
+  }
+}
+
+// Sends one modemLines event. Changes are not coalesced: every edge is
+// reported, with the time the monitor saw it.
+static gboolean modem_lines_cb(gpointer user_data) {
+  ModemLinesEvent* lines_event = static_cast<ModemLinesEvent*>(user_data);
+  ModemMonitorState* state = lines_event->state.get();
+  const serial_com::ModemLineEvent& event = lines_event->event;
+
+  // Drop events from a monitor that has since been stopped.
+  OpenPort* port = lookup_open_port(state->plugin, state->fd);
+  if (port != nullptr && port->modem_monitor_state == lines_event->state) {
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "event",
+                             fl_value_new_string("modemLines"));
+    fl_value_set_string_take(value, "fd", fl_value_new_int(state->fd));
+    set_modem_line_values(value, event.lines);
+    FlValue* changed = fl_value_new_list();
+    for (uint32_t line = 1; line <= serial_com::kLineRi; line <<= 1) {
+      if (event.changed & line) {
+        fl_value_append_take(
+            changed, fl_value_new_string(serial_com::ModemLineName(line)));
+      }
+    }
+    fl_value_set_string_take(value, "changed", changed);
+    fl_value_set_string_take(value, "timestampUs",
+                             fl_value_new_int(event.timestamp_ns / 1000));
+    fl_value_set_string_take(
+        value, "interruptDriven",
+        fl_value_new_bool(port->modem_monitor->interrupt_driven()));
+    if (event.error != 0) {
+      // The monitor has stopped.
+      fl_value_set_string_take(value, "error",
+                               fl_value_new_string(strerror(-event.error)));
+    }
+    send_event(state->plugin, value);
+  }
+  delete lines_event;
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_start_modem_monitor(SerialComPlugin* self,
+                                             FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  // Restarting reports the current lines again.
+  port->modem_monitor.reset();
+
+  auto state = std::make_shared<ModemMonitorState>();
+  state->plugin = SERIAL_COM_PLUGIN(g_object_ref(self));
+  state->fd = fd;
+  port->modem_monitor_state = state;
+  // Drivers that cannot wait for changes are polled at this interval.
+  int poll_interval_ms = 10;
+  FlValue* interval = fl_value_lookup_string(args, "pollIntervalMs");
+  if (interval != nullptr && fl_value_get_type(interval) == FL_VALUE_TYPE_INT &&
+      fl_value_get_int(interval) > 0) {
+    poll_interval_ms = fl_value_get_int(interval);
+  }
+  port->modem_monitor.reset(new serial_com::ModemMonitor(
+      serial_com::CreateTtyModemLineDevice(fd),
+      [state](const serial_com::ModemLineEvent& event) {
+        g_idle_add(modem_lines_cb, new ModemLinesEvent{state, event});
+      },
+      poll_interval_ms));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_stop_modem_monitor(SerialComPlugin* self,
+                                            FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port != nullptr) {
+    port->modem_monitor.reset();
+    port->modem_monitor_state.reset();
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_get_modem_lines(SerialComPlugin* self,
+                                         FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  if (lookup_open_port(self, fd) == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  uint32_t lines = 0;
+  serial_com::Status status = serial_com::GetModemLines(fd, &lines);
+  if (!status.ok()) return status_error_response(status);
+  g_autoptr(FlValue) result = fl_value_new_map();
+  set_modem_line_values(result, lines);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* handle_set_modem_lines(SerialComPlugin* self,
+                                         FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  if (lookup_open_port(self, fd) == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  // Lines that are not mentioned are left alone.
+  uint32_t raise = 0;
+  uint32_t drop = 0;
+  static const struct {
+    const char* key;
+    uint32_t line;
+  } kOutputLines[] = {{"dtr", serial_com::kLineDtr},
+                      {"rts", serial_com::kLineRts}};
+  for (const auto& output : kOutputLines) {
+    FlValue* value = fl_value_lookup_string(args, output.key);
+    if (value == nullptr || fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+      continue;
+    }
+    if (fl_value_get_type(value) != FL_VALUE_TYPE_BOOL) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", "Line states must be booleans", nullptr));
+    }
+    (fl_value_get_bool(value) ? raise : drop) |= output.line;
+  }
+  serial_com::Status status = serial_com::SetModemLines(fd, raise, true);
+  if (status.ok()) status = serial_com::SetModemLines(fd, drop, false);
+  if (!status.ok()) return status_error_response(status);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// A sendBreak call waiting for its break to end.
+struct BreakRequest {
+  SerialComPlugin* plugin;
+  int fd;
+  FlMethodCall* method_call;
+  guint timeout_source;
+};
+
+// Ends the break, answers the call and frees |request|.
+static void finish_break(BreakRequest* request) {
+  OpenPort* port = lookup_open_port(request->plugin, request->fd);
+  if (port != nullptr && port->pending_break == request) {
+    port->pending_break = nullptr;
+  }
+  if (request->timeout_source != 0) g_source_remove(request->timeout_source);
+  serial_com::Status status = serial_com::SetBreak(request->fd, false);
+  g_autoptr(FlMethodResponse) response =
+      status.ok()
+          ? FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr))
+          : status_error_response(status);
+  fl_method_call_respond(request->method_call, response, nullptr);
+  g_object_unref(request->method_call);
+  g_object_unref(request->plugin);
+  delete request;
+}
+
+static gboolean break_timeout_cb(gpointer user_data) {
+  BreakRequest* request = static_cast<BreakRequest*>(user_data);
+  request->timeout_source = 0;
+  finish_break(request);
+  return G_SOURCE_REMOVE;
+}
+
+FlMethodResponse* handle_send_break(SerialComPlugin* self,
+                                    FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  if (port->pending_break != nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "A break is already being sent", nullptr));
+  }
+  // tcsendbreak() would block the main thread for the whole break, so the
+  // line is held in break and released from a timer instead.
+  int64_t duration_ms = 250;
+  FlValue* duration = fl_value_lookup_string(args, "durationMs");
+  if (duration != nullptr &&
+      fl_value_get_type(duration) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(duration) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(duration) <= 0 ||
+        fl_value_get_int(duration) > G_MAXINT) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", "Invalid break duration", nullptr));
+    }
+    duration_ms = fl_value_get_int(duration);
+  }
+  serial_com::Status status = serial_com::SetBreak(fd, true);
+  if (!status.ok()) return status_error_response(status);
+
+  BreakRequest* request = new BreakRequest{
+      SERIAL_COM_PLUGIN(g_object_ref(self)), fd,
+      FL_METHOD_CALL(g_object_ref(method_call)), 0};
+  request->timeout_source = g_timeout_add(
+      static_cast<guint>(duration_ms), break_timeout_cb, request);
+  port->pending_break = request;
+  return nullptr;
+}
+
+FlMethodResponse* handle_get_port_stats(SerialComPlugin* self,
+                                        FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "STATS_ERROR", "Port is not open", nullptr));
+  }
+
+  serial_com::PortStatsSnapshot stats = port->io->stats().Snapshot();
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "bytesReceived",
+                           fl_value_new_int(stats.bytes_received));
+  fl_value_set_string_take(result, "bytesSent",
+                           fl_value_new_int(stats.bytes_sent));
+  fl_value_set_string_take(result, "readCalls",
+                           fl_value_new_int(stats.read_calls));
+  fl_value_set_string_take(result, "writeCalls",
+                           fl_value_new_int(stats.write_calls));
+  fl_value_set_string_take(result, "readErrors",
+                           fl_value_new_int(stats.read_errors));
+  fl_value_set_string_take(result, "writeErrors",
+                           fl_value_new_int(stats.write_errors));
+  // How the reads are sized, and what that costs per MiB received.
+  serial_com::ReadSizerStats sizing = port->io->read_sizer().stats();
+  fl_value_set_string_take(result, "readSizingCalls",
+                           fl_value_new_int(stats.read_sizing_calls));
+  fl_value_set_string_take(
+      result, "readSyscallsPerMB",
+      fl_value_new_float(serial_com::ReadSyscallsPerMegabyte(stats)));
+  fl_value_set_string_take(result, "readSize",
+                           fl_value_new_int(sizing.read_size));
+  fl_value_set_string_take(result, "readBufferBytes",
+                           fl_value_new_int(sizing.buffer_bytes));
+  fl_value_set_string_take(result, "arrivalBytesPerSecond",
+                           fl_value_new_int(sizing.bytes_per_second));
+  // Unread bytes, and what the receive limit has sent to disk.
+  serial_com::ReceiveBufferStats buffer = port->io->receive_buffer_stats();
+  fl_value_set_string_take(
+      result, "bufferedBytes",
+      fl_value_new_int(buffer.memory_bytes + buffer.spill_bytes));
+  fl_value_set_string_take(result, "spillFileBytes",
+                           fl_value_new_int(buffer.spill_bytes));
+  fl_value_set_string_take(result, "spilledBytes",
+                           fl_value_new_int(buffer.spilled_bytes));
+  fl_value_set_string_take(result, "replayedBytes",
+                           fl_value_new_int(buffer.replayed_bytes));
+  fl_value_set_string_take(result, "spillDroppedBytes",
+                           fl_value_new_int(buffer.dropped_bytes));
+  fl_value_set_string_take(result, "ioBackend",
+                           fl_value_new_string(serial_com::IoBackendKindName(
+                               port->loop->kind())));
+  // bytesSent/bytesReceived count what crossed the wire; with a codec the
+  // raw counts give the compression ratio.
+  fl_value_set_string_take(
+      result, "codec",
+      fl_value_new_string(serial_com::LinkCodecName(
+          port->codec_stats ? serial_com::LinkCodec::kLz4
+                            : serial_com::LinkCodec::kNone)));
+  if (port->codec_stats) {
+    serial_com::LinkCodecStatsSnapshot codec = port->codec_stats->Snapshot();
+    fl_value_set_string_take(result, "rawBytesSent",
+                             fl_value_new_int(codec.raw_bytes_sent));
+    fl_value_set_string_take(result, "rawBytesReceived",
+                             fl_value_new_int(codec.raw_bytes_received));
+    fl_value_set_string_take(result, "decodeErrors",
+                             fl_value_new_int(codec.decode_errors));
+  }
+  if (port->frames) {
+    serial_com::FrameRouterStats frames = port->frames->stats();
+    fl_value_set_string_take(result, "framesRouted",
+                             fl_value_new_int(frames.frames_routed));
+    fl_value_set_string_take(result, "framesUnmatched",
+                             fl_value_new_int(frames.frames_unmatched));
+  }
+  if (port->rs485) {
+    // Turnarounds run from releasing the line to the reply's first byte.
+    serial_com::Rs485StatsSnapshot rs485 = port->rs485->Snapshot();
+    fl_value_set_string_take(
+        result, "rs485Mode",
+        fl_value_new_string(serial_com::Rs485ModeName(port->rs485_mode)));
+    fl_value_set_string_take(result, "rs485Transmissions",
+                             fl_value_new_int(rs485.transmissions));
+    fl_value_set_string_take(result, "rs485Replies",
+                             fl_value_new_int(rs485.replies));
+    fl_value_set_string_take(
+        result, "rs485MeanReleaseUs",
+        fl_value_new_int(rs485.transmissions > 0
+                             ? rs485.total_release_us / rs485.transmissions
+                             : 0));
+    fl_value_set_string_take(result, "rs485MaxReleaseUs",
+                             fl_value_new_int(rs485.max_release_us));
+    fl_value_set_string_take(
+        result, "rs485MeanTurnaroundUs",
+        fl_value_new_int(rs485.replies > 0
+                             ? rs485.total_turnaround_us / rs485.replies
+                             : 0));
+    fl_value_set_string_take(result, "rs485MinTurnaroundUs",
+                             fl_value_new_int(rs485.min_turnaround_us));
+    fl_value_set_string_take(result, "rs485MaxTurnaroundUs",
+                             fl_value_new_int(rs485.max_turnaround_us));
+  }
+  if (port->bridge) {
+    serial_com::BridgeStats bridge = port->bridge->stats();
+    fl_value_set_string_take(result, "bridgeClients",
+                             fl_value_new_int(bridge.clients));
+    fl_value_set_string_take(result, "bridgeBytesToClients",
+                             fl_value_new_int(bridge.bytes_to_clients));
+    fl_value_set_string_take(result, "bridgeBytesFromClients",
+                             fl_value_new_int(bridge.bytes_from_clients));
+    fl_value_set_string_take(result, "bridgeDroppedBytes",
+                             fl_value_new_int(bridge.dropped_bytes));
+  }
+  // Per transmit lane; latencies run from queueing to the tty taking the
+  // last byte.
+  g_autoptr(FlValue) lanes = fl_value_new_map();
+  for (int i = 0; i < serial_com::kWriteLaneCount; i++) {
+    serial_com::WriteLane lane = static_cast<serial_com::WriteLane>(i);
+    serial_com::WriteLaneStats lane_stats = port->io->write_lane_stats(lane);
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "queuedWrites",
+                             fl_value_new_int(lane_stats.queued_writes));
+    fl_value_set_string_take(entry, "queuedBytes",
+                             fl_value_new_int(lane_stats.queued_bytes));
+    fl_value_set_string_take(entry, "completedWrites",
+                             fl_value_new_int(lane_stats.completed_writes));
+    fl_value_set_string_take(entry, "failedWrites",
+                             fl_value_new_int(lane_stats.failed_writes));
+    fl_value_set_string_take(entry, "bytesWritten",
+                             fl_value_new_int(lane_stats.bytes_written));
+    fl_value_set_string_take(entry, "preemptions",
+                             fl_value_new_int(lane_stats.preemptions));
+    fl_value_set_string_take(
+        entry, "meanLatencyUs",
+        fl_value_new_int(lane_stats.completed_writes > 0
+                             ? lane_stats.total_latency_us /
+                                   lane_stats.completed_writes
+                             : 0));
+    fl_value_set_string_take(entry, "maxLatencyUs",
+                             fl_value_new_int(lane_stats.max_latency_us));
+    fl_value_set_string_take(lanes, serial_com::WriteLaneName(lane), entry);
+  }
+  fl_value_set_string(result, "writeLanes", lanes);
+  if (port->streams) {
+    g_autoptr(FlValue) streams = fl_value_new_list();
+    for (int id : port->streams->ids()) {
+      serial_com::SubscriberStats stream;
+      if (!port->streams->Stats(id, &stream)) continue;
+      FlValue* entry = fl_value_new_map();
+      fl_value_set_string_take(entry, "subscription", fl_value_new_int(id));
+      fl_value_set_string_take(
+          entry, "policy",
+          fl_value_new_string(
+              serial_com::BackpressurePolicyName(stream.policy)));
+      fl_value_set_string_take(entry, "queuedBytes",
+                               fl_value_new_int(stream.queued_bytes));
+      fl_value_set_string_take(entry, "receivedBytes",
+                               fl_value_new_int(stream.received_bytes));
+      fl_value_set_string_take(entry, "spilledBytes",
+                               fl_value_new_int(stream.spilled_bytes));
+      fl_value_set_string_take(entry, "droppedBytes",
+                               fl_value_new_int(stream.dropped_bytes));
+      fl_value_set_string_take(entry, "holding",
+                               fl_value_new_bool(stream.holding));
+      fl_value_append_take(streams, entry);
+    }
+    fl_value_set_string(result, "streams", streams);
+  }
+  if (port->records) {
+    fl_value_set_string_take(
+        result, "capturedBytes",
+        fl_value_new_int(port->records->captured_bytes()));
+    fl_value_set_string_take(
+        result, "captureFailed",
+        fl_value_new_bool(port->records->capture_failed()));
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Reads the optional startBridge arguments into |options|. Returns false if
+// any of them is malformed.
+static gboolean parse_bridge_options(FlValue* args,
+                                     serial_com::BridgeOptions* options) {
+  FlValue* address = fl_value_lookup_string(args, "address");
+  if (address != nullptr && fl_value_get_type(address) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(address) != FL_VALUE_TYPE_STRING) return FALSE;
+    options->address = fl_value_get_string(address);
+  }
+  FlValue* protocol = fl_value_lookup_string(args, "protocol");
+  if (protocol != nullptr &&
+      fl_value_get_type(protocol) != FL_VALUE_TYPE_NULL &&
+      (fl_value_get_type(protocol) != FL_VALUE_TYPE_STRING ||
+       !serial_com::ParseBridgeProtocol(fl_value_get_string(protocol),
+                                        &options->protocol))) {
+    return FALSE;
+  }
+  size_t tcp_port = options->port;
+  size_t max_clients = options->max_clients;
+  if (!lookup_size_arg(args, "tcpPort", &tcp_port) ||
+      !lookup_size_arg(args, "maxClients", &max_clients) ||
+      !lookup_size_arg(args, "clientBufferLimit",
+                       &options->client_buffer_limit) ||
+      tcp_port > 65535 || max_clients == 0 || max_clients > 1024) {
+    return FALSE;
+  }
+  options->port = static_cast<int>(tcp_port);
+  options->max_clients = static_cast<int>(max_clients);
+  return TRUE;
+}
+
+FlMethodResponse* handle_start_bridge(SerialComPlugin* self,
+                                      FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  if (port->bridge) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is already bridged", nullptr));
+  }
+  // Clients' bytes go straight to the I/O loop, so they would bypass the
+  // encoder.
+  if (port->codec_stats) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Ports with a codec cannot be bridged", nullptr));
+  }
+  // Nor turn the line around.
+  if (port->rs485_mode == serial_com::Rs485Mode::kSoftware) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Bridges need kernel RS-485 direction control",
+        nullptr));
+  }
+  serial_com::BridgeOptions options;
+  if (!parse_bridge_options(args, &options)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid bridge settings", nullptr));
+  }
+  std::shared_ptr<serial_com::IoPort> io = port->io;
+  serial_com::IoLoop* loop = port->loop;
+  serial_com::Status status = serial_com::SerialBridge::Start(
+      fd, port->config, io->receive_fanout(),
+      [io, loop](std::vector<uint8_t> data) {
+        loop->Write(io, std::move(data), nullptr);
+      },
+      options, &port->bridge);
+  if (!status.ok()) return status_error_response(status);
+
+  g_autoptr(FlValue) result = fl_value_new_int(port->bridge->port());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* handle_stop_bridge(SerialComPlugin* self,
+                                     FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  if (port->bridge) {
+    // Keep what the clients set, so that a later bridge starts from it.
+    port->config = port->bridge->config();
+    port->bridge.reset();
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_subscribe_stream(SerialComPlugin* self,
+                                          FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "Port is not open", nullptr));
+  }
+  serial_com::SubscriberOptions options;
+  FlValue* policy = fl_value_lookup_string(args, "policy");
+  FlValue* directory = fl_value_lookup_string(args, "spillDirectory");
+  if ((policy != nullptr && fl_value_get_type(policy) != FL_VALUE_TYPE_NULL &&
+       (fl_value_get_type(policy) != FL_VALUE_TYPE_STRING ||
+        !serial_com::ParseBackpressurePolicy(fl_value_get_string(policy),
+                                             &options.policy))) ||
+      !lookup_size_arg(args, "limit", &options.limit) ||
+      (directory != nullptr &&
+       fl_value_get_type(directory) != FL_VALUE_TYPE_NULL &&
+       fl_value_get_type(directory) != FL_VALUE_TYPE_STRING)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Invalid stream settings", nullptr));
+  }
+  if (directory != nullptr &&
+      fl_value_get_type(directory) == FL_VALUE_TYPE_STRING) {
+    options.spill_directory = fl_value_get_string(directory);
+  }
+  if (!port->streams) {
+    std::shared_ptr<serial_com::IoPort> io = port->io;
+    serial_com::IoLoop* loop = port->loop;
+    std::weak_ptr<OpenPort> weak_port = (*self->ports)[fd];
+    port->streams.reset(new serial_com::StreamSubscribers(
+        io->receive_fanout(),
+        [weak_port](int id) {
+          g_idle_add_full(G_PRIORITY_DEFAULT, port_data_cb,
+                          new std::weak_ptr<OpenPort>(weak_port),
+                          delete_weak_port);
+        },
+        [io, loop](bool held) { loop->SetReceiveHeld(io, held); }));
+  }
+  int subscription = 0;
+  serial_com::Status status = port->streams->Subscribe(options, &subscription);
+  if (!status.ok()) return status_error_response(status);
+  g_autoptr(FlValue) result = fl_value_new_int(subscription);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* handle_unsubscribe_stream(SerialComPlugin* self,
+                                            FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+  int subscription =
+      fl_value_get_int(fl_value_lookup_string(args, "subscription"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->streams ||
+      !port->streams->Unsubscribe(subscription)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "CONFIG_ERROR", "No such subscription", nullptr));
+  }
+  // Waiting readStream calls for the subscription return empty.
+  std::deque<PendingRead*>& queue = port->pending_reads;
+  for (auto it = queue.begin(); it != queue.end();) {
+    PendingRead* pending = *it;
+    if (pending->kind != PendingReadKind::kStream ||
+        pending->subscription != subscription) {
+      ++it;
+      continue;
+    }
+    it = queue.erase(it);
+    finish_pending_read(pending);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_read_stream(SerialComPlugin* self,
+                                     FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  int fd = fl_value_get_int(fl_value_lookup_string(args, "fd"));
+  int subscription =
+      fl_value_get_int(fl_value_lookup_string(args, "subscription"));
+  int max_length = fl_value_get_int(fl_value_lookup_string(args, "maxLength"));
+
+  OpenPort* port = lookup_open_port(self, fd);
+  if (port == nullptr || !port->streams || max_length <= 0) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "READ_ERROR", "No such subscription", nullptr));
+  }
+
+  if (!has_pending_read(port, PendingReadKind::kStream, subscription) &&
+      port->streams->Queued(subscription) > 0) {
+    respond_stream(method_call, port, subscription, max_length);
+    return nullptr;
+  }
+  add_pending_read(port, method_call, PendingReadKind::kStream, max_length,
+                   subscription);
+  return nullptr;
+}
+
+// An executeBatch call in progress.
+struct BatchState {
+  SerialComPlugin* plugin;
+  FlMethodCall* method_call;
+  // The ports the batch operates on, each with |batch| pointing here.
+  std::vector<int> fds;
+  // Set on the runner thread before batch_done_cb is scheduled.
+  std::vector<serial_com::BatchResult> results;
+  // Declared last so that it stops before the rest is destroyed.
+  std::unique_ptr<serial_com::BatchRunner> runner;
+
+  ~BatchState() {
+    g_object_unref(method_call);
+    g_object_unref(plugin);
+  }
+};
+
+// Stops the batch's runner; the call is still answered by batch_done_cb.
+static void cancel_batch(BatchState* state) { state->runner.reset(); }
+
+static void delete_batch_state(gpointer user_data) {
+  delete static_cast<std::shared_ptr<BatchState>*>(user_data);
+}
+
+// Answers an executeBatch call with {results: [{bytes, elapsedUs, data?,
+// error?, message?}], completed}, one result per operation that ran.
+static gboolean batch_done_cb(gpointer user_data) {
+  std::shared_ptr<BatchState> state =
+      *static_cast<std::shared_ptr<BatchState>*>(user_data);
+  if (!state) return G_SOURCE_REMOVE;
+  // The runner thread is done with the results once this is scheduled.
+  state->runner.reset();
+  for (int fd : state->fds) {
+    OpenPort* port = lookup_open_port(state->plugin, fd);
+    if (port != nullptr && port->batch == state) port->batch.reset();
+  }
+
+  g_autoptr(FlValue) results = fl_value_new_list();
+  bool completed = true;
+  for (const serial_com::BatchResult& result : state->results) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "bytes", fl_value_new_int(result.bytes));
+    fl_value_set_string_take(entry, "elapsedUs",
+                             fl_value_new_int(result.elapsed_us));
+    if (!result.data.empty()) {
+      fl_value_set_string_take(
+          entry, "data",
+          fl_value_new_uint8_list(result.data.data(), result.data.size()));
+    }
+    if (!result.status.ok()) {
+      completed = false;
+      fl_value_set_string_take(entry, "error",
+                               fl_value_new_string(result.status.code()));
+      fl_value_set_string_take(
+          entry, "message",
+          fl_value_new_string(result.status.message().c_str()));
+    }
+    fl_value_append_take(results, entry);
+  }
+  g_autoptr(FlValue) value = fl_value_new_map();
+  fl_value_set_string(value, "results", results);
+  fl_value_set_string_take(value, "completed", fl_value_new_bool(completed));
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  fl_method_call_respond(state->method_call, response, nullptr);
+  return G_SOURCE_REMOVE;
+}
+
+// Parses one executeBatch operation: {op, fd, data, delimiter, count,
+// maxLength, timeoutMs, durationMs, dtr, rts}, with only the keys its op
+// uses.
+static gboolean parse_batch_operation(FlValue* entry,
+                                      serial_com::BatchOperation* operation) {
+  if (fl_value_get_type(entry) != FL_VALUE_TYPE_MAP) return FALSE;
+  FlValue* op = fl_value_lookup_string(entry, "op");
+  if (op == nullptr || fl_value_get_type(op) != FL_VALUE_TYPE_STRING ||
+      !serial_com::ParseBatchOpKind(fl_value_get_string(op),
+                                    &operation->kind)) {
+    return FALSE;
+  }
+  size_t timeout_ms = 1000;
+  size_t max_length = 4096;
+  if (operation->kind == serial_com::BatchOpKind::kSleep) {
+    if (!lookup_size_arg(entry, "durationMs", &timeout_ms)) return FALSE;
+  } else {
+    FlValue* fd = fl_value_lookup_string(entry, "fd");
+    if (fd == nullptr || fl_value_get_type(fd) != FL_VALUE_TYPE_INT ||
+        !lookup_size_arg(entry, "timeoutMs", &timeout_ms)) {
+      return FALSE;
+    }
+    operation->fd = static_cast<int>(fl_value_get_int(fd));
+  }
+  if (timeout_ms > G_MAXINT) return FALSE;
+  operation->timeout_ms = static_cast<int>(timeout_ms);
+
+  switch (operation->kind) {
+    case serial_com::BatchOpKind::kWrite:
+      return lookup_bytes_arg(entry, "data", &operation->data);
+    case serial_com::BatchOpKind::kWaitForBytes:
+      return lookup_size_arg(entry, "count", &operation->count) &&
+             operation->count > 0;
+    case serial_com::BatchOpKind::kReadUntil:
+      if (!lookup_bytes_arg(entry, "delimiter", &operation->data) ||
+          operation->data.empty() ||
+          !lookup_size_arg(entry, "maxLength", &max_length) ||
+          max_length == 0) {
+        return FALSE;
+      }
+      operation->count = max_length;
+      return TRUE;
+    case serial_com::BatchOpKind::kSetLines: {
+      // As setModemLines: lines that are not mentioned are left alone.
+      static const struct {
+        const char* key;
+        uint32_t line;
+      } kOutputLines[] = {{"dtr", serial_com::kLineDtr},
+                          {"rts", serial_com::kLineRts}};
+      for (const auto& output : kOutputLines) {
+        FlValue* value = fl_value_lookup_string(entry, output.key);
+        if (value == nullptr ||
+            fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+          continue;
+        }
+        if (fl_value_get_type(value) != FL_VALUE_TYPE_BOOL) return FALSE;
+        (fl_value_get_bool(value) ? operation->raise_lines
+                                  : operation->drop_lines) |= output.line;
+      }
+      return TRUE;
+    }
+    case serial_com::BatchOpKind::kSleep:
+      return TRUE;
+  }
+  return FALSE;
+}
+
+FlMethodResponse* handle_execute_batch(SerialComPlugin* self,
+                                       FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  FlValue* list = fl_value_lookup_string(args, "operations");
+  if (list == nullptr || fl_value_get_type(list) != FL_VALUE_TYPE_LIST) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "Missing operations", nullptr));
+  }
+  std::vector<serial_com::BatchOperation> operations;
+  std::map<int, serial_com::BatchPort> ports;
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    serial_com::BatchOperation operation;
+    if (!parse_batch_operation(fl_value_get_list_value(list, i),
+                               &operation)) {
+      g_autofree gchar* error_msg =
+          g_strdup_printf("Invalid batch operation %zu", i);
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "INVALID_ARGUMENT", error_msg, nullptr));
+    }
+    if (operation.kind != serial_com::BatchOpKind::kSleep &&
+        ports.count(operation.fd) == 0) {
+      OpenPort* port = lookup_open_port(self, operation.fd);
+      if (port == nullptr) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new(
+            "CONFIG_ERROR", "Port is not open", nullptr));
+      }
+      // Batch writes go straight to the I/O loop, and its reads take from
+      // the plain receive buffer.
+      if (port->batch || port->pacer || port->codec_stats || port->upload ||
+          port->link_test || port->file_send || port->frames ||
+          port->records || port->autobaud) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new(
+            "CONFIG_ERROR", "Port is busy or cannot run batches", nullptr));
+      }
+      ports[operation.fd] = serial_com::BatchPort{port->io, port->loop};
+    }
+    operations.push_back(std::move(operation));
+  }
+  // Only the ports keep a running batch alive; one with none would be
+  // destroyed unanswered.
+  if (ports.empty()) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "A batch must operate on a port", nullptr));
+  }
+
+  auto state = std::make_shared<BatchState>();
+  state->plugin = SERIAL_COM_PLUGIN(g_object_ref(self));
+  state->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  for (const auto& it : ports) {
+    state->fds.push_back(it.first);
+    lookup_open_port(self, it.first)->batch = state;
+  }
+  // The state owns the runner, so the runner's callback only holds it
+  // weakly; it runs before the runner is destroyed, while the state lives.
+  std::weak_ptr<BatchState> weak_state = state;
+  BatchState* raw_state = state.get();
+  state->runner.reset(new serial_com::BatchRunner(
+      std::move(operations), std::move(ports),
+      [raw_state, weak_state](std::vector<serial_com::BatchResult> results) {
+        raw_state->results = std::move(results);
+        g_idle_add_full(G_PRIORITY_DEFAULT, batch_done_cb,
+                        new std::shared_ptr<BatchState>(weak_state.lock()),
+                        delete_batch_state);
+      }));
+  return nullptr;
+}
+
+FlMethodResponse* handle_start_tracing(FlMethodCall* method_call) {
+  plugin_trace().Start();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* handle_stop_tracing(FlMethodCall* method_call) {
+  serial_com::TraceBuffer& trace = plugin_trace();
+  trace.Stop();
+  // Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev.
+  std::string json = trace.ToChromeTraceJson();
+  g_autoptr(FlValue) result = fl_value_new_string(json.c_str());
   return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
@@ -9,10 +9,135 @@
 // Handles the getPlatformVersion method call.
 FlMethodResponse *get_platform_version();
 
-// New functions for serial communication
-FlMethodResponse* handle_open_port(FlMethodCall* method_call);
-FlMethodResponse* handle_close_port(FlMethodCall* method_call);
-FlMethodResponse* handle_write_to_port(FlMethodCall* method_call);
-FlMethodResponse* handle_read_from_port(FlMethodCall* method_call);
+// New functions for serial communication.
+//
+// Handlers that finish asynchronously (writes, and reads that have to wait
+// for data) return nullptr and respond to |method_call| themselves.
+FlMethodResponse* handle_initialize(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+FlMethodResponse* handle_open_port(SerialComPlugin* self,
+                                   FlMethodCall* method_call);
+FlMethodResponse* handle_close_port(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+FlMethodResponse* handle_write_to_port(SerialComPlugin* self,
+                                       FlMethodCall* method_call);
+// Writes one payload to many ports at once and responds with each port's
+// result and the skew between the first and last to finish.
+FlMethodResponse* handle_write_many(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+FlMethodResponse* handle_read_from_port(SerialComPlugin* self,
+                                        FlMethodCall* method_call);
+// Responds once everything written before the call has been transmitted
+// (tcdrain), without blocking the main thread.
+FlMethodResponse* handle_drain_port(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+// Discards unread input, untransmitted output, or both.
+FlMethodResponse* handle_flush_port(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+// Caps the unread bytes a port holds in memory; later ones spill to a
+// temporary file and are replayed in order by readFromPort.
+FlMethodResponse* handle_set_receive_buffer(SerialComPlugin* self,
+                                            FlMethodCall* method_call);
+FlMethodResponse* handle_set_pacing(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+// Sets the frame size at which urgent and normal writes (writeToPort's
+// lane) cut into bulk transfers.
+FlMethodResponse* handle_set_write_lanes(SerialComPlugin* self,
+                                         FlMethodCall* method_call);
+// Sets the limits within which a port's tty reads are sized from FIONREAD
+// and the arrival rate.
+FlMethodResponse* handle_set_read_sizing(SerialComPlugin* self,
+                                         FlMethodCall* method_call);
+// Sessions that read a port's receive path themselves.
+struct ReceiveSessions {
+  bool upload = false;
+  bool link_test = false;
+  bool batch = false;
+  bool autobaud = false;
+};
+
+// Returns the error with which setRecordSchema and setFraming refuse a port
+// while one of |sessions| runs, since a framer would take the bytes it
+// waits for; nullptr if none does.
+FlMethodResponse* receive_mode_busy_response(const ReceiveSessions& sessions);
+
+// Registers a fixed-size record layout for a port; readRecords then returns
+// decoded records as typed-array columns.
+FlMethodResponse* handle_set_record_schema(SerialComPlugin* self,
+                                           FlMethodCall* method_call);
+// Reduces a record port's series before readRecords returns it, and
+// optionally captures the full-rate records to a file.
+FlMethodResponse* handle_set_decimation(SerialComPlugin* self,
+                                        FlMethodCall* method_call);
+FlMethodResponse* handle_read_records(SerialComPlugin* self,
+                                      FlMethodCall* method_call);
+// Cuts received bytes into frames so that subscribers registered with
+// subscribeFrames receive only the frames their filters match.
+FlMethodResponse* handle_set_framing(SerialComPlugin* self,
+                                     FlMethodCall* method_call);
+FlMethodResponse* handle_subscribe_frames(SerialComPlugin* self,
+                                          FlMethodCall* method_call);
+FlMethodResponse* handle_unsubscribe_frames(SerialComPlugin* self,
+                                            FlMethodCall* method_call);
+FlMethodResponse* handle_read_frames(SerialComPlugin* self,
+                                     FlMethodCall* method_call);
+// Streams a firmware image to a bootloader with XMODEM-1K or YMODEM,
+// sending progress on the event channel, and responds when it has ended.
+FlMethodResponse* handle_upload_firmware(SerialComPlugin* self,
+                                         FlMethodCall* method_call);
+FlMethodResponse* handle_cancel_upload(SerialComPlugin* self,
+                                       FlMethodCall* method_call);
+// Runs a throughput, error rate and latency test over a looped-back port
+// and responds with the report.
+FlMethodResponse* handle_run_link_test(SerialComPlugin* self,
+                                       FlMethodCall* method_call);
+// Finds an open port's baud rate by switching it in place through
+// candidate rates and scoring what arrives at each, then leaves it at the
+// best one and responds with the scores.
+FlMethodResponse* handle_autobaud(SerialComPlugin* self,
+                                  FlMethodCall* method_call);
+// Sends a region of a file to a port without passing it through Dart,
+// with progress on the event channel.
+FlMethodResponse* handle_send_file(SerialComPlugin* self,
+                                   FlMethodCall* method_call);
+FlMethodResponse* handle_cancel_send_file(SerialComPlugin* self,
+                                          FlMethodCall* method_call);
+// Sends a "modemLines" event whenever CTS, DSR, DCD or RI changes.
+FlMethodResponse* handle_start_modem_monitor(SerialComPlugin* self,
+                                             FlMethodCall* method_call);
+FlMethodResponse* handle_stop_modem_monitor(SerialComPlugin* self,
+                                            FlMethodCall* method_call);
+FlMethodResponse* handle_get_modem_lines(SerialComPlugin* self,
+                                         FlMethodCall* method_call);
+FlMethodResponse* handle_set_modem_lines(SerialComPlugin* self,
+                                         FlMethodCall* method_call);
+// Holds the transmit line in break for durationMs, then responds.
+FlMethodResponse* handle_send_break(SerialComPlugin* self,
+                                    FlMethodCall* method_call);
+// Serves the port to TCP clients, raw or over RFC 2217, and responds with
+// the TCP port. Every client sees everything the port receives.
+FlMethodResponse* handle_start_bridge(SerialComPlugin* self,
+                                      FlMethodCall* method_call);
+FlMethodResponse* handle_stop_bridge(SerialComPlugin* self,
+                                     FlMethodCall* method_call);
+// Adds an independent reader of everything the port receives, with its
+// own limit and backpressure policy (dropOldest, block or spill), and
+// responds with its id for readStream.
+FlMethodResponse* handle_subscribe_stream(SerialComPlugin* self,
+                                          FlMethodCall* method_call);
+FlMethodResponse* handle_unsubscribe_stream(SerialComPlugin* self,
+                                            FlMethodCall* method_call);
+FlMethodResponse* handle_read_stream(SerialComPlugin* self,
+                                     FlMethodCall* method_call);
+// Runs a list of writes, waits, reads, sleeps and line changes across one
+// or more ports natively, in order, and responds with every result at
+// once.
+FlMethodResponse* handle_execute_batch(SerialComPlugin* self,
+                                       FlMethodCall* method_call);
+FlMethodResponse* handle_start_tracing(FlMethodCall* method_call);
+// Stops tracing and returns the recorded spans as Chrome trace-event JSON.
+FlMethodResponse* handle_stop_tracing(FlMethodCall* method_call);
+FlMethodResponse* handle_get_port_stats(SerialComPlugin* self,
+                                        FlMethodCall* method_call);
 FlMethodResponse* handle_request_permission(FlMethodCall* method_call);
 
@@ -27,5 +27,23 @@ TEST(SerialComPlugin, GetPlatformVersion) {
   EXPECT_THAT(fl_value_get_string(result), testing::StartsWith("Linux "));
 }
 
+TEST(SerialComPlugin, RefusesReceiveModesDuringSessions) {
+  ReceiveSessions sessions;
+  EXPECT_EQ(receive_mode_busy_response(sessions), nullptr);
+
+  // Setting a schema or framing mid-upload would starve the engine.
+  sessions.upload = true;
+  g_autoptr(FlMethodResponse) response = receive_mode_busy_response(sessions);
+  ASSERT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(response));
+  EXPECT_STREQ(fl_method_error_response_get_code(
+                   FL_METHOD_ERROR_RESPONSE(response)),
+               "CONFIG_ERROR");
+
+  sessions.upload = false;
+  sessions.batch = true;
+  g_autoptr(FlMethodResponse) batch = receive_mode_busy_response(sessions);
+  EXPECT_NE(batch, nullptr);
+}
+
 }  // namespace test
 }  // namespace serial_com
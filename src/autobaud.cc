@@ -0,0 +1,207 @@
+#include "autobaud.h"
+
+// termios2 and BOTHER come from the kernel's headers, which clash with
+// glibc's <termios.h>; this file must not include it.
+#include <asm/termbits.h>
+#include <errno.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <string>
+
+namespace serial_com {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Most common first, since the first rate to score well ends the search.
+const int kDefaultCandidates[] = {115200, 9600,   57600, 38400, 19200,
+                                  230400, 460800, 921600, 4800, 2400,
+                                  1200};
+
+// Bytes kept per window; enough to judge by.
+constexpr size_t kMaxSampleBytes = 4096;
+// How often a window checks for cancellation.
+constexpr int kPollIntervalMs = 20;
+
+Status IoctlError(const char* what) {
+  return Status::Error("CONFIG_ERROR",
+                       std::string(what) + " failed: " + strerror(errno));
+}
+
+bool ReadCounters(int fd, struct serial_icounter_struct* counters) {
+  memset(counters, 0, sizeof *counters);
+  return ioctl(fd, TIOCGICOUNT, counters) == 0;
+}
+
+bool IsTextByte(uint8_t byte) {
+  return (byte >= 0x20 && byte < 0x7f) || byte == '\r' || byte == '\n' ||
+         byte == '\t';
+}
+
+void FlushInput(int fd) { ioctl(fd, TCFLSH, TCIFLUSH); }
+
+// Listens on |fd| for |window_ms| and appends what arrives to |data|.
+Status Listen(int fd, int window_ms, const std::atomic<bool>& cancelled,
+              std::vector<uint8_t>* data) {
+  Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(window_ms);
+  while (true) {
+    if (cancelled) return Status::Error("CANCELLED", "Autobaud was cancelled");
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         deadline - Clock::now())
+                         .count();
+    if (remaining <= 0) return Status::Ok();
+    struct pollfd poll_fd = {fd, POLLIN, 0};
+    int ready = poll(&poll_fd, 1,
+                     static_cast<int>(std::min<long long>(remaining,
+                                                          kPollIntervalMs)));
+    if (ready < 0 && errno != EINTR) {
+      return Status::Error("READ_ERROR",
+                           std::string("poll failed: ") + strerror(errno));
+    }
+    if (ready <= 0) continue;
+    uint8_t buffer[512];
+    ssize_t n = read(fd, buffer, sizeof buffer);
+    if (n < 0 && errno != EINTR && errno != EAGAIN) {
+      return Status::Error("READ_ERROR",
+                           std::string("read failed: ") + strerror(errno));
+    }
+    if (n > 0 && data->size() < kMaxSampleBytes) {
+      size_t kept = std::min<size_t>(n, kMaxSampleBytes - data->size());
+      data->insert(data->end(), buffer, buffer + kept);
+    }
+  }
+}
+
+}  // namespace
+
+Status SetExactBaudRate(int fd, int baud_rate, int* actual_rate) {
+  if (baud_rate <= 0) {
+    return Status::Error("CONFIG_ERROR", "Baud rate must be positive");
+  }
+  struct termios2 tty;
+  if (ioctl(fd, TCGETS2, &tty) != 0) return IoctlError("TCGETS2");
+  tty.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+  tty.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+  tty.c_ispeed = baud_rate;
+  tty.c_ospeed = baud_rate;
+  if (ioctl(fd, TCSETS2, &tty) != 0) return IoctlError("TCSETS2");
+  if (actual_rate != nullptr) return GetExactBaudRate(fd, actual_rate);
+  return Status::Ok();
+}
+
+Status GetExactBaudRate(int fd, int* baud_rate) {
+  struct termios2 tty;
+  if (ioctl(fd, TCGETS2, &tty) != 0) return IoctlError("TCGETS2");
+  *baud_rate = static_cast<int>(tty.c_ospeed);
+  return Status::Ok();
+}
+
+bool ParseAutobaudContent(const char* name, AutobaudContent* content) {
+  if (strcmp(name, "text") == 0) {
+    *content = AutobaudContent::kText;
+  } else if (strcmp(name, "binary") == 0) {
+    *content = AutobaudContent::kBinary;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double ScoreAutobaudSample(const uint8_t* data, size_t length,
+                           AutobaudContent content, size_t min_bytes,
+                           AutobaudSample* sample) {
+  sample->bytes = length;
+  sample->text_bytes = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (IsTextByte(data[i])) sample->text_bytes++;
+  }
+  sample->score = 0;
+  if (length == 0 || length < min_bytes) return 0;
+
+  double valid = 1;
+  if (content == AutobaudContent::kText) {
+    valid = static_cast<double>(sample->text_bytes) / length;
+  }
+  // A rate that is far off garbles nearly every character, and the UART
+  // says so for each; a nearly right one only some.
+  uint64_t flagged = static_cast<uint64_t>(sample->framing_errors) +
+                     sample->parity_errors + sample->breaks;
+  double flagged_share = std::min(1.0, static_cast<double>(flagged) / length);
+  sample->score = std::max(0.0, valid - flagged_share);
+  return sample->score;
+}
+
+Status DetectBaudRate(int fd, const AutobaudOptions& options,
+                      const std::atomic<bool>& cancelled,
+                      AutobaudResult* result) {
+  Clock::time_point start = Clock::now();
+  std::vector<int> candidates = options.candidates;
+  if (candidates.empty()) {
+    candidates.assign(std::begin(kDefaultCandidates),
+                      std::end(kDefaultCandidates));
+  }
+  int original_rate;
+  Status status = GetExactBaudRate(fd, &original_rate);
+  if (!status.ok()) return status;
+
+  *result = AutobaudResult();
+  std::vector<uint8_t> data;
+  for (int candidate : candidates) {
+    status = SetExactBaudRate(fd, candidate);
+    if (!status.ok()) break;
+    // Whatever arrived at the previous rate would count against this one.
+    FlushInput(fd);
+
+    AutobaudSample sample;
+    sample.baud_rate = candidate;
+    struct serial_icounter_struct before;
+    sample.counters = ReadCounters(fd, &before);
+    if (!options.probe.empty()) {
+      ssize_t n = write(fd, options.probe.data(), options.probe.size());
+      if (n < 0 && errno != EAGAIN) {
+        status = Status::Error(
+            "WRITE_ERROR", std::string("Error writing probe: ") +
+                               strerror(errno));
+        break;
+      }
+    }
+    data.clear();
+    status = Listen(fd, options.window_ms, cancelled, &data);
+    if (!status.ok()) break;
+    struct serial_icounter_struct after;
+    if (sample.counters && ReadCounters(fd, &after)) {
+      sample.framing_errors = after.frame - before.frame;
+      sample.parity_errors = after.parity - before.parity;
+      sample.breaks = after.brk - before.brk;
+      sample.overruns = after.overrun - before.overrun;
+    }
+    ScoreAutobaudSample(data.data(), data.size(), options.content,
+                        options.min_bytes, &sample);
+    result->samples.push_back(sample);
+    if (sample.score > result->score) {
+      result->score = sample.score;
+      result->baud_rate = candidate;
+    }
+    if (sample.score >= options.accept_score) break;
+  }
+
+  // Settle on the winner even if the search ended early.
+  Status settled = SetExactBaudRate(
+      fd, result->baud_rate > 0 ? result->baud_rate : original_rate);
+  FlushInput(fd);
+  result->elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           Clock::now() - start)
+                           .count();
+  return status.ok() ? settled : status;
+}
+
+}  // namespace serial_com
@@ -0,0 +1,94 @@
+#ifndef SERIAL_COM_CORE_AUTOBAUD_H_
+#define SERIAL_COM_CORE_AUTOBAUD_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "status.h"
+
+namespace serial_com {
+
+// Sets |fd|'s input and output rate to exactly |baud_rate| bits per second
+// (termios2 with BOTHER), whether or not it has a Bxxx constant. The driver
+// may round it to what its clock can divide to; |actual_rate|, if given, is
+// set to what it reports. Other settings are left alone.
+Status SetExactBaudRate(int fd, int baud_rate, int* actual_rate = nullptr);
+// Reads back |fd|'s output rate.
+Status GetExactBaudRate(int fd, int* baud_rate);
+
+// What autobaud expects to see on the line.
+enum class AutobaudContent {
+  // Text: printable ASCII and line endings. Bytes received at the wrong
+  // rate are mostly not.
+  kText,
+  // Anything; only the driver's framing, parity and break counters tell
+  // rates apart, so this needs a UART that keeps them (not a pty or most
+  // USB adapters).
+  kBinary,
+};
+
+// Parses "text" or "binary". Returns false for anything else.
+bool ParseAutobaudContent(const char* name, AutobaudContent* content);
+
+struct AutobaudOptions {
+  // Tried in order; the first that scores at least |accept_score| wins
+  // without trying the rest, so put the likeliest first. Empty means the
+  // common rates, most common first.
+  std::vector<int> candidates;
+  // How long to listen at each rate.
+  int window_ms = 100;
+  // Sent at the start of each window, for devices that only talk when
+  // spoken to. May be empty.
+  std::vector<uint8_t> probe;
+  AutobaudContent content = AutobaudContent::kText;
+  // Fewer bytes than this score 0: too little to judge.
+  size_t min_bytes = 4;
+  double accept_score = 0.95;
+};
+
+// How one candidate rate fared.
+struct AutobaudSample {
+  int baud_rate = 0;
+  size_t bytes = 0;
+  // Deltas of the driver's counters over the window. All 0 when the driver
+  // does not keep them (see |counters|).
+  uint32_t framing_errors = 0;
+  uint32_t parity_errors = 0;
+  uint32_t breaks = 0;
+  uint32_t overruns = 0;
+  bool counters = false;
+  // Printable ASCII, CR, LF and tab, with kText.
+  size_t text_bytes = 0;
+  // 0 to 1.
+  double score = 0;
+};
+
+// Scores |sample| from its counters and, with kText, |data|: the share of
+// bytes that look valid, less the share that the UART flagged.
+double ScoreAutobaudSample(const uint8_t* data, size_t length,
+                           AutobaudContent content, size_t min_bytes,
+                           AutobaudSample* sample);
+
+struct AutobaudResult {
+  // The best rate, or 0 if none scored above 0.
+  int baud_rate = 0;
+  double score = 0;
+  // Every rate tried, in order.
+  std::vector<AutobaudSample> samples;
+  uint64_t elapsed_us = 0;
+};
+
+// Finds |fd|'s baud rate by switching it in place through the candidates
+// and scoring what arrives at each. Nothing else may read |fd| meanwhile.
+// Leaves |fd| at the best rate, or at its original rate if none scored,
+// with its input queue flushed. Fails with CANCELLED once |cancelled| is
+// set, checked between reads.
+Status DetectBaudRate(int fd, const AutobaudOptions& options,
+                      const std::atomic<bool>& cancelled,
+                      AutobaudResult* result);
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_AUTOBAUD_H_
@@ -0,0 +1,187 @@
+#include "batch_runner.h"
+
+#include <string.h>
+
+#include <string>
+#include <utility>
+
+#include "modem_lines.h"
+
+namespace serial_com {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+Status Timeout(const char* what) {
+  return Status::Error("TIMEOUT_ERROR", std::string("Timed out ") + what);
+}
+
+Status Cancelled() {
+  return Status::Error("CANCELLED", "Batch was cancelled");
+}
+
+}  // namespace
+
+// Shared with the write's callback, which outlives the runner if the write
+// times out or the batch is cancelled.
+struct BatchRunner::WriteCompletion {
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool done = false;
+  ssize_t result = 0;
+};
+
+bool ParseBatchOpKind(const char* name, BatchOpKind* kind) {
+  static const struct {
+    const char* name;
+    BatchOpKind kind;
+  } kKinds[] = {{"write", BatchOpKind::kWrite},
+                {"waitForBytes", BatchOpKind::kWaitForBytes},
+                {"readUntil", BatchOpKind::kReadUntil},
+                {"sleep", BatchOpKind::kSleep},
+                {"setLines", BatchOpKind::kSetLines}};
+  for (const auto& entry : kKinds) {
+    if (strcmp(name, entry.name) == 0) {
+      *kind = entry.kind;
+      return true;
+    }
+  }
+  return false;
+}
+
+BatchRunner::BatchRunner(std::vector<BatchOperation> operations,
+                         std::map<int, BatchPort> ports, DoneCallback done)
+    : operations_(std::move(operations)),
+      ports_(std::move(ports)),
+      done_(std::move(done)),
+      cancelled_(false) {
+  thread_ = std::thread(&BatchRunner::Run, this);
+}
+
+BatchRunner::~BatchRunner() {
+  cancelled_ = true;
+  std::shared_ptr<WriteCompletion> write;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    changed_.notify_all();
+    write = pending_write_;
+  }
+  if (write) {
+    std::lock_guard<std::mutex> lock(write->mutex);
+    write->changed.notify_all();
+  }
+  for (const auto& it : ports_) it.second.io->WakeWaiters();
+  thread_.join();
+}
+
+void BatchRunner::Run() {
+  std::vector<BatchResult> results;
+  for (const BatchOperation& operation : operations_) {
+    Clock::time_point start = Clock::now();
+    results.emplace_back();
+    BatchResult& result = results.back();
+    result.status = Execute(operation, &result);
+    result.elapsed_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                              start)
+            .count();
+    if (!result.status.ok()) break;
+  }
+  if (done_) done_(std::move(results));
+}
+
+Status BatchRunner::Execute(const BatchOperation& operation,
+                            BatchResult* result) {
+  if (cancelled_) return Cancelled();
+  Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(operation.timeout_ms);
+  if (operation.kind == BatchOpKind::kSleep) {
+    return SleepUntil(deadline) ? Status::Ok() : Cancelled();
+  }
+  auto it = ports_.find(operation.fd);
+  if (it == ports_.end()) {
+    return Status::Error("INVALID_ARGUMENT", "Port is not part of the batch");
+  }
+  const BatchPort& port = it->second;
+
+  switch (operation.kind) {
+    case BatchOpKind::kWrite: {
+      auto completion = std::make_shared<WriteCompletion>();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_write_ = completion;
+      }
+      port.loop->Write(port.io, operation.data,
+                       [completion](ssize_t written) {
+                         std::lock_guard<std::mutex> lock(completion->mutex);
+                         completion->done = true;
+                         completion->result = written;
+                         completion->changed.notify_all();
+                       });
+      bool done;
+      ssize_t written;
+      {
+        std::unique_lock<std::mutex> lock(completion->mutex);
+        completion->changed.wait_until(lock, deadline, [this, &completion]() {
+          return completion->done || cancelled_.load();
+        });
+        done = completion->done;
+        written = completion->result;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_write_.reset();
+      }
+      // A write that is not done stays queued; it cannot be taken back.
+      if (!done) return cancelled_ ? Cancelled() : Timeout("writing");
+      if (written < 0) {
+        return Status::Error(
+            "WRITE_ERROR",
+            std::string("Error writing to port: ") + strerror(-written));
+      }
+      result->bytes = written;
+      return Status::Ok();
+    }
+    case BatchOpKind::kWaitForBytes:
+      if (!port.io->WaitAvailable(operation.count, deadline, cancelled_)) {
+        return cancelled_ ? Cancelled() : Timeout("waiting for bytes");
+      }
+      result->bytes = port.io->Available();
+      return Status::Ok();
+    case BatchOpKind::kReadUntil:
+      while (!port.io->ReadThrough(operation.data, operation.count,
+                                   &result->data)) {
+        size_t available = port.io->Available();
+        if (available >= operation.count) {
+          return Status::Error("READ_ERROR",
+                               "Delimiter not found within " +
+                                   std::to_string(operation.count) +
+                                   " bytes");
+        }
+        if (!port.io->WaitAvailable(available + 1, deadline, cancelled_)) {
+          return cancelled_ ? Cancelled() : Timeout("reading");
+        }
+      }
+      result->bytes = result->data.size();
+      return Status::Ok();
+    case BatchOpKind::kSetLines: {
+      Status status = SetModemLines(operation.fd, operation.raise_lines, true);
+      if (status.ok()) {
+        status = SetModemLines(operation.fd, operation.drop_lines, false);
+      }
+      return status;
+    }
+    case BatchOpKind::kSleep:
+      break;
+  }
+  return Status::Ok();
+}
+
+bool BatchRunner::SleepUntil(Clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait_until(lock, deadline, [this]() { return cancelled_.load(); });
+  return !cancelled_;
+}
+
+}  // namespace serial_com
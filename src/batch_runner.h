@@ -0,0 +1,114 @@
+#ifndef SERIAL_COM_CORE_BATCH_RUNNER_H_
+#define SERIAL_COM_CORE_BATCH_RUNNER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "io_loop.h"
+#include "status.h"
+
+namespace serial_com {
+
+enum class BatchOpKind {
+  // Queues bytes and waits until they have been written.
+  kWrite,
+  // Waits until a number of bytes are buffered, without reading them.
+  kWaitForBytes,
+  // Reads through a delimiter.
+  kReadUntil,
+  kSleep,
+  // Raises and drops DTR and RTS.
+  kSetLines,
+};
+
+// Parses "write", "waitForBytes", "readUntil", "sleep" or "setLines".
+// Returns false for anything else.
+bool ParseBatchOpKind(const char* name, BatchOpKind* kind);
+
+struct BatchOperation {
+  BatchOpKind kind = BatchOpKind::kSleep;
+  // The port operated on; unused by kSleep.
+  int fd = -1;
+  // kWrite: the bytes to send. kReadUntil: the delimiter.
+  std::vector<uint8_t> data;
+  // kWaitForBytes: the bytes to wait for. kReadUntil: how far to look for
+  // the delimiter.
+  size_t count = 0;
+  // How long kWrite, kWaitForBytes and kReadUntil may take, and how long
+  // kSleep sleeps.
+  int timeout_ms = 1000;
+  // kSetLines: output lines to raise and to drop.
+  uint32_t raise_lines = 0;
+  uint32_t drop_lines = 0;
+};
+
+struct BatchResult {
+  Status status = Status::Ok();
+  // kWrite: bytes written. kWaitForBytes: bytes buffered. kReadUntil: bytes
+  // read.
+  size_t bytes = 0;
+  // kReadUntil: the bytes read, delimiter included.
+  std::vector<uint8_t> data;
+  uint64_t elapsed_us = 0;
+};
+
+// A port a batch may operate on.
+struct BatchPort {
+  std::shared_ptr<IoPort> io;
+  IoLoop* loop;
+};
+
+// Runs a list of port operations back to back on a thread of its own, so
+// that a device's whole init sequence costs one round trip from Dart
+// rather than one per step. Reads take bytes from the ports' receive
+// buffers, as readFromPort does, and writes go through their I/O loops in
+// order with everything else written to them.
+class BatchRunner {
+ public:
+  // Invoked on the runner thread with one result per operation run.
+  using DoneCallback = std::function<void(std::vector<BatchResult> results)>;
+
+  // Starts running |operations| in order, stopping after the first that
+  // fails, then calls |done|. Every fd they name must be in |ports|.
+  BatchRunner(std::vector<BatchOperation> operations,
+              std::map<int, BatchPort> ports, DoneCallback done);
+  // Fails the running operation with CANCELLED and returns once |done| has
+  // been called.
+  ~BatchRunner();
+
+  // Disallow copy and assign.
+  BatchRunner(const BatchRunner&) = delete;
+  BatchRunner& operator=(const BatchRunner&) = delete;
+
+ private:
+  struct WriteCompletion;
+
+  void Run();
+  Status Execute(const BatchOperation& operation, BatchResult* result);
+  // Sleeps until |deadline|; returns false if cancelled first.
+  bool SleepUntil(std::chrono::steady_clock::time_point deadline);
+
+  const std::vector<BatchOperation> operations_;
+  const std::map<int, BatchPort> ports_;
+  const DoneCallback done_;
+
+  std::atomic<bool> cancelled_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  // The write being waited for, so that cancelling can wake it.
+  std::shared_ptr<WriteCompletion> pending_write_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_BATCH_RUNNER_H_
@@ -0,0 +1,160 @@
+// Measures what the lz4 link codec buys on a bandwidth-bound link.
+//
+// For each write size it encodes the input write by write, as the plugin
+// does, and reports the compression ratio, encode and decode throughput,
+// and the application-level throughput a link of --baud (8N1) would carry.
+// Without --input it uses synthetic JSON telemetry; pass a capture of real
+// traffic to measure that instead.
+//
+// Example:
+//   serial_com_codec_benchmark --baud 57600 --input capture.bin
+
+#include <time.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "link_codec.h"
+
+namespace serial_com {
+namespace benchmark {
+
+namespace {
+
+struct Options {
+  int baud = 57600;
+  std::string input;
+  // Total bytes pushed through the codec per measurement.
+  size_t volume = 64 << 20;
+};
+
+double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::vector<uint8_t> SyntheticTelemetry(size_t length) {
+  std::string text;
+  unsigned seed = 1;
+  for (int i = 0; text.size() < length; i++) {
+    seed = seed * 1103515245 + 12345;
+    char line[160];
+    snprintf(line, sizeof line,
+             "{\"seq\":%d,\"ts\":%d,\"temp\":%.2f,\"volt\":%.3f,"
+             "\"rssi\":%d,\"state\":\"%s\"}\n",
+             i, 1700000000 + i / 10, 21.5 + (seed >> 28) * 0.01,
+             3.3 - (seed >> 29) * 0.001, -60 - static_cast<int>(seed >> 30),
+             i % 50 == 0 ? "alarm" : "ok");
+    text += line;
+  }
+  text.resize(length);
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+bool ReadFile(const std::string& path, std::vector<uint8_t>* out) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof buffer, file)) > 0) {
+    out->insert(out->end(), buffer, buffer + n);
+  }
+  fclose(file);
+  return !out->empty();
+}
+
+void RunWriteSize(const std::vector<uint8_t>& input, size_t write_size,
+                  const Options& options) {
+  // Encode the input once to get the wire image and the ratio.
+  std::vector<uint8_t> wire;
+  for (size_t offset = 0; offset < input.size(); offset += write_size) {
+    size_t n = std::min(write_size, input.size() - offset);
+    EncodeLz4Frames(input.data() + offset, n, &wire, nullptr);
+  }
+  const double ratio = static_cast<double>(input.size()) / wire.size();
+
+  const size_t rounds = std::max<size_t>(1, options.volume / input.size());
+  std::vector<uint8_t> scratch;
+  scratch.reserve(wire.size());
+  double start = NowSeconds();
+  for (size_t round = 0; round < rounds; round++) {
+    scratch.clear();
+    for (size_t offset = 0; offset < input.size(); offset += write_size) {
+      size_t n = std::min(write_size, input.size() - offset);
+      EncodeLz4Frames(input.data() + offset, n, &scratch, nullptr);
+    }
+  }
+  const double encode_seconds = NowSeconds() - start;
+
+  Lz4FrameDecoder decoder(std::make_shared<LinkCodecStats>());
+  size_t decoded = 0;
+  start = NowSeconds();
+  for (size_t round = 0; round < rounds; round++) {
+    // Feed the wire image in 256-byte reads, roughly what a tty delivers.
+    for (size_t offset = 0; offset < wire.size(); offset += 256) {
+      size_t n = std::min<size_t>(256, wire.size() - offset);
+      decoder.Push(wire.data() + offset, n,
+                   [&decoded](const uint8_t*, size_t length) {
+                     decoded += length;
+                   });
+    }
+  }
+  const double decode_seconds = NowSeconds() - start;
+  if (decoded != rounds * input.size()) {
+    fprintf(stderr, "Decoded %zu bytes, expected %zu\n", decoded,
+            rounds * input.size());
+    exit(1);
+  }
+
+  const double total_mb = rounds * input.size() / 1e6;
+  // 8N1 puts ten bits on the wire per byte.
+  const double link_bytes_per_second = options.baud / 10.0;
+  printf("%10zu %8.2f %12.1f %12.1f %14.0f %14.0f\n", write_size, ratio,
+         total_mb / encode_seconds, total_mb / decode_seconds,
+         link_bytes_per_second, link_bytes_per_second * ratio);
+}
+
+}  // namespace
+
+int Main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--baud" && i + 1 < argc) {
+      options.baud = atoi(argv[++i]);
+    } else if (arg == "--input" && i + 1 < argc) {
+      options.input = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--baud RATE] [--input FILE]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<uint8_t> input;
+  if (options.input.empty()) {
+    input = SyntheticTelemetry(1 << 20);
+  } else if (!ReadFile(options.input, &input)) {
+    fprintf(stderr, "Could not read %s\n", options.input.c_str());
+    return 1;
+  }
+
+  printf("%10s %8s %12s %12s %14s %14s\n", "write B", "ratio", "enc MB/s",
+         "dec MB/s", "raw link B/s", "lz4 link B/s");
+  const size_t write_sizes[] = {64, 256, 1024, kLz4FrameMaxData};
+  for (size_t write_size : write_sizes) {
+    RunWriteSize(input, write_size, options);
+  }
+  return 0;
+}
+
+}  // namespace benchmark
+}  // namespace serial_com
+
+int main(int argc, char** argv) {
+  return serial_com::benchmark::Main(argc, argv);
+}
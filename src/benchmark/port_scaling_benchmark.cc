@@ -0,0 +1,329 @@
+// Measures how the port I/O path scales with the number of open ports.
+//
+// For every step N in 1, 2, 4, ... --max-ports, the benchmark opens N PTY
+// pairs through the same path the Linux plugin uses (OpenPosixPort, then
+// IoLoop::AddPort on a shared loop) and lets a generator thread play N
+// devices that each send timestamped messages at --rate bytes per second.
+// It reports aggregate throughput, end-to-end latency from the device-side
+// write() to the I/O thread's frame callback, CPU per port (excluding the
+// generator), thread count and RSS.
+//
+// Example:
+//   serial_com_port_scaling_benchmark --max-ports 512 --rate 11520
+//       --message-size 64 --duration 5 --backend io_uring
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io_loop.h"
+#include "posix_serial_port.h"
+
+namespace serial_com {
+namespace benchmark {
+
+namespace {
+
+struct Options {
+  int max_ports = 512;
+  // Bytes per second each simulated device sends.
+  int rate = 11520;
+  int message_size = 64;
+  double duration = 5.0;
+  IoBackendKind backend = IoBackendKind::kEpoll;
+  bool csv = false;
+};
+
+// Every message starts with the device-side send time and a sequence number.
+struct MessageHeader {
+  uint64_t sent_ns;
+  uint32_t sequence;
+};
+
+uint64_t NowNs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t MonotonicNs() { return NowNs(CLOCK_MONOTONIC); }
+
+// Reads a "Key:   value kB" style field from /proc/self/status.
+long ProcStatusField(const char* key) {
+  FILE* file = fopen("/proc/self/status", "r");
+  if (file == nullptr) return -1;
+  char line[256];
+  long value = -1;
+  size_t key_length = strlen(key);
+  while (fgets(line, sizeof line, file) != nullptr) {
+    if (strncmp(line, key, key_length) == 0 && line[key_length] == ':') {
+      value = strtol(line + key_length + 1, nullptr, 10);
+      break;
+    }
+  }
+  fclose(file);
+  return value;
+}
+
+// One simulated device and what the plugin side saw from it.
+struct PortUnderTest {
+  int master = -1;
+  std::shared_ptr<IoPort> io;
+
+  // Generator side.
+  std::vector<uint8_t> message;
+  size_t message_offset = 0;
+  uint32_t next_sequence = 0;
+  double credit = 0;
+
+  // I/O thread side; only read once the port is removed from the loop.
+  std::vector<uint32_t> latencies_us;
+  uint64_t bytes_received = 0;
+  uint32_t out_of_order = 0;
+  uint32_t expected_sequence = 0;
+};
+
+bool OpenPty(PortUnderTest* port, std::string* slave_path) {
+  port->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (port->master < 0 || grantpt(port->master) != 0 ||
+      unlockpt(port->master) != 0) {
+    return false;
+  }
+  *slave_path = ptsname(port->master);
+  return true;
+}
+
+// Plays every device: each tick, every port earns rate * tick bytes of
+// credit and writes whole messages while it has credit and the pty has
+// room.
+void RunGenerator(std::vector<PortUnderTest>* ports, const Options& options,
+                  std::atomic<bool>* stop, uint64_t* cpu_ns) {
+  const uint64_t start_cpu = NowNs(CLOCK_THREAD_CPUTIME_ID);
+  const uint64_t tick_ns = 1000000;
+  uint64_t last = MonotonicNs();
+  while (!stop->load(std::memory_order_relaxed)) {
+    struct timespec sleep_time = {0, static_cast<long>(tick_ns)};
+    nanosleep(&sleep_time, nullptr);
+    uint64_t now = MonotonicNs();
+    double elapsed = (now - last) / 1e9;
+    last = now;
+    for (PortUnderTest& port : *ports) {
+      port.credit = std::min(port.credit + elapsed * options.rate,
+                             4.0 * options.message_size + options.rate * 0.1);
+      while (port.credit >= options.message_size - port.message_offset) {
+        if (port.message_offset == 0) {
+          MessageHeader header;
+          header.sent_ns = MonotonicNs();
+          header.sequence = port.next_sequence++;
+          memcpy(port.message.data(), &header, sizeof header);
+        }
+        ssize_t n = write(port.master, port.message.data() + port.message_offset,
+                          port.message.size() - port.message_offset);
+        if (n <= 0) break;  // The plugin side is not keeping up.
+        port.credit -= n;
+        port.message_offset = (port.message_offset + n) % port.message.size();
+      }
+    }
+  }
+  *cpu_ns = NowNs(CLOCK_THREAD_CPUTIME_ID) - start_cpu;
+}
+
+// Returns the |fraction| percentile of |values|, reordering them.
+uint32_t Percentile(std::vector<uint32_t>* values, double fraction) {
+  if (values->empty()) return 0;
+  size_t index = static_cast<size_t>(fraction * (values->size() - 1));
+  std::nth_element(values->begin(), values->begin() + index, values->end());
+  return (*values)[index];
+}
+
+bool RunStep(IoLoop* loop, int port_count, const Options& options) {
+  std::vector<PortUnderTest> ports(port_count);
+  for (PortUnderTest& port : ports) {
+    std::string slave_path;
+    if (!OpenPty(&port, &slave_path)) {
+      fprintf(stderr, "Could not create pty: %s\n", strerror(errno));
+      return false;
+    }
+    PortConfig config;
+    config.path = slave_path;
+    config.baud_rate = 115200;
+    int fd = -1;
+    Status status = OpenPosixPort(config, &fd);
+    if (!status.ok()) {
+      fprintf(stderr, "%s\n", status.message().c_str());
+      return false;
+    }
+    port.io = std::make_shared<IoPort>(fd);
+    port.message.assign(options.message_size, 0x55);
+    PortUnderTest* self = &port;
+    port.io->SetFrameCallback(
+        std::unique_ptr<Framer>(new FixedLengthFramer(options.message_size)),
+        [self](const uint8_t* frame, size_t length) {
+          MessageHeader header;
+          memcpy(&header, frame, sizeof header);
+          self->latencies_us.push_back(
+              static_cast<uint32_t>((MonotonicNs() - header.sent_ns) / 1000));
+          if (header.sequence != self->expected_sequence) self->out_of_order++;
+          self->expected_sequence = header.sequence + 1;
+          self->bytes_received += length;
+        });
+    if (!loop->AddPort(port.io)) {
+      fprintf(stderr, "Could not add port to the I/O loop\n");
+      return false;
+    }
+  }
+
+  std::atomic<bool> stop(false);
+  uint64_t generator_cpu_ns = 0;
+  const uint64_t start_ns = MonotonicNs();
+  const uint64_t start_cpu_ns = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+  std::thread generator(RunGenerator, &ports, std::cref(options), &stop,
+                        &generator_cpu_ns);
+
+  // Sample the footprint halfway through, while everything is running.
+  usleep(static_cast<useconds_t>(options.duration * 5e5));
+  long threads = ProcStatusField("Threads");
+  long rss_kb = ProcStatusField("VmRSS");
+  usleep(static_cast<useconds_t>(options.duration * 5e5));
+
+  stop = true;
+  generator.join();
+  const double elapsed = (MonotonicNs() - start_ns) / 1e9;
+  const uint64_t cpu_ns =
+      NowNs(CLOCK_PROCESS_CPUTIME_ID) - start_cpu_ns - generator_cpu_ns;
+
+  std::vector<uint32_t> all_latencies;
+  std::vector<uint32_t> port_p99s;
+  uint64_t bytes = 0;
+  uint64_t out_of_order = 0;
+  for (PortUnderTest& port : ports) {
+    loop->RemovePort(port.io);
+    close(port.io->fd());
+    close(port.master);
+    bytes += port.bytes_received;
+    out_of_order += port.out_of_order;
+    all_latencies.insert(all_latencies.end(), port.latencies_us.begin(),
+                         port.latencies_us.end());
+    port_p99s.push_back(Percentile(&port.latencies_us, 0.99));
+  }
+
+  const double throughput = bytes / elapsed;
+  const uint32_t p50 = Percentile(&all_latencies, 0.5);
+  const uint32_t p99 = Percentile(&all_latencies, 0.99);
+  const uint32_t p999 = Percentile(&all_latencies, 0.999);
+  const uint32_t worst_port_p99 =
+      *std::max_element(port_p99s.begin(), port_p99s.end());
+  // CPU time the plugin side spent per port, as a percentage of one core.
+  const double cpu_per_port = 100.0 * cpu_ns / 1e9 / elapsed / port_count;
+
+  if (options.csv) {
+    printf("%d,%s,%.0f,%u,%u,%u,%u,%.4f,%ld,%ld,%llu\n", port_count,
+           IoBackendKindName(loop->kind()), throughput, p50, p99, p999,
+           worst_port_p99, cpu_per_port, threads - 1, rss_kb,
+           static_cast<unsigned long long>(out_of_order));
+  } else {
+    printf("%5d %9s %12.1f %8u %8u %9u %13u %12.4f %8ld %9ld %6llu\n",
+           port_count, IoBackendKindName(loop->kind()), throughput / 1024,
+           p50, p99, p999, worst_port_p99, cpu_per_port, threads - 1,
+           rss_kb, static_cast<unsigned long long>(out_of_order));
+  }
+  fflush(stdout);
+  return true;
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--max-ports N] [--rate BYTES_PER_SEC] "
+          "[--message-size BYTES] [--duration SECONDS] "
+          "[--backend epoll|io_uring] [--csv]\n",
+          program);
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--csv") {
+      options->csv = true;
+    } else if (arg == "--max-ports" && has_value) {
+      options->max_ports = atoi(argv[++i]);
+    } else if (arg == "--rate" && has_value) {
+      options->rate = atoi(argv[++i]);
+    } else if (arg == "--message-size" && has_value) {
+      options->message_size = atoi(argv[++i]);
+    } else if (arg == "--duration" && has_value) {
+      options->duration = atof(argv[++i]);
+    } else if (arg == "--backend" && has_value) {
+      if (!ParseIoBackendKind(argv[++i], &options->backend)) return false;
+    } else {
+      return false;
+    }
+  }
+  return options->max_ports > 0 && options->rate > 0 &&
+         options->message_size >= static_cast<int>(sizeof(MessageHeader)) &&
+         options->duration > 0;
+}
+
+// Each port needs two descriptors, which quickly exceeds the usual soft
+// limit of 1024.
+void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+}  // namespace
+
+int Main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 2;
+  }
+  RaiseFileLimit();
+
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(options.backend);
+  if (!loop) {
+    fprintf(stderr, "Could not start the I/O loop\n");
+    return 1;
+  }
+
+  if (options.csv) {
+    printf("ports,backend,bytes_per_sec,p50_us,p99_us,p999_us,"
+           "worst_port_p99_us,cpu_pct_per_port,threads,rss_kb,"
+           "out_of_order\n");
+  } else {
+    printf("%5s %9s %12s %8s %8s %9s %13s %12s %8s %9s %6s\n", "ports",
+           "backend", "KiB/s", "p50 us", "p99 us", "p99.9 us",
+           "worst p99 us", "cpu%/port", "threads", "rss kB", "ooo");
+  }
+  for (int ports = 1; ports <= options.max_ports; ports *= 2) {
+    if (!RunStep(loop.get(), ports, options)) return 1;
+    if (ports < options.max_ports && ports * 2 > options.max_ports) {
+      ports = options.max_ports / 2;
+    }
+  }
+  return 0;
+}
+
+}  // namespace benchmark
+}  // namespace serial_com
+
+int main(int argc, char** argv) {
+  return serial_com::benchmark::Main(argc, argv);
+}
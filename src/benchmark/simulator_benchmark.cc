@@ -0,0 +1,172 @@
+// Measures request/response round trips against a simulated device.
+//
+// A DeviceSimulator answers "READ <n>\r" with a --reply-size byte reply,
+// optionally after --delay-us and at --baud (0 for unthrottled). The
+// benchmark opens the simulated tty with OpenPosixPort, as the plugin does,
+// sends --requests requests one at a time and reports the round-trip
+// percentiles, the request rate and the reply throughput. Use it to see
+// what a polling protocol costs at a given line rate before hardware is
+// available.
+//
+// Example:
+//   serial_com_simulator_benchmark --baud 115200 --reply-size 64
+//       --requests 2000
+
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "device_simulator.h"
+#include "posix_serial_port.h"
+
+namespace serial_com {
+namespace benchmark {
+
+namespace {
+
+struct Options {
+  int baud = 0;
+  int reply_size = 64;
+  int requests = 2000;
+  int delay_us = 0;
+};
+
+uint64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// Returns the |fraction| percentile of |values|, reordering them.
+uint32_t Percentile(std::vector<uint32_t>* values, double fraction) {
+  if (values->empty()) return 0;
+  size_t index = static_cast<size_t>(fraction * (values->size() - 1));
+  std::nth_element(values->begin(), values->begin() + index, values->end());
+  return (*values)[index];
+}
+
+// Reads exactly |length| bytes, giving up after a second without data.
+bool ReadReply(int fd, uint8_t* buffer, size_t length) {
+  size_t received = 0;
+  while (received < length) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0) return false;
+    ssize_t n = read(fd, buffer + received, length - received);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    received += n;
+  }
+  return true;
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--baud BITS_PER_SEC] [--reply-size BYTES] "
+          "[--requests N] [--delay-us MICROSECONDS]\n",
+          program);
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--baud" && has_value) {
+      options->baud = atoi(argv[++i]);
+    } else if (arg == "--reply-size" && has_value) {
+      options->reply_size = atoi(argv[++i]);
+    } else if (arg == "--requests" && has_value) {
+      options->requests = atoi(argv[++i]);
+    } else if (arg == "--delay-us" && has_value) {
+      options->delay_us = atoi(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+  return options->baud >= 0 && options->reply_size > 0 &&
+         options->requests > 0 && options->delay_us >= 0;
+}
+
+}  // namespace
+
+int Main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 2;
+  }
+
+  SimulatorScript script;
+  std::string error;
+  std::string text = "baud " + std::to_string(options.baud) +
+                     "\non /READ [0-9]+\\r/ reply \"" +
+                     std::string(options.reply_size - 1, 'v') + "\\r\"" +
+                     " delay " + std::to_string(options.delay_us) + "us\n";
+  if (!ParseSimulatorScript(text, &script, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  std::unique_ptr<DeviceSimulator> simulator =
+      DeviceSimulator::Create(script);
+  if (!simulator) {
+    fprintf(stderr, "Could not create pty: %s\n", strerror(errno));
+    return 1;
+  }
+
+  PortConfig config;
+  config.path = simulator->device_path();
+  config.baud_rate = 115200;
+  int fd = -1;
+  Status status = OpenPosixPort(config, &fd);
+  if (!status.ok()) {
+    fprintf(stderr, "%s\n", status.message().c_str());
+    return 1;
+  }
+
+  std::vector<uint8_t> reply(options.reply_size);
+  std::vector<uint32_t> round_trips_us;
+  round_trips_us.reserve(options.requests);
+  const uint64_t start_ns = MonotonicNs();
+  for (int i = 0; i < options.requests; i++) {
+    std::string request = "READ " + std::to_string(i) + "\r";
+    uint64_t sent_ns = MonotonicNs();
+    if (write(fd, request.data(), request.size()) !=
+            static_cast<ssize_t>(request.size()) ||
+        !ReadReply(fd, reply.data(), reply.size())) {
+      fprintf(stderr, "Request %d failed\n", i);
+      close(fd);
+      return 1;
+    }
+    round_trips_us.push_back(
+        static_cast<uint32_t>((MonotonicNs() - sent_ns) / 1000));
+  }
+  const double elapsed = (MonotonicNs() - start_ns) / 1e9;
+  close(fd);
+
+  printf("%8s %8s %10s %8s %8s %9s %12s\n", "baud", "reply", "requests/s",
+         "p50 us", "p99 us", "p99.9 us", "reply KiB/s");
+  const double rate = options.requests / elapsed;
+  const uint32_t p50 = Percentile(&round_trips_us, 0.5);
+  const uint32_t p99 = Percentile(&round_trips_us, 0.99);
+  const uint32_t p999 = Percentile(&round_trips_us, 0.999);
+  printf("%8d %8d %10.1f %8u %8u %9u %12.1f\n", options.baud,
+         options.reply_size, rate, p50, p99, p999,
+         rate * options.reply_size / 1024);
+  return 0;
+}
+
+}  // namespace benchmark
+}  // namespace serial_com
+
+int main(int argc, char** argv) {
+  return serial_com::benchmark::Main(argc, argv);
+}
@@ -0,0 +1,35 @@
+#include "capture_file.h"
+
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+constexpr size_t kCaptureBufferSize = 64 * 1024;
+
+}  // namespace
+
+std::unique_ptr<CaptureFile> CaptureFile::Open(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "ab");
+  if (file == nullptr) return nullptr;
+  setvbuf(file, nullptr, _IOFBF, kCaptureBufferSize);
+  return std::unique_ptr<CaptureFile>(new CaptureFile(path, file));
+}
+
+CaptureFile::CaptureFile(std::string path, FILE* file)
+    : path_(std::move(path)), file_(file) {}
+
+CaptureFile::~CaptureFile() { fclose(file_); }
+
+bool CaptureFile::Write(const uint8_t* data, size_t length) {
+  if (failed_) return false;
+  if (fwrite(data, 1, length, file_) != length) {
+    failed_ = true;
+    return false;
+  }
+  bytes_written_ += length;
+  return true;
+}
+
+}  // namespace serial_com
@@ -0,0 +1,46 @@
+#ifndef SERIAL_COM_CORE_CAPTURE_FILE_H_
+#define SERIAL_COM_CORE_CAPTURE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace serial_com {
+
+// An append-only file that receives a full-rate copy of a stream while the
+// app is only shown a reduced one. Writes are buffered so that the I/O
+// thread does not make a syscall per record. Not thread-safe.
+class CaptureFile {
+ public:
+  // Opens |path| for appending, creating it if needed. Returns nullptr if
+  // it cannot be opened.
+  static std::unique_ptr<CaptureFile> Open(const std::string& path);
+
+  ~CaptureFile();
+
+  // Disallow copy and assign.
+  CaptureFile(const CaptureFile&) = delete;
+  CaptureFile& operator=(const CaptureFile&) = delete;
+
+  const std::string& path() const { return path_; }
+
+  // Returns false once a write has failed; later writes are discarded.
+  bool Write(const uint8_t* data, size_t length);
+
+  uint64_t bytes_written() const { return bytes_written_; }
+  bool failed() const { return failed_; }
+
+ private:
+  CaptureFile(std::string path, FILE* file);
+
+  const std::string path_;
+  FILE* file_;
+  uint64_t bytes_written_ = 0;
+  bool failed_ = false;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_CAPTURE_FILE_H_
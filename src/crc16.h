@@ -0,0 +1,14 @@
+#ifndef SERIAL_COM_CORE_CRC16_H_
+#define SERIAL_COM_CORE_CRC16_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace serial_com {
+
+// CRC-16/XMODEM (polynomial 0x1021, initial value 0).
+uint16_t Crc16Xmodem(const uint8_t* data, size_t length);
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_CRC16_H_
@@ -0,0 +1,224 @@
+#include "decimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+double ValueAt(const Column& column, size_t row) {
+  switch (column.type) {
+    case ColumnType::kInt32:
+      return column.values<int32_t>()[row];
+    case ColumnType::kInt64:
+      return static_cast<double>(column.values<int64_t>()[row]);
+    case ColumnType::kFloat32:
+      return column.values<float>()[row];
+    case ColumnType::kFloat64:
+      return column.values<double>()[row];
+  }
+  return 0;
+}
+
+// Callers reserve |batch->columns| so that earlier results stay valid.
+Column* AddColumn(RecordBatch* batch, std::string name) {
+  Column column;
+  column.name = std::move(name);
+  column.type = ColumnType::kFloat64;
+  batch->columns.push_back(std::move(column));
+  return &batch->columns.back();
+}
+
+void AppendValue(Column* column, double value) {
+  size_t end = column->data.size();
+  column->data.resize(end + sizeof value);
+  memcpy(column->data.data() + end, &value, sizeof value);
+}
+
+}  // namespace
+
+bool ParseDecimationMode(const char* name, DecimationMode* mode) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "minmaxmean") == 0) {
+    *mode = DecimationMode::kMinMaxMean;
+  } else if (strcmp(name, "last") == 0) {
+    *mode = DecimationMode::kLast;
+  } else if (strcmp(name, "lttb") == 0) {
+    *mode = DecimationMode::kLttb;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool IsValidDecimationConfig(const DecimationConfig& config,
+                             const RecordSchema& schema) {
+  if (config.window == 0) return false;
+  if (config.x_field.empty()) return true;
+  for (const RecordField& field : schema.fields) {
+    if (field.name == config.x_field) return true;
+  }
+  return false;
+}
+
+Decimator::Decimator(const RecordSchema& schema, DecimationConfig config)
+    : config_(std::move(config)),
+      x_column_(-1),
+      sequence_(0),
+      window_fill_(0),
+      started_(false) {
+  for (size_t i = 0; i < schema.fields.size(); i++) {
+    if (config_.mode == DecimationMode::kLttb &&
+        schema.fields[i].name == config_.x_field) {
+      x_column_ = static_cast<int>(i);
+      continue;
+    }
+    Channel channel;
+    channel.column = i;
+    channel.name = schema.fields[i].name;
+    channel.min = std::numeric_limits<double>::infinity();
+    channel.max = -std::numeric_limits<double>::infinity();
+    channel.sum = 0;
+    channel.last = 0;
+    channel.selected = Point{0, 0};
+    channels_.push_back(std::move(channel));
+  }
+}
+
+RecordBatch Decimator::Process(const RecordBatch& batch) {
+  RecordBatch out;
+  out.dropped = batch.dropped;
+  if (config_.mode == DecimationMode::kLttb) {
+    ProcessLttb(batch, &out);
+  } else {
+    ProcessWindowed(batch, &out);
+  }
+  sequence_ += batch.rows;
+  return out;
+}
+
+void Decimator::ProcessWindowed(const RecordBatch& batch, RecordBatch* out) {
+  const bool min_max_mean = config_.mode == DecimationMode::kMinMaxMean;
+  out->columns.reserve(channels_.size() * (min_max_mean ? 3 : 1));
+  std::vector<Column*> outputs;
+  for (const Channel& channel : channels_) {
+    if (min_max_mean) {
+      outputs.push_back(AddColumn(out, channel.name + ".min"));
+      outputs.push_back(AddColumn(out, channel.name + ".max"));
+      outputs.push_back(AddColumn(out, channel.name + ".mean"));
+    } else {
+      outputs.push_back(AddColumn(out, channel.name));
+    }
+  }
+
+  for (size_t row = 0; row < batch.rows; row++) {
+    for (Channel& channel : channels_) {
+      double value = ValueAt(batch.columns[channel.column], row);
+      channel.min = std::min(channel.min, value);
+      channel.max = std::max(channel.max, value);
+      channel.sum += value;
+      channel.last = value;
+    }
+    if (++window_fill_ < config_.window) continue;
+
+    // The window is complete: emit one point per output column.
+    size_t output = 0;
+    for (Channel& channel : channels_) {
+      if (min_max_mean) {
+        AppendValue(outputs[output++], channel.min);
+        AppendValue(outputs[output++], channel.max);
+        AppendValue(outputs[output++], channel.sum / window_fill_);
+      } else {
+        AppendValue(outputs[output++], channel.last);
+      }
+      channel.min = std::numeric_limits<double>::infinity();
+      channel.max = -std::numeric_limits<double>::infinity();
+      channel.sum = 0;
+    }
+    window_fill_ = 0;
+    out->rows++;
+  }
+}
+
+void Decimator::ProcessLttb(const RecordBatch& batch, RecordBatch* out) {
+  const size_t bucket = config_.window;
+  out->columns.reserve(channels_.size() * 2);
+  std::vector<std::pair<Column*, Column*>> outputs;
+  for (const Channel& channel : channels_) {
+    Column* y = AddColumn(out, channel.name);
+    Column* x = AddColumn(out, channel.name + ".x");
+    outputs.emplace_back(y, x);
+  }
+
+  for (size_t row = 0; row < batch.rows; row++) {
+    double x = x_column_ >= 0 ? ValueAt(batch.columns[x_column_], row)
+                              : static_cast<double>(sequence_ + row);
+    for (Channel& channel : channels_) {
+      channel.pending.push_back(
+          Point{x, ValueAt(batch.columns[channel.column], row)});
+    }
+  }
+  if (channels_.empty()) return;
+
+  // The very first sample is always kept, as in batch LTTB.
+  if (!started_ && !channels_[0].pending.empty()) {
+    for (size_t i = 0; i < channels_.size(); i++) {
+      Channel& channel = channels_[i];
+      channel.selected = channel.pending.front();
+      channel.pending.erase(channel.pending.begin());
+      AppendValue(outputs[i].first, channel.selected.y);
+      AppendValue(outputs[i].second, channel.selected.x);
+    }
+    started_ = true;
+    out->rows++;
+  }
+
+  // A bucket is decided once the following bucket is complete, since the
+  // choice depends on that bucket's average.
+  size_t consumed = 0;
+  const size_t available = channels_[0].pending.size();
+  while (available - consumed >= 2 * bucket) {
+    for (size_t i = 0; i < channels_.size(); i++) {
+      Channel& channel = channels_[i];
+      const Point* current = channel.pending.data() + consumed;
+      const Point* next = current + bucket;
+      double next_x = 0;
+      double next_y = 0;
+      for (size_t j = 0; j < bucket; j++) {
+        next_x += next[j].x;
+        next_y += next[j].y;
+      }
+      next_x /= bucket;
+      next_y /= bucket;
+
+      const Point& a = channel.selected;
+      size_t best = 0;
+      double best_area = -1;
+      for (size_t j = 0; j < bucket; j++) {
+        double area = std::fabs((a.x - next_x) * (current[j].y - a.y) -
+                                (a.x - current[j].x) * (next_y - a.y));
+        if (area > best_area) {
+          best_area = area;
+          best = j;
+        }
+      }
+      channel.selected = current[best];
+      AppendValue(outputs[i].first, channel.selected.y);
+      AppendValue(outputs[i].second, channel.selected.x);
+    }
+    consumed += bucket;
+    out->rows++;
+  }
+  if (consumed > 0) {
+    for (Channel& channel : channels_) {
+      channel.pending.erase(channel.pending.begin(),
+                            channel.pending.begin() + consumed);
+    }
+  }
+}
+
+}  // namespace serial_com
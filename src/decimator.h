@@ -0,0 +1,93 @@
+#ifndef SERIAL_COM_CORE_DECIMATOR_H_
+#define SERIAL_COM_CORE_DECIMATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "record_decoder.h"
+
+namespace serial_com {
+
+enum class DecimationMode {
+  // Per window of |window| records: "<field>.min", "<field>.max" and
+  // "<field>.mean". Peaks survive however far the series is reduced.
+  kMinMaxMean,
+  // Per window: the window's last value, as "<field>".
+  kLast,
+  // Largest-Triangle-Three-Buckets: one representative sample per bucket
+  // of |window| records, chosen to preserve the shape of the curve, as
+  // "<field>" with its x position in "<field>.x".
+  kLttb,
+};
+
+// Parses "minmaxmean", "last" or "lttb". Returns false for anything else.
+bool ParseDecimationMode(const char* name, DecimationMode* mode);
+
+struct DecimationConfig {
+  DecimationMode mode = DecimationMode::kMinMaxMean;
+  // Records per output point.
+  size_t window = 1;
+  // For kLttb, the field that supplies x (typically a timestamp). It is
+  // not decimated itself. Empty means x is the record's sequence number.
+  std::string x_field;
+};
+
+// Returns false for a zero window or an x field that is not in |schema|.
+bool IsValidDecimationConfig(const DecimationConfig& config,
+                             const RecordSchema& schema);
+
+// Reduces decoded record batches channel by channel. Windows and buckets
+// carry over between batches, so results do not depend on how the stream
+// was split. All output columns are float64 and have the same length.
+class Decimator {
+ public:
+  Decimator(const RecordSchema& schema, DecimationConfig config);
+
+  // Disallow copy and assign.
+  Decimator(const Decimator&) = delete;
+  Decimator& operator=(const Decimator&) = delete;
+
+  // Consumes |batch| and returns the points completed by it.
+  RecordBatch Process(const RecordBatch& batch);
+
+ private:
+  struct Point {
+    double x;
+    double y;
+  };
+
+  // State for one decimated field.
+  struct Channel {
+    size_t column;
+    std::string name;
+    // Windowed modes: the window in progress.
+    double min;
+    double max;
+    double sum;
+    double last;
+    // kLttb: samples not yet assigned to an emitted bucket, and the last
+    // emitted point.
+    std::vector<Point> pending;
+    Point selected;
+  };
+
+  void ProcessWindowed(const RecordBatch& batch, RecordBatch* out);
+  void ProcessLttb(const RecordBatch& batch, RecordBatch* out);
+
+  const DecimationConfig config_;
+  std::vector<Channel> channels_;
+  // Column of the x field, or -1.
+  int x_column_;
+  // Records seen so far; the default x for kLttb.
+  uint64_t sequence_;
+  // Records in the current window (windowed modes).
+  size_t window_fill_;
+  // kLttb: whether the first sample has been emitted.
+  bool started_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_DECIMATOR_H_
@@ -0,0 +1,561 @@
+#include "device_simulator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+// Bytes handled per read or write on the master side.
+constexpr size_t kChunkSize = 4096;
+// Unmatched request bytes kept for rules to match against; older ones are
+// discarded.
+constexpr size_t kMaxRequestBuffer = 4096;
+
+struct Token {
+  enum Kind { kWord, kString, kRegex } kind;
+  std::string text;
+};
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Splits |line| into words, "strings" (unescaped) and /regexes/ (passed to
+// std::regex as written, except for \/).
+bool Tokenize(const std::string& line, std::vector<Token>* tokens,
+              std::string* error) {
+  size_t i = 0;
+  while (i < line.size()) {
+    char c = line[i];
+    if (c == ' ' || c == '\t' || c == '\r') {
+      i++;
+    } else if (c == '#') {
+      break;
+    } else if (c == '"') {
+      std::string text;
+      i++;
+      while (i < line.size() && line[i] != '"') {
+        if (line[i] != '\\') {
+          text.push_back(line[i++]);
+          continue;
+        }
+        if (++i >= line.size()) break;
+        char escape = line[i++];
+        switch (escape) {
+          case 'r':
+            text.push_back('\r');
+            break;
+          case 'n':
+            text.push_back('\n');
+            break;
+          case 't':
+            text.push_back('\t');
+            break;
+          case '0':
+            text.push_back('\0');
+            break;
+          case '\\':
+          case '"':
+          case '/':
+            text.push_back(escape);
+            break;
+          case 'x': {
+            int high = i < line.size() ? HexDigit(line[i]) : -1;
+            int low = i + 1 < line.size() ? HexDigit(line[i + 1]) : -1;
+            if (high < 0 || low < 0) {
+              *error = "bad \\x escape";
+              return false;
+            }
+            text.push_back(static_cast<char>(high * 16 + low));
+            i += 2;
+            break;
+          }
+          default:
+            *error = std::string("unknown escape \\") + escape;
+            return false;
+        }
+      }
+      if (i >= line.size()) {
+        *error = "unterminated string";
+        return false;
+      }
+      i++;
+      tokens->push_back(Token{Token::kString, text});
+    } else if (c == '/') {
+      std::string text;
+      i++;
+      while (i < line.size() && line[i] != '/') {
+        if (line[i] == '\\' && i + 1 < line.size() && line[i + 1] == '/') {
+          i++;
+        } else if (line[i] == '\\' && i + 1 < line.size()) {
+          text.push_back(line[i++]);
+        }
+        text.push_back(line[i++]);
+      }
+      if (i >= line.size()) {
+        *error = "unterminated regular expression";
+        return false;
+      }
+      i++;
+      tokens->push_back(Token{Token::kRegex, text});
+    } else {
+      size_t end = line.find_first_of(" \t\r#", i);
+      if (end == std::string::npos) end = line.size();
+      tokens->push_back(Token{Token::kWord, line.substr(i, end - i)});
+      i = end;
+    }
+  }
+  return true;
+}
+
+// Parses "250us", "5ms" or "1s".
+bool ParseDuration(const Token& token, int64_t* us) {
+  if (token.kind != Token::kWord) return false;
+  char* end = nullptr;
+  double value = strtod(token.text.c_str(), &end);
+  if (end == token.text.c_str() || value < 0) return false;
+  std::string unit(end);
+  double scale;
+  if (unit == "us") {
+    scale = 1;
+  } else if (unit == "ms") {
+    scale = 1e3;
+  } else if (unit == "s") {
+    scale = 1e6;
+  } else {
+    return false;
+  }
+  *us = static_cast<int64_t>(value * scale);
+  return true;
+}
+
+bool ParseNumber(const Token& token, double* value) {
+  if (token.kind != Token::kWord) return false;
+  char* end = nullptr;
+  *value = strtod(token.text.c_str(), &end);
+  return end != token.text.c_str() && *end == '\0';
+}
+
+bool ParseLine(const std::vector<Token>& tokens, SimulatorScript* script,
+               std::string* error) {
+  const std::string& command = tokens[0].text;
+  size_t i = 1;
+  auto next = [&tokens, &i]() -> const Token* {
+    return i < tokens.size() ? &tokens[i++] : nullptr;
+  };
+
+  if (tokens[0].kind != Token::kWord) {
+    *error = "expected a command";
+    return false;
+  }
+  if (command == "baud") {
+    const Token* rate = next();
+    double value;
+    if (rate == nullptr || !ParseNumber(*rate, &value) || value < 0) {
+      *error = "baud needs a rate";
+      return false;
+    }
+    script->baud_rate = static_cast<int>(value);
+  } else if (command == "noise") {
+    while (const Token* key = next()) {
+      const Token* value_token = next();
+      double value;
+      if (value_token == nullptr || !ParseNumber(*value_token, &value) ||
+          value < 0) {
+        *error = "noise needs numeric values";
+        return false;
+      }
+      if (key->text == "corrupt" && value <= 1) {
+        script->corrupt_probability = value;
+      } else if (key->text == "drop" && value <= 1) {
+        script->drop_probability = value;
+      } else if (key->text == "seed") {
+        script->seed = static_cast<uint32_t>(value);
+      } else {
+        *error = "noise takes corrupt, drop (0-1) and seed";
+        return false;
+      }
+    }
+  } else if (command == "on") {
+    SimulatorRule rule;
+    const Token* match = next();
+    const Token* reply_keyword = next();
+    const Token* reply = next();
+    if (match == nullptr || match->kind == Token::kWord ||
+        reply_keyword == nullptr || reply_keyword->text != "reply" ||
+        reply == nullptr || reply->kind != Token::kString) {
+      *error = "expected: on \"request\"|/regex/ reply \"reply\"";
+      return false;
+    }
+    rule.match = match->text;
+    rule.regex = match->kind == Token::kRegex;
+    rule.reply = reply->text;
+    if (const Token* delay_keyword = next()) {
+      const Token* delay = next();
+      if (delay_keyword->text != "delay" || delay == nullptr ||
+          !ParseDuration(*delay, &rule.delay_us)) {
+        *error = "expected: delay <duration>";
+        return false;
+      }
+    }
+    if (rule.match.empty()) {
+      *error = "empty request";
+      return false;
+    }
+    if (rule.regex) {
+      try {
+        std::regex check(rule.match);
+      } catch (const std::regex_error& e) {
+        *error = std::string("bad regular expression: ") + e.what();
+        return false;
+      }
+    }
+    script->rules.push_back(rule);
+  } else if (command == "every") {
+    SimulatorPeriodicFrame frame;
+    const Token* interval = next();
+    const Token* send_keyword = next();
+    const Token* data = next();
+    if (interval == nullptr || !ParseDuration(*interval, &frame.interval_us) ||
+        frame.interval_us <= 0 || send_keyword == nullptr ||
+        send_keyword->text != "send" || data == nullptr ||
+        data->kind != Token::kString) {
+      *error = "expected: every <duration> send \"data\"";
+      return false;
+    }
+    frame.data = data->text;
+    script->periodic.push_back(frame);
+  } else {
+    *error = "unknown command " + command;
+    return false;
+  }
+  if (i != tokens.size()) {
+    *error = "unexpected " + tokens[i].text;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ParseSimulatorScript(const std::string& text, SimulatorScript* script,
+                          std::string* error) {
+  SimulatorScript parsed;
+  size_t start = 0;
+  int line_number = 0;
+  while (start <= text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    line_number++;
+
+    std::vector<Token> tokens;
+    std::string line_error;
+    if (!Tokenize(line, &tokens, &line_error) ||
+        (!tokens.empty() && !ParseLine(tokens, &parsed, &line_error))) {
+      *error = "line " + std::to_string(line_number) + ": " + line_error;
+      return false;
+    }
+  }
+  *script = std::move(parsed);
+  return true;
+}
+
+DeviceSimulator::LineRate::LineRate(int baud_rate)
+    // 8N1: ten bit times per byte.
+    : bytes_per_second_(baud_rate / 10.0),
+      tokens_(0),
+      refilled_(Clock::now()) {}
+
+size_t DeviceSimulator::LineRate::Available(Clock::time_point now,
+                                            size_t wanted) {
+  if (bytes_per_second_ <= 0) return wanted;
+  double elapsed = std::chrono::duration<double>(now - refilled_).count();
+  refilled_ = now;
+  // Allow bursts of about a millisecond, like a UART FIFO being refilled,
+  // but never less than one byte.
+  double burst = std::max(1.0, bytes_per_second_ / 1000);
+  tokens_ = std::min(burst, tokens_ + elapsed * bytes_per_second_);
+  return std::min(wanted, static_cast<size_t>(tokens_));
+}
+
+DeviceSimulator::Clock::time_point DeviceSimulator::LineRate::NextByte(
+    Clock::time_point now) const {
+  if (bytes_per_second_ <= 0 || tokens_ >= 1) return now;
+  return now + std::chrono::duration_cast<Clock::duration>(
+                   std::chrono::duration<double>((1 - tokens_) /
+                                                 bytes_per_second_));
+}
+
+std::unique_ptr<DeviceSimulator> DeviceSimulator::Create(
+    SimulatorScript script) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (master < 0) return nullptr;
+  if (grantpt(master) != 0 || unlockpt(master) != 0) {
+    int error = errno;
+    close(master);
+    errno = error;
+    return nullptr;
+  }
+  std::string path = ptsname(master);
+  int slave = open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+  int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (slave < 0 || wake_fd < 0) {
+    int error = errno;
+    if (slave >= 0) close(slave);
+    close(master);
+    errno = error;
+    return nullptr;
+  }
+  // Raw until the code under test configures the port itself.
+  struct termios tty;
+  if (tcgetattr(slave, &tty) == 0) {
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+  }
+  return std::unique_ptr<DeviceSimulator>(new DeviceSimulator(
+      std::move(script), master, slave, wake_fd, std::move(path)));
+}
+
+DeviceSimulator::DeviceSimulator(SimulatorScript script, int master, int slave,
+                                 int wake_fd, std::string device_path)
+    : script_(std::move(script)),
+      master_(master),
+      slave_(slave),
+      wake_fd_(wake_fd),
+      device_path_(std::move(device_path)),
+      rx_rate_(script_.baud_rate),
+      tx_rate_(script_.baud_rate),
+      random_(script_.seed),
+      stats_(),
+      stopping_(false) {
+  for (const SimulatorRule& rule : script_.rules) {
+    // Literal rules are matched with std::string::find.
+    rules_.push_back(CompiledRule{
+        rule, rule.regex ? std::regex(rule.match) : std::regex()});
+  }
+  Clock::time_point now = Clock::now();
+  for (const SimulatorPeriodicFrame& frame : script_.periodic) {
+    periodic_due_.push_back(now + std::chrono::microseconds(frame.interval_us));
+  }
+  thread_ = std::thread(&DeviceSimulator::Run, this);
+}
+
+DeviceSimulator::~DeviceSimulator() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  Wake();
+  thread_.join();
+  close(wake_fd_);
+  close(slave_);
+  close(master_);
+}
+
+void DeviceSimulator::Send(const std::string& data) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    scheduled_.emplace(Clock::now(), data);
+  }
+  Wake();
+}
+
+SimulatorStats DeviceSimulator::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void DeviceSimulator::Wake() {
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof one);
+  (void)ignored;
+}
+
+void DeviceSimulator::Run() {
+  uint8_t buffer[kChunkSize];
+  while (true) {
+    Clock::time_point now = Clock::now();
+    Clock::time_point deadline = Clock::time_point::max();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) return;
+    }
+    CollectDue(now);
+    Transmit(now);
+
+    size_t readable = rx_rate_.Available(now, sizeof buffer);
+    if (readable > 0) {
+      ssize_t n = read(master_, buffer, readable);
+      if (n > 0) {
+        rx_rate_.Consume(n);
+        HandleReceived(buffer, n, now);
+        // There may be more; check again straight away.
+        continue;
+      }
+    } else {
+      deadline = std::min(deadline, rx_rate_.NextByte(now));
+    }
+
+    // Sleep until the next thing is due or the pty has something for us.
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!scheduled_.empty()) {
+        deadline = std::min(deadline, scheduled_.begin()->first);
+      }
+    }
+    for (Clock::time_point due : periodic_due_) {
+      deadline = std::min(deadline, due);
+    }
+    bool blocked = false;
+    if (!tx_.empty()) {
+      Clock::time_point next = tx_rate_.NextByte(now);
+      if (next <= now) {
+        // Waiting for the code under test to make room.
+        blocked = true;
+      } else {
+        deadline = std::min(deadline, next);
+      }
+    }
+    int timeout_ms = -1;
+    if (deadline != Clock::time_point::max()) {
+      auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+          deadline - Clock::now());
+      // Round up so that the deadline has passed on wakeup.
+      timeout_ms = std::max<int64_t>(0, (wait.count() + 999) / 1000);
+    }
+    struct pollfd fds[2] = {
+        {master_,
+         static_cast<short>((readable > 0 ? POLLIN : 0) |
+                            (blocked ? POLLOUT : 0)),
+         0},
+        {wake_fd_, POLLIN, 0},
+    };
+    if (poll(fds, 2, timeout_ms) > 0 && (fds[1].revents & POLLIN)) {
+      uint64_t value;
+      ssize_t ignored = read(wake_fd_, &value, sizeof value);
+      (void)ignored;
+    }
+  }
+}
+
+void DeviceSimulator::HandleReceived(const uint8_t* data, size_t length,
+                                     Clock::time_point now) {
+  request_.append(reinterpret_cast<const char*>(data), length);
+  uint64_t matched = 0;
+  while (true) {
+    // The earliest match wins; earlier rules win ties.
+    const CompiledRule* best = nullptr;
+    size_t best_start = std::string::npos;
+    size_t best_end = 0;
+    std::smatch best_match;
+    for (const CompiledRule& compiled : rules_) {
+      size_t start;
+      size_t end;
+      std::smatch match;
+      if (compiled.rule.regex) {
+        if (!std::regex_search(request_, match, compiled.pattern)) continue;
+        start = match.position(0);
+        end = start + match.length(0);
+      } else {
+        start = request_.find(compiled.rule.match);
+        if (start == std::string::npos) continue;
+        end = start + compiled.rule.match.size();
+      }
+      if (start < best_start) {
+        best = &compiled;
+        best_start = start;
+        best_end = end;
+        best_match = std::move(match);
+      }
+    }
+    if (best == nullptr) break;
+
+    std::string reply = best->rule.regex ? best_match.format(best->rule.reply)
+                                         : best->rule.reply;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      scheduled_.emplace(now + std::chrono::microseconds(best->rule.delay_us),
+                         std::move(reply));
+    }
+    // |best_match| refers into |request_|, so erase only after formatting.
+    request_.erase(0, best_end);
+    matched++;
+  }
+  if (request_.size() > kMaxRequestBuffer) {
+    request_.erase(0, request_.size() - kMaxRequestBuffer);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.bytes_received += length;
+  stats_.requests_matched += matched;
+}
+
+void DeviceSimulator::CollectDue(Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto end = scheduled_.upper_bound(now);
+  for (auto it = scheduled_.begin(); it != end; ++it) {
+    QueueLocked(it->second);
+  }
+  scheduled_.erase(scheduled_.begin(), end);
+  for (size_t i = 0; i < periodic_due_.size(); i++) {
+    const SimulatorPeriodicFrame& frame = script_.periodic[i];
+    std::chrono::microseconds interval(frame.interval_us);
+    while (periodic_due_[i] <= now) {
+      QueueLocked(frame.data);
+      periodic_due_[i] += interval;
+    }
+  }
+}
+
+void DeviceSimulator::QueueLocked(const std::string& data) {
+  std::uniform_real_distribution<double> chance(0, 1);
+  std::uniform_int_distribution<int> bit(0, 7);
+  for (char c : data) {
+    uint8_t byte = static_cast<uint8_t>(c);
+    if (script_.drop_probability > 0 &&
+        chance(random_) < script_.drop_probability) {
+      stats_.bytes_dropped++;
+      continue;
+    }
+    if (script_.corrupt_probability > 0 &&
+        chance(random_) < script_.corrupt_probability) {
+      byte ^= static_cast<uint8_t>(1 << bit(random_));
+      stats_.bytes_corrupted++;
+    }
+    tx_.push_back(byte);
+  }
+}
+
+void DeviceSimulator::Transmit(Clock::time_point now) {
+  while (!tx_.empty()) {
+    size_t allowed = tx_rate_.Available(now, std::min(tx_.size(), kChunkSize));
+    if (allowed == 0) break;
+    // Counted under the lock so that stats() never lags what the code under
+    // test has already read.
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Full (EAGAIN) or no reader yet (EIO): try again later.
+    ssize_t n = write(master_, tx_.data(), allowed);
+    if (n <= 0) break;
+    stats_.bytes_sent += n;
+    tx_rate_.Consume(n);
+    tx_.erase(tx_.begin(), tx_.begin() + n);
+    if (static_cast<size_t>(n) < allowed) break;
+  }
+}
+
+}  // namespace serial_com
@@ -0,0 +1,168 @@
+#ifndef SERIAL_COM_CORE_DEVICE_SIMULATOR_H_
+#define SERIAL_COM_CORE_DEVICE_SIMULATOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace serial_com {
+
+// Answers requests that match |match| with |reply| after |delay_us|.
+struct SimulatorRule {
+  // Literal request bytes, or an ECMAScript regular expression over them.
+  std::string match;
+  bool regex = false;
+  // With |regex|, $1... are replaced by the request's capture groups and $$
+  // is a literal dollar sign.
+  std::string reply;
+  int64_t delay_us = 0;
+};
+
+// Sent unprompted every |interval_us|, starting one interval after start.
+struct SimulatorPeriodicFrame {
+  std::string data;
+  int64_t interval_us = 0;
+};
+
+// How a simulated device behaves.
+struct SimulatorScript {
+  std::vector<SimulatorRule> rules;
+  std::vector<SimulatorPeriodicFrame> periodic;
+  // Throughput of an 8N1 line at this rate, in both directions; 0 is as
+  // fast as the pty goes.
+  int baud_rate = 0;
+  // Per transmitted byte: the chance that one bit is flipped, and the
+  // chance that the byte is lost.
+  double corrupt_probability = 0;
+  double drop_probability = 0;
+  uint32_t seed = 1;
+};
+
+// Parses a script such as:
+//
+//   # Comments run to the end of the line.
+//   baud 115200
+//   noise corrupt 0.001 drop 0.0001 seed 7
+//   on "PING\r\n" reply "PONG\r\n" delay 2ms
+//   on /READ ([0-9]+)\r\n/ reply "VALUE $1\r\n"
+//   every 100ms send "\x02STATUS\x03"
+//
+// Strings take \r, \n, \t, \0, \\, \", \/ and \xHH escapes; regular
+// expressions sit between slashes. Durations are in us, ms or s. On failure
+// |error| names the line.
+bool ParseSimulatorScript(const std::string& text, SimulatorScript* script,
+                          std::string* error);
+
+struct SimulatorStats {
+  uint64_t bytes_received;
+  uint64_t bytes_sent;
+  uint64_t requests_matched;
+  uint64_t bytes_corrupted;
+  uint64_t bytes_dropped;
+};
+
+// A serial device played on the master side of a pseudo-terminal, for
+// exercising port handling and protocol engines at realistic rates without
+// hardware. Code under test opens device_path() like a real tty.
+//
+// Received bytes collect in a request buffer; whenever a rule matches it,
+// everything up to the end of the earliest match is consumed and the reply
+// is scheduled. Replies, periodic frames and Send() share one transmit
+// queue, which is paced to the baud rate and passed through the noise
+// model on its way out.
+class DeviceSimulator {
+ public:
+  // Returns nullptr with errno set if no pty can be created.
+  static std::unique_ptr<DeviceSimulator> Create(SimulatorScript script);
+
+  ~DeviceSimulator();
+
+  // Disallow copy and assign.
+  DeviceSimulator(const DeviceSimulator&) = delete;
+  DeviceSimulator& operator=(const DeviceSimulator&) = delete;
+
+  const std::string& device_path() const { return device_path_; }
+
+  // Queues |data| for transmission as if the device sent it unprompted.
+  void Send(const std::string& data);
+
+  SimulatorStats stats();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // A token bucket for one direction of the simulated line.
+  class LineRate {
+   public:
+    explicit LineRate(int baud_rate);
+    // Bytes that may move now, at most |wanted|.
+    size_t Available(Clock::time_point now, size_t wanted);
+    void Consume(size_t bytes) {
+      if (bytes_per_second_ > 0) tokens_ -= bytes;
+    }
+    // When at least one byte may move.
+    Clock::time_point NextByte(Clock::time_point now) const;
+
+   private:
+    const double bytes_per_second_;
+    double tokens_;
+    Clock::time_point refilled_;
+  };
+
+  struct CompiledRule {
+    SimulatorRule rule;
+    std::regex pattern;
+  };
+
+  DeviceSimulator(SimulatorScript script, int master, int slave, int wake_fd,
+                  std::string device_path);
+
+  void Run();
+  // Appends to |request_| and schedules replies for every match.
+  void HandleReceived(const uint8_t* data, size_t length,
+                      Clock::time_point now);
+  // Moves due replies and periodic frames into |tx_|.
+  void CollectDue(Clock::time_point now);
+  // Appends |data| to |tx_| through the noise model.
+  void QueueLocked(const std::string& data);
+  // Writes as much of |tx_| as the line rate and the pty allow.
+  void Transmit(Clock::time_point now);
+  void Wake();
+
+  const SimulatorScript script_;
+  std::vector<CompiledRule> rules_;
+  const int master_;
+  // Held open so the master never sees a hangup between test connections.
+  const int slave_;
+  const int wake_fd_;
+  const std::string device_path_;
+
+  // Only touched on the thread.
+  std::string request_;
+  // Bytes waiting for the line, noise already applied.
+  std::vector<uint8_t> tx_;
+  std::vector<Clock::time_point> periodic_due_;
+  LineRate rx_rate_;
+  LineRate tx_rate_;
+  std::mt19937 random_;
+
+  std::mutex mutex_;
+  // Replies and Send() data by due time, in insertion order for equal
+  // times.
+  std::multimap<Clock::time_point, std::string> scheduled_;
+  SimulatorStats stats_;
+  bool stopping_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_DEVICE_SIMULATOR_H_
@@ -0,0 +1,74 @@
+#include "drain_worker.h"
+
+#include <errno.h>
+#include <termios.h>
+
+#include <chrono>
+#include <utility>
+
+namespace serial_com {
+
+DrainWorker::DrainWorker(int fd)
+    : fd_(fd), draining_(false), stopping_(false), exited_(false) {
+  thread_ = std::thread(&DrainWorker::Run, this);
+}
+
+DrainWorker::~DrainWorker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopping_ = true;
+  changed_.notify_all();
+  // The flush can land just before tcdrain starts, so repeat it until the
+  // thread is out.
+  while (!exited_) {
+    if (draining_) tcflush(fd_, TCOFLUSH);
+    changed_.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  std::vector<DoneCallback> cancelled;
+  cancelled.swap(waiting_);
+  lock.unlock();
+  thread_.join();
+  for (auto& done : cancelled) {
+    if (done) done(ECANCELED);
+  }
+}
+
+void DrainWorker::Drain(DoneCallback done) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  waiting_.push_back(std::move(done));
+  changed_.notify_all();
+}
+
+void DrainWorker::Run() {
+  while (true) {
+    std::vector<DoneCallback> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [this]() { return stopping_ || !waiting_.empty(); });
+      if (stopping_) break;
+      batch.swap(waiting_);
+      draining_ = true;
+    }
+    int error = 0;
+    while (tcdrain(fd_) != 0) {
+      if (errno != EINTR) {
+        error = errno;
+        break;
+      }
+    }
+    bool stopping;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      draining_ = false;
+      stopping = stopping_;
+    }
+    // A drain cut short by the destructor's flush did not transmit.
+    for (auto& done : batch) {
+      if (done) done(stopping ? ECANCELED : error);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  exited_ = true;
+  changed_.notify_all();
+}
+
+}  // namespace serial_com
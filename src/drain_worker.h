@@ -0,0 +1,52 @@
+#ifndef SERIAL_COM_CORE_DRAIN_WORKER_H_
+#define SERIAL_COM_CORE_DRAIN_WORKER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace serial_com {
+
+// Waits for a tty's output to be physically transmitted (tcdrain) on its
+// own thread, so that callers are told when the last stop bit has left
+// instead of blocking until it has.
+class DrainWorker {
+ public:
+  // Invoked on the worker thread with 0 or an errno.
+  using DoneCallback = std::function<void(int error)>;
+
+  explicit DrainWorker(int fd);
+  // Fails waiting drains with ECANCELED. A drain held up by flow control
+  // is ended by discarding the tty's output queue, so closing a port never
+  // waits for the peer.
+  ~DrainWorker();
+
+  // Disallow copy and assign.
+  DrainWorker(const DrainWorker&) = delete;
+  DrainWorker& operator=(const DrainWorker&) = delete;
+
+  // Calls |done| once everything written to the tty before this call has
+  // been transmitted. Drains requested while one is running share the next
+  // tcdrain.
+  void Drain(DoneCallback done);
+
+ private:
+  void Run();
+
+  const int fd_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<DoneCallback> waiting_;
+  bool draining_;
+  bool stopping_;
+  bool exited_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_DRAIN_WORKER_H_
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "io_loop.h"
+
+namespace serial_com {
+
+namespace {
+
+constexpr int kMaxEvents = 64;
+
+class EpollBackend : public IoBackend {
+ public:
+  EpollBackend() : epoll_fd_(-1), wake_fd_(-1) {}
+
+  ~EpollBackend() override {
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+  }
+
+  IoBackendKind kind() const override { return IoBackendKind::kEpoll; }
+
+  bool Init(int wake_fd) override {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) return false;
+    wake_fd_ = wake_fd;
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) == 0;
+  }
+
+  bool Watch(const std::shared_ptr<IoPort>& port) override {
+    int flags = fcntl(port->fd(), F_GETFL);
+    if (flags < 0 || fcntl(port->fd(), F_SETFL, flags | O_NONBLOCK) < 0) {
+      return false;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = port->fd();
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, port->fd(), &event) != 0) {
+      return false;
+    }
+    ports_[port->fd()] = Entry{port, false, EPOLLIN, {}};
+    return true;
+  }
+
+  void Unwatch(const std::shared_ptr<IoPort>& port,
+               std::function<void()> detached) override {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, port->fd(), nullptr);
+    ports_.erase(port->fd());
+    detached();
+  }
+
+  void WritesQueued(const std::shared_ptr<IoPort>& port) override {
+    auto it = ports_.find(port->fd());
+    if (it == ports_.end()) {
+      port->CancelWrites(EBADF);
+      return;
+    }
+    // Try the write straight away; only wait for EPOLLOUT when the tty
+    // cannot take everything now.
+    Flush(it->first, &it->second);
+  }
+
+  void ReceiveReleased(const std::shared_ptr<IoPort>& port) override {
+    auto it = ports_.find(port->fd());
+    if (it != ports_.end()) UpdateEvents(it->first, &it->second);
+  }
+
+  void Wait() override {
+    struct epoll_event events[kMaxEvents];
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        uint64_t value;
+        ssize_t ignored = read(wake_fd_, &value, sizeof value);
+        (void)ignored;
+        continue;
+      }
+      auto it = ports_.find(fd);
+      if (it == ports_.end()) continue;
+      // Keep the port alive even if a callback below unwatches it.
+      std::shared_ptr<IoPort> port = it->second.port;
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        Drain(port.get(), &it->second.buffer);
+      }
+      it = ports_.find(fd);
+      if (it != ports_.end() && port->receive_held()) {
+        UpdateEvents(fd, &it->second);
+      }
+      if (it != ports_.end() && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+        // The device is gone; stop polling it rather than spinning on the
+        // hangup until the port is closed.
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        port->CancelWrites(EIO);
+        continue;
+      }
+      if (it != ports_.end() && (events[i].events & EPOLLOUT)) {
+        Flush(fd, &it->second);
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    std::shared_ptr<IoPort> port;
+    bool want_out;
+    // What the epoll set currently watches for.
+    uint32_t events;
+    // Sized by the port's ReadSizer.
+    std::vector<uint8_t> buffer;
+  };
+
+  // Reads until the tty is empty. A read that fills the buffer may have
+  // left more behind; FIONREAD then sizes the next one to take all of it,
+  // and saves the read that would only have found the tty empty.
+  void Drain(IoPort* port, std::vector<uint8_t>* buffer) {
+    ReadSizer& sizer = port->read_sizer();
+    size_t queued = 0;
+    while (!port->receive_held()) {
+      size_t size = sizer.NextReadSize(queued);
+      sizer.FitBuffer(size, buffer);
+      ssize_t n = read(port->fd(), buffer->data(), size);
+      int error = errno;
+      port->stats().RecordRead(
+          n >= 0 || error == EAGAIN ? std::max<ssize_t>(n, 0) : -error);
+      if (n > 0) {
+        sizer.OnRead(n, std::chrono::steady_clock::now());
+        port->OnReceived(buffer->data(), n);
+        if (static_cast<size_t>(n) < size) return;
+        int available = 0;
+        port->stats().RecordReadSizing();
+        if (ioctl(port->fd(), FIONREAD, &available) != 0) {
+          queued = 0;
+          continue;
+        }
+        if (available <= 0) return;
+        queued = available;
+        continue;
+      }
+      if (n < 0 && error == EINTR) continue;
+      return;
+    }
+  }
+
+  void Flush(int fd, Entry* entry) {
+    const uint8_t* data;
+    size_t length;
+    bool blocked = false;
+    while (entry->port->FrontWrite(&data, &length)) {
+      ssize_t n = write(fd, data, length);
+      int error = errno;
+      entry->port->stats().RecordWrite(
+          n >= 0 || error == EAGAIN ? std::max<ssize_t>(n, 0) : -error);
+      if (n < 0 && error == EINTR) continue;
+      if (n < 0 && error == EAGAIN) {
+        blocked = true;
+        break;
+      }
+      entry->port->CompleteWrite(n < 0 ? -error : n);
+    }
+    entry->want_out = blocked;
+    UpdateEvents(fd, entry);
+  }
+
+  // Watches for input unless the port's receive is held, and for output
+  // while a write is blocked.
+  void UpdateEvents(int fd, Entry* entry) {
+    uint32_t events = (entry->port->receive_held() ? 0 : EPOLLIN) |
+                      (entry->want_out ? EPOLLOUT : 0);
+    if (events == entry->events) return;
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+    entry->events = events;
+  }
+
+  int epoll_fd_;
+  int wake_fd_;
+  std::map<int, Entry> ports_;
+};
+
+}  // namespace
+
+std::unique_ptr<IoBackend> CreateEpollBackend() {
+  return std::unique_ptr<IoBackend>(new EpollBackend());
+}
+
+}  // namespace serial_com
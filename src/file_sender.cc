@@ -0,0 +1,280 @@
+#include "file_sender.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+// Bytes per splice, read/write or chunk; one default-sized pipe.
+constexpr size_t kChunkSize = 64 * 1024;
+// Chunks a chunked send keeps queued.
+constexpr int kChunkWindow = 4;
+// How often a sender waiting for room checks whether it was aborted.
+constexpr int kWritablePollMs = 50;
+
+}  // namespace
+
+std::unique_ptr<FileSender> FileSender::Open(const std::string& path,
+                                             uint64_t offset,
+                                             uint64_t length) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return nullptr;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    errno = EINVAL;
+    return nullptr;
+  }
+  uint64_t size = static_cast<uint64_t>(st.st_size);
+  if (offset > size || (length > 0 && length > size - offset)) {
+    close(fd);
+    errno = EINVAL;
+    return nullptr;
+  }
+  if (length == 0) length = size - offset;
+  // The region is read front to back exactly once.
+  posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+  return std::unique_ptr<FileSender>(new FileSender(fd, offset, length));
+}
+
+FileSender::FileSender(int file_fd, uint64_t offset, uint64_t length)
+    : file_fd_(file_fd),
+      offset_(offset),
+      length_(length),
+      window_(std::make_shared<Window>()) {
+  progress_state_.total_bytes = length;
+}
+
+FileSender::~FileSender() {
+  Abort();
+  std::thread thread;
+  {
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    thread.swap(thread_);
+  }
+  if (thread.joinable()) thread.join();
+  if (pipe_[0] >= 0) close(pipe_[0]);
+  if (pipe_[1] >= 0) close(pipe_[1]);
+  close(file_fd_);
+}
+
+void FileSender::StartDirect(int fd, PortStats* stats, ProgressFn progress,
+                             DoneFn done) {
+  Start([this, fd, stats]() { return RunDirect(fd, stats); },
+        std::move(progress), std::move(done));
+}
+
+void FileSender::StartChunked(SendFn send, ProgressFn progress, DoneFn done) {
+  Start([this, send]() { return RunChunked(send); }, std::move(progress),
+        std::move(done));
+}
+
+void FileSender::Abort() {
+  {
+    std::lock_guard<std::mutex> lock(window_->mutex);
+    window_->aborted = true;
+  }
+  window_->changed.notify_all();
+}
+
+void FileSender::Start(std::function<int64_t()> run, ProgressFn progress,
+                       DoneFn done) {
+  std::lock_guard<std::mutex> lock(thread_mutex_);
+  progress_ = std::move(progress);
+  thread_ = std::thread([this, run, done]() {
+    int64_t result = run();
+    if (done) done(result, progress_state_);
+  });
+}
+
+int64_t FileSender::RunDirect(int fd, PortStats* stats) {
+  bool splice_supported = pipe2(pipe_, O_CLOEXEC) == 0;
+  std::vector<uint8_t> buffer;
+  uint64_t sent = 0;
+  while (sent < length_) {
+    if (aborted()) return -ECANCELED;
+    size_t chunk =
+        static_cast<size_t>(std::min<uint64_t>(kChunkSize, length_ - sent));
+    int64_t moved = 0;
+    if (splice_supported) {
+      bool unsupported = false;
+      moved = SpliceSome(fd, offset_ + sent, chunk, stats, &unsupported);
+      if (moved < 0) return moved;
+      if (unsupported) splice_supported = false;
+    }
+    if (moved == 0) {
+      if (buffer.empty()) buffer.resize(kChunkSize);
+      ssize_t n = pread(file_fd_, buffer.data(), chunk, offset_ + sent);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) return -errno;
+      // The file shrank underneath us.
+      if (n == 0) return -EIO;
+      moved = WriteAll(fd, buffer.data(), n, stats);
+      if (moved < 0) return moved;
+    }
+    progress_state_.spliced = splice_supported;
+    sent += moved;
+    progress_state_.bytes_sent = sent;
+    ReportProgress();
+  }
+  return static_cast<int64_t>(sent);
+}
+
+int64_t FileSender::SpliceSome(int fd, uint64_t offset, size_t length,
+                               PortStats* stats, bool* unsupported) {
+  loff_t file_offset = static_cast<loff_t>(offset);
+  ssize_t in;
+  do {
+    in = splice(file_fd_, &file_offset, pipe_[1], nullptr, length,
+                SPLICE_F_MOVE);
+  } while (in < 0 && errno == EINTR);
+  if (in < 0 && errno == EINVAL) {
+    *unsupported = true;
+    return 0;
+  }
+  if (in < 0) return -errno;
+  if (in == 0) return -EIO;
+
+  size_t pending = in;
+  bool first = true;
+  while (pending > 0) {
+    ssize_t out = splice(pipe_[0], nullptr, fd, nullptr, pending,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (out > 0) {
+      stats->RecordWrite(out);
+      pending -= out;
+      first = false;
+      continue;
+    }
+    if (out < 0 && errno == EINTR) continue;
+    if (out < 0 && errno == EAGAIN) {
+      if (!WaitWritable(fd)) return -ECANCELED;
+      continue;
+    }
+    if (out < 0 && errno == EINVAL && first) {
+      // The tty cannot be spliced to. Send what is already in the pipe the
+      // ordinary way; later chunks skip the pipe.
+      std::vector<uint8_t> drained(pending);
+      ssize_t n = read(pipe_[0], drained.data(), pending);
+      if (n != static_cast<ssize_t>(pending)) return -EIO;
+      int64_t written = WriteAll(fd, drained.data(), pending, stats);
+      if (written < 0) return written;
+      *unsupported = true;
+      return in;
+    }
+    int error = out < 0 ? errno : EIO;
+    stats->RecordWrite(-error);
+    return -error;
+  }
+  return in;
+}
+
+int64_t FileSender::WriteAll(int fd, const uint8_t* data, size_t length,
+                             PortStats* stats) {
+  size_t written = 0;
+  while (written < length) {
+    ssize_t n = write(fd, data + written, length - written);
+    if (n >= 0) {
+      stats->RecordWrite(n);
+      written += n;
+      continue;
+    }
+    if (errno == EINTR) continue;
+    if (errno != EAGAIN) {
+      int error = errno;
+      stats->RecordWrite(-error);
+      return -error;
+    }
+    if (!WaitWritable(fd)) return -ECANCELED;
+  }
+  return static_cast<int64_t>(written);
+}
+
+bool FileSender::WaitWritable(int fd) {
+  struct pollfd writable = {fd, POLLOUT, 0};
+  poll(&writable, 1, kWritablePollMs);
+  return !aborted();
+}
+
+int64_t FileSender::RunChunked(const SendFn& send) {
+  std::shared_ptr<Window> window = window_;
+  uint64_t queued = 0;
+  uint64_t reported = 0;
+  while (true) {
+    uint64_t completed;
+    bool room;
+    bool finished;
+    {
+      std::unique_lock<std::mutex> lock(window->mutex);
+      window->changed.wait(lock, [&window, queued, reported, this] {
+        return window->aborted || window->error < 0 ||
+               window->completed != reported || window->in_flight == 0 ||
+               (queued < length_ && window->in_flight < kChunkWindow);
+      });
+      if (window->aborted) return -ECANCELED;
+      if (window->error < 0) return window->error;
+      completed = window->completed;
+      room = queued < length_ && window->in_flight < kChunkWindow;
+      finished = queued == length_ && window->in_flight == 0;
+    }
+    if (completed != reported) {
+      reported = completed;
+      progress_state_.bytes_sent = completed;
+      ReportProgress();
+    }
+    if (finished) return static_cast<int64_t>(completed);
+    if (!room) continue;
+
+    size_t chunk =
+        static_cast<size_t>(std::min<uint64_t>(kChunkSize, length_ - queued));
+    std::vector<uint8_t> data(chunk);
+    ssize_t n = pread(file_fd_, data.data(), chunk, offset_ + queued);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -errno;
+    // The file shrank underneath us.
+    if (n == 0) return -EIO;
+    data.resize(n);
+    queued += n;
+    {
+      std::lock_guard<std::mutex> lock(window->mutex);
+      window->in_flight++;
+    }
+    send(std::move(data), [window, n](int64_t result) {
+      {
+        std::lock_guard<std::mutex> lock(window->mutex);
+        window->in_flight--;
+        if (result < 0) {
+          if (window->error == 0) window->error = result;
+        } else {
+          window->completed += n;
+        }
+      }
+      window->changed.notify_all();
+    });
+  }
+}
+
+void FileSender::ReportProgress() {
+  if (progress_) progress_(progress_state_);
+}
+
+bool FileSender::aborted() {
+  std::lock_guard<std::mutex> lock(window_->mutex);
+  return window_->aborted;
+}
+
+}  // namespace serial_com
@@ -0,0 +1,120 @@
+#ifndef SERIAL_COM_CORE_FILE_SENDER_H_
+#define SERIAL_COM_CORE_FILE_SENDER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "port_stats.h"
+
+namespace serial_com {
+
+struct FileSendProgress {
+  uint64_t bytes_sent = 0;
+  uint64_t total_bytes = 0;
+  // Whether the data is moving file -> pipe -> tty inside the kernel.
+  bool spliced = false;
+};
+
+// Sends a region of a file to a port without the data passing through the
+// application.
+//
+// Direct sends own the port's transmit side while they run and write to
+// the tty themselves: with splice() through a pipe where the tty driver
+// supports it, and a large read/write loop otherwise. Either way a full
+// output queue (hardware flow control, a slow line) just parks the sender
+// in poll(). Chunked sends hand fixed-size chunks to a write function
+// instead, for ports whose writes must go through a pacer or codec, and
+// keep a bounded number of them in flight.
+class FileSender {
+ public:
+  using WriteDone = std::function<void(int64_t result)>;
+  using SendFn = std::function<void(std::vector<uint8_t> data, WriteDone done)>;
+  // Called on the sender thread as data leaves.
+  using ProgressFn = std::function<void(const FileSendProgress& progress)>;
+  // Called once on the sender thread with the bytes sent or a negative
+  // errno; -ECANCELED after Abort().
+  using DoneFn =
+      std::function<void(int64_t result, const FileSendProgress& progress)>;
+
+  // Opens |path| for sending |length| bytes from |offset|; a zero length
+  // means up to the end of the file. Returns nullptr with errno set if the
+  // file cannot be opened or the region lies outside it.
+  static std::unique_ptr<FileSender> Open(const std::string& path,
+                                          uint64_t offset, uint64_t length);
+
+  // Aborts a running send and waits for its thread.
+  ~FileSender();
+
+  // Disallow copy and assign.
+  FileSender(const FileSender&) = delete;
+  FileSender& operator=(const FileSender&) = delete;
+
+  uint64_t total_bytes() const { return length_; }
+
+  // Starts writing to |fd|, which may be non-blocking. Writes are recorded
+  // in |stats|, which must outlive the send. Call at most one Start method,
+  // from any thread.
+  void StartDirect(int fd, PortStats* stats, ProgressFn progress,
+                   DoneFn done);
+  // Starts handing chunks to |send|.
+  void StartChunked(SendFn send, ProgressFn progress, DoneFn done);
+
+  void Abort();
+
+ private:
+  FileSender(int file_fd, uint64_t offset, uint64_t length);
+
+  void Start(std::function<int64_t()> run, ProgressFn progress, DoneFn done);
+  // Thread bodies. Return the bytes sent or a negative errno.
+  int64_t RunDirect(int fd, PortStats* stats);
+  int64_t RunChunked(const SendFn& send);
+  // Moves up to |length| bytes from the file at |offset| to |fd| through a
+  // pipe. Returns the bytes moved or a negative errno, and sets
+  // |unsupported| if the file or tty cannot be spliced, in which case the
+  // bytes it did move were written the ordinary way.
+  int64_t SpliceSome(int fd, uint64_t offset, size_t length, PortStats* stats,
+                     bool* unsupported);
+  // Writes all of |data| to |fd|, waiting for room as needed.
+  int64_t WriteAll(int fd, const uint8_t* data, size_t length,
+                   PortStats* stats);
+  // Waits until |fd| is writable or the send is aborted. Returns false
+  // once aborted.
+  bool WaitWritable(int fd);
+  void ReportProgress();
+  bool aborted();
+
+  const int file_fd_;
+  const uint64_t offset_;
+  const uint64_t length_;
+
+  // Shared with chunk completions, which may outlive the sender.
+  struct Window {
+    std::mutex mutex;
+    std::condition_variable changed;
+    int in_flight = 0;
+    // Bytes of completed chunks.
+    uint64_t completed = 0;
+    int64_t error = 0;
+    bool aborted = false;
+  };
+  std::shared_ptr<Window> window_;
+
+  // Sender thread only.
+  int pipe_[2] = {-1, -1};
+  FileSendProgress progress_state_;
+  ProgressFn progress_;
+
+  std::mutex thread_mutex_;
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_FILE_SENDER_H_
@@ -0,0 +1,141 @@
+#include "frame_filter.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+uint32_t LoadId(const uint8_t* p, size_t size, bool big_endian) {
+  uint32_t id = 0;
+  for (size_t i = 0; i < size; i++) {
+    size_t shift = big_endian ? 8 * (size - 1 - i) : 8 * i;
+    id |= static_cast<uint32_t>(p[i]) << shift;
+  }
+  return id;
+}
+
+}  // namespace
+
+bool IsValidFrameFilterSpec(const FrameFilterSpec& spec) {
+  for (const MaskMatch& mask : spec.masks) {
+    if (mask.mask.size() != mask.value.size()) return false;
+  }
+  for (const IdRange& range : spec.id_ranges) {
+    if (range.size != 1 && range.size != 2 && range.size != 4) return false;
+    if (range.min > range.max) return false;
+  }
+  return true;
+}
+
+FrameFilter::FrameFilter(const FrameFilterSpec& spec)
+    : id_ranges_(spec.id_ranges), min_length_(0) {
+  for (const MaskMatch& match : spec.masks) {
+    for (size_t i = 0; i < match.mask.size(); i++) {
+      // Bytes with an empty mask always match.
+      if (match.mask[i] == 0) continue;
+      tests_.push_back(ByteTest{match.offset + i, match.mask[i],
+                                static_cast<uint8_t>(match.value[i] &
+                                                     match.mask[i])});
+      min_length_ = std::max(min_length_, match.offset + i + 1);
+    }
+  }
+}
+
+bool FrameFilter::Matches(const uint8_t* frame, size_t length) const {
+  if (length < min_length_) return false;
+  for (const ByteTest& test : tests_) {
+    if ((frame[test.offset] & test.mask) != test.value) return false;
+  }
+  if (id_ranges_.empty()) return true;
+  for (const IdRange& range : id_ranges_) {
+    if (range.offset + range.size > length) continue;
+    uint32_t id = LoadId(frame + range.offset, range.size, range.big_endian);
+    if (id >= range.min && id <= range.max) return true;
+  }
+  return false;
+}
+
+FrameRouter::FrameRouter(size_t max_queued_frames)
+    : max_queued_frames_(max_queued_frames), next_id_(1), stats_() {}
+
+int FrameRouter::Subscribe(const FrameFilterSpec& spec) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int id = next_id_++;
+  subscribers_.push_back(Subscriber{id, FrameFilter(spec), {}, 0});
+  return id;
+}
+
+bool FrameRouter::Unsubscribe(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = subscribers_.begin(); it != subscribers_.end(); ++it) {
+    if (it->id == id) {
+      subscribers_.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FrameRouter::Route(const uint8_t* frame, size_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool matched = false;
+  bool wake = false;
+  for (Subscriber& subscriber : subscribers_) {
+    if (!subscriber.filter.Matches(frame, length)) continue;
+    matched = true;
+    if (subscriber.frames.size() >= max_queued_frames_) {
+      subscriber.dropped++;
+      continue;
+    }
+    if (subscriber.frames.empty()) wake = true;
+    subscriber.frames.emplace_back(frame, frame + length);
+  }
+  if (matched) {
+    stats_.frames_routed++;
+  } else {
+    stats_.frames_unmatched++;
+  }
+  return wake;
+}
+
+bool FrameRouter::Take(int id, std::vector<std::vector<uint8_t>>* frames,
+                       uint64_t* dropped) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Subscriber* subscriber = FindLocked(id);
+  if (subscriber == nullptr) return false;
+  frames->reserve(frames->size() + subscriber->frames.size());
+  for (std::vector<uint8_t>& frame : subscriber->frames) {
+    frames->push_back(std::move(frame));
+  }
+  subscriber->frames.clear();
+  *dropped = subscriber->dropped;
+  subscriber->dropped = 0;
+  return true;
+}
+
+size_t FrameRouter::Queued(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Subscriber* subscriber = FindLocked(id);
+  return subscriber != nullptr ? subscriber->frames.size() : 0;
+}
+
+void FrameRouter::DiscardQueued() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (Subscriber& subscriber : subscribers_) subscriber.frames.clear();
+}
+
+FrameRouterStats FrameRouter::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+FrameRouter::Subscriber* FrameRouter::FindLocked(int id) {
+  for (Subscriber& subscriber : subscribers_) {
+    if (subscriber.id == id) return &subscriber;
+  }
+  return nullptr;
+}
+
+}  // namespace serial_com
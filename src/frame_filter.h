@@ -0,0 +1,124 @@
+#ifndef SERIAL_COM_CORE_FRAME_FILTER_H_
+#define SERIAL_COM_CORE_FRAME_FILTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace serial_com {
+
+// Matches when (frame[offset + i] & mask[i]) == value[i] for every i.
+struct MaskMatch {
+  size_t offset = 0;
+  std::vector<uint8_t> mask;
+  std::vector<uint8_t> value;
+};
+
+// Matches when the |size|-byte unsigned integer at |offset| lies in
+// [min, max].
+struct IdRange {
+  size_t offset = 0;
+  // 1, 2 or 4.
+  size_t size = 1;
+  bool big_endian = false;
+  uint32_t min = 0;
+  uint32_t max = 0;
+};
+
+// A frame passes when every mask matches and, if there are ranges, its ID
+// lies in at least one of them. An empty spec passes every frame.
+struct FrameFilterSpec {
+  std::vector<MaskMatch> masks;
+  std::vector<IdRange> id_ranges;
+};
+
+// Returns false if a mask and its value differ in length or a range has
+// an unsupported size or is empty.
+bool IsValidFrameFilterSpec(const FrameFilterSpec& spec);
+
+// A FrameFilterSpec flattened for matching on the I/O thread: masks become
+// one list of byte tests, and frames too short for any test are rejected
+// up front.
+class FrameFilter {
+ public:
+  explicit FrameFilter(const FrameFilterSpec& spec);
+
+  bool Matches(const uint8_t* frame, size_t length) const;
+
+ private:
+  struct ByteTest {
+    size_t offset;
+    uint8_t mask;
+    uint8_t value;
+  };
+
+  std::vector<ByteTest> tests_;
+  std::vector<IdRange> id_ranges_;
+  // Shortest frame that every byte test can look at.
+  size_t min_length_;
+};
+
+struct FrameRouterStats {
+  // Frames that matched at least one subscriber.
+  uint64_t frames_routed;
+  // Frames that matched none and were discarded.
+  uint64_t frames_unmatched;
+};
+
+// Hands frames cut on the I/O thread to the subscribers whose filters
+// match them, so that only wanted frames ever reach the method channel.
+// All methods are thread-safe.
+class FrameRouter {
+ public:
+  // Each subscriber holds at most |max_queued_frames| frames; later ones
+  // are counted as dropped.
+  explicit FrameRouter(size_t max_queued_frames);
+
+  // Disallow copy and assign.
+  FrameRouter(const FrameRouter&) = delete;
+  FrameRouter& operator=(const FrameRouter&) = delete;
+
+  // Returns the new subscriber's id, which is never 0.
+  int Subscribe(const FrameFilterSpec& spec);
+  // Returns false if there is no such subscriber.
+  bool Unsubscribe(int id);
+
+  // Queues |frame| for every matching subscriber. Returns true if one of
+  // their queues was empty, so that a waiting reader can be woken.
+  bool Route(const uint8_t* frame, size_t length);
+
+  // Moves subscriber |id|'s queued frames into |frames| and sets |dropped|
+  // to the frames it has lost since the last call. Returns false if there
+  // is no such subscriber.
+  bool Take(int id, std::vector<std::vector<uint8_t>>* frames,
+            uint64_t* dropped);
+  // Frames queued for subscriber |id|; 0 if there is no such subscriber.
+  size_t Queued(int id);
+  // Empties every subscriber's queue without counting drops.
+  void DiscardQueued();
+
+  FrameRouterStats stats();
+
+ private:
+  struct Subscriber {
+    int id;
+    FrameFilter filter;
+    std::deque<std::vector<uint8_t>> frames;
+    uint64_t dropped;
+  };
+
+  Subscriber* FindLocked(int id);
+
+  const size_t max_queued_frames_;
+
+  std::mutex mutex_;
+  std::vector<Subscriber> subscribers_;
+  int next_id_;
+  FrameRouterStats stats_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_FRAME_FILTER_H_
@@ -0,0 +1,72 @@
+#include "framer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace serial_com {
+
+DelimiterFramer::DelimiterFramer(uint8_t delimiter, size_t max_length)
+    : delimiter_(delimiter), max_length_(max_length) {}
+
+void DelimiterFramer::Push(const uint8_t* data, size_t length,
+                           const FrameCallback& on_frame) {
+  const uint8_t* end = data + length;
+  while (data < end) {
+    const uint8_t* found = static_cast<const uint8_t*>(
+        memchr(data, delimiter_, end - data));
+    const uint8_t* stop = found != nullptr ? found : end;
+    // Whole frames that arrive in one piece are delivered without copying.
+    if (found != nullptr && partial_.empty() &&
+        static_cast<size_t>(found - data) <= max_length_) {
+      on_frame(data, found - data);
+      data = found + 1;
+      continue;
+    }
+    while (data < stop) {
+      size_t take = std::min<size_t>(stop - data, max_length_ - partial_.size());
+      partial_.insert(partial_.end(), data, data + take);
+      data += take;
+      if (partial_.size() == max_length_) {
+        on_frame(partial_.data(), partial_.size());
+        partial_.clear();
+      }
+    }
+    if (found != nullptr) {
+      on_frame(partial_.data(), partial_.size());
+      partial_.clear();
+      data = found + 1;
+    }
+  }
+}
+
+void DelimiterFramer::Reset() { partial_.clear(); }
+
+FixedLengthFramer::FixedLengthFramer(size_t frame_length)
+    : frame_length_(frame_length) {}
+
+void FixedLengthFramer::Push(const uint8_t* data, size_t length,
+                             const FrameCallback& on_frame) {
+  const uint8_t* end = data + length;
+  if (!partial_.empty()) {
+    size_t take = std::min<size_t>(end - data, frame_length_ - partial_.size());
+    partial_.insert(partial_.end(), data, data + take);
+    data += take;
+    if (partial_.size() < frame_length_) return;
+    on_frame(partial_.data(), partial_.size());
+    partial_.clear();
+  }
+  while (static_cast<size_t>(end - data) >= frame_length_) {
+    on_frame(data, frame_length_);
+    data += frame_length_;
+  }
+  partial_.assign(data, end);
+}
+
+void FixedLengthFramer::Reset() { partial_.clear(); }
+
+void PassThroughFramer::Push(const uint8_t* data, size_t length,
+                             const FrameCallback& on_frame) {
+  if (length > 0) on_frame(data, length);
+}
+
+}  // namespace serial_com
@@ -0,0 +1,70 @@
+#ifndef SERIAL_COM_CORE_FRAMER_H_
+#define SERIAL_COM_CORE_FRAMER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace serial_com {
+
+// Splits a received byte stream into frames. Implementations carry partial
+// frames over between Push() calls.
+class Framer {
+ public:
+  using FrameCallback =
+      std::function<void(const uint8_t* frame, size_t length)>;
+
+  virtual ~Framer() = default;
+
+  // Feeds |length| received bytes and calls |on_frame| for every frame they
+  // complete. The frame pointer is only valid during the call.
+  virtual void Push(const uint8_t* data, size_t length,
+                    const FrameCallback& on_frame) = 0;
+  // Drops any partial frame.
+  virtual void Reset() = 0;
+};
+
+// Frames end with |delimiter|, which is not part of the delivered frame.
+// Frames longer than |max_length| are delivered in |max_length| pieces
+// rather than buffered without bound.
+class DelimiterFramer : public Framer {
+ public:
+  DelimiterFramer(uint8_t delimiter, size_t max_length);
+
+  void Push(const uint8_t* data, size_t length,
+            const FrameCallback& on_frame) override;
+  void Reset() override;
+
+ private:
+  const uint8_t delimiter_;
+  const size_t max_length_;
+  std::vector<uint8_t> partial_;
+};
+
+// Every frame is exactly |frame_length| bytes.
+class FixedLengthFramer : public Framer {
+ public:
+  explicit FixedLengthFramer(size_t frame_length);
+
+  void Push(const uint8_t* data, size_t length,
+            const FrameCallback& on_frame) override;
+  void Reset() override;
+
+ private:
+  const size_t frame_length_;
+  std::vector<uint8_t> partial_;
+};
+
+// Delivers every received chunk as it arrives, for consumers that parse
+// the stream themselves.
+class PassThroughFramer : public Framer {
+ public:
+  void Push(const uint8_t* data, size_t length,
+            const FrameCallback& on_frame) override;
+  void Reset() override {}
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_FRAMER_H_
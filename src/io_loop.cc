@@ -0,0 +1,617 @@
+#include "io_loop.h"
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <map>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+// About 90ms of wire time at 115200 baud, which bounds how long an urgent
+// write waits behind a bulk transfer once the tty has room.
+constexpr size_t kDefaultBulkFrameSize = 1024;
+
+}  // namespace
+
+const char* IoBackendKindName(IoBackendKind kind) {
+  switch (kind) {
+    case IoBackendKind::kEpoll:
+      return "epoll";
+    case IoBackendKind::kIoUring:
+      return "io_uring";
+  }
+  return "unknown";
+}
+
+bool ParseIoBackendKind(const char* name, IoBackendKind* kind) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "epoll") == 0) {
+    *kind = IoBackendKind::kEpoll;
+    return true;
+  }
+  if (strcmp(name, "io_uring") == 0) {
+    *kind = IoBackendKind::kIoUring;
+    return true;
+  }
+  return false;
+}
+
+const char* WriteLaneName(WriteLane lane) {
+  switch (lane) {
+    case WriteLane::kUrgent:
+      return "urgent";
+    case WriteLane::kNormal:
+      return "normal";
+    case WriteLane::kBulk:
+      return "bulk";
+  }
+  return "unknown";
+}
+
+bool ParseWriteLane(const char* name, WriteLane* lane) {
+  if (name == nullptr) return false;
+  for (int i = 0; i < kWriteLaneCount; i++) {
+    if (strcmp(name, WriteLaneName(static_cast<WriteLane>(i))) == 0) {
+      *lane = static_cast<WriteLane>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+IoPort::IoPort(int fd)
+    : fd_(fd),
+      fanout_(std::make_shared<ReceiveFanout>()),
+      bulk_frame_size_(kDefaultBulkFrameSize) {}
+
+void IoPort::SetDataCallback(DataCallback callback) {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  data_callback_ = std::move(callback);
+}
+
+void IoPort::SetFrameCallback(std::unique_ptr<Framer> framer,
+                              FrameCallback callback) {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  framer_ = std::move(framer);
+  frame_callback_ = framer_ ? std::move(callback) : nullptr;
+}
+
+void IoPort::SetDecoder(std::unique_ptr<Framer> decoder) {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  decoder_ = std::move(decoder);
+}
+
+Status IoPort::SetReceiveLimit(size_t memory_limit,
+                               const std::string& spill_directory) {
+  std::unique_ptr<SpillFile> spill;
+  if (memory_limit > 0) {
+    spill = SpillFile::Create(spill_directory);
+    if (!spill) {
+      return Status::Error("CONFIG_ERROR",
+                           std::string("Cannot create spill file: ") +
+                               strerror(errno));
+    }
+  }
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  if (spill_) {
+    // Whatever is spilled already moves to the new file, or back into
+    // memory, in order.
+    uint8_t chunk[16 * 1024];
+    while (!spill_->empty()) {
+      size_t n = spill_->Read(chunk, sizeof chunk);
+      if (n == 0) break;
+      if (spill) {
+        spill->Append(chunk, n);
+      } else {
+        rx_.Append(chunk, n);
+      }
+    }
+    retired_dropped_bytes_ += spill_->dropped_bytes();
+  }
+  memory_limit_ = memory_limit;
+  spill_ = std::move(spill);
+  return Status::Ok();
+}
+
+ReceiveBufferStats IoPort::receive_buffer_stats() {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  ReceiveBufferStats stats;
+  stats.memory_bytes = rx_.size();
+  stats.spill_bytes = spill_ ? spill_->size() : 0;
+  stats.spilled_bytes = spilled_bytes_;
+  stats.replayed_bytes = replayed_bytes_;
+  stats.dropped_bytes =
+      retired_dropped_bytes_ + (spill_ ? spill_->dropped_bytes() : 0);
+  return stats;
+}
+
+void IoPort::ReplayLocked(size_t wanted) {
+  uint8_t chunk[16 * 1024];
+  while (spill_ && !spill_->empty() && rx_.size() < wanted) {
+    size_t n = spill_->Read(
+        chunk, std::min(sizeof chunk, wanted - rx_.size()));
+    if (n == 0) break;
+    rx_.Append(chunk, n);
+    replayed_bytes_ += n;
+  }
+}
+
+size_t IoPort::Read(uint8_t* out, size_t max_length,
+                    std::vector<uint64_t>* finished_chunks) {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  return ReadLocked(out, max_length, finished_chunks);
+}
+
+size_t IoPort::ReadLocked(uint8_t* out, size_t max_length,
+                          std::vector<uint64_t>* finished_chunks) {
+  size_t read = rx_.Read(out, max_length);
+  if (spill_ && read < max_length && !spill_->empty()) {
+    // Refill memory up to the limit, which also serves this read.
+    ReplayLocked(memory_limit_);
+    read += rx_.Read(out + read, max_length - read);
+  }
+  size_t remaining = read;
+  while (remaining > 0 && !rx_chunks_.empty()) {
+    std::pair<uint64_t, size_t>& chunk = rx_chunks_.front();
+    size_t taken = std::min(remaining, chunk.second);
+    chunk.second -= taken;
+    remaining -= taken;
+    if (chunk.second > 0) break;
+    if (finished_chunks != nullptr && chunk.first != 0) {
+      finished_chunks->push_back(chunk.first);
+    }
+    rx_chunks_.pop_front();
+  }
+  return read;
+}
+
+size_t IoPort::Available() {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  return AvailableLocked();
+}
+
+bool IoPort::ReadThrough(const std::vector<uint8_t>& delimiter,
+                         size_t max_length, std::vector<uint8_t>* out) {
+  if (delimiter.empty()) return false;
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  // Spilled bytes have to be in memory to be searched.
+  if (spill_ && rx_.size() < max_length) ReplayLocked(max_length);
+  const uint8_t* begin = rx_.data();
+  const uint8_t* end = begin + std::min(max_length, rx_.size());
+  const uint8_t* found =
+      std::search(begin, end, delimiter.begin(), delimiter.end());
+  if (found == end) return false;
+  size_t length = found - begin + delimiter.size();
+  size_t offset = out->size();
+  out->resize(offset + length);
+  ReadLocked(out->data() + offset, length, nullptr);
+  return true;
+}
+
+bool IoPort::WaitAvailable(size_t count,
+                           std::chrono::steady_clock::time_point deadline,
+                           const std::atomic<bool>& cancelled) {
+  std::unique_lock<std::mutex> lock(rx_mutex_);
+  rx_arrived_.wait_until(lock, deadline, [this, count, &cancelled]() {
+    return AvailableLocked() >= count || cancelled.load();
+  });
+  return AvailableLocked() >= count;
+}
+
+void IoPort::WakeWaiters() {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  rx_arrived_.notify_all();
+}
+
+void IoPort::DiscardReceived() {
+  std::lock_guard<std::mutex> lock(rx_mutex_);
+  rx_.Clear();
+  if (spill_) spill_->Clear();
+  rx_chunks_.clear();
+  if (framer_) framer_->Reset();
+  if (decoder_) decoder_->Reset();
+}
+
+void IoPort::OnReceived(const uint8_t* data, size_t length) {
+  uint64_t chunk = 0;
+  if (trace_ != nullptr) {
+    chunk = trace_->NewChunk();
+    trace_->Record(TraceStage::kRead, fd_, chunk, length);
+  }
+  DataCallback callback;
+  {
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    if (decoder_) {
+      decoder_->Push(
+          data, length,
+          [this, chunk, &callback](const uint8_t* decoded, size_t size) {
+            DeliverLocked(decoded, size, chunk, &callback);
+          });
+    } else {
+      DeliverLocked(data, length, chunk, &callback);
+    }
+  }
+  if (callback) callback();
+}
+
+void IoPort::DeliverLocked(const uint8_t* data, size_t length,
+                           uint64_t chunk, DataCallback* callback) {
+  fanout_->Publish(data, length);
+  if (framer_) {
+    framer_->Push(data, length, frame_callback_);
+    return;
+  }
+  // Only the first arrival after the buffer has been emptied needs to be
+  // announced; readers drain everything that is buffered when they run.
+  if (rx_.empty() && data_callback_) *callback = data_callback_;
+  if (spill_) {
+    // Fill memory up to the limit; the rest, and everything after it until
+    // the spill file has been read back, goes to disk to keep the order.
+    size_t room = memory_limit_ > rx_.size() && spill_->empty()
+                      ? memory_limit_ - rx_.size()
+                      : 0;
+    size_t in_memory = std::min(room, length);
+    rx_.Append(data, in_memory);
+    if (in_memory < length) {
+      spill_->Append(data + in_memory, length - in_memory);
+      spilled_bytes_ += length - in_memory;
+    }
+  } else {
+    rx_.Append(data, length);
+  }
+  rx_arrived_.notify_all();
+  if (trace_ != nullptr) {
+    // A decoder may deliver one read as several pieces.
+    if (!rx_chunks_.empty() && rx_chunks_.back().first == chunk) {
+      rx_chunks_.back().second += length;
+    } else {
+      rx_chunks_.emplace_back(chunk, length);
+    }
+    trace_->Record(TraceStage::kBuffered, fd_, chunk, length);
+  }
+}
+
+void IoPort::SetBulkFrameSize(size_t size) {
+  std::lock_guard<std::mutex> lock(tx_mutex_);
+  bulk_frame_size_ = size;
+}
+
+WriteLaneStats IoPort::write_lane_stats(WriteLane lane) {
+  int index = static_cast<int>(lane);
+  std::lock_guard<std::mutex> lock(tx_mutex_);
+  WriteLaneStats stats = lane_stats_[index];
+  stats.queued_writes = tx_[index].size();
+  stats.queued_bytes = 0;
+  for (const WriteRequest& request : tx_[index]) {
+    stats.queued_bytes += request.data->size() - request.written;
+  }
+  return stats;
+}
+
+uint64_t IoPort::QueueWrite(SharedChunk data, WriteCallback callback,
+                            WriteLane lane) {
+  uint64_t chunk = 0;
+  if (trace_ != nullptr) {
+    chunk = trace_->NewChunk();
+    trace_->Record(TraceStage::kWriteQueued, fd_, chunk, data->size());
+  }
+  std::lock_guard<std::mutex> lock(tx_mutex_);
+  tx_[static_cast<int>(lane)].push_back(
+      WriteRequest{std::move(data), 0, std::move(callback), chunk, false,
+                   std::chrono::steady_clock::now()});
+  return chunk;
+}
+
+bool IoPort::InFrameLocked(int lane) const {
+  if (lane < 0 || tx_[lane].empty()) return false;
+  const WriteRequest& request = tx_[lane].front();
+  if (request.written == 0 || request.written >= request.data->size()) {
+    return false;
+  }
+  if (lane != static_cast<int>(WriteLane::kBulk) || bulk_frame_size_ == 0) {
+    return true;
+  }
+  return request.written % bulk_frame_size_ != 0;
+}
+
+int IoPort::NextLaneLocked(std::vector<WriteCallback>* empty_writes) {
+  if (InFrameLocked(active_lane_)) return active_lane_;
+  for (int lane = 0; lane < kWriteLaneCount; lane++) {
+    std::deque<WriteRequest>& queue = tx_[lane];
+    // Zero-length writes complete without touching the tty.
+    while (!queue.empty() && queue.front().data->empty()) {
+      empty_writes->push_back(std::move(queue.front().callback));
+      queue.pop_front();
+      lane_stats_[lane].completed_writes++;
+    }
+    if (queue.empty()) continue;
+    if (lane != active_lane_ && active_lane_ >= 0 &&
+        !tx_[active_lane_].empty() && tx_[active_lane_].front().written > 0) {
+      lane_stats_[lane].preemptions++;
+    }
+    return lane;
+  }
+  return -1;
+}
+
+bool IoPort::FrontWrite(const uint8_t** data, size_t* length) {
+  std::vector<WriteCallback> empty_writes;
+  bool pending = false;
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    int lane = NextLaneLocked(&empty_writes);
+    if (lane >= 0) {
+      active_lane_ = lane;
+      WriteRequest& request = tx_[lane].front();
+      if (!request.started) {
+        request.started = true;
+        if (trace_ != nullptr) {
+          trace_->Record(TraceStage::kWriteStarted, fd_, request.trace_chunk,
+                         request.data->size());
+        }
+      }
+      *data = request.data->data() + request.written;
+      *length = request.data->size() - request.written;
+      if (lane == static_cast<int>(WriteLane::kBulk) && bulk_frame_size_ > 0) {
+        *length = std::min(
+            *length, bulk_frame_size_ - request.written % bulk_frame_size_);
+      }
+      pending = true;
+    }
+  }
+  for (auto& callback : empty_writes) {
+    if (callback) callback(0);
+  }
+  return pending;
+}
+
+void IoPort::CompleteWrite(ssize_t result) {
+  WriteCallback callback;
+  ssize_t reported = result;
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    if (active_lane_ < 0 || tx_[active_lane_].empty()) return;
+    WriteRequest& request = tx_[active_lane_].front();
+    WriteLaneStats& stats = lane_stats_[active_lane_];
+    if (result >= 0) {
+      request.written += result;
+      stats.bytes_written += result;
+      if (request.written < request.data->size()) return;
+      reported = request.written;
+      uint64_t latency_us =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - request.queued)
+              .count();
+      stats.completed_writes++;
+      stats.total_latency_us += latency_us;
+      stats.max_latency_us = std::max(stats.max_latency_us, latency_us);
+      if (trace_ != nullptr) {
+        trace_->Record(TraceStage::kWriteDone, fd_, request.trace_chunk,
+                       request.written);
+      }
+    } else {
+      stats.failed_writes++;
+    }
+    callback = std::move(request.callback);
+    tx_[active_lane_].pop_front();
+  }
+  if (callback) callback(reported);
+}
+
+void IoPort::CancelWrites(int error) {
+  std::vector<WriteRequest> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    for (int lane = 0; lane < kWriteLaneCount; lane++) {
+      lane_stats_[lane].failed_writes += tx_[lane].size();
+      cancelled.insert(cancelled.end(),
+                       std::make_move_iterator(tx_[lane].begin()),
+                       std::make_move_iterator(tx_[lane].end()));
+      tx_[lane].clear();
+    }
+  }
+  for (auto& request : cancelled) {
+    if (request.callback) request.callback(-error);
+  }
+}
+
+void IoPort::CancelQueuedWrites(int error) {
+  std::vector<WriteRequest> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    // Every lane can have a write partly sent, left there by a higher one.
+    for (int lane = 0; lane < kWriteLaneCount; lane++) {
+      std::deque<WriteRequest>& queue = tx_[lane];
+      auto first = queue.begin();
+      if (first != queue.end() && first->started) ++first;
+      lane_stats_[lane].failed_writes += queue.end() - first;
+      cancelled.insert(cancelled.end(), std::make_move_iterator(first),
+                       std::make_move_iterator(queue.end()));
+      queue.erase(first, queue.end());
+    }
+  }
+  for (auto& request : cancelled) {
+    if (request.callback) request.callback(-error);
+  }
+}
+
+std::unique_ptr<IoLoop> IoLoop::Create(IoBackendKind kind) {
+  int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd < 0) return nullptr;
+
+  std::unique_ptr<IoBackend> backend;
+  if (kind == IoBackendKind::kIoUring) {
+    backend = CreateIoUringBackend();
+    if (backend && !backend->Init(wake_fd)) backend.reset();
+  }
+  if (!backend) {
+    backend = CreateEpollBackend();
+    if (!backend->Init(wake_fd)) {
+      close(wake_fd);
+      return nullptr;
+    }
+  }
+
+  return std::unique_ptr<IoLoop>(new IoLoop(std::move(backend), wake_fd));
+}
+
+IoLoop::IoLoop(std::unique_ptr<IoBackend> backend, int wake_fd)
+    : backend_(std::move(backend)),
+      kind_(backend_->kind()),
+      wake_fd_(wake_fd),
+      running_(true) {
+  thread_ = std::thread(&IoLoop::Run, this);
+}
+
+IoLoop::~IoLoop() {
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    running_ = false;
+  }
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof one);
+  (void)ignored;
+  thread_.join();
+  backend_.reset();
+  close(wake_fd_);
+}
+
+bool IoLoop::AddPort(const std::shared_ptr<IoPort>& port) {
+  std::promise<bool> added;
+  Post([this, port, &added]() { added.set_value(backend_->Watch(port)); });
+  return added.get_future().get();
+}
+
+void IoLoop::RemovePort(const std::shared_ptr<IoPort>& port) {
+  std::promise<void> detached;
+  Post([this, port, &detached]() {
+    backend_->Unwatch(port, [port, &detached]() {
+      port->CancelWrites(ECANCELED);
+      detached.set_value();
+    });
+  });
+  detached.get_future().wait();
+}
+
+Status IoLoop::Tune(const ThreadTuning& tuning) {
+  std::promise<Status> applied;
+  Post([this, &tuning, &applied]() {
+    applied.set_value(ApplyThreadTuning(tuning, startup_cpus_));
+  });
+  return applied.get_future().get();
+}
+
+uint64_t IoLoop::Write(const std::shared_ptr<IoPort>& port,
+                       std::vector<uint8_t> data,
+                       IoPort::WriteCallback callback, WriteLane lane) {
+  return Write(port,
+               std::make_shared<const std::vector<uint8_t>>(std::move(data)),
+               std::move(callback), lane);
+}
+
+uint64_t IoLoop::Write(const std::shared_ptr<IoPort>& port, SharedChunk data,
+                       IoPort::WriteCallback callback, WriteLane lane) {
+  uint64_t chunk =
+      port->QueueWrite(std::move(data), std::move(callback), lane);
+  Post([this, port]() { backend_->WritesQueued(port); });
+  return chunk;
+}
+
+void IoLoop::WriteMany(const std::vector<WriteTarget>& targets,
+                       SharedChunk data, BroadcastCallback done) {
+  struct Broadcast {
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point queued;
+    BroadcastResult result;
+    size_t remaining;
+    BroadcastCallback done;
+  };
+  auto broadcast = std::make_shared<Broadcast>();
+  broadcast->queued = std::chrono::steady_clock::now();
+  broadcast->result.results.assign(targets.size(), 0);
+  broadcast->result.finished_ns.assign(targets.size(), 0);
+  broadcast->result.skew_ns = 0;
+  broadcast->remaining = targets.size();
+  broadcast->done = std::move(done);
+  if (targets.empty()) {
+    if (broadcast->done) broadcast->done(broadcast->result);
+    return;
+  }
+
+  // Queue everywhere first, then wake each loop once for all of its ports,
+  // so that the ports start as close together as the loops allow.
+  std::map<IoLoop*, std::vector<std::shared_ptr<IoPort>>> by_loop;
+  for (size_t i = 0; i < targets.size(); i++) {
+    targets[i].port->QueueWrite(data, [broadcast, i](ssize_t result) {
+      BroadcastResult finished;
+      {
+        std::lock_guard<std::mutex> lock(broadcast->mutex);
+        broadcast->result.results[i] = result;
+        broadcast->result.finished_ns[i] =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - broadcast->queued)
+                .count();
+        if (--broadcast->remaining > 0) return;
+        finished = std::move(broadcast->result);
+      }
+      int64_t first = std::numeric_limits<int64_t>::max();
+      int64_t last = 0;
+      for (size_t j = 0; j < finished.results.size(); j++) {
+        if (finished.results[j] < 0) continue;
+        first = std::min(first, finished.finished_ns[j]);
+        last = std::max(last, finished.finished_ns[j]);
+      }
+      finished.skew_ns = last > first ? last - first : 0;
+      if (broadcast->done) broadcast->done(finished);
+    });
+    by_loop[targets[i].loop].push_back(targets[i].port);
+  }
+  for (auto& it : by_loop) {
+    IoLoop* loop = it.first;
+    std::vector<std::shared_ptr<IoPort>> ports = std::move(it.second);
+    loop->Post([loop, ports]() {
+      for (const auto& port : ports) loop->backend_->WritesQueued(port);
+    });
+  }
+}
+
+void IoLoop::SetReceiveHeld(const std::shared_ptr<IoPort>& port,
+                            bool held) {
+  port->receive_held_.store(held, std::memory_order_release);
+  if (!held) Post([this, port]() { backend_->ReceiveReleased(port); });
+}
+
+void IoLoop::Post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof one);
+  (void)ignored;
+}
+
+void IoLoop::Run() {
+  startup_cpus_ = ThreadCpus();
+  std::vector<std::function<void()>> tasks;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(tasks_mutex_);
+      if (!running_) break;
+      tasks.swap(tasks_);
+    }
+    for (auto& task : tasks) task();
+    tasks.clear();
+    backend_->Wait();
+  }
+}
+
+}  // namespace serial_com
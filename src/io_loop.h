@@ -0,0 +1,394 @@
+#ifndef SERIAL_COM_CORE_IO_LOOP_H_
+#define SERIAL_COM_CORE_IO_LOOP_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framer.h"
+#include "port_stats.h"
+#include "read_sizer.h"
+#include "receive_buffer.h"
+#include "receive_fanout.h"
+#include "spill_file.h"
+#include "status.h"
+#include "thread_tuning.h"
+#include "trace_buffer.h"
+
+namespace serial_com {
+
+// How an IoLoop waits for and performs port I/O.
+enum class IoBackendKind {
+  // Readiness based: epoll, then read()/write() per ready port.
+  kEpoll,
+  // Completion based: reads stay posted on every port and writes are
+  // submitted in batches, so the loop needs one syscall per wakeup rather
+  // than one per port.
+  kIoUring,
+};
+
+const char* IoBackendKindName(IoBackendKind kind);
+
+// Parses "epoll" or "io_uring". Returns false for anything else.
+bool ParseIoBackendKind(const char* name, IoBackendKind* kind);
+
+// Transmit priority. Each lane is a FIFO of its own; the next write always
+// comes from the highest lane with one queued.
+enum class WriteLane {
+  // Commands that must not wait, such as an emergency stop.
+  kUrgent,
+  kNormal,
+  // Long transfers. Their writes are sent in frames (see
+  // IoPort::SetBulkFrameSize()) between which the other lanes cut in.
+  kBulk,
+};
+
+constexpr int kWriteLaneCount = 3;
+
+const char* WriteLaneName(WriteLane lane);
+
+// Parses "urgent", "normal" or "bulk". Returns false for anything else.
+bool ParseWriteLane(const char* name, WriteLane* lane);
+
+struct WriteLaneStats {
+  // Writes waiting or in progress, and their unwritten bytes.
+  uint64_t queued_writes;
+  uint64_t queued_bytes;
+  // Totals since the port was opened.
+  uint64_t completed_writes;
+  uint64_t failed_writes;
+  uint64_t bytes_written;
+  // Writes sent ahead of a partly sent write in a lower lane.
+  uint64_t preemptions;
+  // From queueing to the last byte leaving the process, over completed
+  // writes.
+  uint64_t total_latency_us;
+  uint64_t max_latency_us;
+};
+
+// Where a port's unread bytes are, and what its receive budget has cost.
+struct ReceiveBufferStats {
+  // Unread bytes in memory and in the spill file.
+  uint64_t memory_bytes;
+  uint64_t spill_bytes;
+  // Totals since the port was opened.
+  uint64_t spilled_bytes;
+  uint64_t replayed_bytes;
+  // Bytes lost because the spill file could not be written or read.
+  uint64_t dropped_bytes;
+};
+
+// Per-port state shared between the I/O thread and the method handlers.
+//
+// The I/O thread appends everything it reads from the tty to the receive
+// buffer and works through the transmit lanes by priority. Handlers drain the
+// receive buffer and queue writes from any thread.
+class IoPort {
+ public:
+  // Invoked on the I/O thread when data arrives in an empty receive buffer.
+  using DataCallback = std::function<void()>;
+  // Invoked on the I/O thread once a queued write has fully left the
+  // process, with the number of bytes written or a negative errno.
+  using WriteCallback = std::function<void(ssize_t result)>;
+  // Invoked on the I/O thread for every frame a framer cuts from the
+  // received stream.
+  using FrameCallback = Framer::FrameCallback;
+
+  explicit IoPort(int fd);
+
+  // Disallow copy and assign.
+  IoPort(const IoPort&) = delete;
+  IoPort& operator=(const IoPort&) = delete;
+
+  int fd() const { return fd_; }
+
+  void SetDataCallback(DataCallback callback);
+
+  // Routes received bytes through |framer| and hands complete frames to
+  // |callback| instead of the receive buffer. Passing nullptr restores
+  // plain buffering.
+  void SetFrameCallback(std::unique_ptr<Framer> framer,
+                        FrameCallback callback);
+
+  // Passes received bytes through |decoder| (for example a link codec)
+  // before they are buffered or framed. Passing nullptr removes it.
+  void SetDecoder(std::unique_ptr<Framer> decoder);
+
+  // Records the port's read and write stages into |trace| while it is
+  // started. Must be set before the port is added to a loop; |trace| must
+  // outlive the port.
+  void SetTraceBuffer(TraceBuffer* trace) { trace_ = trace; }
+  TraceBuffer* trace_buffer() const { return trace_; }
+
+  PortStats& stats() { return stats_; }
+  // How large the backend's reads of the tty are; its limits may be set
+  // from any thread.
+  ReadSizer& read_sizer() { return read_sizer_; }
+
+  // Sees every received byte, after decoding and before framing or
+  // buffering, whatever else consumes it.
+  const std::shared_ptr<ReceiveFanout>& receive_fanout() const {
+    return fanout_;
+  }
+
+  // Keeps at most |memory_limit| unread bytes in memory and appends the
+  // rest to a spill file in |spill_directory| (see SpillFile::Create for
+  // the default), from which reads replay them in order. A limit of 0
+  // buffers everything in memory again. Fails with CONFIG_ERROR if the
+  // spill file cannot be created.
+  Status SetReceiveLimit(size_t memory_limit,
+                         const std::string& spill_directory);
+  ReceiveBufferStats receive_buffer_stats();
+
+  // Whether the backend should stop reading the tty; see
+  // IoLoop::SetReceiveHeld().
+  bool receive_held() const {
+    return receive_held_.load(std::memory_order_acquire);
+  }
+
+  // Moves up to |max_length| buffered bytes into |out| and returns the
+  // number of bytes moved. When tracing, the ids of the received chunks
+  // this read finished are appended to |finished_chunks|.
+  size_t Read(uint8_t* out, size_t max_length,
+              std::vector<uint64_t>* finished_chunks = nullptr);
+  size_t Available();
+  // Moves the buffered bytes up to and including the first |delimiter|
+  // that ends within the first |max_length| bytes into |out|. Returns
+  // false, moving nothing, if there is no such delimiter yet.
+  bool ReadThrough(const std::vector<uint8_t>& delimiter, size_t max_length,
+                   std::vector<uint8_t>* out);
+  // Blocks until at least |count| bytes are buffered, |deadline| passes or
+  // |cancelled| is set and WakeWaiters() called. Returns whether |count|
+  // bytes are buffered. Bytes taken by a framer never arrive here.
+  bool WaitAvailable(size_t count,
+                     std::chrono::steady_clock::time_point deadline,
+                     const std::atomic<bool>& cancelled);
+  void WakeWaiters();
+  // Drops everything buffered and any partly received frame, as after
+  // tcflush(TCIFLUSH).
+  void DiscardReceived();
+
+  // Backend side of the receive path.
+  void OnReceived(const uint8_t* data, size_t length);
+
+  // Bulk-lane writes are sent |size| bytes at a time, and a write queued
+  // in a higher lane goes out at the next such boundary rather than after
+  // the whole bulk write. 0 makes every bulk write a single frame. Bytes
+  // already handed to the tty stay ahead of it either way.
+  void SetBulkFrameSize(size_t size);
+  WriteLaneStats write_lane_stats(WriteLane lane);
+
+  // Backend side of the transmit path. FrontWrite() exposes the unwritten
+  // part of the current frame of the next write; CompleteWrite() consumes
+  // |result| bytes of it or fails the write with a negative errno.
+  bool FrontWrite(const uint8_t** data, size_t* length);
+  void CompleteWrite(ssize_t result);
+  // Fails every queued write with |error|.
+  void CancelWrites(int error);
+  // Fails the queued writes that have not started with |error|. A write
+  // that is partly written (or in flight) finishes.
+  void CancelQueuedWrites(int error);
+
+ private:
+  friend class IoLoop;
+
+  struct WriteRequest {
+    // Shared when the same bytes go to several ports.
+    SharedChunk data;
+    size_t written;
+    WriteCallback callback;
+    uint64_t trace_chunk;
+    bool started;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  // Returns the write's trace chunk id, or 0 when not tracing.
+  uint64_t QueueWrite(SharedChunk data, WriteCallback callback,
+                      WriteLane lane = WriteLane::kNormal);
+  // Picks the lane the next write comes from, completing the zero-length
+  // writes it passes over into |empty_writes|. Returns -1 if nothing is
+  // queued. Requires tx_mutex_.
+  int NextLaneLocked(std::vector<WriteCallback>* empty_writes);
+  // Whether the front write of |lane| has stopped part way into a frame,
+  // so that nothing may be sent before it continues. Requires tx_mutex_.
+  bool InFrameLocked(int lane) const;
+  // Buffers or frames decoded bytes from trace chunk |chunk|. Sets
+  // |callback| if readers need to be told. Requires rx_mutex_.
+  void DeliverLocked(const uint8_t* data, size_t length, uint64_t chunk,
+                     DataCallback* callback);
+
+  const int fd_;
+
+  PortStats stats_;
+  ReadSizer read_sizer_;
+  TraceBuffer* trace_ = nullptr;
+  const std::shared_ptr<ReceiveFanout> fanout_;
+  std::atomic<bool> receive_held_{false};
+
+  // Moves spilled bytes back into |rx_| until it holds |wanted| bytes or
+  // the spill file is empty. Requires rx_mutex_.
+  void ReplayLocked(size_t wanted);
+  size_t ReadLocked(uint8_t* out, size_t max_length,
+                    std::vector<uint64_t>* finished_chunks);
+  size_t AvailableLocked() const {
+    return rx_.size() + (spill_ ? spill_->size() : 0);
+  }
+
+  std::mutex rx_mutex_;
+  // Notified whenever bytes are buffered, for WaitAvailable().
+  std::condition_variable rx_arrived_;
+  ReceiveBuffer rx_;
+  // 0 for no receive limit.
+  size_t memory_limit_ = 0;
+  // With a receive limit: bytes that arrived while |rx_| was full, all
+  // newer than everything in |rx_|.
+  std::unique_ptr<SpillFile> spill_;
+  uint64_t spilled_bytes_ = 0;
+  uint64_t replayed_bytes_ = 0;
+  // Dropped by spill files that have since been replaced.
+  uint64_t retired_dropped_bytes_ = 0;
+  DataCallback data_callback_;
+  std::unique_ptr<Framer> framer_;
+  FrameCallback frame_callback_;
+  std::unique_ptr<Framer> decoder_;
+  // With a trace buffer: the trace chunk id and remaining length of every
+  // chunk in |rx_|, oldest first. Chunks received while tracing was
+  // stopped have id 0.
+  std::deque<std::pair<uint64_t, size_t>> rx_chunks_;
+
+  std::mutex tx_mutex_;
+  std::deque<WriteRequest> tx_[kWriteLaneCount];
+  // The lane FrontWrite() last exposed, which CompleteWrite() applies to.
+  int active_lane_ = -1;
+  size_t bulk_frame_size_;
+  // Only the totals; the queue depths are counted when asked for.
+  WriteLaneStats lane_stats_[kWriteLaneCount] = {};
+};
+
+// The part of an IoLoop that talks to the kernel. All methods run on the
+// loop thread.
+class IoBackend {
+ public:
+  virtual ~IoBackend() = default;
+
+  virtual IoBackendKind kind() const = 0;
+
+  // Prepares the backend. |wake_fd| is an eventfd that becomes readable
+  // whenever Wait() should return early.
+  virtual bool Init(int wake_fd) = 0;
+
+  // Starts receiving on |port|.
+  virtual bool Watch(const std::shared_ptr<IoPort>& port) = 0;
+  // Stops all I/O on |port|. |detached| runs once the backend no longer
+  // references the port or its fd, which may be after Unwatch() returns.
+  virtual void Unwatch(const std::shared_ptr<IoPort>& port,
+                       std::function<void()> detached) = 0;
+  // Called after writes are queued on |port|.
+  virtual void WritesQueued(const std::shared_ptr<IoPort>& port) = 0;
+  // Called after |port|'s receive hold is released. Backends check
+  // IoPort::receive_held() after every read they deliver and stop reading
+  // until this is called.
+  virtual void ReceiveReleased(const std::shared_ptr<IoPort>& port) = 0;
+
+  // Blocks until there is I/O or a wakeup and dispatches it.
+  virtual void Wait() = 0;
+};
+
+std::unique_ptr<IoBackend> CreateEpollBackend();
+// Returns nullptr when the running kernel (or the headers this was built
+// against) lack the io_uring features the backend needs.
+std::unique_ptr<IoBackend> CreateIoUringBackend();
+
+// The outcome of IoLoop::WriteMany().
+struct BroadcastResult {
+  // Per port, in the order given: bytes written or a negative errno.
+  std::vector<ssize_t> results;
+  // Per port: when its write had fully left the process, in nanoseconds
+  // since the broadcast was queued.
+  std::vector<int64_t> finished_ns;
+  // Between the first and the last successful port finishing.
+  int64_t skew_ns;
+};
+
+// A thread that performs the I/O for a set of ports.
+class IoLoop {
+ public:
+  struct WriteTarget {
+    IoLoop* loop;
+    std::shared_ptr<IoPort> port;
+  };
+  // Invoked once, on the I/O thread of the last port to finish.
+  using BroadcastCallback = std::function<void(const BroadcastResult&)>;
+
+  // Creates a loop with the requested backend, falling back to epoll when
+  // io_uring is unavailable. Returns nullptr if no backend can be set up.
+  static std::unique_ptr<IoLoop> Create(IoBackendKind kind);
+
+  ~IoLoop();
+
+  // Disallow copy and assign.
+  IoLoop(const IoLoop&) = delete;
+  IoLoop& operator=(const IoLoop&) = delete;
+
+  // The backend actually in use.
+  IoBackendKind kind() const { return kind_; }
+
+  // Starts servicing |port|. Blocks until the loop has picked it up.
+  bool AddPort(const std::shared_ptr<IoPort>& port);
+  // Stops servicing |port| and fails its queued writes. Blocks until the
+  // backend has let go of the fd, after which it is safe to close it.
+  void RemovePort(const std::shared_ptr<IoPort>& port);
+  // Applies |tuning| to the loop thread. Blocks until it has been applied.
+  Status Tune(const ThreadTuning& tuning);
+  // Queues |data| for transmission on |port| in |lane|. Returns the
+  // write's trace chunk id, or 0 when the port is not being traced.
+  uint64_t Write(const std::shared_ptr<IoPort>& port,
+                 std::vector<uint8_t> data, IoPort::WriteCallback callback,
+                 WriteLane lane = WriteLane::kNormal);
+  uint64_t Write(const std::shared_ptr<IoPort>& port, SharedChunk data,
+                 IoPort::WriteCallback callback,
+                 WriteLane lane = WriteLane::kNormal);
+  // Queues the same |data| on every target without copying it, and wakes
+  // each loop involved once for all of its ports, so that they start
+  // transmitting together. Each write keeps its place in its port's
+  // transmit queue. Calls |done| once every port has finished.
+  static void WriteMany(const std::vector<WriteTarget>& targets,
+                        SharedChunk data, BroadcastCallback done);
+  // Stops or resumes reading |port|'s tty, so that a consumer that cannot
+  // keep up pushes back on the device through the kernel's input buffer
+  // (and flow control, if configured) instead of losing data. The read in
+  // progress when a hold starts is still delivered. Any thread.
+  void SetReceiveHeld(const std::shared_ptr<IoPort>& port, bool held);
+
+ private:
+  IoLoop(std::unique_ptr<IoBackend> backend, int wake_fd);
+
+  void Post(std::function<void()> task);
+  void Run();
+
+  std::unique_ptr<IoBackend> backend_;
+  const IoBackendKind kind_;
+  const int wake_fd_;
+
+  std::mutex tasks_mutex_;
+  std::vector<std::function<void()>> tasks_;
+  bool running_;
+
+  std::thread thread_;
+  // The loop thread's affinity before any tuning. Only used on the thread.
+  cpu_set_t startup_cpus_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_IO_LOOP_H_
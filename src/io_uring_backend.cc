@@ -0,0 +1,523 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "io_loop.h"
+
+// The backend talks to the kernel through the raw syscalls so that the
+// plugin does not pick up a liburing dependency. It needs headers from
+// Linux 5.7 or newer; older build hosts get the epoll backend only.
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_FAST_POLL)
+#define SERIAL_COM_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace serial_com {
+
+#ifdef SERIAL_COM_HAVE_IO_URING
+
+namespace {
+
+constexpr unsigned kSubmissionEntries = 256;
+constexpr unsigned kCompletionEntries = 4096;
+constexpr size_t kReadChunkSize = 4096;
+// Number of read buffers registered with the ring up front. Ports opened
+// beyond this, and reads the port's ReadSizer wants larger than a chunk,
+// use unregistered buffers.
+constexpr unsigned kRegisteredBuffers = 512;
+
+// The low bits of a submission's user_data say what it was for; the rest is
+// the Entry it belongs to.
+constexpr uint64_t kTagMask = 7;
+constexpr uint64_t kTagReadPoll = 1;
+constexpr uint64_t kTagRead = 2;
+constexpr uint64_t kTagWritePoll = 3;
+constexpr uint64_t kTagWrite = 4;
+// Entry-less submissions.
+constexpr uint64_t kIgnoredCompletion = 0;
+constexpr uint64_t kWakeCompletion = 5;
+
+int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int ring_fd, unsigned opcode, const void* arg,
+                      unsigned nr_args) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+class IoUringBackend : public IoBackend {
+ public:
+  IoUringBackend()
+      : ring_fd_(-1),
+        wake_fd_(-1),
+        sq_ring_(MAP_FAILED),
+        cq_ring_(MAP_FAILED),
+        sqes_(MAP_FAILED),
+        sq_ring_size_(0),
+        cq_ring_size_(0),
+        sqes_size_(0),
+        sqe_tail_(0),
+        unsubmitted_(0),
+        buffers_(MAP_FAILED) {}
+
+  ~IoUringBackend() override {
+    // Closing the ring cancels whatever is still in flight.
+    if (ring_fd_ >= 0) close(ring_fd_);
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+    if (buffers_ != MAP_FAILED) {
+      munmap(buffers_, kRegisteredBuffers * kReadChunkSize);
+    }
+    for (auto& it : entries_) delete it.second;
+    for (Entry* entry : closing_) delete entry;
+  }
+
+  IoBackendKind kind() const override { return IoBackendKind::kIoUring; }
+
+  bool Init(int wake_fd) override {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = kCompletionEntries;
+    ring_fd_ = io_uring_setup(kSubmissionEntries, &params);
+    if (ring_fd_ < 0) return false;
+    if (!MapRings(params) || !SupportsRequiredOps()) return false;
+
+    wake_fd_ = wake_fd;
+    RegisterBuffers();
+    PostWakePoll();
+    return true;
+  }
+
+  bool Watch(const std::shared_ptr<IoPort>& port) override {
+    int flags = fcntl(port->fd(), F_GETFL);
+    if (flags < 0 || fcntl(port->fd(), F_SETFL, flags | O_NONBLOCK) < 0) {
+      return false;
+    }
+    Entry* entry = new Entry();
+    entry->port = port;
+    if (!free_buffers_.empty()) {
+      entry->buffer_index = free_buffers_.back();
+      free_buffers_.pop_back();
+      entry->buffer = static_cast<uint8_t*>(buffers_) +
+                      entry->buffer_index * kReadChunkSize;
+    }
+    entries_[port->fd()] = entry;
+    PostRead(entry);
+    return true;
+  }
+
+  void Unwatch(const std::shared_ptr<IoPort>& port,
+               std::function<void()> detached) override {
+    auto it = entries_.find(port->fd());
+    if (it == entries_.end()) {
+      detached();
+      return;
+    }
+    Entry* entry = it->second;
+    entries_.erase(it);
+    entry->detached = std::move(detached);
+    closing_.push_back(entry);
+    for (uint64_t tag : {kTagReadPoll, kTagRead, kTagWritePoll, kTagWrite}) {
+      struct io_uring_sqe* sqe = GetSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = UserData(entry, tag);
+      sqe->user_data = kIgnoredCompletion;
+    }
+    MaybeRelease(entry);
+  }
+
+  void WritesQueued(const std::shared_ptr<IoPort>& port) override {
+    auto it = entries_.find(port->fd());
+    if (it == entries_.end()) {
+      port->CancelWrites(EBADF);
+      return;
+    }
+    // The submission itself is deferred to Wait(), so writes queued for
+    // many ports in one loop iteration go to the kernel in one syscall.
+    if (!it->second->write_posted) PostWrite(it->second, false);
+  }
+
+  void ReceiveReleased(const std::shared_ptr<IoPort>& port) override {
+    auto it = entries_.find(port->fd());
+    if (it == entries_.end() || !it->second->read_parked) return;
+    it->second->read_parked = false;
+    PostRead(it->second);
+  }
+
+  void Wait() override {
+    int submitted = io_uring_enter(ring_fd_, unsubmitted_, 1,
+                                   IORING_ENTER_GETEVENTS);
+    if (submitted > 0) unsubmitted_ -= submitted;
+    Reap();
+  }
+
+ private:
+  struct Entry {
+    std::shared_ptr<IoPort> port;
+    // The registered buffer, if the port got one.
+    int buffer_index = -1;
+    uint8_t* buffer = nullptr;
+    // Fitted by the port's ReadSizer when the registered buffer is missing
+    // or too small.
+    std::vector<uint8_t> heap_buffer;
+    // Where the posted read goes, and how much it asks for.
+    uint8_t* read_buffer = nullptr;
+    size_t read_size = 0;
+    // What FIONREAD reported after the last read filled its buffer.
+    size_t queued = 0;
+    bool write_posted = false;
+    // Set when a read completed while the port's receive was held; the
+    // next read is posted once it is released.
+    bool read_parked = false;
+    // Submissions still owned by the kernel.
+    int in_flight = 0;
+    bool closing = false;
+    std::function<void()> detached;
+  };
+
+  static uint64_t UserData(Entry* entry, uint64_t tag) {
+    return reinterpret_cast<uint64_t>(entry) | tag;
+  }
+
+  bool MapRings(const struct io_uring_params& params) {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) return false;
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED) return false;
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) return false;
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqe_tail_ = *sq_tail_;
+
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // IORING_REGISTER_PROBE itself only exists from Linux 5.6, which is also
+  // where plain READ/WRITE appeared, so a failed probe means "too old".
+  bool SupportsRequiredOps() {
+    size_t size = sizeof(struct io_uring_probe) +
+                  IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe =
+        static_cast<struct io_uring_probe*>(calloc(1, size));
+    if (probe == nullptr) return false;
+    bool supported =
+        io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe,
+                          IORING_OP_LAST) == 0;
+    for (int op : {IORING_OP_POLL_ADD, IORING_OP_READ, IORING_OP_READ_FIXED,
+                   IORING_OP_WRITE, IORING_OP_ASYNC_CANCEL}) {
+      supported = supported && op <= probe->last_op &&
+                  (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+  }
+
+  // Registered buffers spare the kernel from pinning and unpinning the
+  // destination pages on every read. Registration can fail against
+  // RLIMIT_MEMLOCK on older kernels; reads then use ordinary buffers.
+  void RegisterBuffers() {
+    size_t size = kRegisteredBuffers * kReadChunkSize;
+    buffers_ = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers_ == MAP_FAILED) return;
+    std::vector<struct iovec> iovecs(kRegisteredBuffers);
+    for (unsigned i = 0; i < kRegisteredBuffers; i++) {
+      iovecs[i].iov_base = static_cast<uint8_t*>(buffers_) + i * kReadChunkSize;
+      iovecs[i].iov_len = kReadChunkSize;
+    }
+    if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(),
+                          kRegisteredBuffers) != 0) {
+      munmap(buffers_, size);
+      buffers_ = MAP_FAILED;
+      return;
+    }
+    for (unsigned i = kRegisteredBuffers; i > 0; i--) {
+      free_buffers_.push_back(i - 1);
+    }
+  }
+
+  struct io_uring_sqe* GetSqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    while (sqe_tail_ - head >= sq_entries_) {
+      // The ring is full: hand what we have to the kernel and try again.
+      int submitted = io_uring_enter(ring_fd_, unsubmitted_, 0, 0);
+      if (submitted > 0) unsubmitted_ -= submitted;
+      if (submitted <= 0) Reap();
+      head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+    unsigned index = sqe_tail_ & sq_mask_;
+    struct io_uring_sqe* sqe = &static_cast<struct io_uring_sqe*>(sqes_)[index];
+    memset(sqe, 0, sizeof *sqe);
+    sq_array_[index] = index;
+    sqe_tail_++;
+    unsubmitted_++;
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+    return sqe;
+  }
+
+  void PostWakePoll() {
+    struct io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd_;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = kWakeCompletion;
+  }
+
+  // Keeps a read outstanding on the port. The read is linked behind a poll
+  // so that it only runs once the tty has data, and both go to the kernel
+  // together. Reads the ReadSizer wants no larger than a chunk use the
+  // whole registered buffer, which costs nothing extra.
+  void PostRead(Entry* entry) {
+    ReadSizer& sizer = entry->port->read_sizer();
+    size_t size = sizer.NextReadSize(entry->queued);
+    entry->queued = 0;
+
+    struct io_uring_sqe* poll = GetSqe();
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = entry->port->fd();
+    poll->poll_events = POLLIN;
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = UserData(entry, kTagReadPoll);
+
+    struct io_uring_sqe* read = GetSqe();
+    read->fd = entry->port->fd();
+    if (entry->buffer_index >= 0 && size <= kReadChunkSize) {
+      std::vector<uint8_t>().swap(entry->heap_buffer);
+      sizer.SetBufferSize(kReadChunkSize);
+      entry->read_buffer = entry->buffer;
+      entry->read_size = kReadChunkSize;
+      read->opcode = IORING_OP_READ_FIXED;
+      read->buf_index = entry->buffer_index;
+    } else {
+      sizer.FitBuffer(size, &entry->heap_buffer);
+      entry->read_buffer = entry->heap_buffer.data();
+      entry->read_size = size;
+      read->opcode = IORING_OP_READ;
+    }
+    read->addr = reinterpret_cast<uint64_t>(entry->read_buffer);
+    read->len = static_cast<unsigned>(entry->read_size);
+    read->user_data = UserData(entry, kTagRead);
+    entry->in_flight += 2;
+  }
+
+  // Submits the head of the port's transmit queue. When the previous
+  // attempt found the tty full, the write waits behind a POLLOUT poll.
+  void PostWrite(Entry* entry, bool wait_writable) {
+    const uint8_t* data;
+    size_t length;
+    if (!entry->port->FrontWrite(&data, &length)) return;
+    if (wait_writable) {
+      struct io_uring_sqe* poll = GetSqe();
+      poll->opcode = IORING_OP_POLL_ADD;
+      poll->fd = entry->port->fd();
+      poll->poll_events = POLLOUT;
+      poll->flags = IOSQE_IO_LINK;
+      poll->user_data = UserData(entry, kTagWritePoll);
+      entry->in_flight++;
+    }
+    struct io_uring_sqe* write = GetSqe();
+    write->opcode = IORING_OP_WRITE;
+    write->fd = entry->port->fd();
+    write->addr = reinterpret_cast<uint64_t>(data);
+    write->len = static_cast<unsigned>(length);
+    write->user_data = UserData(entry, kTagWrite);
+    entry->write_posted = true;
+    entry->in_flight++;
+  }
+
+  void Reap() {
+    unsigned head = *cq_head_;
+    while (true) {
+      unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      if (head == tail) break;
+      struct io_uring_cqe cqe = cqes_[head & cq_mask_];
+      head++;
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      Complete(cqe.user_data, cqe.res);
+    }
+  }
+
+  void Complete(uint64_t user_data, int result) {
+    if (user_data == kIgnoredCompletion) return;
+    if (user_data == kWakeCompletion) {
+      uint64_t value;
+      ssize_t ignored = read(wake_fd_, &value, sizeof value);
+      (void)ignored;
+      PostWakePoll();
+      return;
+    }
+
+    Entry* entry = reinterpret_cast<Entry*>(user_data & ~kTagMask);
+    uint64_t tag = user_data & kTagMask;
+    entry->in_flight--;
+    if (entry->closing) {
+      MaybeRelease(entry);
+      return;
+    }
+
+    switch (tag) {
+      case kTagRead:
+        entry->port->stats().RecordRead(result == -EAGAIN ? 0 : result);
+        if (result > 0) {
+          entry->port->read_sizer().OnRead(result,
+                                           std::chrono::steady_clock::now());
+          entry->port->OnReceived(entry->read_buffer, result);
+        }
+        // A full read may have left more behind; size the next one to
+        // take all of it.
+        if (result > 0 && static_cast<size_t>(result) == entry->read_size) {
+          int available = 0;
+          entry->port->stats().RecordReadSizing();
+          if (ioctl(entry->port->fd(), FIONREAD, &available) == 0 &&
+              available > 0) {
+            entry->queued = available;
+          }
+        }
+        // A hung up tty keeps reporting readable; stop reading from it
+        // rather than spinning until the port is closed.
+        if ((result > 0 || result == -EAGAIN || result == -EINTR) &&
+            entry->port->receive_held()) {
+          entry->read_parked = true;
+        } else if (result > 0 || result == -EAGAIN || result == -EINTR) {
+          PostRead(entry);
+        } else if (entry->write_posted) {
+          // The kernel is still reading the started write's buffer; it
+          // fails or finishes through its own completion.
+          entry->port->CancelQueuedWrites(EIO);
+        } else {
+          entry->port->CancelWrites(EIO);
+        }
+        break;
+      case kTagWrite:
+        entry->write_posted = false;
+        if (result != -ECANCELED) {
+          entry->port->stats().RecordWrite(result == -EAGAIN ? 0 : result);
+        }
+        if (result == -EAGAIN) {
+          PostWrite(entry, true);
+        } else if (result != -ECANCELED) {
+          entry->port->CompleteWrite(result);
+          PostWrite(entry, false);
+        }
+        break;
+      default:
+        // Poll completions only gate the linked read or write.
+        break;
+    }
+  }
+
+  void MaybeRelease(Entry* entry) {
+    entry->closing = true;
+    if (entry->in_flight > 0) return;
+    if (entry->buffer_index >= 0) free_buffers_.push_back(entry->buffer_index);
+    for (auto it = closing_.begin(); it != closing_.end(); ++it) {
+      if (*it == entry) {
+        closing_.erase(it);
+        break;
+      }
+    }
+    std::function<void()> detached = std::move(entry->detached);
+    delete entry;
+    if (detached) detached();
+  }
+
+  int ring_fd_;
+  int wake_fd_;
+
+  void* sq_ring_;
+  void* cq_ring_;
+  void* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  unsigned sqe_tail_;
+  unsigned unsubmitted_;
+
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  void* buffers_;
+  std::vector<int> free_buffers_;
+
+  std::map<int, Entry*> entries_;
+  std::vector<Entry*> closing_;
+};
+
+}  // namespace
+
+std::unique_ptr<IoBackend> CreateIoUringBackend() {
+  return std::unique_ptr<IoBackend>(new IoUringBackend());
+}
+
+#else  // SERIAL_COM_HAVE_IO_URING
+
+std::unique_ptr<IoBackend> CreateIoUringBackend() {
+  return nullptr;
+}
+
+#endif  // SERIAL_COM_HAVE_IO_URING
+
+}  // namespace serial_com
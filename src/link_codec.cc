@@ -0,0 +1,133 @@
+#include "link_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "crc16.h"
+#include "lz4_block.h"
+
+namespace serial_com {
+
+namespace {
+
+constexpr uint16_t kStoredFlag = 0x8000;
+
+}  // namespace
+
+const char* LinkCodecName(LinkCodec codec) {
+  switch (codec) {
+    case LinkCodec::kNone:
+      return "none";
+    case LinkCodec::kLz4:
+      return "lz4";
+  }
+  return "unknown";
+}
+
+bool ParseLinkCodec(const char* name, LinkCodec* codec) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "none") == 0) {
+    *codec = LinkCodec::kNone;
+    return true;
+  }
+  if (strcmp(name, "lz4") == 0) {
+    *codec = LinkCodec::kLz4;
+    return true;
+  }
+  return false;
+}
+
+void EncodeLz4Frames(const uint8_t* data, size_t length,
+                     std::vector<uint8_t>* out, LinkCodecStats* stats) {
+  const size_t start = out->size();
+  for (size_t offset = 0; offset < length; offset += kLz4FrameMaxData) {
+    const size_t raw = std::min(kLz4FrameMaxData, length - offset);
+    const size_t header = out->size();
+    out->resize(header + kLz4FrameHeaderSize + Lz4CompressBound(raw) +
+                kLz4FrameTrailerSize);
+    uint8_t* payload = out->data() + header + kLz4FrameHeaderSize;
+    size_t payload_length = Lz4Compress(data + offset, raw, payload);
+    uint16_t flags = 0;
+    if (payload_length >= raw) {
+      memcpy(payload, data + offset, raw);
+      payload_length = raw;
+      flags = kStoredFlag;
+    }
+    uint8_t* h = out->data() + header;
+    h[0] = kLz4FrameSync;
+    h[1] = static_cast<uint8_t>(raw);
+    h[2] = static_cast<uint8_t>(raw >> 8);
+    h[3] = static_cast<uint8_t>(payload_length);
+    h[4] = static_cast<uint8_t>((payload_length | flags) >> 8);
+    const uint16_t crc = Crc16Xmodem(data + offset, raw);
+    payload[payload_length] = static_cast<uint8_t>(crc);
+    payload[payload_length + 1] = static_cast<uint8_t>(crc >> 8);
+    out->resize(header + kLz4FrameHeaderSize + payload_length +
+                kLz4FrameTrailerSize);
+  }
+  if (stats != nullptr) stats->RecordEncoded(length, out->size() - start);
+}
+
+Lz4FrameDecoder::Lz4FrameDecoder(std::shared_ptr<LinkCodecStats> stats)
+    : stats_(std::move(stats)), decoded_(kLz4FrameMaxData) {}
+
+void Lz4FrameDecoder::Push(const uint8_t* data, size_t length,
+                           const FrameCallback& on_frame) {
+  pending_.insert(pending_.end(), data, data + length);
+  size_t pos = 0;
+  while (pos < pending_.size()) {
+    if (pending_[pos] != kLz4FrameSync) {
+      const uint8_t* sync = static_cast<const uint8_t*>(memchr(
+          pending_.data() + pos, kLz4FrameSync, pending_.size() - pos));
+      pos = sync != nullptr ? sync - pending_.data() : pending_.size();
+      continue;
+    }
+    int64_t used =
+        DecodeFrame(pending_.data() + pos, pending_.size() - pos, on_frame);
+    if (used == 0) break;
+    if (used < 0) {
+      // Resynchronise on the next sync byte.
+      stats_->RecordDecodeError();
+      pos++;
+      continue;
+    }
+    pos += used;
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + pos);
+}
+
+void Lz4FrameDecoder::Reset() { pending_.clear(); }
+
+int64_t Lz4FrameDecoder::DecodeFrame(const uint8_t* frame, size_t available,
+                                     const FrameCallback& on_frame) {
+  if (available < kLz4FrameHeaderSize) return 0;
+  const size_t raw = frame[1] | (frame[2] << 8);
+  const uint16_t field = frame[3] | (frame[4] << 8);
+  const bool stored = (field & kStoredFlag) != 0;
+  const size_t payload_length = field & ~kStoredFlag;
+  if (raw == 0 || raw > kLz4FrameMaxData ||
+      (stored ? payload_length != raw
+              : payload_length > Lz4CompressBound(raw))) {
+    return -1;
+  }
+  const size_t frame_length =
+      kLz4FrameHeaderSize + payload_length + kLz4FrameTrailerSize;
+  if (available < frame_length) return 0;
+
+  const uint8_t* payload = frame + kLz4FrameHeaderSize;
+  const uint8_t* data = payload;
+  if (!stored) {
+    int64_t decoded =
+        Lz4Decompress(payload, payload_length, decoded_.data(), raw);
+    if (decoded != static_cast<int64_t>(raw)) return -1;
+    data = decoded_.data();
+  }
+  const uint8_t* trailer = payload + payload_length;
+  if (Crc16Xmodem(data, raw) != (trailer[0] | (trailer[1] << 8))) return -1;
+  on_frame(data, raw);
+  stats_->RecordDecoded(raw, frame_length);
+  return frame_length;
+}
+
+}  // namespace serial_com
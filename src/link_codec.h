@@ -0,0 +1,124 @@
+#ifndef SERIAL_COM_CORE_LINK_CODEC_H_
+#define SERIAL_COM_CORE_LINK_CODEC_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "framer.h"
+
+namespace serial_com {
+
+// Compression applied between the application and the wire. Both ends of
+// the link must use the same codec.
+enum class LinkCodec {
+  kNone,
+  // Writes are split into frames of at most kLz4FrameMaxData bytes, each
+  // sent as
+  //
+  //   0xA5                       sync byte
+  //   uint16 LE raw length       1..kLz4FrameMaxData
+  //   uint16 LE payload length   bit 15 set: payload is stored uncompressed
+  //   payload                    an LZ4 block, or the raw bytes
+  //   uint16 LE CRC              Crc16Xmodem of the raw bytes
+  //
+  // The sync byte lets a receiver recover from a corrupted frame by
+  // scanning for the next one. The CRC catches corruption that still
+  // leaves a well-formed frame, such as a bit flipped in stored bytes.
+  kLz4,
+};
+
+const char* LinkCodecName(LinkCodec codec);
+
+// Parses "none" or "lz4". Returns false for anything else.
+bool ParseLinkCodec(const char* name, LinkCodec* codec);
+
+constexpr uint8_t kLz4FrameSync = 0xA5;
+constexpr size_t kLz4FrameHeaderSize = 5;
+constexpr size_t kLz4FrameTrailerSize = 2;
+constexpr size_t kLz4FrameMaxData = 4096;
+
+struct LinkCodecStatsSnapshot {
+  // Bytes before encoding and after decoding.
+  uint64_t raw_bytes_sent;
+  uint64_t raw_bytes_received;
+  // Bytes on the wire, headers and trailers included.
+  uint64_t wire_bytes_sent;
+  uint64_t wire_bytes_received;
+  // Frames dropped because their header or payload was malformed, or
+  // their CRC did not match.
+  uint64_t decode_errors;
+};
+
+// Shared by a port's encoder (write path) and decoder (I/O thread).
+class LinkCodecStats {
+ public:
+  LinkCodecStats() = default;
+
+  // Disallow copy and assign.
+  LinkCodecStats(const LinkCodecStats&) = delete;
+  LinkCodecStats& operator=(const LinkCodecStats&) = delete;
+
+  void RecordEncoded(size_t raw, size_t wire) {
+    raw_bytes_sent_.fetch_add(raw, std::memory_order_relaxed);
+    wire_bytes_sent_.fetch_add(wire, std::memory_order_relaxed);
+  }
+  void RecordDecoded(size_t raw, size_t wire) {
+    raw_bytes_received_.fetch_add(raw, std::memory_order_relaxed);
+    wire_bytes_received_.fetch_add(wire, std::memory_order_relaxed);
+  }
+  void RecordDecodeError() {
+    decode_errors_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  LinkCodecStatsSnapshot Snapshot() const {
+    LinkCodecStatsSnapshot snapshot;
+    snapshot.raw_bytes_sent = raw_bytes_sent_.load(std::memory_order_relaxed);
+    snapshot.raw_bytes_received =
+        raw_bytes_received_.load(std::memory_order_relaxed);
+    snapshot.wire_bytes_sent = wire_bytes_sent_.load(std::memory_order_relaxed);
+    snapshot.wire_bytes_received =
+        wire_bytes_received_.load(std::memory_order_relaxed);
+    snapshot.decode_errors = decode_errors_.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+ private:
+  std::atomic<uint64_t> raw_bytes_sent_{0};
+  std::atomic<uint64_t> raw_bytes_received_{0};
+  std::atomic<uint64_t> wire_bytes_sent_{0};
+  std::atomic<uint64_t> wire_bytes_received_{0};
+  std::atomic<uint64_t> decode_errors_{0};
+};
+
+// Appends the kLz4 encoding of |length| bytes to |out|. Frames that would
+// not shrink are stored uncompressed. |stats| may be null.
+void EncodeLz4Frames(const uint8_t* data, size_t length,
+                     std::vector<uint8_t>* out, LinkCodecStats* stats);
+
+// Turns a received kLz4 stream back into the original bytes. Each decoded
+// frame is handed on as one chunk.
+class Lz4FrameDecoder : public Framer {
+ public:
+  explicit Lz4FrameDecoder(std::shared_ptr<LinkCodecStats> stats);
+
+  void Push(const uint8_t* data, size_t length,
+            const FrameCallback& on_frame) override;
+  void Reset() override;
+
+ private:
+  // Decodes the frame at the start of |frame|. Returns the number of bytes
+  // it occupies, 0 if more input is needed, or -1 if it is malformed.
+  int64_t DecodeFrame(const uint8_t* frame, size_t available,
+                      const FrameCallback& on_frame);
+
+  const std::shared_ptr<LinkCodecStats> stats_;
+  std::vector<uint8_t> pending_;
+  std::vector<uint8_t> decoded_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_LINK_CODEC_H_
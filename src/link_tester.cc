@@ -0,0 +1,316 @@
+#include "link_tester.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+// Writes kept in flight during the throughput run.
+constexpr int kWriteWindow = 4;
+// Bytes that must match after a gap before it is taken for a drop, and
+// the longest drop looked for.
+constexpr size_t kResyncWindow = 16;
+constexpr size_t kMaxDrop = 4096;
+
+struct PrbsPolynomial {
+  int degree;
+  int tap;
+};
+
+void GeneratePrbs(PrbsPolynomial polynomial, size_t length,
+                  std::vector<uint8_t>* out) {
+  const uint32_t mask = (1u << polynomial.degree) - 1;
+  uint32_t state = mask;
+  out->resize(length);
+  for (size_t i = 0; i < length; i++) {
+    uint8_t byte = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      uint32_t next = ((state >> (polynomial.degree - 1)) ^
+                       (state >> (polynomial.tap - 1))) &
+                      1;
+      state = ((state << 1) | next) & mask;
+      byte = static_cast<uint8_t>((byte << 1) | next);
+    }
+    (*out)[i] = byte;
+  }
+}
+
+int PopCount(uint8_t byte) {
+  int count = 0;
+  for (; byte != 0; byte &= byte - 1) count++;
+  return count;
+}
+
+uint64_t Micros(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+}  // namespace
+
+const char* LinkTestPatternName(LinkTestPattern pattern) {
+  switch (pattern) {
+    case LinkTestPattern::kPrbs7:
+      return "prbs7";
+    case LinkTestPattern::kPrbs15:
+      return "prbs15";
+    case LinkTestPattern::kPrbs31:
+      return "prbs31";
+    case LinkTestPattern::kCounter:
+      return "counter";
+    case LinkTestPattern::kAlternating:
+      return "alternating";
+  }
+  return "unknown";
+}
+
+bool ParseLinkTestPattern(const char* name, LinkTestPattern* pattern) {
+  static const LinkTestPattern kPatterns[] = {
+      LinkTestPattern::kPrbs7, LinkTestPattern::kPrbs15,
+      LinkTestPattern::kPrbs31, LinkTestPattern::kCounter,
+      LinkTestPattern::kAlternating};
+  for (LinkTestPattern candidate : kPatterns) {
+    if (strcmp(name, LinkTestPatternName(candidate)) == 0) {
+      *pattern = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void GenerateLinkTestPattern(LinkTestPattern pattern, size_t length,
+                             std::vector<uint8_t>* out) {
+  switch (pattern) {
+    case LinkTestPattern::kPrbs7:
+      GeneratePrbs(PrbsPolynomial{7, 6}, length, out);
+      return;
+    case LinkTestPattern::kPrbs15:
+      GeneratePrbs(PrbsPolynomial{15, 14}, length, out);
+      return;
+    case LinkTestPattern::kPrbs31:
+      GeneratePrbs(PrbsPolynomial{31, 28}, length, out);
+      return;
+    case LinkTestPattern::kCounter:
+      out->resize(length);
+      for (size_t i = 0; i < length; i++) {
+        (*out)[i] = static_cast<uint8_t>(i);
+      }
+      return;
+    case LinkTestPattern::kAlternating:
+      out->resize(length);
+      for (size_t i = 0; i < length; i++) {
+        (*out)[i] = i % 2 == 0 ? 0x55 : 0xaa;
+      }
+      return;
+  }
+}
+
+LinkErrorCounts CompareLoopback(const std::vector<uint8_t>& sent,
+                                const std::vector<uint8_t>& received) {
+  LinkErrorCounts counts;
+  size_t s = 0;
+  size_t r = 0;
+  while (s < sent.size() && r < received.size()) {
+    if (sent[s] == received[r]) {
+      s++;
+      r++;
+      continue;
+    }
+    // Either this byte was corrupted or some were lost before it. A drop
+    // leaves the following bytes matching the sent stream further on.
+    size_t window = std::min(kResyncWindow, received.size() - r);
+    size_t drop = 0;
+    for (size_t d = 1; d <= kMaxDrop && s + d + window <= sent.size(); d++) {
+      if (memcmp(&sent[s + d], &received[r], window) == 0) {
+        drop = d;
+        break;
+      }
+    }
+    if (drop > 0) {
+      counts.dropped_bytes += drop;
+      s += drop;
+      continue;
+    }
+    counts.byte_errors++;
+    counts.bit_errors += PopCount(sent[s] ^ received[r]);
+    s++;
+    r++;
+  }
+  counts.dropped_bytes += sent.size() - s;
+  counts.extra_bytes = received.size() - r;
+  return counts;
+}
+
+LinkTester::LinkTester(const LinkTestOptions& options, SendFn send,
+                       DoneFn done)
+    : options_(options),
+      send_(std::move(send)),
+      done_(std::move(done)),
+      state_(std::make_shared<State>()) {}
+
+LinkTester::~LinkTester() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stopping = true;
+    state_->changed.notify_all();
+  }
+  if (thread_.joinable()) thread_.join();
+}
+
+void LinkTester::Start() { thread_ = std::thread(&LinkTester::Run, this); }
+
+void LinkTester::OnReceived(const uint8_t* data, size_t length) {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->received.insert(state_->received.end(), data, data + length);
+  state_->last_received = Clock::now();
+  state_->last_activity = state_->last_received;
+  state_->changed.notify_all();
+}
+
+void LinkTester::Run() {
+  LinkTestReport report;
+  report.status = MeasureThroughput(&report);
+  if (report.status.ok()) report.status = MeasureLatency(&report);
+  if (done_) done_(report);
+}
+
+Status LinkTester::MeasureThroughput(LinkTestReport* report) {
+  std::vector<uint8_t> pattern;
+  GenerateLinkTestPattern(options_.pattern, options_.bytes, &pattern);
+  Clock::time_point start = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->received.clear();
+    state_->last_received = start;
+    state_->last_activity = start;
+  }
+  for (size_t offset = 0; offset < pattern.size();) {
+    size_t length = std::min(options_.chunk_size, pattern.size() - offset);
+    Status status = Send(std::vector<uint8_t>(
+        pattern.begin() + offset, pattern.begin() + offset + length));
+    if (!status.ok()) return status;
+    offset += length;
+    report->bytes_sent += length;
+  }
+
+  // Whatever has not come back once the line has been quiet for the
+  // timeout never will.
+  std::vector<uint8_t> received;
+  Clock::time_point last_received;
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    while (true) {
+      Status status = StoppedLocked();
+      if (!status.ok()) return status;
+      if (state_->received.size() >= pattern.size() &&
+          state_->writes_in_flight == 0) {
+        break;
+      }
+      Clock::time_point deadline =
+          state_->last_activity +
+          std::chrono::milliseconds(options_.timeout_ms);
+      if (Clock::now() >= deadline) break;
+      state_->changed.wait_until(lock, deadline);
+    }
+    received.swap(state_->received);
+    last_received = state_->last_received;
+  }
+
+  report->bytes_received = received.size();
+  report->errors = CompareLoopback(pattern, received);
+  report->elapsed_us = Micros(last_received - start);
+  if (report->elapsed_us > 0) {
+    report->bytes_per_second =
+        received.size() * 1e6 / static_cast<double>(report->elapsed_us);
+  }
+  if (!received.empty()) {
+    report->bit_error_rate = report->errors.bit_errors /
+                             (static_cast<double>(received.size()) * 8);
+  }
+  return Status::Ok();
+}
+
+Status LinkTester::MeasureLatency(LinkTestReport* report) {
+  std::vector<uint8_t> pattern;
+  GenerateLinkTestPattern(options_.pattern, options_.probe_size, &pattern);
+  std::vector<uint64_t> latencies;
+  for (int i = 0; i < options_.probes; i++) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->received.clear();
+    }
+    Clock::time_point sent = Clock::now();
+    Status status = Send(pattern);
+    if (!status.ok()) return status;
+    report->probes_sent++;
+
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    Clock::time_point deadline =
+        sent + std::chrono::milliseconds(options_.timeout_ms);
+    state_->changed.wait_until(lock, deadline, [this]() {
+      return !StoppedLocked().ok() ||
+             state_->received.size() >= options_.probe_size;
+    });
+    status = StoppedLocked();
+    if (!status.ok()) return status;
+    if (state_->received.size() >= options_.probe_size) {
+      latencies.push_back(Micros(state_->last_received - sent));
+    } else {
+      report->probes_lost++;
+    }
+  }
+
+  if (latencies.empty()) return Status::Ok();
+  std::sort(latencies.begin(), latencies.end());
+  uint64_t total = 0;
+  for (uint64_t latency : latencies) total += latency;
+  report->min_latency_us = latencies.front();
+  report->max_latency_us = latencies.back();
+  report->mean_latency_us = total / latencies.size();
+  report->p50_latency_us = latencies[(latencies.size() - 1) / 2];
+  report->p99_latency_us = latencies[(latencies.size() * 99 + 99) / 100 - 1];
+  return Status::Ok();
+}
+
+Status LinkTester::Send(std::vector<uint8_t> data) {
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->changed.wait(lock, [this]() {
+      return !StoppedLocked().ok() ||
+             state_->writes_in_flight < kWriteWindow;
+    });
+    Status status = StoppedLocked();
+    if (!status.ok()) return status;
+    state_->writes_in_flight++;
+  }
+  std::shared_ptr<State> state = state_;
+  send_(std::move(data), [state](int64_t result) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->writes_in_flight--;
+    if (result < 0 && state->write_error == 0) {
+      state->write_error = static_cast<int>(-result);
+    }
+    state->last_activity = Clock::now();
+    state->changed.notify_all();
+  });
+  return Status::Ok();
+}
+
+Status LinkTester::StoppedLocked() const {
+  if (state_->stopping) {
+    return Status::Error("CANCELLED", "Link test was cancelled");
+  }
+  if (state_->write_error != 0) {
+    return Status::Error(
+        "WRITE_ERROR",
+        std::string("Error writing to port: ") + strerror(state_->write_error));
+  }
+  return Status::Ok();
+}
+
+}  // namespace serial_com
@@ -0,0 +1,165 @@
+#ifndef SERIAL_COM_CORE_LINK_TESTER_H_
+#define SERIAL_COM_CORE_LINK_TESTER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "status.h"
+
+namespace serial_com {
+
+// What a link test transmits.
+enum class LinkTestPattern {
+  // Pseudo-random bit sequences (ITU-T O.150 polynomials x^7+x^6+1,
+  // x^15+x^14+1 and x^31+x^28+1), packed most significant bit first.
+  kPrbs7,
+  kPrbs15,
+  kPrbs31,
+  // 0x00, 0x01, ... 0xff, 0x00, ...
+  kCounter,
+  // 0x55 and 0xaa alternately: every bit toggles, the worst case for
+  // edges.
+  kAlternating,
+};
+
+const char* LinkTestPatternName(LinkTestPattern pattern);
+
+// Parses "prbs7", "prbs15", "prbs31", "counter" or "alternating". Returns
+// false for anything else.
+bool ParseLinkTestPattern(const char* name, LinkTestPattern* pattern);
+
+// Sets |out| to the first |length| bytes of |pattern|. PRBS generators
+// start from the all-ones state.
+void GenerateLinkTestPattern(LinkTestPattern pattern, size_t length,
+                             std::vector<uint8_t>* out);
+
+struct LinkErrorCounts {
+  // Received bytes that differ from the ones sent in their place, and the
+  // bits that differ in them.
+  uint64_t byte_errors = 0;
+  uint64_t bit_errors = 0;
+  // Bytes sent that never came back, including a missing tail.
+  uint64_t dropped_bytes = 0;
+  // Bytes received beyond the end of what was sent.
+  uint64_t extra_bytes = 0;
+};
+
+// Compares what came back over a loopback with what was sent. A run of
+// bytes missing from the middle is recognised as a drop, so the rest of the
+// stream still lines up, rather than counting as errors to the end.
+LinkErrorCounts CompareLoopback(const std::vector<uint8_t>& sent,
+                                const std::vector<uint8_t>& received);
+
+struct LinkTestOptions {
+  LinkTestPattern pattern = LinkTestPattern::kPrbs15;
+  // Sent back to back for the throughput and error measurement.
+  size_t bytes = 1 << 20;
+  // Per write. A few writes are kept in flight so the line never idles.
+  size_t chunk_size = 4096;
+  // Round trips timed one at a time after the throughput run, each
+  // |probe_size| bytes.
+  int probes = 100;
+  size_t probe_size = 1;
+  // How long to wait for bytes to come back before counting the rest as
+  // dropped, or a probe as lost.
+  int timeout_ms = 2000;
+};
+
+struct LinkTestReport {
+  // Ok, CANCELLED, or WRITE_ERROR if the port failed.
+  Status status = Status::Ok();
+  uint64_t bytes_sent = 0;
+  uint64_t bytes_received = 0;
+  LinkErrorCounts errors;
+  // Over the throughput run, from the first write to the last byte back.
+  uint64_t elapsed_us = 0;
+  double bytes_per_second = 0;
+  // Bit errors per bit received.
+  double bit_error_rate = 0;
+  int probes_sent = 0;
+  int probes_lost = 0;
+  // Round trip times of the probes that came back.
+  uint64_t min_latency_us = 0;
+  uint64_t mean_latency_us = 0;
+  uint64_t p50_latency_us = 0;
+  uint64_t p99_latency_us = 0;
+  uint64_t max_latency_us = 0;
+};
+
+// Qualifies a looped-back link (a loopback plug on a cable or adapter) on a
+// thread of its own: first a sustained run of a known pattern for
+// throughput and error rates, then single round trips for latency.
+//
+// Like UploadEngine, the tester only produces bytes and consumes what comes
+// back: writes go out through |send| and whatever the port receives is fed
+// in with OnReceived(), so the port's I/O stays with its loop.
+class LinkTester {
+ public:
+  // Called with the number of bytes written or a negative errno.
+  using WriteDone = std::function<void(int64_t result)>;
+  using SendFn = std::function<void(std::vector<uint8_t> data, WriteDone done)>;
+  // Called once on the tester thread when the test has ended.
+  using DoneFn = std::function<void(const LinkTestReport& report)>;
+
+  // Options with a zero byte count, chunk or probe size are an error the
+  // caller must rule out.
+  LinkTester(const LinkTestOptions& options, SendFn send, DoneFn done);
+  // Ends a running test with CANCELLED and returns once |done| has been
+  // called.
+  ~LinkTester();
+
+  // Disallow copy and assign.
+  LinkTester(const LinkTester&) = delete;
+  LinkTester& operator=(const LinkTester&) = delete;
+
+  // Starts the test. Whatever the port receives must be fed in by then,
+  // since the first bytes can come back straight away.
+  void Start();
+
+  // Feeds bytes received from the port. May be called from any thread.
+  void OnReceived(const uint8_t* data, size_t length);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // Shared with write completions, which may outlive the tester.
+  struct State {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<uint8_t> received;
+    // When bytes last arrived or a write last completed.
+    Clock::time_point last_received;
+    Clock::time_point last_activity;
+    int writes_in_flight = 0;
+    int write_error = 0;
+    bool stopping = false;
+  };
+
+  void Run();
+  Status MeasureThroughput(LinkTestReport* report);
+  Status MeasureLatency(LinkTestReport* report);
+  // Queues |data|, first waiting for the write window to have room.
+  Status Send(std::vector<uint8_t> data);
+  // Returns the status to end the test with, if it must end. Requires
+  // |state_|'s mutex.
+  Status StoppedLocked() const;
+
+  const LinkTestOptions options_;
+  const SendFn send_;
+  const DoneFn done_;
+
+  std::shared_ptr<State> state_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_LINK_TESTER_H_
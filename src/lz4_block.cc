@@ -0,0 +1,147 @@
+#include "lz4_block.h"
+
+#include <cstring>
+
+namespace serial_com {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+// The last match must start at least this far from the end of the input...
+constexpr size_t kMatchStartLimit = 12;
+// ...and the last this many bytes are always literals.
+constexpr size_t kLastLiterals = 5;
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashLog = 12;
+
+uint32_t Read32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof value);
+  return value;
+}
+
+uint32_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+// Writes the 255-run encoding of a length that did not fit in its token
+// nibble.
+uint8_t* WriteLengthTail(uint8_t* out, size_t length) {
+  while (length >= 255) {
+    *out++ = 255;
+    length -= 255;
+  }
+  *out++ = static_cast<uint8_t>(length);
+  return out;
+}
+
+uint8_t* WriteSequence(uint8_t* out, const uint8_t* literals,
+                       size_t literal_length, size_t offset,
+                       size_t match_length) {
+  uint8_t* token = out++;
+  *token = static_cast<uint8_t>(literal_length < 15 ? literal_length << 4
+                                                    : 15 << 4);
+  if (literal_length >= 15) out = WriteLengthTail(out, literal_length - 15);
+  memcpy(out, literals, literal_length);
+  out += literal_length;
+  if (match_length == 0) return out;  // The final, literal-only sequence.
+
+  *out++ = static_cast<uint8_t>(offset);
+  *out++ = static_cast<uint8_t>(offset >> 8);
+  size_t extra = match_length - kMinMatch;
+  *token |= static_cast<uint8_t>(extra < 15 ? extra : 15);
+  if (extra >= 15) out = WriteLengthTail(out, extra - 15);
+  return out;
+}
+
+// Reads a length that continues past its token nibble. Returns false if
+// the input ends first.
+bool ReadLengthTail(const uint8_t** in, const uint8_t* end, size_t* length) {
+  uint8_t byte;
+  do {
+    if (*in >= end) return false;
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+}  // namespace
+
+size_t Lz4CompressBound(size_t length) { return length + length / 255 + 16; }
+
+size_t Lz4Compress(const uint8_t* data, size_t length, uint8_t* out) {
+  uint8_t* const out_start = out;
+  size_t anchor = 0;
+  if (length > kMatchStartLimit) {
+    // Positions are stored plus one so that zero means "empty".
+    uint32_t table[1 << kHashLog] = {};
+    const size_t match_start_end = length - kMatchStartLimit;
+    const size_t match_end = length - kLastLiterals;
+    size_t pos = 0;
+    while (pos < match_start_end) {
+      uint32_t sequence = Read32(data + pos);
+      uint32_t& slot = table[Hash(sequence)];
+      size_t candidate = slot;
+      slot = static_cast<uint32_t>(pos + 1);
+      if (candidate == 0 || pos - (candidate - 1) > kMaxOffset ||
+          Read32(data + candidate - 1) != sequence) {
+        pos++;
+        continue;
+      }
+      size_t ref = candidate - 1;
+      size_t match_length = kMinMatch;
+      while (pos + match_length < match_end &&
+             data[ref + match_length] == data[pos + match_length]) {
+        match_length++;
+      }
+      out = WriteSequence(out, data + anchor, pos - anchor, pos - ref,
+                          match_length);
+      pos += match_length;
+      anchor = pos;
+    }
+  }
+  out = WriteSequence(out, data + anchor, length - anchor, 0, 0);
+  return out - out_start;
+}
+
+int64_t Lz4Decompress(const uint8_t* data, size_t length, uint8_t* out,
+                      size_t capacity) {
+  const uint8_t* in = data;
+  const uint8_t* const in_end = data + length;
+  size_t written = 0;
+  while (in < in_end) {
+    const uint8_t token = *in++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !ReadLengthTail(&in, in_end, &literal_length)) {
+      return -1;
+    }
+    if (literal_length > static_cast<size_t>(in_end - in) ||
+        literal_length > capacity - written) {
+      return -1;
+    }
+    memcpy(out + written, in, literal_length);
+    in += literal_length;
+    written += literal_length;
+    if (in == in_end) break;  // The final sequence has no match.
+
+    if (in_end - in < 2) return -1;
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > written) return -1;
+    size_t match_length = token & 15;
+    if (match_length == 15 && !ReadLengthTail(&in, in_end, &match_length)) {
+      return -1;
+    }
+    match_length += kMinMatch;
+    if (match_length > capacity - written) return -1;
+    // Matches may overlap their own output, so copy byte by byte.
+    const uint8_t* match = out + written - offset;
+    for (size_t i = 0; i < match_length; i++) out[written + i] = match[i];
+    written += match_length;
+  }
+  return static_cast<int64_t>(written);
+}
+
+}  // namespace serial_com
@@ -0,0 +1,29 @@
+#ifndef SERIAL_COM_CORE_LZ4_BLOCK_H_
+#define SERIAL_COM_CORE_LZ4_BLOCK_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace serial_com {
+
+// A self-contained implementation of the LZ4 block format
+// (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), so blocks
+// interoperate with the reference library and with the small decoders
+// available for microcontrollers.
+
+// The largest compressed size of |length| input bytes.
+size_t Lz4CompressBound(size_t length);
+
+// Compresses |length| bytes into |out|, which must hold at least
+// Lz4CompressBound(length) bytes. Returns the compressed size. Inputs up to
+// 64 KiB are supported, which covers the frame sizes used on serial links.
+size_t Lz4Compress(const uint8_t* data, size_t length, uint8_t* out);
+
+// Decompresses one block into |out|. Returns the decompressed size, or -1
+// if the block is malformed or would not fit in |capacity| bytes.
+int64_t Lz4Decompress(const uint8_t* data, size_t length, uint8_t* out,
+                      size_t capacity);
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_LZ4_BLOCK_H_
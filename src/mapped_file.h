@@ -0,0 +1,37 @@
+#ifndef SERIAL_COM_CORE_MAPPED_FILE_H_
+#define SERIAL_COM_CORE_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace serial_com {
+
+// A read-only memory mapping of a whole file, so that large images can be
+// streamed without first being copied into memory.
+class MappedFile {
+ public:
+  // Returns nullptr and leaves errno set if |path| cannot be mapped.
+  static std::unique_ptr<MappedFile> Open(const std::string& path);
+
+  ~MappedFile();
+
+  // Disallow copy and assign.
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // nullptr for an empty file.
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const uint8_t* data, size_t size);
+
+  const uint8_t* data_;
+  const size_t size_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_MAPPED_FILE_H_
@@ -0,0 +1,260 @@
+#include "modem_lines.h"
+
+#include <errno.h>
+#include <linux/serial.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+namespace serial_com {
+
+namespace {
+
+// Delivered to a monitor thread to break it out of TIOCMIWAIT. A realtime
+// signal, so it does not collide with anything an application uses by
+// default.
+int InterruptSignal() { return SIGRTMIN + 4; }
+
+void IgnoreInterrupt(int) {}
+
+struct LineBit {
+  uint32_t line;
+  int tiocm;
+};
+
+const LineBit kLineBits[] = {
+    {kLineDtr, TIOCM_DTR}, {kLineRts, TIOCM_RTS}, {kLineCts, TIOCM_CTS},
+    {kLineDsr, TIOCM_DSR}, {kLineDcd, TIOCM_CD},  {kLineRi, TIOCM_RNG},
+};
+
+int ToTiocm(uint32_t lines) {
+  int bits = 0;
+  for (const LineBit& bit : kLineBits) {
+    if (lines & bit.line) bits |= bit.tiocm;
+  }
+  return bits;
+}
+
+uint32_t FromTiocm(int bits) {
+  uint32_t lines = 0;
+  for (const LineBit& bit : kLineBits) {
+    if (bits & bit.tiocm) lines |= bit.line;
+  }
+  return lines;
+}
+
+Status IoctlError(const char* what) {
+  return Status::Error("CONFIG_ERROR",
+                       std::string(what) + " failed: " + strerror(errno));
+}
+
+class TtyModemLineDevice : public ModemLineDevice {
+ public:
+  explicit TtyModemLineDevice(int fd) : fd_(fd) {
+    // Without a handler the signal would either kill the process or, if
+    // ignored, not interrupt the ioctl.
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+      struct sigaction action;
+      memset(&action, 0, sizeof action);
+      action.sa_handler = IgnoreInterrupt;
+      sigemptyset(&action.sa_mask);
+      // No SA_RESTART: the ioctl must return EINTR.
+      sigaction(InterruptSignal(), &action, nullptr);
+    });
+  }
+
+  int Read(uint32_t* lines) override {
+    int bits;
+    if (ioctl(fd_, TIOCMGET, &bits) != 0) return -errno;
+    *lines = FromTiocm(bits);
+    return 0;
+  }
+
+  int ReadCounts(ModemLineCounts* counts) override {
+    struct serial_icounter_struct icount;
+    memset(&icount, 0, sizeof icount);
+    if (ioctl(fd_, TIOCGICOUNT, &icount) != 0) return -errno;
+    counts->cts = icount.cts;
+    counts->dsr = icount.dsr;
+    counts->dcd = icount.dcd;
+    counts->ri = icount.rng;
+    return 0;
+  }
+
+  int Wait() override {
+    if (ioctl(fd_, TIOCMIWAIT, TIOCM_CTS | TIOCM_DSR | TIOCM_CD | TIOCM_RNG) !=
+        0) {
+      return -errno;
+    }
+    return 0;
+  }
+
+  void Interrupt(std::thread* thread) override {
+    pthread_kill(thread->native_handle(), InterruptSignal());
+  }
+
+ private:
+  const int fd_;
+};
+
+// Input lines whose transition count moved.
+uint32_t CountedChanges(const ModemLineCounts& before,
+                        const ModemLineCounts& after) {
+  uint32_t changed = 0;
+  if (after.cts != before.cts) changed |= kLineCts;
+  if (after.dsr != before.dsr) changed |= kLineDsr;
+  if (after.dcd != before.dcd) changed |= kLineDcd;
+  if (after.ri != before.ri) changed |= kLineRi;
+  return changed;
+}
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+const char* ModemLineName(uint32_t line) {
+  switch (line) {
+    case kLineDtr:
+      return "dtr";
+    case kLineRts:
+      return "rts";
+    case kLineCts:
+      return "cts";
+    case kLineDsr:
+      return "dsr";
+    case kLineDcd:
+      return "dcd";
+    case kLineRi:
+      return "ri";
+  }
+  return "unknown";
+}
+
+Status GetModemLines(int fd, uint32_t* lines) {
+  int bits;
+  if (ioctl(fd, TIOCMGET, &bits) != 0) return IoctlError("TIOCMGET");
+  *lines = FromTiocm(bits);
+  return Status::Ok();
+}
+
+Status SetModemLines(int fd, uint32_t lines, bool on) {
+  int bits = ToTiocm(lines & (kLineDtr | kLineRts));
+  if (bits == 0) return Status::Ok();
+  if (ioctl(fd, on ? TIOCMBIS : TIOCMBIC, &bits) != 0) {
+    return IoctlError(on ? "TIOCMBIS" : "TIOCMBIC");
+  }
+  return Status::Ok();
+}
+
+Status SetBreak(int fd, bool on) {
+  if (ioctl(fd, on ? TIOCSBRK : TIOCCBRK) != 0) {
+    return IoctlError(on ? "TIOCSBRK" : "TIOCCBRK");
+  }
+  return Status::Ok();
+}
+
+std::unique_ptr<ModemLineDevice> CreateTtyModemLineDevice(int fd) {
+  return std::unique_ptr<ModemLineDevice>(new TtyModemLineDevice(fd));
+}
+
+ModemMonitor::ModemMonitor(std::unique_ptr<ModemLineDevice> device,
+                           EventCallback callback, int poll_interval_ms)
+    : device_(std::move(device)),
+      callback_(std::move(callback)),
+      poll_interval_ms_(poll_interval_ms),
+      stopping_(false),
+      exited_(false),
+      interrupt_driven_(true) {
+  thread_ = std::thread(&ModemMonitor::Run, this);
+}
+
+ModemMonitor::~ModemMonitor() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopping_ = true;
+  changed_.notify_all();
+  // The interrupt can arrive just before the thread blocks, so repeat it
+  // until the thread is out.
+  while (!exited_) {
+    device_->Interrupt(&thread_);
+    changed_.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  lock.unlock();
+  thread_.join();
+}
+
+bool ModemMonitor::interrupt_driven() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return interrupt_driven_;
+}
+
+void ModemMonitor::Run() {
+  uint32_t lines = 0;
+  int error = device_->Read(&lines);
+  ModemLineCounts counts;
+  bool have_counts = error == 0 && device_->ReadCounts(&counts) == 0;
+  Report(lines, 0, error);
+
+  bool waiting = true;
+  while (error == 0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) break;
+    }
+    if (waiting) {
+      int result = device_->Wait();
+      if (result == -ENOTTY || result == -EINVAL) {
+        waiting = false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        interrupt_driven_ = false;
+      } else if (result < 0 && result != -EINTR) {
+        Report(lines, 0, result);
+        break;
+      }
+    } else if (!SleepPollInterval()) {
+      break;
+    }
+
+    uint32_t now;
+    int result = device_->Read(&now);
+    if (result < 0) {
+      Report(lines, 0, result);
+      break;
+    }
+    uint32_t changed = (now ^ lines) & kInputLines;
+    if (have_counts) {
+      ModemLineCounts now_counts;
+      if (device_->ReadCounts(&now_counts) == 0) {
+        changed |= CountedChanges(counts, now_counts);
+        counts = now_counts;
+      }
+    }
+    // Output lines are reported but do not trigger events.
+    lines = now;
+    if (changed != 0) Report(lines, changed, 0);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  exited_ = true;
+  changed_.notify_all();
+}
+
+bool ModemMonitor::SleepPollInterval() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait_for(lock, std::chrono::milliseconds(poll_interval_ms_),
+                    [this] { return stopping_; });
+  return !stopping_;
+}
+
+void ModemMonitor::Report(uint32_t lines, uint32_t changed, int error) {
+  if (callback_) callback_(ModemLineEvent{lines, changed, NowNs(), error});
+}
+
+}  // namespace serial_com
@@ -0,0 +1,121 @@
+#ifndef SERIAL_COM_CORE_MODEM_LINES_H_
+#define SERIAL_COM_CORE_MODEM_LINES_H_
+
+#include <pthread.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "status.h"
+
+namespace serial_com {
+
+// Modem control and status lines, as bits of a mask.
+constexpr uint32_t kLineDtr = 1 << 0;
+constexpr uint32_t kLineRts = 1 << 1;
+constexpr uint32_t kLineCts = 1 << 2;
+constexpr uint32_t kLineDsr = 1 << 3;
+constexpr uint32_t kLineDcd = 1 << 4;
+constexpr uint32_t kLineRi = 1 << 5;
+// Lines driven by the device, which the monitor watches.
+constexpr uint32_t kInputLines = kLineCts | kLineDsr | kLineDcd | kLineRi;
+
+// "dtr", "rts", "cts", "dsr", "dcd" or "ri" for a single line bit.
+const char* ModemLineName(uint32_t line);
+
+// Reads the current lines of the tty |fd|.
+Status GetModemLines(int fd, uint32_t* lines);
+// Raises (|on|) or drops the output lines (DTR, RTS) in |lines|.
+Status SetModemLines(int fd, uint32_t lines, bool on);
+// Starts or ends a break condition on the transmit line.
+Status SetBreak(int fd, bool on);
+
+// Transitions seen on each input line since the device was opened. They
+// catch pulses (typically RI) that are over before the lines are read.
+struct ModemLineCounts {
+  uint32_t cts = 0;
+  uint32_t dsr = 0;
+  uint32_t dcd = 0;
+  uint32_t ri = 0;
+};
+
+// The kernel interface a ModemMonitor uses. Methods return 0 or a negative
+// errno.
+class ModemLineDevice {
+ public:
+  virtual ~ModemLineDevice() = default;
+
+  virtual int Read(uint32_t* lines) = 0;
+  virtual int ReadCounts(ModemLineCounts* counts) = 0;
+  // Blocks until an input line changes. Returns -ENOTTY or -EINVAL if
+  // the driver cannot wait for changes.
+  virtual int Wait() = 0;
+  // Makes a Wait() blocked on |thread| return -EINTR soon.
+  virtual void Interrupt(std::thread* thread) = 0;
+};
+
+// TIOCMGET, TIOCGICOUNT and TIOCMIWAIT on a tty. Interrupt() signals the
+// waiting thread with a signal the first device installs an empty handler
+// for, since nothing else wakes TIOCMIWAIT.
+std::unique_ptr<ModemLineDevice> CreateTtyModemLineDevice(int fd);
+
+struct ModemLineEvent {
+  // Current lines.
+  uint32_t lines;
+  // Input lines that changed since the previous event; 0 for the first.
+  uint32_t changed;
+  // steady_clock time at which the change was seen.
+  int64_t timestamp_ns;
+  // Negative errno if monitoring failed; it has stopped.
+  int error;
+};
+
+// Watches a port's input lines on its own thread and reports every change.
+//
+// It sleeps in the kernel until a line changes, so a change is reported
+// with interrupt latency and an idle port costs no CPU. Drivers that cannot
+// wait for changes (pseudo-terminals, some USB adapters) are polled every
+// |poll_interval_ms| instead.
+class ModemMonitor {
+ public:
+  // Invoked on the monitor thread, first with the initial lines.
+  using EventCallback = std::function<void(const ModemLineEvent& event)>;
+
+  ModemMonitor(std::unique_ptr<ModemLineDevice> device, EventCallback callback,
+               int poll_interval_ms);
+  ~ModemMonitor();
+
+  // Disallow copy and assign.
+  ModemMonitor(const ModemMonitor&) = delete;
+  ModemMonitor& operator=(const ModemMonitor&) = delete;
+
+  // Whether changes are being waited for rather than polled. Settles once
+  // the first event has been reported.
+  bool interrupt_driven();
+
+ private:
+  void Run();
+  // Sleeps for the poll interval. Returns false once stopping.
+  bool SleepPollInterval();
+  void Report(uint32_t lines, uint32_t changed, int error);
+
+  const std::unique_ptr<ModemLineDevice> device_;
+  const EventCallback callback_;
+  const int poll_interval_ms_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool stopping_;
+  bool exited_;
+  bool interrupt_driven_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_MODEM_LINES_H_
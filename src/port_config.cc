@@ -0,0 +1,40 @@
+#include "port_config.h"
+
+#include <cstring>
+
+namespace serial_com {
+
+bool ParseParity(const char* name, Parity* parity) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "none") == 0) {
+    *parity = Parity::kNone;
+  } else if (strcmp(name, "odd") == 0) {
+    *parity = Parity::kOdd;
+  } else if (strcmp(name, "even") == 0) {
+    *parity = Parity::kEven;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseFlowControl(const char* name, FlowControl* flow_control) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "none") == 0) {
+    *flow_control = FlowControl::kNone;
+  } else if (strcmp(name, "hardware") == 0) {
+    *flow_control = FlowControl::kHardware;
+  } else if (strcmp(name, "software") == 0) {
+    *flow_control = FlowControl::kSoftware;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool IsValidPortConfig(const PortConfig& config) {
+  return !config.path.empty() && config.baud_rate > 0 &&
+         config.data_bits >= 5 && config.data_bits <= 8;
+}
+
+}  // namespace serial_com
@@ -0,0 +1,41 @@
+#ifndef SERIAL_COM_CORE_PORT_CONFIG_H_
+#define SERIAL_COM_CORE_PORT_CONFIG_H_
+
+#include <string>
+
+namespace serial_com {
+
+enum class Parity { kNone, kOdd, kEven };
+
+enum class StopBits { kOne, kTwo };
+
+enum class FlowControl {
+  kNone,
+  // RTS/CTS.
+  kHardware,
+  // XON/XOFF.
+  kSoftware,
+};
+
+// Line settings for a port. The defaults are the 8N1, no flow control setup
+// every platform used before these became configurable.
+struct PortConfig {
+  std::string path;
+  int baud_rate = 9600;
+  int data_bits = 8;
+  Parity parity = Parity::kNone;
+  StopBits stop_bits = StopBits::kOne;
+  FlowControl flow_control = FlowControl::kNone;
+};
+
+// Parse the names used on the method channels ("none", "odd", "even" and
+// "none", "hardware", "software"). Return false for anything else.
+bool ParseParity(const char* name, Parity* parity);
+bool ParseFlowControl(const char* name, FlowControl* flow_control);
+
+// Returns false unless |config| describes settings every backend can apply.
+bool IsValidPortConfig(const PortConfig& config);
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_PORT_CONFIG_H_
@@ -0,0 +1,88 @@
+#ifndef SERIAL_COM_CORE_PORT_STATS_H_
+#define SERIAL_COM_CORE_PORT_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace serial_com {
+
+struct PortStatsSnapshot {
+  uint64_t bytes_received;
+  uint64_t bytes_sent;
+  // Read and write calls made against the device, successful or not.
+  uint64_t read_calls;
+  uint64_t write_calls;
+  uint64_t read_errors;
+  uint64_t write_errors;
+  // Calls made to size reads (FIONREAD, ClearCommError), on top of
+  // |read_calls|.
+  uint64_t read_sizing_calls;
+};
+
+// Read and sizing calls per MiB received, or 0 before anything arrived.
+inline double ReadSyscallsPerMegabyte(const PortStatsSnapshot& stats) {
+  if (stats.bytes_received == 0) return 0;
+  return (stats.read_calls + stats.read_sizing_calls) * 1048576.0 /
+         stats.bytes_received;
+}
+
+// Counters for one port. Updated by whichever thread does the I/O and read
+// from any thread.
+class PortStats {
+ public:
+  PortStats() = default;
+
+  // Disallow copy and assign.
+  PortStats(const PortStats&) = delete;
+  PortStats& operator=(const PortStats&) = delete;
+
+  // Record the result of one read or write: a byte count or a negative
+  // errno.
+  void RecordRead(int64_t result) {
+    read_calls_.fetch_add(1, std::memory_order_relaxed);
+    if (result < 0) {
+      read_errors_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      bytes_received_.fetch_add(result, std::memory_order_relaxed);
+    }
+  }
+
+  void RecordReadSizing() {
+    read_sizing_calls_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void RecordWrite(int64_t result) {
+    write_calls_.fetch_add(1, std::memory_order_relaxed);
+    if (result < 0) {
+      write_errors_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      bytes_sent_.fetch_add(result, std::memory_order_relaxed);
+    }
+  }
+
+  PortStatsSnapshot Snapshot() const {
+    PortStatsSnapshot snapshot;
+    snapshot.bytes_received = bytes_received_.load(std::memory_order_relaxed);
+    snapshot.bytes_sent = bytes_sent_.load(std::memory_order_relaxed);
+    snapshot.read_calls = read_calls_.load(std::memory_order_relaxed);
+    snapshot.write_calls = write_calls_.load(std::memory_order_relaxed);
+    snapshot.read_errors = read_errors_.load(std::memory_order_relaxed);
+    snapshot.write_errors = write_errors_.load(std::memory_order_relaxed);
+    snapshot.read_sizing_calls =
+        read_sizing_calls_.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+ private:
+  std::atomic<uint64_t> bytes_received_{0};
+  std::atomic<uint64_t> bytes_sent_{0};
+  std::atomic<uint64_t> read_calls_{0};
+  std::atomic<uint64_t> write_calls_{0};
+  std::atomic<uint64_t> read_errors_{0};
+  std::atomic<uint64_t> write_errors_{0};
+  std::atomic<uint64_t> read_sizing_calls_{0};
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_PORT_STATS_H_
@@ -0,0 +1,242 @@
+#include "posix_serial_port.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+namespace serial_com {
+
+namespace {
+
+struct BaudRate {
+  int bits_per_second;
+  speed_t speed;
+};
+
+const BaudRate kBaudRates[] = {
+    {50, B50},           {75, B75},           {110, B110},
+    {134, B134},         {150, B150},         {200, B200},
+    {300, B300},         {600, B600},         {1200, B1200},
+    {1800, B1800},       {2400, B2400},       {4800, B4800},
+    {9600, B9600},       {19200, B19200},     {38400, B38400},
+    {57600, B57600},     {115200, B115200},   {230400, B230400},
+#ifdef B460800
+    {460800, B460800},
+#endif
+#ifdef B500000
+    {500000, B500000},
+#endif
+#ifdef B576000
+    {576000, B576000},
+#endif
+#ifdef B921600
+    {921600, B921600},
+#endif
+#ifdef B1000000
+    {1000000, B1000000},
+#endif
+#ifdef B1152000
+    {1152000, B1152000},
+#endif
+#ifdef B1500000
+    {1500000, B1500000},
+#endif
+#ifdef B2000000
+    {2000000, B2000000},
+#endif
+#ifdef B2500000
+    {2500000, B2500000},
+#endif
+#ifdef B3000000
+    {3000000, B3000000},
+#endif
+#ifdef B3500000
+    {3500000, B3500000},
+#endif
+#ifdef B4000000
+    {4000000, B4000000},
+#endif
+};
+
+std::string ErrnoMessage(const char* what, int error) {
+  return std::string(what) + ": " + strerror(error);
+}
+
+}  // namespace
+
+bool BaudRateToSpeed(int baud_rate, speed_t* speed) {
+  for (const BaudRate& rate : kBaudRates) {
+    if (rate.bits_per_second == baud_rate) {
+      *speed = rate.speed;
+      return true;
+    }
+  }
+  return false;
+}
+
+Status ConfigurePosixPort(int fd, const PortConfig& config) {
+  speed_t speed;
+  if (!BaudRateToSpeed(config.baud_rate, &speed)) {
+    return Status::Error("CONFIG_ERROR", "Unsupported baud rate " +
+                                             std::to_string(config.baud_rate));
+  }
+
+  struct termios tty;
+  memset(&tty, 0, sizeof tty);
+  if (tcgetattr(fd, &tty) != 0) {
+    return Status::Error("CONFIG_ERROR", "Error from tcgetattr");
+  }
+
+  cfsetospeed(&tty, speed);
+  cfsetispeed(&tty, speed);
+
+  static const tcflag_t kDataBits[] = {CS5, CS6, CS7, CS8};
+  tty.c_cflag = (tty.c_cflag & ~CSIZE) | kDataBits[config.data_bits - 5];
+  tty.c_cflag &= ~(PARENB | PARODD);
+  if (config.parity == Parity::kEven) tty.c_cflag |= PARENB;
+  if (config.parity == Parity::kOdd) tty.c_cflag |= PARENB | PARODD;
+  if (config.stop_bits == StopBits::kTwo) {
+    tty.c_cflag |= CSTOPB;
+  } else {
+    tty.c_cflag &= ~CSTOPB;
+  }
+
+  tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL);
+  tty.c_lflag = 0;
+  tty.c_oflag = 0;
+  tty.c_cc[VMIN]  = 0;
+  tty.c_cc[VTIME] = 5;
+
+  tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+  tty.c_cflag &= ~CRTSCTS;
+  if (config.flow_control == FlowControl::kSoftware) {
+    tty.c_iflag |= IXON | IXOFF;
+  } else if (config.flow_control == FlowControl::kHardware) {
+    tty.c_cflag |= CRTSCTS;
+  }
+  tty.c_cflag |= (CLOCAL | CREAD);
+
+  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+    return Status::Error("CONFIG_ERROR", "Error from tcsetattr");
+  }
+  return Status::Ok();
+}
+
+Status OpenPosixPort(const PortConfig& config, int* fd) {
+  if (!IsValidPortConfig(config)) {
+    return Status::Error("CONFIG_ERROR", "Invalid port configuration");
+  }
+
+  int port_fd = open(config.path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (port_fd < 0) {
+    return Status::Error("OPEN_ERROR",
+                         ErrnoMessage("Error opening port", errno));
+  }
+
+  Status status = ConfigurePosixPort(port_fd, config);
+  if (!status.ok()) {
+    close(port_fd);
+    return status;
+  }
+  *fd = port_fd;
+  return Status::Ok();
+}
+
+bool ParseFlushQueue(const char* name, FlushQueue* queue) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "rx") == 0) {
+    *queue = FlushQueue::kReceive;
+  } else if (strcmp(name, "tx") == 0) {
+    *queue = FlushQueue::kTransmit;
+  } else if (strcmp(name, "both") == 0) {
+    *queue = FlushQueue::kBoth;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+Status FlushPosixPort(int fd, FlushQueue queue) {
+  int selector = queue == FlushQueue::kReceive    ? TCIFLUSH
+                 : queue == FlushQueue::kTransmit ? TCOFLUSH
+                                                  : TCIOFLUSH;
+  if (tcflush(fd, selector) != 0) {
+    return Status::Error("FLUSH_ERROR",
+                         ErrnoMessage("Error flushing port", errno));
+  }
+  return Status::Ok();
+}
+
+PosixSerialPort::PosixSerialPort() : fd_(-1) {}
+
+PosixSerialPort::~PosixSerialPort() { Close(); }
+
+Status PosixSerialPort::Open(const PortConfig& config) {
+  Close();
+  return OpenPosixPort(config, &fd_);
+}
+
+void PosixSerialPort::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+Status PosixSerialPort::Write(const uint8_t* data, size_t length) {
+  if (!IsOpen()) return Status::Error("WRITE_ERROR", "Port is not open");
+  size_t written = 0;
+  while (written < length) {
+    ssize_t n = write(fd_, data + written, length - written);
+    int error = errno;
+    if (n < 0 && error == EINTR) continue;
+    stats_.RecordWrite(n < 0 ? -error : n);
+    if (n < 0) {
+      return Status::Error("WRITE_ERROR",
+                           ErrnoMessage("Error writing to port", error));
+    }
+    written += n;
+  }
+  return Status::Ok();
+}
+
+Status PosixSerialPort::Read(size_t max_length, std::vector<uint8_t>* data) {
+  if (!IsOpen()) return Status::Error("READ_ERROR", "Port is not open");
+  data->resize(max_length);
+  ssize_t n;
+  int error;
+  do {
+    n = read(fd_, data->data(), max_length);
+    error = errno;
+  } while (n < 0 && error == EINTR);
+  stats_.RecordRead(n < 0 ? -error : n);
+  if (n < 0) {
+    data->clear();
+    return Status::Error("READ_ERROR",
+                         ErrnoMessage("Error reading from port", error));
+  }
+  data->resize(n);
+  return Status::Ok();
+}
+
+Status PosixSerialPort::Queued(size_t* bytes) {
+  if (!IsOpen()) return Status::Error("READ_ERROR", "Port is not open");
+  int available = 0;
+  stats_.RecordReadSizing();
+  if (ioctl(fd_, FIONREAD, &available) != 0) {
+    return Status::Error("READ_ERROR",
+                         ErrnoMessage("Error querying the port", errno));
+  }
+  *bytes = available;
+  return Status::Ok();
+}
+
+std::unique_ptr<SerialPort> SerialPort::Create() {
+  return std::unique_ptr<SerialPort>(new PosixSerialPort());
+}
+
+}  // namespace serial_com
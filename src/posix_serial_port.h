@@ -0,0 +1,61 @@
+#ifndef SERIAL_COM_CORE_POSIX_SERIAL_PORT_H_
+#define SERIAL_COM_CORE_POSIX_SERIAL_PORT_H_
+
+#include <termios.h>
+
+#include "serial_port.h"
+
+namespace serial_com {
+
+// Maps a baud rate in bits per second to its termios speed constant.
+bool BaudRateToSpeed(int baud_rate, speed_t* speed);
+
+// Applies |config| to an open tty: raw mode, the requested framing and flow
+// control, and a 500 ms read timeout.
+Status ConfigurePosixPort(int fd, const PortConfig& config);
+
+// Opens and configures |config.path|. On success |*fd| owns the descriptor.
+// Writes complete once the driver has the bytes, not once they are on the
+// wire; use tcdrain (or a DrainWorker) to wait for that.
+Status OpenPosixPort(const PortConfig& config, int* fd);
+
+// Which of a tty's queues FlushPosixPort discards.
+enum class FlushQueue {
+  kReceive,
+  kTransmit,
+  kBoth,
+};
+
+// Parses "rx", "tx" or "both". Returns false for anything else.
+bool ParseFlushQueue(const char* name, FlushQueue* queue);
+
+// Discards data received but not read, written but not transmitted, or
+// both (tcflush).
+Status FlushPosixPort(int fd, FlushQueue queue);
+
+class PosixSerialPort : public SerialPort {
+ public:
+  PosixSerialPort();
+  ~PosixSerialPort() override;
+
+  // Disallow copy and assign.
+  PosixSerialPort(const PosixSerialPort&) = delete;
+  PosixSerialPort& operator=(const PosixSerialPort&) = delete;
+
+  Status Open(const PortConfig& config) override;
+  void Close() override;
+  bool IsOpen() const override { return fd_ >= 0; }
+
+  Status Write(const uint8_t* data, size_t length) override;
+  Status Read(size_t max_length, std::vector<uint8_t>* data) override;
+  Status Queued(size_t* bytes) override;
+
+  int fd() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_POSIX_SERIAL_PORT_H_
@@ -0,0 +1,96 @@
+#include "read_sizer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace serial_com {
+
+namespace {
+
+// Arrivals are counted over windows at least this long, so that one read's
+// worth of bytes does not make a rate of its own.
+constexpr auto kRateWindow = std::chrono::milliseconds(10);
+// A read covers what the estimated rate brings in over this long: about
+// one turn of the I/O loop under load.
+constexpr uint64_t kLookaheadPerSecond = 100;
+// A window longer than this spans a pause, and the rate before it says
+// nothing about the rate after.
+constexpr auto kStaleRate = std::chrono::seconds(1);
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t power = 1;
+  while (power < value && power <= SIZE_MAX / 2) power <<= 1;
+  return power;
+}
+
+}  // namespace
+
+constexpr size_t ReadSizer::kDefaultMinReadSize;
+constexpr size_t ReadSizer::kDefaultMaxReadSize;
+
+ReadSizer::ReadSizer()
+    : min_size_(kDefaultMinReadSize), max_size_(kDefaultMaxReadSize) {}
+
+void ReadSizer::SetLimits(size_t min_size, size_t max_size) {
+  min_size = std::max<size_t>(min_size, 1);
+  max_size_.store(std::max(max_size, min_size), std::memory_order_relaxed);
+  min_size_.store(min_size, std::memory_order_relaxed);
+}
+
+size_t ReadSizer::NextReadSize(size_t queued) {
+  uint64_t expected =
+      bytes_per_second_.load(std::memory_order_relaxed) / kLookaheadPerSecond;
+  size_t wanted = RoundUpToPowerOfTwo(
+      std::max<size_t>(queued, static_cast<size_t>(expected)));
+  // Read the limits once; SetLimits() may run meanwhile.
+  size_t min_size = min_read_size();
+  size_t max_size = std::max(max_read_size(), min_size);
+  size_t size = std::min(std::max(wanted, min_size), max_size);
+  read_size_.store(size, std::memory_order_relaxed);
+  return size;
+}
+
+void ReadSizer::OnRead(size_t length, Clock::time_point now) {
+  if (!window_started_) {
+    window_started_ = true;
+    window_start_ = now;
+  }
+  window_bytes_ += length;
+  Clock::duration elapsed = now - window_start_;
+  if (elapsed < kRateWindow) return;
+
+  uint64_t elapsed_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  uint64_t sample = window_bytes_ * 1000000 / elapsed_us;
+  uint64_t rate = bytes_per_second_.load(std::memory_order_relaxed);
+  // Rising rates are followed at once, so a burst is not read in small
+  // pieces; falling ones decay, so a short lull does not shrink the
+  // buffer.
+  if (sample >= rate || elapsed > kStaleRate) {
+    rate = sample;
+  } else {
+    rate = (rate * 3 + sample) / 4;
+  }
+  bytes_per_second_.store(rate, std::memory_order_relaxed);
+  window_start_ = now;
+  window_bytes_ = 0;
+}
+
+void ReadSizer::FitBuffer(size_t size, std::vector<uint8_t>* buffer) {
+  if (buffer->size() < size) {
+    buffer->resize(size);
+  } else if (buffer->size() > size * 4) {
+    std::vector<uint8_t>(size).swap(*buffer);
+  }
+  buffer_bytes_.store(buffer->size(), std::memory_order_relaxed);
+}
+
+ReadSizerStats ReadSizer::stats() const {
+  ReadSizerStats stats;
+  stats.read_size = read_size_.load(std::memory_order_relaxed);
+  stats.buffer_bytes = buffer_bytes_.load(std::memory_order_relaxed);
+  stats.bytes_per_second = bytes_per_second_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace serial_com
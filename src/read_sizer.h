@@ -0,0 +1,84 @@
+#ifndef SERIAL_COM_CORE_READ_SIZER_H_
+#define SERIAL_COM_CORE_READ_SIZER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace serial_com {
+
+struct ReadSizerStats {
+  // The size last chosen for a read.
+  size_t read_size;
+  // The size of the read buffer in use.
+  size_t buffer_bytes;
+  // Smoothed arrival rate.
+  uint64_t bytes_per_second;
+};
+
+// Chooses how much to ask for in each read of a port, so that a busy port
+// takes what has arrived in few large reads and an idle one keeps a small
+// buffer. A read is sized to cover both the bytes the driver reports as
+// queued (FIONREAD, or cbInQue on Windows) and what the smoothed arrival
+// rate brings in over a short lookahead, rounded up to a power of two and
+// kept within the limits.
+//
+// NextReadSize(), OnRead() and FitBuffer() are for the thread that reads
+// the port; the limits and stats may be used from any thread.
+class ReadSizer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t kDefaultMinReadSize = 1024;
+  static constexpr size_t kDefaultMaxReadSize = 64 * 1024;
+
+  ReadSizer();
+
+  // Disallow copy and assign.
+  ReadSizer(const ReadSizer&) = delete;
+  ReadSizer& operator=(const ReadSizer&) = delete;
+
+  // A |min_size| of 0 is taken as 1, and a |max_size| below |min_size| as
+  // |min_size|.
+  void SetLimits(size_t min_size, size_t max_size);
+  size_t min_read_size() const {
+    return min_size_.load(std::memory_order_relaxed);
+  }
+  size_t max_read_size() const {
+    return max_size_.load(std::memory_order_relaxed);
+  }
+
+  // Returns the size for the next read, given |queued| bytes known to be
+  // waiting (0 when not asked).
+  size_t NextReadSize(size_t queued);
+  // Records a read that returned |length| bytes (0 for none) at |now|.
+  void OnRead(size_t length, Clock::time_point now);
+  // Grows |buffer| to hold |size| bytes, or shrinks it once it is more
+  // than four times that, so a port that goes quiet gives the memory back.
+  void FitBuffer(size_t size, std::vector<uint8_t>* buffer);
+  // Records the size of a buffer managed elsewhere, for stats().
+  void SetBufferSize(size_t size) {
+    buffer_bytes_.store(size, std::memory_order_relaxed);
+  }
+
+  ReadSizerStats stats() const;
+
+ private:
+  std::atomic<size_t> min_size_;
+  std::atomic<size_t> max_size_;
+
+  // The rate window in progress.
+  bool window_started_ = false;
+  Clock::time_point window_start_;
+  uint64_t window_bytes_ = 0;
+
+  std::atomic<uint64_t> bytes_per_second_{0};
+  std::atomic<size_t> read_size_{0};
+  std::atomic<size_t> buffer_bytes_{0};
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_READ_SIZER_H_
@@ -0,0 +1,31 @@
+#include "receive_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace serial_com {
+
+ReceiveBuffer::ReceiveBuffer() : head_(0) {}
+
+void ReceiveBuffer::Append(const uint8_t* data, size_t length) {
+  if (head_ > 0 && head_ >= data_.size() / 2) {
+    data_.erase(data_.begin(), data_.begin() + head_);
+    head_ = 0;
+  }
+  data_.insert(data_.end(), data, data + length);
+}
+
+size_t ReceiveBuffer::Read(uint8_t* out, size_t max_length) {
+  size_t length = std::min(max_length, size());
+  if (length > 0) memcpy(out, data_.data() + head_, length);
+  head_ += length;
+  if (head_ == data_.size()) Clear();
+  return length;
+}
+
+void ReceiveBuffer::Clear() {
+  data_.clear();
+  head_ = 0;
+}
+
+}  // namespace serial_com
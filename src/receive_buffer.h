@@ -0,0 +1,34 @@
+#ifndef SERIAL_COM_CORE_RECEIVE_BUFFER_H_
+#define SERIAL_COM_CORE_RECEIVE_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace serial_com {
+
+// FIFO of received bytes. Not thread-safe; owners lock around it.
+class ReceiveBuffer {
+ public:
+  ReceiveBuffer();
+
+  void Append(const uint8_t* data, size_t length);
+  // Moves up to |max_length| bytes into |out| and returns how many moved.
+  size_t Read(uint8_t* out, size_t max_length);
+  void Clear();
+
+  // The unread bytes; valid until the next Append(), Read() or Clear().
+  const uint8_t* data() const { return data_.data() + head_; }
+  size_t size() const { return data_.size() - head_; }
+  bool empty() const { return size() == 0; }
+
+ private:
+  // Consumed bytes stay in front of |head_| until compaction is cheaper
+  // than keeping them, so reads do not shift the buffer every time.
+  std::vector<uint8_t> data_;
+  size_t head_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_RECEIVE_BUFFER_H_
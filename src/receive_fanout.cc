@@ -0,0 +1,79 @@
+#include "receive_fanout.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace serial_com {
+
+ChunkQueue::ChunkQueue(size_t limit)
+    : limit_(limit), offset_(0), bytes_(0), dropped_bytes_(0) {}
+
+void ChunkQueue::Push(SharedChunk chunk) {
+  if (!chunk || chunk->empty()) return;
+  bytes_ += chunk->size();
+  chunks_.push_back(std::move(chunk));
+  if (limit_ == 0 || bytes_ <= limit_) return;
+  size_t excess = bytes_ - limit_;
+  dropped_bytes_ += excess;
+  Consume(excess);
+}
+
+size_t ChunkQueue::Peek(size_t max_segments,
+                        std::vector<ChunkSegment>* segments) const {
+  size_t total = 0;
+  size_t offset = offset_;
+  for (size_t i = 0; i < chunks_.size() && i < max_segments; i++) {
+    const std::vector<uint8_t>& chunk = *chunks_[i];
+    segments->push_back(ChunkSegment{chunk.data() + offset,
+                                     chunk.size() - offset});
+    total += chunk.size() - offset;
+    offset = 0;
+  }
+  return total;
+}
+
+void ChunkQueue::Consume(size_t length) {
+  length = std::min(length, bytes_);
+  bytes_ -= length;
+  while (length > 0) {
+    size_t remaining = chunks_.front()->size() - offset_;
+    if (length < remaining) {
+      offset_ += length;
+      return;
+    }
+    length -= remaining;
+    chunks_.pop_front();
+    offset_ = 0;
+  }
+}
+
+void ChunkQueue::Clear() {
+  chunks_.clear();
+  offset_ = 0;
+  bytes_ = 0;
+}
+
+ReceiveFanout::ReceiveFanout() : next_id_(1) {}
+
+int ReceiveFanout::AddSink(Sink sink) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int id = next_id_++;
+  sinks_[id] = std::move(sink);
+  return id;
+}
+
+void ReceiveFanout::RemoveSink(int id) {
+  // Sinks run under the lock, so none is running once we have it.
+  std::lock_guard<std::mutex> lock(mutex_);
+  sinks_.erase(id);
+}
+
+void ReceiveFanout::Publish(const uint8_t* data, size_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (sinks_.empty() || length == 0) return;
+  SharedChunk chunk =
+      std::make_shared<const std::vector<uint8_t>>(data, data + length);
+  for (auto& it : sinks_) it.second(chunk);
+}
+
+}  // namespace serial_com
@@ -0,0 +1,88 @@
+#ifndef SERIAL_COM_CORE_RECEIVE_FANOUT_H_
+#define SERIAL_COM_CORE_RECEIVE_FANOUT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace serial_com {
+
+// Received bytes shared, without copying, by every reader they are fanned
+// out to. Freed when the last reader is done with them.
+using SharedChunk = std::shared_ptr<const std::vector<uint8_t>>;
+
+// A contiguous run of queued bytes.
+struct ChunkSegment {
+  const uint8_t* data;
+  size_t length;
+};
+
+// One reader's backlog of shared chunks. Not thread-safe; owners lock
+// around it.
+class ChunkQueue {
+ public:
+  // Keeps at most |limit| unread bytes (0 for no limit); pushing past it
+  // drops the oldest ones, so a slow reader loses data instead of holding
+  // up the others.
+  explicit ChunkQueue(size_t limit = 0);
+
+  void Push(SharedChunk chunk);
+  // Appends up to |max_segments| segments, oldest first, to |segments| and
+  // returns the number of bytes they cover. Valid until the next Push(),
+  // Consume() or Clear().
+  size_t Peek(size_t max_segments, std::vector<ChunkSegment>* segments) const;
+  // Marks |length| bytes, at most bytes(), as read.
+  void Consume(size_t length);
+  void Clear();
+
+  size_t bytes() const { return bytes_; }
+  bool empty() const { return bytes_ == 0; }
+  size_t limit() const { return limit_; }
+  // Bytes lost to the limit since the queue was created.
+  uint64_t dropped_bytes() const { return dropped_bytes_; }
+
+ private:
+  const size_t limit_;
+  std::deque<SharedChunk> chunks_;
+  // Read bytes at the start of the oldest chunk.
+  size_t offset_;
+  size_t bytes_;
+  uint64_t dropped_bytes_;
+};
+
+// Hands every received chunk to any number of sinks. The bytes are copied
+// once, into a SharedChunk, however many sinks there are; with none,
+// Publish() costs a lock and nothing else.
+class ReceiveFanout {
+ public:
+  // Invoked on the publishing thread, which must not be held up; sinks
+  // queue the chunk and return.
+  using Sink = std::function<void(const SharedChunk& chunk)>;
+
+  ReceiveFanout();
+
+  // Disallow copy and assign.
+  ReceiveFanout(const ReceiveFanout&) = delete;
+  ReceiveFanout& operator=(const ReceiveFanout&) = delete;
+
+  // Returns an id for RemoveSink().
+  int AddSink(Sink sink);
+  // Once this returns, |id|'s sink is not running and will not run again.
+  void RemoveSink(int id);
+
+  void Publish(const uint8_t* data, size_t length);
+
+ private:
+  std::mutex mutex_;
+  std::map<int, Sink> sinks_;
+  int next_id_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_RECEIVE_FANOUT_H_
@@ -0,0 +1,213 @@
+#include "record_decoder.h"
+
+#include <cstring>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+bool HostIsBigEndian() {
+  const uint16_t probe = 1;
+  uint8_t first;
+  memcpy(&first, &probe, 1);
+  return first == 0;
+}
+
+// Loads an unsigned field of type T, swapping bytes if its byte order
+// differs from the host's.
+template <typename T>
+T Load(const uint8_t* p, bool swap) {
+  uint8_t bytes[sizeof(T)];
+  memcpy(bytes, p, sizeof(T));
+  if (swap) {
+    for (size_t i = 0; i < sizeof(T) / 2; i++) {
+      std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+    }
+  }
+  T value;
+  memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void Append(std::vector<uint8_t>* column, T value) {
+  size_t end = column->size();
+  column->resize(end + sizeof(T));
+  memcpy(column->data() + end, &value, sizeof(T));
+}
+
+size_t ColumnTypeSize(ColumnType type) {
+  switch (type) {
+    case ColumnType::kInt32:
+    case ColumnType::kFloat32:
+      return 4;
+    case ColumnType::kInt64:
+    case ColumnType::kFloat64:
+      return 8;
+  }
+  return 8;
+}
+
+}  // namespace
+
+bool ParseFieldType(const char* name, FieldType* type) {
+  static const struct {
+    const char* name;
+    FieldType type;
+  } kTypes[] = {
+      {"u8", FieldType::kU8},   {"i8", FieldType::kI8},
+      {"u16", FieldType::kU16}, {"i16", FieldType::kI16},
+      {"u32", FieldType::kU32}, {"i32", FieldType::kI32},
+      {"f32", FieldType::kF32}, {"f64", FieldType::kF64},
+  };
+  if (name == nullptr) return false;
+  for (const auto& entry : kTypes) {
+    if (strcmp(name, entry.name) == 0) {
+      *type = entry.type;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t FieldTypeSize(FieldType type) {
+  switch (type) {
+    case FieldType::kU8:
+    case FieldType::kI8:
+      return 1;
+    case FieldType::kU16:
+    case FieldType::kI16:
+      return 2;
+    case FieldType::kU32:
+    case FieldType::kI32:
+    case FieldType::kF32:
+      return 4;
+    case FieldType::kF64:
+      return 8;
+  }
+  return 0;
+}
+
+bool IsValidRecordSchema(const RecordSchema& schema) {
+  if (schema.record_size == 0 || schema.fields.empty()) return false;
+  for (const RecordField& field : schema.fields) {
+    if (field.name.empty() ||
+        field.offset + FieldTypeSize(field.type) > schema.record_size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ColumnType ColumnTypeFor(FieldType type) {
+  switch (type) {
+    case FieldType::kU32:
+      return ColumnType::kInt64;
+    case FieldType::kF32:
+      return ColumnType::kFloat32;
+    case FieldType::kF64:
+      return ColumnType::kFloat64;
+    default:
+      return ColumnType::kInt32;
+  }
+}
+
+RecordDecoder::RecordDecoder(RecordSchema schema, size_t max_rows)
+    : schema_(std::move(schema)), max_rows_(max_rows), batch_(NewBatch()) {}
+
+bool RecordDecoder::Decode(const uint8_t* record, size_t length) {
+  static const bool host_big_endian = HostIsBigEndian();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (capture_ && length == schema_.record_size) {
+    capture_->Write(record, length);
+  }
+  if (length != schema_.record_size || batch_.rows >= max_rows_) {
+    batch_.dropped++;
+    return false;
+  }
+  for (size_t i = 0; i < schema_.fields.size(); i++) {
+    const RecordField& field = schema_.fields[i];
+    const uint8_t* p = record + field.offset;
+    const bool swap = field.big_endian != host_big_endian;
+    std::vector<uint8_t>* column = &batch_.columns[i].data;
+    switch (field.type) {
+      case FieldType::kU8:
+        Append<int32_t>(column, *p);
+        break;
+      case FieldType::kI8:
+        Append<int32_t>(column, static_cast<int8_t>(*p));
+        break;
+      case FieldType::kU16:
+        Append<int32_t>(column, Load<uint16_t>(p, swap));
+        break;
+      case FieldType::kI16:
+        Append<int32_t>(column, static_cast<int16_t>(Load<uint16_t>(p, swap)));
+        break;
+      case FieldType::kU32:
+        Append<int64_t>(column, Load<uint32_t>(p, swap));
+        break;
+      case FieldType::kI32:
+        Append<int32_t>(column, static_cast<int32_t>(Load<uint32_t>(p, swap)));
+        break;
+      case FieldType::kF32: {
+        uint32_t bits = Load<uint32_t>(p, swap);
+        float value;
+        memcpy(&value, &bits, sizeof value);
+        Append<float>(column, value);
+        break;
+      }
+      case FieldType::kF64: {
+        uint64_t bits = Load<uint64_t>(p, swap);
+        double value;
+        memcpy(&value, &bits, sizeof value);
+        Append<double>(column, value);
+        break;
+      }
+    }
+  }
+  return ++batch_.rows == 1;
+}
+
+size_t RecordDecoder::rows() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return batch_.rows;
+}
+
+void RecordDecoder::SetCapture(std::unique_ptr<CaptureFile> capture) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capture_ = std::move(capture);
+}
+
+uint64_t RecordDecoder::captured_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capture_ ? capture_->bytes_written() : 0;
+}
+
+bool RecordDecoder::capture_failed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capture_ && capture_->failed();
+}
+
+RecordBatch RecordDecoder::TakeBatch() {
+  RecordBatch batch = NewBatch();
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::swap(batch, batch_);
+  return batch;
+}
+
+RecordBatch RecordDecoder::NewBatch() const {
+  RecordBatch batch;
+  batch.columns.reserve(schema_.fields.size());
+  for (const RecordField& field : schema_.fields) {
+    Column column;
+    column.name = field.name;
+    column.type = ColumnTypeFor(field.type);
+    // Room for a typical batch without regrowing on the I/O thread.
+    column.data.reserve(256 * ColumnTypeSize(column.type));
+    batch.columns.push_back(std::move(column));
+  }
+  return batch;
+}
+
+}  // namespace serial_com
@@ -0,0 +1,111 @@
+#ifndef SERIAL_COM_CORE_RECORD_DECODER_H_
+#define SERIAL_COM_CORE_RECORD_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "capture_file.h"
+
+namespace serial_com {
+
+// Scalar types a record field can have on the wire.
+enum class FieldType { kU8, kI8, kU16, kI16, kU32, kI32, kF32, kF64 };
+
+// Parses "u8", "i8", "u16", "i16", "u32", "i32", "f32" or "f64". Returns
+// false for anything else.
+bool ParseFieldType(const char* name, FieldType* type);
+size_t FieldTypeSize(FieldType type);
+
+struct RecordField {
+  std::string name;
+  FieldType type = FieldType::kU8;
+  // Byte offset of the field within the record.
+  size_t offset = 0;
+  bool big_endian = false;
+};
+
+// The layout of a fixed-size binary record.
+struct RecordSchema {
+  size_t record_size = 0;
+  std::vector<RecordField> fields;
+};
+
+// Returns false if the record is empty or a field lies outside it.
+bool IsValidRecordSchema(const RecordSchema& schema);
+
+// How a field is delivered: the narrowest typed array that holds every
+// value of its wire type. Integers up to 32 bits signed become int32,
+// u32 becomes int64 so large values do not wrap.
+enum class ColumnType { kInt32, kInt64, kFloat32, kFloat64 };
+
+ColumnType ColumnTypeFor(FieldType type);
+
+// One field's values for a batch of records, stored as a packed array of
+// the column type in host byte order.
+struct Column {
+  std::string name;
+  ColumnType type;
+  std::vector<uint8_t> data;
+
+  template <typename T>
+  const T* values() const {
+    return reinterpret_cast<const T*>(data.data());
+  }
+};
+
+struct RecordBatch {
+  size_t rows = 0;
+  // Records discarded because the batch was full or the wrong size.
+  uint64_t dropped = 0;
+  std::vector<Column> columns;
+};
+
+// Decodes records into columns as they arrive and hands them out in
+// batches. Decode() and TakeBatch() may be called from different threads.
+class RecordDecoder {
+ public:
+  // At most |max_rows| records are held between TakeBatch() calls; later
+  // ones are counted as dropped.
+  RecordDecoder(RecordSchema schema, size_t max_rows);
+
+  // Disallow copy and assign.
+  RecordDecoder(const RecordDecoder&) = delete;
+  RecordDecoder& operator=(const RecordDecoder&) = delete;
+
+  const RecordSchema& schema() const { return schema_; }
+
+  // Decodes one record. Returns true if it was the first row of a new
+  // batch, so that a waiting reader can be woken once per batch.
+  bool Decode(const uint8_t* record, size_t length);
+
+  size_t rows();
+
+  // Appends every record of the right size to |capture| as it arrives,
+  // including records dropped from a full batch. Passing nullptr stops
+  // capturing.
+  void SetCapture(std::unique_ptr<CaptureFile> capture);
+  // Bytes captured so far, and whether the capture file has failed.
+  uint64_t captured_bytes();
+  bool capture_failed();
+
+  // Returns the decoded records and starts a new batch.
+  RecordBatch TakeBatch();
+
+ private:
+  RecordBatch NewBatch() const;
+
+  const RecordSchema schema_;
+  const size_t max_rows_;
+
+  std::mutex mutex_;
+  RecordBatch batch_;
+  std::unique_ptr<CaptureFile> capture_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_RECORD_DECODER_H_
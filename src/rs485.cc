@@ -0,0 +1,154 @@
+#include "rs485.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <string>
+
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#include "modem_lines.h"
+
+namespace serial_com {
+
+namespace {
+
+uint64_t Micros(Rs485Stats::Clock::duration duration) {
+  return std::max<int64_t>(
+      0, std::chrono::duration_cast<std::chrono::microseconds>(duration)
+             .count());
+}
+
+#if defined(__linux__) && defined(TIOCSRS485)
+// The kernel's delays are in milliseconds; round up so the line is never
+// switched early.
+uint32_t DelayMs(int delay_us) {
+  return static_cast<uint32_t>((delay_us + 999) / 1000);
+}
+
+// Returns 0, or the errno of a driver that refused.
+int SetKernelRs485(int fd, const Rs485Config& config) {
+  struct serial_rs485 rs485;
+  memset(&rs485, 0, sizeof rs485);
+  rs485.flags = SER_RS485_ENABLED |
+                (config.rts_on_send ? SER_RS485_RTS_ON_SEND
+                                    : SER_RS485_RTS_AFTER_SEND);
+  if (config.rx_during_tx) rs485.flags |= SER_RS485_RX_DURING_TX;
+  rs485.delay_rts_before_send = DelayMs(config.delay_before_send_us);
+  rs485.delay_rts_after_send = DelayMs(config.delay_after_send_us);
+  if (ioctl(fd, TIOCSRS485, &rs485) != 0) return errno;
+  // Drivers drop flags they cannot honour rather than failing.
+  if (!(rs485.flags & SER_RS485_ENABLED)) return ENOTTY;
+  return 0;
+}
+#else
+int SetKernelRs485(int, const Rs485Config&) { return ENOTTY; }
+#endif
+
+}  // namespace
+
+bool IsValidRs485Config(const Rs485Config& config) {
+  return config.delay_before_send_us >= 0 && config.delay_after_send_us >= 0;
+}
+
+const char* Rs485ModeName(Rs485Mode mode) {
+  switch (mode) {
+    case Rs485Mode::kAuto:
+      return "auto";
+    case Rs485Mode::kKernel:
+      return "kernel";
+    case Rs485Mode::kSoftware:
+      return "software";
+  }
+  return "unknown";
+}
+
+bool ParseRs485Mode(const char* name, Rs485Mode* mode) {
+  static const Rs485Mode kModes[] = {Rs485Mode::kAuto, Rs485Mode::kKernel,
+                                     Rs485Mode::kSoftware};
+  for (Rs485Mode candidate : kModes) {
+    if (strcmp(name, Rs485ModeName(candidate)) == 0) {
+      *mode = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+Status EnableRs485(int fd, const Rs485Config& config, Rs485Mode requested,
+                   Rs485Mode* applied) {
+  if (!IsValidRs485Config(config)) {
+    return Status::Error("CONFIG_ERROR", "RS-485 delays must not be negative");
+  }
+  if (requested != Rs485Mode::kSoftware) {
+    int error = SetKernelRs485(fd, config);
+    if (error == 0) {
+      *applied = Rs485Mode::kKernel;
+      return Status::Ok();
+    }
+    if (requested == Rs485Mode::kKernel) {
+      return Status::Error(
+          "CONFIG_ERROR",
+          std::string("The driver does not support RS-485: ") +
+              strerror(error));
+    }
+  }
+  Status status = SetRs485Direction(fd, config, false);
+  if (!status.ok()) return status;
+  *applied = Rs485Mode::kSoftware;
+  return Status::Ok();
+}
+
+Status DisableKernelRs485(int fd) {
+#if defined(__linux__) && defined(TIOCSRS485)
+  struct serial_rs485 rs485;
+  memset(&rs485, 0, sizeof rs485);
+  if (ioctl(fd, TIOCSRS485, &rs485) != 0) {
+    return Status::Error("CONFIG_ERROR",
+                         std::string("TIOCSRS485 failed: ") + strerror(errno));
+  }
+#else
+  (void)fd;
+#endif
+  return Status::Ok();
+}
+
+Status SetRs485Direction(int fd, const Rs485Config& config, bool transmit) {
+  return SetModemLines(fd, kLineRts, transmit == config.rts_on_send);
+}
+
+void Rs485Stats::OnTransmitted(Clock::time_point drained,
+                               Clock::time_point released) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t release_us = Micros(released - drained);
+  stats_.transmissions++;
+  stats_.total_release_us += release_us;
+  stats_.max_release_us = std::max(stats_.max_release_us, release_us);
+  awaiting_reply_ = true;
+  released_ = released;
+}
+
+void Rs485Stats::OnReceived(Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!awaiting_reply_) return;
+  awaiting_reply_ = false;
+  uint64_t turnaround_us = Micros(now - released_);
+  stats_.min_turnaround_us = stats_.replies == 0
+                                 ? turnaround_us
+                                 : std::min(stats_.min_turnaround_us,
+                                            turnaround_us);
+  stats_.max_turnaround_us = std::max(stats_.max_turnaround_us, turnaround_us);
+  stats_.total_turnaround_us += turnaround_us;
+  stats_.replies++;
+}
+
+Rs485StatsSnapshot Rs485Stats::Snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace serial_com
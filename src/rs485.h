@@ -0,0 +1,102 @@
+#ifndef SERIAL_COM_CORE_RS485_H_
+#define SERIAL_COM_CORE_RS485_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "status.h"
+
+namespace serial_com {
+
+// Direction control for a half-duplex RS-485 transceiver whose driver
+// enable follows RTS.
+struct Rs485Config {
+  // RTS level while sending; it is at the other level while receiving.
+  bool rts_on_send = true;
+  // How long the driver is enabled before the first bit goes out, and
+  // kept enabled after the last one has left the UART.
+  int delay_before_send_us = 0;
+  int delay_after_send_us = 0;
+  // Keep receiving while sending, to read back the bus (kernel mode only;
+  // otherwise the transceiver's wiring decides).
+  bool rx_during_tx = false;
+};
+
+// Returns false if a delay is negative.
+bool IsValidRs485Config(const Rs485Config& config);
+
+enum class Rs485Mode {
+  // The kernel's if the driver supports it, the software one otherwise.
+  kAuto,
+  // The driver switches RTS itself (TIOCSRS485), with delays in whole
+  // milliseconds.
+  kKernel,
+  // The transmit path raises RTS, writes, waits for tcdrain and drops RTS
+  // again; see TransmitPacer::SetHalfDuplex().
+  kSoftware,
+};
+
+const char* Rs485ModeName(Rs485Mode mode);
+
+// Parses "auto", "kernel" or "software". Returns false for anything else.
+bool ParseRs485Mode(const char* name, Rs485Mode* mode);
+
+// Puts the tty |fd| in RS-485 mode and sets |applied| to kKernel or
+// kSoftware. kKernel fails with CONFIG_ERROR when the driver lacks
+// support; kSoftware (and kAuto's fallback) puts RTS at its receive level,
+// and fails if the driver cannot drive RTS (a pty, for one).
+Status EnableRs485(int fd, const Rs485Config& config, Rs485Mode requested,
+                   Rs485Mode* applied);
+// Takes a driver out of kernel RS-485 mode.
+Status DisableKernelRs485(int fd);
+// Puts RTS at its level for sending (|transmit|) or receiving.
+Status SetRs485Direction(int fd, const Rs485Config& config, bool transmit);
+
+struct Rs485StatsSnapshot {
+  // Writes sent, each a turn of the bus to transmit and back.
+  uint64_t transmissions = 0;
+  // Transmissions followed by received bytes before the next one.
+  uint64_t replies = 0;
+  // From the last bit leaving the UART to the line being released, over
+  // all transmissions. Includes the after-send delay.
+  uint64_t total_release_us = 0;
+  uint64_t max_release_us = 0;
+  // From the line being released to the first byte of the reply, over
+  // |replies|.
+  uint64_t total_turnaround_us = 0;
+  uint64_t min_turnaround_us = 0;
+  uint64_t max_turnaround_us = 0;
+};
+
+// Bus turnaround times. Transmissions are recorded by the transmit path
+// and arrivals by the receive path, from any thread.
+class Rs485Stats {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Rs485Stats() = default;
+
+  // Disallow copy and assign.
+  Rs485Stats(const Rs485Stats&) = delete;
+  Rs485Stats& operator=(const Rs485Stats&) = delete;
+
+  // A transmission's last bit left the UART at |drained| and the line was
+  // released at |released|.
+  void OnTransmitted(Clock::time_point drained, Clock::time_point released);
+  // Bytes arrived at |now|. The first arrival after a transmission ends
+  // its turnaround.
+  void OnReceived(Clock::time_point now);
+
+  Rs485StatsSnapshot Snapshot();
+
+ private:
+  std::mutex mutex_;
+  Rs485StatsSnapshot stats_;
+  bool awaiting_reply_ = false;
+  Clock::time_point released_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_RS485_H_
@@ -0,0 +1,747 @@
+#include "serial_bridge.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <utility>
+
+#include "modem_lines.h"
+#include "posix_serial_port.h"
+
+namespace serial_com {
+
+namespace {
+
+// Telnet (RFC 854) commands and the options the bridge negotiates.
+constexpr uint8_t kSe = 240;
+constexpr uint8_t kSb = 250;
+constexpr uint8_t kWill = 251;
+constexpr uint8_t kWont = 252;
+constexpr uint8_t kDo = 253;
+constexpr uint8_t kDont = 254;
+constexpr uint8_t kIac = 255;
+constexpr uint8_t kOptionBinary = 0;
+constexpr uint8_t kOptionSuppressGoAhead = 3;
+constexpr uint8_t kOptionComPort = 44;
+
+// RFC 2217 client-to-server commands; the server answers with the same
+// command plus 100.
+constexpr uint8_t kSignature = 0;
+constexpr uint8_t kSetBaudRate = 1;
+constexpr uint8_t kSetDataSize = 2;
+constexpr uint8_t kSetParity = 3;
+constexpr uint8_t kSetStopSize = 4;
+constexpr uint8_t kSetControl = 5;
+constexpr uint8_t kFlowControlSuspend = 8;
+constexpr uint8_t kFlowControlResume = 9;
+constexpr uint8_t kSetLineStateMask = 10;
+constexpr uint8_t kSetModemStateMask = 11;
+constexpr uint8_t kPurgeData = 12;
+constexpr uint8_t kServerOffset = 100;
+
+constexpr char kSignatureText[] = "serial_com";
+
+// Longest subnegotiation kept; RFC 2217 ones are a few bytes.
+constexpr size_t kMaxSubnegotiation = 64;
+// Bounds the iovecs built for one sendmsg().
+constexpr size_t kMaxSegments = 64;
+constexpr size_t kMaxIovecs = 256;
+
+const uint8_t kIacByte = kIac;
+
+// The epoll data of the listening socket and the wake eventfd; clients use
+// their fd, which is never negative.
+constexpr uint64_t kListenTag = ~0ull;
+constexpr uint64_t kWakeTag = ~0ull - 1;
+
+enum class TelnetState {
+  kData,
+  kIac,
+  kNegotiate,
+  kSubnegotiation,
+  kSubnegotiationIac,
+};
+
+std::string ErrnoMessage(const char* what, int error) {
+  return std::string(what) + ": " + strerror(error);
+}
+
+}  // namespace
+
+struct SerialBridge::Client {
+  explicit Client(int fd, size_t limit) : fd(fd), queue(limit) {}
+
+  const int fd;
+  ChunkQueue queue;
+  // Telnet replies, sent ahead of queued data.
+  std::string control;
+  // The doubling of a data IAC whose first byte has been sent.
+  bool pending_iac = false;
+  // Set by FLOWCONTROL-SUSPEND; data queues (up to the limit) meanwhile.
+  bool suspended = false;
+  // Whether the socket is being watched for writability.
+  bool watching_output = false;
+
+  TelnetState state = TelnetState::kData;
+  uint8_t command = 0;
+  std::string subnegotiation;
+  // Options we have asked for or agreed to, so that replies to our own
+  // requests are not answered again.
+  std::bitset<256> will;
+  std::bitset<256> do_;
+};
+
+bool ParseBridgeProtocol(const char* name, BridgeProtocol* protocol) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "raw") == 0) {
+    *protocol = BridgeProtocol::kRaw;
+  } else if (strcmp(name, "rfc2217") == 0) {
+    *protocol = BridgeProtocol::kRfc2217;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+Status SerialBridge::Start(int fd, const PortConfig& config,
+                           std::shared_ptr<ReceiveFanout> fanout,
+                           WriteFunction write, const BridgeOptions& options,
+                           std::unique_ptr<SerialBridge>* bridge) {
+  if (options.port < 0 || options.port > 65535 || options.max_clients <= 0 ||
+      !fanout || !write) {
+    return Status::Error("INVALID_ARGUMENT", "Invalid bridge options");
+  }
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  struct addrinfo* address = nullptr;
+  if (getaddrinfo(options.address.c_str(),
+                  std::to_string(options.port).c_str(), &hints,
+                  &address) != 0) {
+    return Status::Error("INVALID_ARGUMENT",
+                         "Invalid bridge address " + options.address);
+  }
+
+  int listen_fd = socket(address->ai_family,
+                         SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  if (listen_fd < 0 ||
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) != 0 ||
+      bind(listen_fd, address->ai_addr, address->ai_addrlen) != 0 ||
+      listen(listen_fd, options.max_clients) != 0) {
+    int error = errno;
+    freeaddrinfo(address);
+    if (listen_fd >= 0) close(listen_fd);
+    return Status::Error("BRIDGE_ERROR",
+                         ErrnoMessage("Error listening for clients", error));
+  }
+  freeaddrinfo(address);
+
+  struct sockaddr_storage bound;
+  socklen_t bound_length = sizeof bound;
+  getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&bound),
+              &bound_length);
+  int port = ntohs(bound.ss_family == AF_INET6
+                       ? reinterpret_cast<struct sockaddr_in6*>(&bound)
+                             ->sin6_port
+                       : reinterpret_cast<struct sockaddr_in*>(&bound)
+                             ->sin_port);
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  struct epoll_event listen_event = {};
+  listen_event.events = EPOLLIN;
+  listen_event.data.u64 = kListenTag;
+  struct epoll_event wake_event = {};
+  wake_event.events = EPOLLIN;
+  wake_event.data.u64 = kWakeTag;
+  if (epoll_fd < 0 || wake_fd < 0 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) != 0 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) != 0) {
+    int error = errno;
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (wake_fd >= 0) close(wake_fd);
+    close(listen_fd);
+    return Status::Error("BRIDGE_ERROR",
+                         ErrnoMessage("Error starting the bridge", error));
+  }
+
+  bridge->reset(new SerialBridge(fd, config, std::move(fanout),
+                                 std::move(write), options, listen_fd, port,
+                                 epoll_fd, wake_fd));
+  return Status::Ok();
+}
+
+SerialBridge::SerialBridge(int fd, const PortConfig& config,
+                           std::shared_ptr<ReceiveFanout> fanout,
+                           WriteFunction write, const BridgeOptions& options,
+                           int listen_fd, int port, int epoll_fd, int wake_fd)
+    : fd_(fd),
+      fanout_(std::move(fanout)),
+      write_(std::move(write)),
+      options_(options),
+      listen_fd_(listen_fd),
+      port_(port),
+      epoll_fd_(epoll_fd),
+      wake_fd_(wake_fd),
+      config_(config),
+      break_on_(false),
+      stats_(),
+      stopping_(false) {
+  thread_ = std::thread(&SerialBridge::Run, this);
+  sink_id_ = fanout_->AddSink(
+      [this](const SharedChunk& chunk) { Publish(chunk); });
+}
+
+SerialBridge::~SerialBridge() {
+  fanout_->RemoveSink(sink_id_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  Wake();
+  thread_.join();
+  for (auto& it : clients_) close(it.first);
+  close(wake_fd_);
+  close(epoll_fd_);
+  close(listen_fd_);
+}
+
+BridgeStats SerialBridge::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  BridgeStats stats = stats_;
+  stats.clients = static_cast<uint32_t>(clients_.size());
+  return stats;
+}
+
+PortConfig SerialBridge::config() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return config_;
+}
+
+void SerialBridge::Wake() {
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof one);
+  (void)ignored;
+}
+
+void SerialBridge::Publish(const SharedChunk& chunk) {
+  bool wake = false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& it : clients_) {
+    Client* client = it.second.get();
+    // A client with a backlog is already being flushed.
+    if (client->queue.empty() && !client->suspended) wake = true;
+    uint64_t dropped = client->queue.dropped_bytes();
+    client->queue.Push(chunk);
+    stats_.dropped_bytes += client->queue.dropped_bytes() - dropped;
+  }
+  if (wake) Wake();
+}
+
+void SerialBridge::Run() {
+  struct epoll_event events[32];
+  while (true) {
+    int count = epoll_wait(epoll_fd_, events, 32, -1);
+    if (count < 0 && errno != EINTR) return;
+    for (int i = 0; i < count; i++) {
+      uint64_t tag = events[i].data.u64;
+      if (tag == kListenTag) {
+        Accept();
+      } else if (tag == kWakeTag) {
+        uint64_t value;
+        ssize_t ignored = read(wake_fd_, &value, sizeof value);
+        (void)ignored;
+        std::vector<int> gone;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (stopping_) return;
+          for (auto& it : clients_) {
+            Client* client = it.second.get();
+            if (!client->watching_output && !FlushLocked(client)) {
+              gone.push_back(it.first);
+            }
+          }
+        }
+        for (int client_fd : gone) Disconnect(client_fd);
+      } else {
+        int client_fd = static_cast<int>(tag);
+        bool alive = true;
+        Client* client;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          auto it = clients_.find(client_fd);
+          // Already disconnected earlier in this batch.
+          if (it == clients_.end()) continue;
+          client = it->second.get();
+          if (events[i].events & EPOLLOUT) alive = FlushLocked(client);
+        }
+        if (alive && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+          alive = ReadFrom(client);
+        }
+        if (!alive) Disconnect(client_fd);
+      }
+    }
+  }
+}
+
+void SerialBridge::Accept() {
+  int client_fd = accept4(listen_fd_, nullptr, nullptr,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (client_fd < 0) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (static_cast<int>(clients_.size()) >= options_.max_clients) {
+    close(client_fd);
+    return;
+  }
+  // Serial traffic is mostly small writes that should not wait for more.
+  int one = 1;
+  setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = static_cast<uint64_t>(client_fd);
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &event) != 0) {
+    close(client_fd);
+    return;
+  }
+  std::unique_ptr<Client> client(
+      new Client(client_fd, options_.client_buffer_limit));
+  if (options_.protocol == BridgeProtocol::kRfc2217) {
+    // Ask for an 8-bit clean stream both ways and for the client to drive
+    // the port settings.
+    const uint8_t kGreeting[] = {
+        kIac, kWill, kOptionBinary,
+        kIac, kDo,   kOptionBinary,
+        kIac, kWill, kOptionSuppressGoAhead,
+        kIac, kDo,   kOptionSuppressGoAhead,
+        kIac, kDo,   kOptionComPort,
+    };
+    client->control.assign(reinterpret_cast<const char*>(kGreeting),
+                           sizeof kGreeting);
+    client->will.set(kOptionBinary);
+    client->will.set(kOptionSuppressGoAhead);
+    client->do_.set(kOptionBinary);
+    client->do_.set(kOptionSuppressGoAhead);
+    client->do_.set(kOptionComPort);
+  }
+  stats_.connections++;
+  Client* added = client.get();
+  clients_[client_fd] = std::move(client);
+  if (!FlushLocked(added)) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_fd, nullptr);
+    close(client_fd);
+    clients_.erase(client_fd);
+  }
+}
+
+bool SerialBridge::ReadFrom(Client* client) {
+  uint8_t buffer[4096];
+  ssize_t n = read(client->fd, buffer, sizeof buffer);
+  if (n < 0) return errno == EAGAIN || errno == EINTR;
+  if (n == 0) return false;
+
+  std::vector<uint8_t> port_data;
+  bool alive = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (options_.protocol == BridgeProtocol::kRfc2217) {
+      ParseTelnetLocked(client, buffer, n, &port_data);
+      if (!client->control.empty()) alive = FlushLocked(client);
+    } else {
+      port_data.assign(buffer, buffer + n);
+    }
+    stats_.bytes_from_clients += port_data.size();
+  }
+  if (!port_data.empty()) write_(std::move(port_data));
+  return alive;
+}
+
+bool SerialBridge::FlushLocked(Client* client) {
+  // What each iovec of a send carries.
+  enum class Piece {
+    // The second byte of an escaped IAC.
+    kEscape,
+    kControl,
+    kData,
+    // Port data ending in an IAC, which the next (kEscape) iovec doubles.
+    kDataIac,
+  };
+  bool telnet = options_.protocol == BridgeProtocol::kRfc2217;
+  bool blocked = false;
+  std::vector<ChunkSegment> segments;
+  std::vector<struct iovec> iovecs;
+  std::vector<Piece> pieces;
+  while (true) {
+    iovecs.clear();
+    pieces.clear();
+    size_t total = 0;
+    auto add = [&iovecs, &pieces, &total](const void* data, size_t length,
+                                          Piece piece) {
+      iovecs.push_back({const_cast<void*>(data), length});
+      pieces.push_back(piece);
+      total += length;
+    };
+    if (client->pending_iac) {
+      // Nothing else may come between an IAC and its double, or the
+      // client would read a command.
+      add(&kIacByte, 1, Piece::kEscape);
+    } else if (!client->control.empty()) {
+      add(client->control.data(), client->control.size(), Piece::kControl);
+    } else if (!client->suspended && !client->queue.empty()) {
+      segments.clear();
+      client->queue.Peek(kMaxSegments, &segments);
+      for (const ChunkSegment& segment : segments) {
+        const uint8_t* data = segment.data;
+        const uint8_t* end = segment.data + segment.length;
+        while (data < end && iovecs.size() + 2 <= kMaxIovecs) {
+          const uint8_t* iac =
+              telnet ? static_cast<const uint8_t*>(
+                           memchr(data, kIac, end - data))
+                     : nullptr;
+          if (iac == nullptr) {
+            add(data, end - data, Piece::kData);
+            data = end;
+          } else {
+            add(data, iac + 1 - data, Piece::kDataIac);
+            add(&kIacByte, 1, Piece::kEscape);
+            data = iac + 1;
+          }
+        }
+      }
+    }
+    if (iovecs.empty()) break;
+
+    struct msghdr message = {};
+    message.msg_iov = iovecs.data();
+    message.msg_iovlen = iovecs.size();
+    ssize_t n = sendmsg(client->fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) return false;
+      blocked = true;
+      break;
+    }
+
+    size_t remaining = n;
+    size_t port_bytes = 0;
+    for (size_t i = 0; i < iovecs.size() && remaining > 0; i++) {
+      size_t sent = std::min(remaining, iovecs[i].iov_len);
+      remaining -= sent;
+      switch (pieces[i]) {
+        case Piece::kEscape:
+          client->pending_iac = false;
+          break;
+        case Piece::kControl:
+          client->control.erase(0, sent);
+          break;
+        case Piece::kData:
+          port_bytes += sent;
+          break;
+        case Piece::kDataIac:
+          port_bytes += sent;
+          if (sent == iovecs[i].iov_len) client->pending_iac = true;
+          break;
+      }
+    }
+    client->queue.Consume(port_bytes);
+    stats_.bytes_to_clients += port_bytes;
+    if (static_cast<size_t>(n) < total) {
+      blocked = true;
+      break;
+    }
+  }
+
+  if (blocked != client->watching_output) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN | (blocked ? EPOLLOUT : 0);
+    event.data.u64 = static_cast<uint64_t>(client->fd);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client->fd, &event);
+    client->watching_output = blocked;
+  }
+  return true;
+}
+
+void SerialBridge::Disconnect(int client_fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = clients_.find(client_fd);
+  if (it == clients_.end()) return;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_fd, nullptr);
+  close(client_fd);
+  clients_.erase(it);
+}
+
+void SerialBridge::ParseTelnetLocked(Client* client, const uint8_t* data,
+                                     size_t length,
+                                     std::vector<uint8_t>* port_data) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t byte = data[i];
+    switch (client->state) {
+      case TelnetState::kData:
+        if (byte == kIac) {
+          client->state = TelnetState::kIac;
+        } else {
+          port_data->push_back(byte);
+        }
+        break;
+      case TelnetState::kIac:
+        client->state = TelnetState::kData;
+        if (byte == kIac) {
+          port_data->push_back(kIac);
+        } else if (byte >= kWill && byte <= kDont) {
+          client->command = byte;
+          client->state = TelnetState::kNegotiate;
+        } else if (byte == kSb) {
+          client->subnegotiation.clear();
+          client->state = TelnetState::kSubnegotiation;
+        }
+        // Anything else (NOP, AYT, ...) has no meaning for a serial port.
+        break;
+      case TelnetState::kNegotiate:
+        NegotiateLocked(client, client->command, byte);
+        client->state = TelnetState::kData;
+        break;
+      case TelnetState::kSubnegotiation:
+        if (byte == kIac) {
+          client->state = TelnetState::kSubnegotiationIac;
+        } else if (client->subnegotiation.size() < kMaxSubnegotiation) {
+          client->subnegotiation.push_back(static_cast<char>(byte));
+        }
+        break;
+      case TelnetState::kSubnegotiationIac:
+        if (byte == kIac) {
+          if (client->subnegotiation.size() < kMaxSubnegotiation) {
+            client->subnegotiation.push_back(static_cast<char>(kIac));
+          }
+          client->state = TelnetState::kSubnegotiation;
+          break;
+        }
+        client->state = TelnetState::kData;
+        if (byte == kSe && client->subnegotiation.size() >= 2 &&
+            static_cast<uint8_t>(client->subnegotiation[0]) ==
+                kOptionComPort) {
+          HandleComPortLocked(client,
+                              static_cast<uint8_t>(client->subnegotiation[1]),
+                              client->subnegotiation.substr(2));
+        }
+        break;
+    }
+  }
+}
+
+void SerialBridge::NegotiateLocked(Client* client, uint8_t command,
+                                   uint8_t option) {
+  // Only answer requests that change an option's state, so the two sides
+  // never bounce acknowledgements (RFC 854).
+  bool local = option == kOptionBinary || option == kOptionSuppressGoAhead;
+  bool remote = local || option == kOptionComPort;
+  uint8_t reply = 0;
+  if (command == kDo) {
+    if (!local) {
+      reply = kWont;
+    } else if (!client->will.test(option)) {
+      client->will.set(option);
+      reply = kWill;
+    }
+  } else if (command == kDont) {
+    if (client->will.test(option)) {
+      client->will.reset(option);
+      reply = kWont;
+    }
+  } else if (command == kWill) {
+    if (!remote) {
+      reply = kDont;
+    } else if (!client->do_.test(option)) {
+      client->do_.set(option);
+      reply = kDo;
+    }
+  } else if (command == kWont) {
+    if (client->do_.test(option)) {
+      client->do_.reset(option);
+      reply = kDont;
+    }
+  }
+  if (reply == 0) return;
+  client->control.push_back(static_cast<char>(kIac));
+  client->control.push_back(static_cast<char>(reply));
+  client->control.push_back(static_cast<char>(option));
+}
+
+void SerialBridge::HandleComPortLocked(Client* client, uint8_t command,
+                                       const std::string& value) {
+  stats_.control_requests++;
+  auto byte_value = [&value]() -> uint8_t {
+    return value.empty() ? 0 : static_cast<uint8_t>(value[0]);
+  };
+  PortConfig next = config_;
+  switch (command) {
+    case kSignature:
+      // A client sending its own signature expects no answer.
+      if (value.empty()) ReplyLocked(client, command, kSignatureText);
+      return;
+    case kSetBaudRate: {
+      if (value.size() != 4) return;
+      uint32_t baud_rate = 0;
+      for (char c : value) baud_rate = baud_rate << 8 | static_cast<uint8_t>(c);
+      if (baud_rate != 0) {
+        next.baud_rate = static_cast<int>(baud_rate);
+        ApplyConfigLocked(next);
+      }
+      std::string reply(4, '\0');
+      for (int i = 0; i < 4; i++) {
+        reply[i] = static_cast<char>(config_.baud_rate >> (24 - 8 * i));
+      }
+      ReplyLocked(client, command, reply);
+      return;
+    }
+    case kSetDataSize:
+      if (byte_value() != 0) {
+        next.data_bits = byte_value();
+        ApplyConfigLocked(next);
+      }
+      ReplyLocked(client, command,
+                  std::string(1, static_cast<char>(config_.data_bits)));
+      return;
+    case kSetParity: {
+      // 1 none, 2 odd, 3 even; mark and space are not supported.
+      static const Parity kParities[] = {Parity::kNone, Parity::kOdd,
+                                         Parity::kEven};
+      uint8_t requested = byte_value();
+      if (requested >= 1 && requested <= 3) {
+        next.parity = kParities[requested - 1];
+        ApplyConfigLocked(next);
+      }
+      uint8_t current = config_.parity == Parity::kNone  ? 1
+                        : config_.parity == Parity::kOdd ? 2
+                                                         : 3;
+      ReplyLocked(client, command, std::string(1, static_cast<char>(current)));
+      return;
+    }
+    case kSetStopSize: {
+      // 1 and 2 stop bits; 1.5 (3) is not supported.
+      uint8_t requested = byte_value();
+      if (requested == 1 || requested == 2) {
+        next.stop_bits = requested == 2 ? StopBits::kTwo : StopBits::kOne;
+        ApplyConfigLocked(next);
+      }
+      uint8_t current = config_.stop_bits == StopBits::kTwo ? 2 : 1;
+      ReplyLocked(client, command, std::string(1, static_cast<char>(current)));
+      return;
+    }
+    case kSetControl: {
+      uint8_t requested = byte_value();
+      uint8_t current = requested;
+      uint32_t lines = 0;
+      switch (requested) {
+        case 0:  // Query outbound flow control.
+        case 1:  // None.
+        case 2:  // XON/XOFF.
+        case 3:  // RTS/CTS.
+          if (requested != 0) {
+            static const FlowControl kFlows[] = {FlowControl::kNone,
+                                                 FlowControl::kSoftware,
+                                                 FlowControl::kHardware};
+            next.flow_control = kFlows[requested - 1];
+            ApplyConfigLocked(next);
+          }
+          current = config_.flow_control == FlowControl::kNone       ? 1
+                    : config_.flow_control == FlowControl::kSoftware ? 2
+                                                                     : 3;
+          break;
+        case 4:  // Query break.
+        case 5:  // Break on.
+        case 6:  // Break off.
+          if (requested != 4 && SetBreak(fd_, requested == 5).ok()) {
+            break_on_ = requested == 5;
+          }
+          current = break_on_ ? 5 : 6;
+          break;
+        case 7:   // Query DTR.
+        case 8:   // DTR on.
+        case 9:   // DTR off.
+        case 10:  // Query RTS.
+        case 11:  // RTS on.
+        case 12: {  // RTS off.
+          bool dtr = requested <= 9;
+          uint8_t query = dtr ? 7 : 10;
+          uint32_t line = dtr ? kLineDtr : kLineRts;
+          if (requested != query) {
+            SetModemLines(fd_, line, requested == query + 1);
+          }
+          if (GetModemLines(fd_, &lines).ok()) {
+            current = (lines & line) ? query + 1 : query + 2;
+          }
+          break;
+        }
+        default:
+          // Inbound flow control and DCD/DSR flow are not supported; the
+          // echo tells the client nothing changed.
+          break;
+      }
+      ReplyLocked(client, command, std::string(1, static_cast<char>(current)));
+      return;
+    }
+    case kFlowControlSuspend:
+      client->suspended = true;
+      return;
+    case kFlowControlResume:
+      client->suspended = false;
+      // Resumes sending whatever queued meanwhile.
+      Wake();
+      return;
+    case kSetLineStateMask:
+    case kSetModemStateMask:
+      // Acknowledged; no line or modem state notifications are sent.
+      ReplyLocked(client, command, value.substr(0, 1));
+      return;
+    case kPurgeData: {
+      // 1 the port's receive buffer, 2 its transmit buffer, 3 both.
+      static const FlushQueue kQueues[] = {
+          FlushQueue::kReceive, FlushQueue::kTransmit, FlushQueue::kBoth};
+      uint8_t requested = byte_value();
+      if (requested >= 1 && requested <= 3) {
+        FlushPosixPort(fd_, kQueues[requested - 1]);
+      }
+      ReplyLocked(client, command, value.substr(0, 1));
+      return;
+    }
+    default:
+      return;
+  }
+}
+
+void SerialBridge::ReplyLocked(Client* client, uint8_t command,
+                               const std::string& value) {
+  std::string& out = client->control;
+  out.push_back(static_cast<char>(kIac));
+  out.push_back(static_cast<char>(kSb));
+  out.push_back(static_cast<char>(kOptionComPort));
+  out.push_back(static_cast<char>(command + kServerOffset));
+  for (char c : value) {
+    out.push_back(c);
+    if (static_cast<uint8_t>(c) == kIac) out.push_back(c);
+  }
+  out.push_back(static_cast<char>(kIac));
+  out.push_back(static_cast<char>(kSe));
+}
+
+void SerialBridge::ApplyConfigLocked(const PortConfig& config) {
+  // Unsupported values leave the port as it was; the reply then tells the
+  // client what it actually got.
+  if (IsValidPortConfig(config) && ConfigurePosixPort(fd_, config).ok()) {
+    config_ = config;
+  }
+}
+
+}  // namespace serial_com
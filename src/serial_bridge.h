@@ -0,0 +1,149 @@
+#ifndef SERIAL_COM_CORE_SERIAL_BRIDGE_H_
+#define SERIAL_COM_CORE_SERIAL_BRIDGE_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "port_config.h"
+#include "receive_fanout.h"
+#include "status.h"
+
+namespace serial_com {
+
+// What a SerialBridge speaks to its TCP clients.
+enum class BridgeProtocol {
+  // The port's bytes as they are, for loggers and netcat.
+  kRaw,
+  // Telnet with the COM-PORT-OPTION (RFC 2217), so that clients such as
+  // pyserial's rfc2217:// URLs can change the line settings and control
+  // lines remotely.
+  kRfc2217,
+};
+
+// Parses "raw" or "rfc2217". Returns false for anything else.
+bool ParseBridgeProtocol(const char* name, BridgeProtocol* protocol);
+
+struct BridgeOptions {
+  // Numeric IPv4 or IPv6 address to listen on. Clients are not
+  // authenticated, so anything but loopback exposes the port to the
+  // network.
+  std::string address = "127.0.0.1";
+  // 0 picks a free port; see SerialBridge::port().
+  int port = 0;
+  BridgeProtocol protocol = BridgeProtocol::kRfc2217;
+  // Received bytes queued for one client before its oldest are dropped.
+  size_t client_buffer_limit = 1 << 20;
+  // Connections beyond this many are closed straight away.
+  int max_clients = 8;
+};
+
+struct BridgeStats {
+  uint32_t clients;
+  uint64_t connections;
+  // Port data sent to clients, counted once per client, excluding telnet
+  // escapes.
+  uint64_t bytes_to_clients;
+  // Client data passed on to the port.
+  uint64_t bytes_from_clients;
+  // Port data slow clients lost to client_buffer_limit.
+  uint64_t dropped_bytes;
+  // RFC 2217 requests handled.
+  uint64_t control_requests;
+};
+
+// Serves an open tty to several TCP clients at once.
+//
+// Everything the port receives reaches every client from the same shared
+// chunks; each client only holds references into them, up to its buffer
+// limit. Sockets are non-blocking, so a client that stops reading loses its
+// own oldest data and never holds up the port or the other clients.
+// Clients' data is interleaved onto the port as it arrives.
+class SerialBridge {
+ public:
+  // Queues bytes for transmission on the port. Called on the bridge
+  // thread.
+  using WriteFunction = std::function<void(std::vector<uint8_t> data)>;
+
+  // Listens for clients of the tty |fd|, whose settings are |config|.
+  // Received bytes come from |fanout|; client bytes go to |write|. RFC 2217
+  // requests are applied to |fd| directly. Fails with INVALID_ARGUMENT for
+  // bad options and BRIDGE_ERROR if the socket cannot be set up.
+  static Status Start(int fd, const PortConfig& config,
+                      std::shared_ptr<ReceiveFanout> fanout,
+                      WriteFunction write, const BridgeOptions& options,
+                      std::unique_ptr<SerialBridge>* bridge);
+
+  // Disconnects every client.
+  ~SerialBridge();
+
+  // Disallow copy and assign.
+  SerialBridge(const SerialBridge&) = delete;
+  SerialBridge& operator=(const SerialBridge&) = delete;
+
+  // The TCP port actually listened on.
+  int port() const { return port_; }
+  BridgeStats stats();
+  // The line settings, as last changed by a client.
+  PortConfig config();
+
+ private:
+  struct Client;
+
+  SerialBridge(int fd, const PortConfig& config,
+               std::shared_ptr<ReceiveFanout> fanout, WriteFunction write,
+               const BridgeOptions& options, int listen_fd, int port,
+               int epoll_fd, int wake_fd);
+
+  void Run();
+  void Wake();
+  // Hands |chunk| to every client. Runs on the publishing thread.
+  void Publish(const SharedChunk& chunk);
+
+  void Accept();
+  // Reads from |client|; returns false once it has gone.
+  bool ReadFrom(Client* client);
+  // Sends what |client| has queued, watching for writability if the
+  // socket is full. Returns false if the client has gone. Requires
+  // mutex_.
+  bool FlushLocked(Client* client);
+  void Disconnect(int client_fd);
+
+  // Telnet (kRfc2217 only). Require mutex_.
+  void ParseTelnetLocked(Client* client, const uint8_t* data, size_t length,
+                         std::vector<uint8_t>* port_data);
+  void NegotiateLocked(Client* client, uint8_t command, uint8_t option);
+  void HandleComPortLocked(Client* client, uint8_t command,
+                           const std::string& value);
+  void ReplyLocked(Client* client, uint8_t command,
+                   const std::string& value);
+  void ApplyConfigLocked(const PortConfig& config);
+
+  const int fd_;
+  const std::shared_ptr<ReceiveFanout> fanout_;
+  const WriteFunction write_;
+  const BridgeOptions options_;
+  const int listen_fd_;
+  const int port_;
+  const int epoll_fd_;
+  const int wake_fd_;
+  int sink_id_;
+
+  std::mutex mutex_;
+  std::map<int, std::unique_ptr<Client>> clients_;
+  PortConfig config_;
+  bool break_on_;
+  BridgeStats stats_;
+  bool stopping_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_SERIAL_BRIDGE_H_
@@ -0,0 +1,48 @@
+#ifndef SERIAL_COM_CORE_SERIAL_PORT_H_
+#define SERIAL_COM_CORE_SERIAL_PORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "port_config.h"
+#include "port_stats.h"
+#include "status.h"
+
+namespace serial_com {
+
+// A blocking handle on one serial device, with the same semantics on every
+// platform:
+//
+//  - Open() applies the full PortConfig or fails with "OPEN_ERROR" or
+//    "CONFIG_ERROR".
+//  - Write() returns once all bytes have been accepted by the driver.
+//  - Read() returns whatever arrives within a short timeout (possibly
+//    nothing), up to |max_length| bytes.
+//  - Queued() reports how many received bytes the driver holds, for
+//    sizing the next Read() (see ReadSizer).
+class SerialPort {
+ public:
+  // Creates the backend for the platform being built.
+  static std::unique_ptr<SerialPort> Create();
+
+  virtual ~SerialPort() = default;
+
+  virtual Status Open(const PortConfig& config) = 0;
+  virtual void Close() = 0;
+  virtual bool IsOpen() const = 0;
+
+  virtual Status Write(const uint8_t* data, size_t length) = 0;
+  virtual Status Read(size_t max_length, std::vector<uint8_t>* data) = 0;
+  virtual Status Queued(size_t* bytes) = 0;
+
+  const PortStats& stats() const { return stats_; }
+
+ protected:
+  PortStats stats_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_SERIAL_PORT_H_
@@ -0,0 +1,93 @@
+#include "spill_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace serial_com {
+
+namespace {
+
+constexpr size_t kSpillWriteSize = 64 * 1024;
+
+}  // namespace
+
+std::unique_ptr<SpillFile> SpillFile::Create(const std::string& directory) {
+  std::string path = directory;
+  if (path.empty()) {
+    const char* tmpdir = getenv("TMPDIR");
+    path = tmpdir != nullptr && tmpdir[0] != '\0' ? tmpdir : "/var/tmp";
+  }
+  path += "/serial_com-spill-XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  int fd = mkostemp(name.data(), O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  unlink(name.data());
+  return std::unique_ptr<SpillFile>(new SpillFile(fd));
+}
+
+SpillFile::SpillFile(int fd) : fd_(fd) { pending_.reserve(kSpillWriteSize); }
+
+SpillFile::~SpillFile() { close(fd_); }
+
+void SpillFile::Append(const uint8_t* data, size_t length) {
+  if (pending_.size() + length > kSpillWriteSize) Flush();
+  pending_.insert(pending_.end(), data, data + length);
+  if (pending_.size() >= kSpillWriteSize) Flush();
+}
+
+void SpillFile::Flush() {
+  size_t written = 0;
+  while (written < pending_.size()) {
+    ssize_t n = pwrite(fd_, pending_.data() + written,
+                       pending_.size() - written, flushed_ + written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      dropped_bytes_ += pending_.size() - written;
+      break;
+    }
+    written += n;
+  }
+  flushed_ += written;
+  pending_.clear();
+}
+
+size_t SpillFile::Read(uint8_t* out, size_t max_length) {
+  // The oldest bytes may still be waiting to be written.
+  if (read_offset_ == flushed_ && !pending_.empty()) Flush();
+  size_t length = static_cast<size_t>(
+      std::min<uint64_t>(max_length, flushed_ - read_offset_));
+  size_t read = 0;
+  while (read < length) {
+    ssize_t n = pread(fd_, out + read, length - read, read_offset_ + read);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      // What cannot be read back is lost; skip it rather than stall.
+      dropped_bytes_ += flushed_ - read_offset_ - read;
+      read_offset_ = flushed_;
+      break;
+    }
+    read += n;
+  }
+  if (read_offset_ != flushed_) read_offset_ += read;
+  if (read_offset_ == flushed_ && pending_.empty()) Clear();
+  return read;
+}
+
+void SpillFile::Clear() {
+  if (flushed_ > 0) {
+    // Give the disk space back.
+    int ignored = ftruncate(fd_, 0);
+    (void)ignored;
+  }
+  pending_.clear();
+  read_offset_ = 0;
+  flushed_ = 0;
+}
+
+}  // namespace serial_com
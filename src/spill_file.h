@@ -0,0 +1,61 @@
+#ifndef SERIAL_COM_CORE_SPILL_FILE_H_
+#define SERIAL_COM_CORE_SPILL_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace serial_com {
+
+// A FIFO of bytes kept in an anonymous temporary file, for received data
+// that does not fit a port's memory budget. Bytes are appended
+// sequentially in large writes and read back from the front; once
+// everything has been read the file is truncated, so it only occupies disk
+// while a consumer is behind. Not thread-safe.
+class SpillFile {
+ public:
+  // Creates the file in |directory|, or in $TMPDIR (else /var/tmp, which
+  // unlike /tmp is rarely RAM-backed) if it is empty. The file is unlinked
+  // at once, so nothing is left behind after a crash. Returns nullptr with
+  // errno set on failure.
+  static std::unique_ptr<SpillFile> Create(const std::string& directory);
+
+  ~SpillFile();
+
+  // Disallow copy and assign.
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  // Queues |data| behind everything already spilled. Bytes that cannot be
+  // written (disk full) are discarded and counted in dropped_bytes().
+  void Append(const uint8_t* data, size_t length);
+  // Moves up to |max_length| of the oldest bytes into |out| and returns how
+  // many moved.
+  size_t Read(uint8_t* out, size_t max_length);
+  void Clear();
+
+  // Bytes spilled and not yet read.
+  uint64_t size() const { return flushed_ + pending_.size() - read_offset_; }
+  bool empty() const { return size() == 0; }
+  uint64_t dropped_bytes() const { return dropped_bytes_; }
+
+ private:
+  explicit SpillFile(int fd);
+
+  // Writes |pending_| to the end of the file.
+  void Flush();
+
+  const int fd_;
+  // File offsets of the next byte to read and of the end of written data.
+  uint64_t read_offset_ = 0;
+  uint64_t flushed_ = 0;
+  // Appended bytes not yet written, so that the file sees large writes.
+  std::vector<uint8_t> pending_;
+  uint64_t dropped_bytes_ = 0;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_SPILL_FILE_H_
@@ -0,0 +1,32 @@
+#ifndef SERIAL_COM_CORE_STATUS_H_
+#define SERIAL_COM_CORE_STATUS_H_
+
+#include <string>
+#include <utility>
+
+namespace serial_com {
+
+// Outcome of a port operation. Error codes are the strings the platform
+// channels hand to Dart, e.g. "OPEN_ERROR" or "CONFIG_ERROR".
+class Status {
+ public:
+  static Status Ok() { return Status(nullptr, std::string()); }
+  static Status Error(const char* code, std::string message) {
+    return Status(code, std::move(message));
+  }
+
+  bool ok() const { return code_ == nullptr; }
+  const char* code() const { return code_; }
+  const std::string& message() const { return message_; }
+
+ private:
+  Status(const char* code, std::string message)
+      : code_(code), message_(std::move(message)) {}
+
+  const char* code_;
+  std::string message_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_STATUS_H_
@@ -0,0 +1,243 @@
+#include "stream_subscribers.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+// Segments copied per Peek() while reading.
+constexpr size_t kReadSegments = 16;
+
+}  // namespace
+
+bool ParseBackpressurePolicy(const char* name, BackpressurePolicy* policy) {
+  if (strcmp(name, "dropOldest") == 0) {
+    *policy = BackpressurePolicy::kDropOldest;
+  } else if (strcmp(name, "block") == 0) {
+    *policy = BackpressurePolicy::kBlock;
+  } else if (strcmp(name, "spill") == 0) {
+    *policy = BackpressurePolicy::kSpill;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* BackpressurePolicyName(BackpressurePolicy policy) {
+  switch (policy) {
+    case BackpressurePolicy::kDropOldest:
+      return "dropOldest";
+    case BackpressurePolicy::kBlock:
+      return "block";
+    case BackpressurePolicy::kSpill:
+      return "spill";
+  }
+  return "dropOldest";
+}
+
+struct StreamSubscribers::Subscriber {
+  explicit Subscriber(const SubscriberOptions& options)
+      : policy(options.policy),
+        limit(options.limit),
+        queue(options.policy == BackpressurePolicy::kDropOldest
+                  ? options.limit
+                  : 0) {}
+
+  uint64_t queued() const {
+    return queue.bytes() + (spill ? spill->size() : 0);
+  }
+
+  const BackpressurePolicy policy;
+  const size_t limit;
+  // Only kDropOldest queues enforce the limit themselves.
+  ChunkQueue queue;
+  // kSpill only: bytes that arrived while |queue| was full, all newer than
+  // everything in it.
+  std::unique_ptr<SpillFile> spill;
+  int sink_id = 0;
+  bool holding = false;
+  uint64_t received_bytes = 0;
+  uint64_t read_bytes = 0;
+  uint64_t spilled_bytes = 0;
+};
+
+StreamSubscribers::StreamSubscribers(std::shared_ptr<ReceiveFanout> fanout,
+                                     NotifyFunction notify,
+                                     HoldFunction hold)
+    : fanout_(std::move(fanout)),
+      notify_(std::move(notify)),
+      hold_(std::move(hold)),
+      next_id_(1),
+      holders_(0) {}
+
+StreamSubscribers::~StreamSubscribers() {
+  for (int id : ids()) Unsubscribe(id);
+}
+
+Status StreamSubscribers::Subscribe(const SubscriberOptions& options,
+                                    int* id) {
+  if (options.limit == 0) {
+    return Status::Error("INVALID_ARGUMENT", "Subscriber limit must be set");
+  }
+  std::unique_ptr<Subscriber> subscriber(new Subscriber(options));
+  if (options.policy == BackpressurePolicy::kSpill) {
+    subscriber->spill = SpillFile::Create(options.spill_directory);
+    if (!subscriber->spill) {
+      return Status::Error(
+          "CONFIG_ERROR",
+          std::string("Could not create spill file: ") + strerror(errno));
+    }
+  }
+
+  std::lock_guard<std::mutex> membership(membership_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *id = next_id_++;
+    subscribers_[*id] = std::move(subscriber);
+  }
+  // The subscriber sees everything published from here on.
+  int subscriber_id = *id;
+  int sink_id = fanout_->AddSink([this, subscriber_id](
+                                     const SharedChunk& chunk) {
+    Deliver(subscriber_id, chunk);
+  });
+  std::lock_guard<std::mutex> lock(mutex_);
+  subscribers_[*id]->sink_id = sink_id;
+  return Status::Ok();
+}
+
+bool StreamSubscribers::Unsubscribe(int id) {
+  std::lock_guard<std::mutex> membership(membership_mutex_);
+  int sink_id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = subscribers_.find(id);
+    if (it == subscribers_.end()) return false;
+    sink_id = it->second->sink_id;
+  }
+  fanout_->RemoveSink(sink_id);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = subscribers_.find(id);
+  SetHoldingLocked(it->second.get(), false);
+  subscribers_.erase(it);
+  return true;
+}
+
+void StreamSubscribers::Deliver(int id, const SharedChunk& chunk) {
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = subscribers_.find(id);
+    if (it == subscribers_.end()) return;
+    Subscriber* subscriber = it->second.get();
+    was_empty = subscriber->queued() == 0;
+    subscriber->received_bytes += chunk->size();
+    switch (subscriber->policy) {
+      case BackpressurePolicy::kDropOldest:
+        subscriber->queue.Push(chunk);
+        break;
+      case BackpressurePolicy::kBlock:
+        subscriber->queue.Push(chunk);
+        // The read in progress still lands, so the queue can overshoot
+        // the limit by one read.
+        if (subscriber->queue.bytes() >= subscriber->limit) {
+          SetHoldingLocked(subscriber, true);
+        }
+        break;
+      case BackpressurePolicy::kSpill:
+        if (subscriber->spill->empty() &&
+            subscriber->queue.bytes() + chunk->size() <= subscriber->limit) {
+          subscriber->queue.Push(chunk);
+        } else {
+          subscriber->spill->Append(chunk->data(), chunk->size());
+          subscriber->spilled_bytes += chunk->size();
+        }
+        break;
+    }
+  }
+  if (was_empty && notify_) notify_(id);
+}
+
+size_t StreamSubscribers::Read(int id, uint8_t* out, size_t max_length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = subscribers_.find(id);
+  if (it == subscribers_.end()) return 0;
+  Subscriber* subscriber = it->second.get();
+
+  size_t read = 0;
+  std::vector<ChunkSegment> segments;
+  while (read < max_length && !subscriber->queue.empty()) {
+    segments.clear();
+    subscriber->queue.Peek(kReadSegments, &segments);
+    size_t copied = 0;
+    for (const ChunkSegment& segment : segments) {
+      size_t n = std::min(segment.length, max_length - read - copied);
+      memcpy(out + read + copied, segment.data, n);
+      copied += n;
+      if (read + copied == max_length) break;
+    }
+    subscriber->queue.Consume(copied);
+    read += copied;
+  }
+  if (subscriber->spill && read < max_length) {
+    read += subscriber->spill->Read(out + read, max_length - read);
+  }
+  subscriber->read_bytes += read;
+  // Let the port go once half the limit is free again, rather than
+  // toggling on every read.
+  if (subscriber->holding &&
+      subscriber->queue.bytes() <= subscriber->limit / 2) {
+    SetHoldingLocked(subscriber, false);
+  }
+  return read;
+}
+
+uint64_t StreamSubscribers::Queued(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = subscribers_.find(id);
+  return it == subscribers_.end() ? 0 : it->second->queued();
+}
+
+bool StreamSubscribers::Stats(int id, SubscriberStats* stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = subscribers_.find(id);
+  if (it == subscribers_.end()) return false;
+  const Subscriber& subscriber = *it->second;
+  stats->policy = subscriber.policy;
+  stats->queued_bytes = subscriber.queued();
+  stats->received_bytes = subscriber.received_bytes;
+  stats->read_bytes = subscriber.read_bytes;
+  stats->spilled_bytes = subscriber.spilled_bytes;
+  stats->dropped_bytes =
+      subscriber.queue.dropped_bytes() +
+      (subscriber.spill ? subscriber.spill->dropped_bytes() : 0);
+  stats->holding = subscriber.holding;
+  return true;
+}
+
+std::vector<int> StreamSubscribers::ids() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<int> ids;
+  for (const auto& it : subscribers_) ids.push_back(it.first);
+  return ids;
+}
+
+void StreamSubscribers::SetHoldingLocked(Subscriber* subscriber,
+                                         bool holding) {
+  if (subscriber->holding == holding) return;
+  subscriber->holding = holding;
+  // Calling under mutex_ keeps a release from overtaking the hold it
+  // undoes.
+  if (holding) {
+    if (holders_++ == 0 && hold_) hold_(true);
+  } else {
+    if (--holders_ == 0 && hold_) hold_(false);
+  }
+}
+
+}  // namespace serial_com
@@ -0,0 +1,127 @@
+#ifndef SERIAL_COM_CORE_STREAM_SUBSCRIBERS_H_
+#define SERIAL_COM_CORE_STREAM_SUBSCRIBERS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "receive_fanout.h"
+#include "spill_file.h"
+#include "status.h"
+
+namespace serial_com {
+
+// What a stream subscriber does when it falls behind by its limit.
+enum class BackpressurePolicy {
+  // Loses its oldest bytes, and nobody else notices.
+  kDropOldest,
+  // Holds up reading the port until it catches up. The tty's input buffer
+  // then fills, and with hardware or software flow control configured, the
+  // device is told to pause. Every consumer of the port waits with it.
+  kBlock,
+  // Keeps the bytes past its limit in a spill file and reads them back in
+  // order.
+  kSpill,
+};
+
+// Parses "dropOldest", "block" or "spill". Returns false for anything else.
+bool ParseBackpressurePolicy(const char* name, BackpressurePolicy* policy);
+const char* BackpressurePolicyName(BackpressurePolicy policy);
+
+struct SubscriberOptions {
+  BackpressurePolicy policy = BackpressurePolicy::kDropOldest;
+  // Unread bytes kept in memory. Must not be 0.
+  size_t limit = 1 << 20;
+  // For kSpill; see SpillFile::Create.
+  std::string spill_directory;
+};
+
+struct SubscriberStats {
+  BackpressurePolicy policy;
+  // Unread bytes, in memory and spilled.
+  uint64_t queued_bytes;
+  // Totals since the subscriber was added.
+  uint64_t received_bytes;
+  uint64_t read_bytes;
+  uint64_t spilled_bytes;
+  // Lost to the limit (kDropOldest) or to a spill file that could not be
+  // written.
+  uint64_t dropped_bytes;
+  // Whether this kBlock subscriber is holding up the port.
+  bool holding;
+};
+
+// Any number of independent readers of one port's received stream.
+//
+// Every subscriber sees every byte, from the moment it subscribes, as
+// references into the chunks the port's ReceiveFanout shares; nothing is
+// copied per subscriber until it reads. Each one has its own limit and
+// BackpressurePolicy, so a slow reader only affects others if it asked to
+// block. All methods are thread-safe.
+class StreamSubscribers {
+ public:
+  // Invoked on the publishing thread when bytes arrive for subscriber |id|
+  // while it had none queued, so that a waiting reader can be woken.
+  using NotifyFunction = std::function<void(int id)>;
+  // Invoked with true when a kBlock subscriber reaches its limit and the
+  // port should stop being read, and with false once no subscriber needs
+  // that any more. Calls are serialized, and only made on changes.
+  using HoldFunction = std::function<void(bool held)>;
+
+  StreamSubscribers(std::shared_ptr<ReceiveFanout> fanout,
+                    NotifyFunction notify, HoldFunction hold);
+  // Removes every subscriber, releasing any hold.
+  ~StreamSubscribers();
+
+  // Disallow copy and assign.
+  StreamSubscribers(const StreamSubscribers&) = delete;
+  StreamSubscribers& operator=(const StreamSubscribers&) = delete;
+
+  // Sets |id| to the new subscriber's id, which is never 0. Fails with
+  // INVALID_ARGUMENT for a zero limit and CONFIG_ERROR if a kSpill
+  // subscriber's spill file cannot be created.
+  Status Subscribe(const SubscriberOptions& options, int* id);
+  // Returns false if there is no such subscriber.
+  bool Unsubscribe(int id);
+
+  // Moves up to |max_length| of subscriber |id|'s oldest bytes into |out|
+  // and returns how many moved; 0 if there is no such subscriber.
+  size_t Read(int id, uint8_t* out, size_t max_length);
+  // Unread bytes of subscriber |id|; 0 if there is no such subscriber.
+  uint64_t Queued(int id);
+  // Returns false if there is no such subscriber.
+  bool Stats(int id, SubscriberStats* stats);
+  // Ids of the current subscribers, in subscription order.
+  std::vector<int> ids();
+
+ private:
+  struct Subscriber;
+
+  // Queues |chunk| for subscriber |id|. Runs on the publishing thread.
+  void Deliver(int id, const SharedChunk& chunk);
+  // Starts or stops holding for |subscriber| and tells |hold_| when the
+  // port's state changes. Requires mutex_.
+  void SetHoldingLocked(Subscriber* subscriber, bool holding);
+
+  const std::shared_ptr<ReceiveFanout> fanout_;
+  const NotifyFunction notify_;
+  const HoldFunction hold_;
+
+  // Serializes Subscribe() and Unsubscribe(), which call into |fanout_|
+  // without mutex_, since its sinks take mutex_.
+  std::mutex membership_mutex_;
+  std::mutex mutex_;
+  std::map<int, std::unique_ptr<Subscriber>> subscribers_;
+  int next_id_;
+  // kBlock subscribers at their limit.
+  int holders_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_STREAM_SUBSCRIBERS_H_
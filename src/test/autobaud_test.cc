@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "autobaud.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// A device on the master side of |pty| that answers each '?' with a line
+// of text when the slave is set to |baud_rate|, and with the kind of
+// garbage a UART produces at a wrong rate otherwise.
+class ProbedDevice {
+ public:
+  ProbedDevice(const PtyPair& pty, int baud_rate)
+      : master_(pty.master()), slave_(pty.slave()), stopping_(false) {
+    thread_ = std::thread([this, baud_rate]() {
+      while (!stopping_) {
+        struct pollfd fd = {master_, POLLIN, 0};
+        if (poll(&fd, 1, 10) <= 0) continue;
+        char request[64];
+        ssize_t n = read(master_, request, sizeof request);
+        if (n <= 0 || std::string(request, n).find('?') == std::string::npos) {
+          continue;
+        }
+        int rate = 0;
+        GetExactBaudRate(slave_, &rate);
+        static const char kText[] = "OK ready\r\n";
+        static const char kGarbage[] = "\x00\xff\xe0\x80\xf8\x00\xfe\x1c";
+        ssize_t ignored = rate == baud_rate
+                              ? write(master_, kText, sizeof kText - 1)
+                              : write(master_, kGarbage, sizeof kGarbage - 1);
+        (void)ignored;
+      }
+    });
+  }
+
+  ~ProbedDevice() {
+    stopping_ = true;
+    thread_.join();
+  }
+
+ private:
+  const int master_;
+  const int slave_;
+  std::atomic<bool> stopping_;
+  std::thread thread_;
+};
+
+}  // namespace
+
+TEST(AutobaudTest, SetsRatesWithoutABaudConstant) {
+  PtyPair pty;
+  int actual = 0;
+  ASSERT_TRUE(SetExactBaudRate(pty.slave(), 250000, &actual).ok());
+  EXPECT_EQ(actual, 250000);
+  ASSERT_TRUE(SetExactBaudRate(pty.slave(), 9600).ok());
+  ASSERT_TRUE(GetExactBaudRate(pty.slave(), &actual).ok());
+  EXPECT_EQ(actual, 9600);
+  EXPECT_FALSE(SetExactBaudRate(pty.slave(), 0).ok());
+}
+
+TEST(AutobaudTest, ScoresValidBytesLessFlaggedOnes) {
+  const std::string text = "temperature=21.5\r\n";
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text.data());
+  AutobaudSample sample;
+  EXPECT_EQ(ScoreAutobaudSample(bytes, text.size(), AutobaudContent::kText, 4,
+                                &sample),
+            1.0);
+  EXPECT_EQ(sample.text_bytes, text.size());
+
+  const uint8_t garbage[] = {0x00, 0xff, 0xe0, 0x80, 'a', 0xf8, 0x00, 0xfe};
+  EXPECT_LT(ScoreAutobaudSample(garbage, sizeof garbage,
+                                AutobaudContent::kText, 4, &sample),
+            0.2);
+  // Binary content is judged by the UART's counters alone.
+  EXPECT_EQ(ScoreAutobaudSample(garbage, sizeof garbage,
+                                AutobaudContent::kBinary, 4, &sample),
+            1.0);
+  sample.framing_errors = 2;
+  EXPECT_EQ(ScoreAutobaudSample(garbage, sizeof garbage,
+                                AutobaudContent::kBinary, 4, &sample),
+            0.75);
+  // Too little to go on.
+  EXPECT_EQ(ScoreAutobaudSample(bytes, 3, AutobaudContent::kText, 4, &sample),
+            0);
+
+  AutobaudContent content;
+  ASSERT_TRUE(ParseAutobaudContent("binary", &content));
+  EXPECT_EQ(content, AutobaudContent::kBinary);
+  EXPECT_FALSE(ParseAutobaudContent("ascii", &content));
+}
+
+TEST(AutobaudTest, FindsTheRateADeviceAnswersAt) {
+  PtyPair pty;
+  ProbedDevice device(pty, 57600);
+  AutobaudOptions options;
+  options.candidates = {9600, 57600, 115200};
+  options.probe = {'?'};
+  options.window_ms = 50;
+  std::atomic<bool> cancelled(false);
+  AutobaudResult result;
+  ASSERT_TRUE(DetectBaudRate(pty.slave(), options, cancelled, &result).ok());
+
+  EXPECT_EQ(result.baud_rate, 57600);
+  EXPECT_EQ(result.score, 1.0);
+  // The search stops at the first rate that scores well.
+  ASSERT_EQ(result.samples.size(), 2u);
+  EXPECT_EQ(result.samples[0].baud_rate, 9600);
+  EXPECT_GT(result.samples[0].bytes, 0u);
+  EXPECT_LT(result.samples[0].score, 0.5);
+  EXPECT_FALSE(result.samples[0].counters);
+  int rate = 0;
+  ASSERT_TRUE(GetExactBaudRate(pty.slave(), &rate).ok());
+  EXPECT_EQ(rate, 57600);
+}
+
+TEST(AutobaudTest, RestoresTheRateWhenNothingScores) {
+  PtyPair pty;
+  ASSERT_TRUE(SetExactBaudRate(pty.slave(), 19200).ok());
+  AutobaudOptions options;
+  options.candidates = {9600, 115200};
+  options.window_ms = 20;
+  std::atomic<bool> cancelled(false);
+  AutobaudResult result;
+  ASSERT_TRUE(DetectBaudRate(pty.slave(), options, cancelled, &result).ok());
+  EXPECT_EQ(result.baud_rate, 0);
+  EXPECT_EQ(result.samples.size(), 2u);
+  int rate = 0;
+  ASSERT_TRUE(GetExactBaudRate(pty.slave(), &rate).ok());
+  EXPECT_EQ(rate, 19200);
+
+  cancelled = true;
+  EXPECT_STREQ(DetectBaudRate(pty.slave(), options, cancelled, &result).code(),
+               "CANCELLED");
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_runner.h"
+#include "io_loop.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+std::vector<uint8_t> Bytes(const std::string& text) {
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+BatchOperation Op(BatchOpKind kind, int fd, const std::string& data = "",
+                  size_t count = 0, int timeout_ms = 2000) {
+  BatchOperation operation;
+  operation.kind = kind;
+  operation.fd = fd;
+  operation.data = Bytes(data);
+  operation.count = count;
+  operation.timeout_ms = timeout_ms;
+  return operation;
+}
+
+class BatchRunnerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_ = IoLoop::Create(IoBackendKind::kEpoll);
+    ASSERT_NE(loop_, nullptr);
+    io_ = std::make_shared<IoPort>(pty_.slave());
+    ASSERT_TRUE(loop_->AddPort(io_));
+  }
+
+  void TearDown() override { loop_->RemovePort(io_); }
+
+  // Runs |operations| to completion.
+  std::vector<BatchResult> Run(std::vector<BatchOperation> operations) {
+    std::promise<std::vector<BatchResult>> done;
+    BatchRunner runner(
+        std::move(operations), {{pty_.slave(), BatchPort{io_, loop_.get()}}},
+        [&done](std::vector<BatchResult> results) {
+          done.set_value(std::move(results));
+        });
+    std::future<std::vector<BatchResult>> future = done.get_future();
+    EXPECT_EQ(future.wait_for(std::chrono::seconds(10)),
+              std::future_status::ready);
+    return future.get();
+  }
+
+  PtyPair pty_;
+  std::unique_ptr<IoLoop> loop_;
+  std::shared_ptr<IoPort> io_;
+};
+
+}  // namespace
+
+TEST(BatchRunner, ParsesOperationKinds) {
+  BatchOpKind kind;
+  ASSERT_TRUE(ParseBatchOpKind("readUntil", &kind));
+  EXPECT_EQ(kind, BatchOpKind::kReadUntil);
+  ASSERT_TRUE(ParseBatchOpKind("setLines", &kind));
+  EXPECT_EQ(kind, BatchOpKind::kSetLines);
+  EXPECT_FALSE(ParseBatchOpKind("read", &kind));
+}
+
+TEST_F(BatchRunnerTest, RunsACommandExchangeInOrder) {
+  // A device that answers "AT\r" with a line and some trailing bytes.
+  std::thread device([this]() {
+    std::string received;
+    while (received.find("AT\r") == std::string::npos) {
+      struct pollfd pfd = {pty_.master(), POLLIN, 0};
+      if (poll(&pfd, 1, 2000) <= 0) return;
+      char buffer[64];
+      ssize_t n = read(pty_.master(), buffer, sizeof buffer);
+      if (n <= 0) return;
+      received.append(buffer, n);
+    }
+    ASSERT_EQ(write(pty_.master(), "OK\r\nxyz", 7), 7);
+  });
+  int fd = pty_.slave();
+  std::vector<BatchResult> results =
+      Run({Op(BatchOpKind::kWrite, fd, "AT\r"),
+           Op(BatchOpKind::kReadUntil, fd, "\r\n", 64),
+           Op(BatchOpKind::kWaitForBytes, fd, "", 3),
+           Op(BatchOpKind::kSleep, -1, "", 0, 10)});
+  device.join();
+
+  ASSERT_EQ(results.size(), 4u);
+  for (const BatchResult& result : results) {
+    EXPECT_TRUE(result.status.ok()) << result.status.message();
+  }
+  EXPECT_EQ(results[0].bytes, 3u);
+  EXPECT_EQ(results[1].data, Bytes("OK\r\n"));
+  EXPECT_EQ(results[2].bytes, 3u);
+  EXPECT_GE(results[3].elapsed_us, 10000u);
+  // Waiting does not consume.
+  EXPECT_EQ(io_->Available(), 3u);
+}
+
+TEST_F(BatchRunnerTest, StopsAtTheFirstFailure) {
+  int fd = pty_.slave();
+  std::vector<BatchResult> results =
+      Run({Op(BatchOpKind::kReadUntil, fd, "\n", 64, 50),
+           Op(BatchOpKind::kWrite, fd, "never")});
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_STREQ(results[0].status.code(), "TIMEOUT_ERROR");
+
+  ASSERT_EQ(write(pty_.master(), "abcdef", 6), 6);
+  results = Run({Op(BatchOpKind::kWaitForBytes, fd, "", 6),
+                 Op(BatchOpKind::kReadUntil, fd, "\n", 4)});
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_STREQ(results[1].status.code(), "READ_ERROR");
+  EXPECT_EQ(io_->Available(), 6u);
+
+  results = Run({Op(BatchOpKind::kWrite, fd + 1000, "x")});
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_STREQ(results[0].status.code(), "INVALID_ARGUMENT");
+}
+
+TEST_F(BatchRunnerTest, CancelsTheRunningOperation) {
+  std::vector<BatchResult> results;
+  auto start = std::chrono::steady_clock::now();
+  {
+    BatchRunner runner(
+        {Op(BatchOpKind::kWaitForBytes, pty_.slave(), "", 100, 10000)},
+        {{pty_.slave(), BatchPort{io_, loop_.get()}}},
+        [&results](std::vector<BatchResult> done) { results = done; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(5));
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_STREQ(results[0].status.code(), "CANCELLED");
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "decimator.h"
+#include "record_decoder.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// u16 t, i16 value, little endian.
+RecordSchema SampleSchema() {
+  RecordSchema schema;
+  schema.record_size = 4;
+  schema.fields = {
+      {"t", FieldType::kU16, 0, false},
+      {"value", FieldType::kI16, 2, false},
+  };
+  return schema;
+}
+
+std::vector<uint8_t> SampleRecord(uint16_t t, int16_t value) {
+  uint16_t bits = static_cast<uint16_t>(value);
+  return {static_cast<uint8_t>(t), static_cast<uint8_t>(t >> 8),
+          static_cast<uint8_t>(bits), static_cast<uint8_t>(bits >> 8)};
+}
+
+RecordBatch Samples(RecordDecoder* decoder, uint16_t first_t,
+                    const std::vector<int16_t>& values) {
+  uint16_t t = first_t;
+  for (int16_t value : values) {
+    std::vector<uint8_t> record = SampleRecord(t++, value);
+    decoder->Decode(record.data(), record.size());
+  }
+  return decoder->TakeBatch();
+}
+
+std::vector<double> ColumnValues(const RecordBatch& batch,
+                                 const std::string& name) {
+  for (const Column& column : batch.columns) {
+    if (column.name != name) continue;
+    EXPECT_EQ(column.type, ColumnType::kFloat64);
+    const double* values = column.values<double>();
+    return std::vector<double>(values, values + batch.rows);
+  }
+  ADD_FAILURE() << "no column " << name;
+  return {};
+}
+
+}  // namespace
+
+TEST(DecimatorTest, ParsesModes) {
+  DecimationMode mode;
+  EXPECT_TRUE(ParseDecimationMode("lttb", &mode));
+  EXPECT_EQ(mode, DecimationMode::kLttb);
+  EXPECT_TRUE(ParseDecimationMode("last", &mode));
+  EXPECT_EQ(mode, DecimationMode::kLast);
+  EXPECT_TRUE(ParseDecimationMode("minmaxmean", &mode));
+  EXPECT_EQ(mode, DecimationMode::kMinMaxMean);
+  EXPECT_FALSE(ParseDecimationMode("median", &mode));
+  EXPECT_FALSE(ParseDecimationMode(nullptr, &mode));
+}
+
+TEST(DecimatorTest, ValidatesConfig) {
+  DecimationConfig config;
+  config.window = 0;
+  EXPECT_FALSE(IsValidDecimationConfig(config, SampleSchema()));
+  config.window = 4;
+  EXPECT_TRUE(IsValidDecimationConfig(config, SampleSchema()));
+  config.x_field = "t";
+  EXPECT_TRUE(IsValidDecimationConfig(config, SampleSchema()));
+  config.x_field = "missing";
+  EXPECT_FALSE(IsValidDecimationConfig(config, SampleSchema()));
+}
+
+TEST(DecimatorTest, MinMaxMeanSpansBatches) {
+  RecordDecoder decoder(SampleSchema(), 100);
+  DecimationConfig config;
+  config.mode = DecimationMode::kMinMaxMean;
+  config.window = 4;
+  Decimator decimator(SampleSchema(), config);
+
+  // The first window is split across two batches.
+  RecordBatch out = decimator.Process(Samples(&decoder, 0, {1, 9, -3}));
+  EXPECT_EQ(out.rows, 0u);
+  out = decimator.Process(Samples(&decoder, 3, {5, 2, 2, 2, 2, 7}));
+  ASSERT_EQ(out.rows, 2u);
+  EXPECT_EQ(ColumnValues(out, "value.min"), (std::vector<double>{-3, 2}));
+  EXPECT_EQ(ColumnValues(out, "value.max"), (std::vector<double>{9, 2}));
+  EXPECT_EQ(ColumnValues(out, "value.mean"), (std::vector<double>{3, 2}));
+  EXPECT_EQ(ColumnValues(out, "t.max"), (std::vector<double>{3, 7}));
+}
+
+TEST(DecimatorTest, LastKeepsEachWindowsFinalValue) {
+  RecordDecoder decoder(SampleSchema(), 100);
+  DecimationConfig config;
+  config.mode = DecimationMode::kLast;
+  config.window = 3;
+  Decimator decimator(SampleSchema(), config);
+
+  RecordBatch out =
+      decimator.Process(Samples(&decoder, 0, {1, 2, 3, 4, 5, 6, 7}));
+  ASSERT_EQ(out.rows, 2u);
+  EXPECT_EQ(ColumnValues(out, "value"), (std::vector<double>{3, 6}));
+  EXPECT_EQ(ColumnValues(out, "t"), (std::vector<double>{2, 5}));
+}
+
+TEST(DecimatorTest, LttbKeepsSpikes) {
+  RecordDecoder decoder(SampleSchema(), 1000);
+  DecimationConfig config;
+  config.mode = DecimationMode::kLttb;
+  config.window = 10;
+  config.x_field = "t";
+  Decimator decimator(SampleSchema(), config);
+
+  // A flat line with one single-sample spike, which averaging would
+  // flatten to a tenth of its height.
+  std::vector<int16_t> values(100, 0);
+  values[45] = 100;
+  RecordBatch out = decimator.Process(Samples(&decoder, 1000, values));
+
+  // The first sample, then every bucket that has a complete successor.
+  ASSERT_EQ(out.rows, 9u);
+  std::vector<double> y = ColumnValues(out, "value");
+  std::vector<double> x = ColumnValues(out, "value.x");
+  EXPECT_EQ(x[0], 1000);
+  // Samples 41-50 form the fifth bucket.
+  EXPECT_EQ(y[5], 100);
+  EXPECT_EQ(x[5], 1045);
+  for (size_t i = 1; i < out.rows; i++) {
+    EXPECT_GE(x[i], x[i - 1] + 1);
+    if (i != 5) {
+      EXPECT_EQ(y[i], 0) << i;
+    }
+  }
+  // The x field is not decimated itself.
+  for (const Column& column : out.columns) EXPECT_NE(column.name, "t");
+}
+
+TEST(DecimatorTest, LttbResultDoesNotDependOnBatching) {
+  std::vector<int16_t> values;
+  for (int i = 0; i < 500; i++) {
+    values.push_back(static_cast<int16_t>(1000 * std::sin(i * 0.05) +
+                                          (i % 37 == 0 ? 400 : 0)));
+  }
+  DecimationConfig config;
+  config.mode = DecimationMode::kLttb;
+  config.window = 16;
+
+  RecordDecoder decoder(SampleSchema(), 1000);
+  Decimator whole(SampleSchema(), config);
+  RecordBatch expected = whole.Process(Samples(&decoder, 0, values));
+
+  Decimator split(SampleSchema(), config);
+  std::vector<double> y;
+  std::vector<double> x;
+  for (size_t start = 0; start < values.size(); start += 23) {
+    size_t end = std::min(values.size(), start + 23);
+    std::vector<int16_t> part(values.begin() + start, values.begin() + end);
+    RecordBatch out = split.Process(
+        Samples(&decoder, static_cast<uint16_t>(start), part));
+    std::vector<double> part_y = ColumnValues(out, "value");
+    std::vector<double> part_x = ColumnValues(out, "value.x");
+    y.insert(y.end(), part_y.begin(), part_y.end());
+    x.insert(x.end(), part_x.begin(), part_x.end());
+  }
+  EXPECT_EQ(y, ColumnValues(expected, "value"));
+  // Without an x field, x is the record's position in the stream.
+  EXPECT_EQ(x, ColumnValues(expected, "value.x"));
+  EXPECT_LT(x.back(), 500);
+}
+
+TEST(DecimatorTest, PassesDroppedCountThrough) {
+  RecordDecoder decoder(SampleSchema(), 2);
+  DecimationConfig config;
+  config.window = 2;
+  Decimator decimator(SampleSchema(), config);
+  RecordBatch out = decimator.Process(Samples(&decoder, 0, {1, 2, 3, 4}));
+  EXPECT_EQ(out.dropped, 2u);
+  EXPECT_EQ(out.rows, 1u);
+}
+
+TEST(DecimatorTest, CaptureKeepsFullRateRecords) {
+  char path[] = "/tmp/serial_com_capture_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  RecordDecoder decoder(SampleSchema(), 2);
+  std::unique_ptr<CaptureFile> capture = CaptureFile::Open(path);
+  ASSERT_NE(capture, nullptr);
+  decoder.SetCapture(std::move(capture));
+  // Records beyond the batch limit still reach the capture; malformed
+  // ones do not.
+  Samples(&decoder, 0, {1, 2, 3});
+  const uint8_t short_record[] = {1, 2};
+  decoder.Decode(short_record, sizeof short_record);
+  EXPECT_EQ(decoder.captured_bytes(), 12u);
+  EXPECT_FALSE(decoder.capture_failed());
+  decoder.SetCapture(nullptr);
+
+  FILE* file = fopen(path, "rb");
+  ASSERT_NE(file, nullptr);
+  std::vector<uint8_t> contents(64);
+  contents.resize(fread(contents.data(), 1, contents.size(), file));
+  fclose(file);
+  unlink(path);
+
+  std::vector<uint8_t> expected;
+  for (uint16_t t = 0; t < 3; t++) {
+    std::vector<uint8_t> record = SampleRecord(t, static_cast<int16_t>(t + 1));
+    expected.insert(expected.end(), record.begin(), record.end());
+  }
+  EXPECT_EQ(contents, expected);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,203 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "device_simulator.h"
+#include "posix_serial_port.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::unique_ptr<DeviceSimulator> StartSimulator(const std::string& text) {
+  SimulatorScript script;
+  std::string error;
+  EXPECT_TRUE(ParseSimulatorScript(text, &script, &error)) << error;
+  return DeviceSimulator::Create(script);
+}
+
+void OpenSimulated(const DeviceSimulator& simulator, PosixSerialPort* port) {
+  PortConfig config;
+  config.path = simulator.device_path();
+  config.baud_rate = 115200;
+  ASSERT_TRUE(port->Open(config).ok());
+}
+
+void WriteString(PosixSerialPort* port, const std::string& data) {
+  ASSERT_TRUE(
+      port->Write(reinterpret_cast<const uint8_t*>(data.data()), data.size())
+          .ok());
+}
+
+// Reads until |length| bytes have arrived or two seconds have passed.
+std::string ReadBytes(PosixSerialPort* port, size_t length) {
+  std::string received;
+  Clock::time_point deadline = Clock::now() + std::chrono::seconds(2);
+  while (received.size() < length && Clock::now() < deadline) {
+    std::vector<uint8_t> chunk;
+    if (!port->Read(length - received.size(), &chunk).ok()) break;
+    received.append(chunk.begin(), chunk.end());
+  }
+  return received;
+}
+
+}  // namespace
+
+TEST(DeviceSimulator, ParsesScript) {
+  SimulatorScript script;
+  std::string error;
+  ASSERT_TRUE(ParseSimulatorScript(
+      "# A sensor\n"
+      "baud 9600\n"
+      "noise corrupt 0.5 drop 0.25 seed 3\n"
+      "on \"PING\\r\\n\" reply \"PONG\\x0d\\n\" delay 2ms\n"
+      "\n"
+      "on /READ ([0-9]+)\\r\\n/ reply \"VALUE $1\"  # trailing comment\n"
+      "every 1.5s send \"\\x02S\\x03\"\n",
+      &script, &error))
+      << error;
+  EXPECT_EQ(script.baud_rate, 9600);
+  EXPECT_EQ(script.corrupt_probability, 0.5);
+  EXPECT_EQ(script.drop_probability, 0.25);
+  EXPECT_EQ(script.seed, 3u);
+  ASSERT_EQ(script.rules.size(), 2u);
+  EXPECT_EQ(script.rules[0].match, "PING\r\n");
+  EXPECT_FALSE(script.rules[0].regex);
+  EXPECT_EQ(script.rules[0].reply, "PONG\r\n");
+  EXPECT_EQ(script.rules[0].delay_us, 2000);
+  EXPECT_EQ(script.rules[1].match, "READ ([0-9]+)\\r\\n");
+  EXPECT_TRUE(script.rules[1].regex);
+  EXPECT_EQ(script.rules[1].delay_us, 0);
+  ASSERT_EQ(script.periodic.size(), 1u);
+  EXPECT_EQ(script.periodic[0].data, "\x02S\x03");
+  EXPECT_EQ(script.periodic[0].interval_us, 1500000);
+}
+
+TEST(DeviceSimulator, ReportsScriptErrorsWithLine) {
+  SimulatorScript script;
+  std::string error;
+  EXPECT_FALSE(ParseSimulatorScript("baud 9600\nwibble\n", &script, &error));
+  EXPECT_EQ(error, "line 2: unknown command wibble");
+  EXPECT_FALSE(ParseSimulatorScript("on \"A\" reply \"B", &script, &error));
+  EXPECT_EQ(error, "line 1: unterminated string");
+  EXPECT_FALSE(ParseSimulatorScript("on /(/ reply \"B\"", &script, &error));
+  EXPECT_EQ(error.find("line 1: bad regular expression"), 0u);
+  EXPECT_FALSE(
+      ParseSimulatorScript("on \"A\" reply \"B\" delay 5", &script, &error));
+  EXPECT_FALSE(ParseSimulatorScript("every 0ms send \"A\"", &script, &error));
+  EXPECT_FALSE(ParseSimulatorScript("noise corrupt 2", &script, &error));
+}
+
+TEST(DeviceSimulator, RepliesToLiteralRequests) {
+  std::unique_ptr<DeviceSimulator> simulator =
+      StartSimulator("on \"PING\\r\\n\" reply \"PONG\\r\\n\"");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  // Split across writes, and with noise in front of the request.
+  WriteString(&port, "xxPI");
+  WriteString(&port, "NG\r\n");
+  EXPECT_EQ(ReadBytes(&port, 6), "PONG\r\n");
+  WriteString(&port, "PING\r\nPING\r\n");
+  EXPECT_EQ(ReadBytes(&port, 12), "PONG\r\nPONG\r\n");
+
+  SimulatorStats stats = simulator->stats();
+  EXPECT_EQ(stats.requests_matched, 3u);
+  EXPECT_EQ(stats.bytes_received, 20u);
+  EXPECT_EQ(stats.bytes_sent, 18u);
+}
+
+TEST(DeviceSimulator, SubstitutesRegexCaptures) {
+  std::unique_ptr<DeviceSimulator> simulator = StartSimulator(
+      "on /READ ([0-9]+)\\r/ reply \"VALUE $1=$$\\r\"\n"
+      "on \"ID\\r\" reply \"SIM\\r\"");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  // The earliest match wins regardless of rule order.
+  WriteString(&port, "ID\rREAD 42\r");
+  EXPECT_EQ(ReadBytes(&port, 15), "SIM\rVALUE 42=$\r");
+}
+
+TEST(DeviceSimulator, DelaysReplies) {
+  std::unique_ptr<DeviceSimulator> simulator =
+      StartSimulator("on \"?\" reply \"!\" delay 50ms");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  Clock::time_point start = Clock::now();
+  WriteString(&port, "?");
+  EXPECT_EQ(ReadBytes(&port, 1), "!");
+  EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(50));
+}
+
+TEST(DeviceSimulator, SendsPeriodicFrames) {
+  std::unique_ptr<DeviceSimulator> simulator =
+      StartSimulator("every 20ms send \"T\"");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  Clock::time_point start = Clock::now();
+  EXPECT_EQ(ReadBytes(&port, 3), "TTT");
+  EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(40));
+}
+
+TEST(DeviceSimulator, LimitsThroughputToBaudRate) {
+  // 9600 baud 8N1 is 960 bytes per second.
+  std::unique_ptr<DeviceSimulator> simulator = StartSimulator("baud 9600");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  Clock::time_point start = Clock::now();
+  simulator->Send(std::string(192, 'x'));
+  EXPECT_EQ(ReadBytes(&port, 192).size(), 192u);
+  auto elapsed = Clock::now() - start;
+  EXPECT_GE(elapsed, std::chrono::milliseconds(180));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+}
+
+TEST(DeviceSimulator, CorruptsEveryByteWithProbabilityOne) {
+  std::unique_ptr<DeviceSimulator> simulator =
+      StartSimulator("noise corrupt 1");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  const std::string sent(64, '\x55');
+  simulator->Send(sent);
+  std::string received = ReadBytes(&port, sent.size());
+  ASSERT_EQ(received.size(), sent.size());
+  for (size_t i = 0; i < sent.size(); i++) {
+    // Exactly one bit flipped.
+    int diff = static_cast<uint8_t>(received[i] ^ sent[i]);
+    EXPECT_EQ(__builtin_popcount(diff), 1) << i;
+  }
+  EXPECT_EQ(simulator->stats().bytes_corrupted, sent.size());
+}
+
+TEST(DeviceSimulator, DropsEveryByteWithProbabilityOne) {
+  std::unique_ptr<DeviceSimulator> simulator = StartSimulator("noise drop 1");
+  ASSERT_NE(simulator, nullptr);
+  PosixSerialPort port;
+  OpenSimulated(*simulator, &port);
+
+  simulator->Send("lost");
+  // The port's read timeout is 500 ms.
+  EXPECT_EQ(ReadBytes(&port, 4), "");
+  SimulatorStats stats = simulator->stats();
+  EXPECT_EQ(stats.bytes_dropped, 4u);
+  EXPECT_EQ(stats.bytes_sent, 0u);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+
+#include "drain_worker.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+TEST(DrainWorkerTest, CompletesOnceOutputIsTransmitted) {
+  PtyPair pty;
+  DrainWorker worker(pty.slave());
+  ASSERT_EQ(write(pty.slave(), "command", 7), 7);
+
+  std::promise<int> first;
+  std::promise<int> second;
+  worker.Drain([&first](int error) { first.set_value(error); });
+  worker.Drain([&second](int error) { second.set_value(error); });
+  std::future<int> first_done = first.get_future();
+  std::future<int> second_done = second.get_future();
+  ASSERT_EQ(first_done.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  ASSERT_EQ(second_done.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(first_done.get(), 0);
+  EXPECT_EQ(second_done.get(), 0);
+}
+
+TEST(DrainWorkerTest, ReportsErrors) {
+  DrainWorker worker(-1);
+  std::promise<int> done;
+  worker.Drain([&done](int error) { done.set_value(error); });
+  std::future<int> result = done.get_future();
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(result.get(), EBADF);
+}
+
+TEST(DrainWorkerTest, StopsWithoutWaitingDrains) {
+  PtyPair pty;
+  std::unique_ptr<DrainWorker> worker(new DrainWorker(pty.slave()));
+  worker.reset();
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_sender.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// Writes |contents| to a temporary file that is removed on destruction.
+class TempFile {
+ public:
+  explicit TempFile(const std::vector<uint8_t>& contents) {
+    char path[] = "/tmp/serial_com_send_XXXXXX";
+    int fd = mkstemp(path);
+    path_ = path;
+    size_t written = 0;
+    while (written < contents.size()) {
+      ssize_t n = write(fd, contents.data() + written,
+                        contents.size() - written);
+      if (n <= 0) break;
+      written += n;
+    }
+    close(fd);
+  }
+  ~TempFile() { unlink(path_.c_str()); }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+std::vector<uint8_t> Contents(size_t size) {
+  std::vector<uint8_t> contents(size);
+  for (size_t i = 0; i < size; i++) {
+    contents[i] = static_cast<uint8_t>((i * 131) ^ (i >> 8));
+  }
+  return contents;
+}
+
+// Reads from the device side until |count| bytes arrived or it goes quiet.
+std::vector<uint8_t> ReadDevice(int fd, size_t count) {
+  std::vector<uint8_t> received;
+  uint8_t buffer[4096];
+  while (received.size() < count) {
+    struct pollfd readable = {fd, POLLIN, 0};
+    if (poll(&readable, 1, 5000) != 1) break;
+    ssize_t n = read(fd, buffer, sizeof buffer);
+    if (n <= 0) break;
+    received.insert(received.end(), buffer, buffer + n);
+  }
+  return received;
+}
+
+struct Result {
+  int64_t result;
+  FileSendProgress progress;
+};
+
+}  // namespace
+
+TEST(FileSenderTest, RejectsMissingFilesAndBadRegions) {
+  EXPECT_EQ(FileSender::Open("/nonexistent/blob.bin", 0, 0), nullptr);
+  EXPECT_EQ(errno, ENOENT);
+  TempFile file(Contents(100));
+  EXPECT_EQ(FileSender::Open(file.path(), 101, 0), nullptr);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(FileSender::Open(file.path(), 50, 51), nullptr);
+  EXPECT_EQ(FileSender::Open("/tmp", 0, 0), nullptr);
+
+  std::unique_ptr<FileSender> sender = FileSender::Open(file.path(), 40, 0);
+  ASSERT_NE(sender, nullptr);
+  EXPECT_EQ(sender->total_bytes(), 60u);
+  sender = FileSender::Open(file.path(), 40, 10);
+  ASSERT_NE(sender, nullptr);
+  EXPECT_EQ(sender->total_bytes(), 10u);
+}
+
+TEST(FileSenderTest, SendsRegionDirectlyToTty) {
+  std::vector<uint8_t> contents = Contents(300 * 1024);
+  TempFile file(contents);
+  PtyPair pty;
+  PortStats stats;
+  const uint64_t offset = 1000;
+  const uint64_t length = 250 * 1024;
+
+  std::unique_ptr<FileSender> sender =
+      FileSender::Open(file.path(), offset, length);
+  ASSERT_NE(sender, nullptr);
+  std::promise<Result> finished;
+  std::vector<uint64_t> reports;
+  sender->StartDirect(
+      pty.slave(), &stats,
+      [&reports](const FileSendProgress& progress) {
+        reports.push_back(progress.bytes_sent);
+      },
+      [&finished](int64_t result, const FileSendProgress& progress) {
+        finished.set_value(Result{result, progress});
+      });
+
+  std::vector<uint8_t> received = ReadDevice(pty.master(), length);
+  Result result = finished.get_future().get();
+  EXPECT_EQ(result.result, static_cast<int64_t>(length));
+  EXPECT_EQ(result.progress.bytes_sent, length);
+  ASSERT_EQ(received.size(), length);
+  EXPECT_TRUE(std::equal(received.begin(), received.end(),
+                         contents.begin() + offset));
+  EXPECT_EQ(stats.Snapshot().bytes_sent, length);
+  ASSERT_FALSE(reports.empty());
+  EXPECT_TRUE(std::is_sorted(reports.begin(), reports.end()));
+  EXPECT_EQ(reports.back(), length);
+}
+
+TEST(FileSenderTest, AbortsWhileTheTtyIsFull) {
+  std::vector<uint8_t> contents = Contents(1024 * 1024);
+  TempFile file(contents);
+  PtyPair pty;
+  // Nobody reads the device side, so the sender ends up waiting for room.
+  int flags = fcntl(pty.slave(), F_GETFL);
+  fcntl(pty.slave(), F_SETFL, flags | O_NONBLOCK);
+  PortStats stats;
+  std::unique_ptr<FileSender> sender = FileSender::Open(file.path(), 0, 0);
+  ASSERT_NE(sender, nullptr);
+  std::promise<int64_t> finished;
+  sender->StartDirect(pty.slave(), &stats, nullptr,
+                      [&finished](int64_t result, const FileSendProgress&) {
+                        finished.set_value(result);
+                      });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  sender->Abort();
+  std::future<int64_t> result = finished.get_future();
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(result.get(), -ECANCELED);
+}
+
+TEST(FileSenderTest, KeepsChunkedSendsWithinWindow) {
+  std::vector<uint8_t> contents = Contents(1000 * 1000);
+  TempFile file(contents);
+  std::unique_ptr<FileSender> sender = FileSender::Open(file.path(), 0, 0);
+  ASSERT_NE(sender, nullptr);
+
+  // Completes chunks from another thread, like an I/O loop would.
+  std::mutex mutex;
+  std::vector<uint8_t> sent;
+  std::vector<FileSender::WriteDone> queued;
+  size_t max_queued = 0;
+  std::promise<Result> finished;
+  sender->StartChunked(
+      [&](std::vector<uint8_t> data, FileSender::WriteDone done) {
+        std::lock_guard<std::mutex> lock(mutex);
+        sent.insert(sent.end(), data.begin(), data.end());
+        queued.push_back(std::move(done));
+        max_queued = std::max(max_queued, queued.size());
+      },
+      nullptr,
+      [&finished](int64_t result, const FileSendProgress& progress) {
+        finished.set_value(Result{result, progress});
+      });
+  std::future<Result> result = finished.get_future();
+  while (result.wait_for(std::chrono::milliseconds(1)) !=
+         std::future_status::ready) {
+    std::vector<FileSender::WriteDone> completions;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      completions.swap(queued);
+    }
+    for (auto& done : completions) done(1);
+  }
+
+  Result outcome = result.get();
+  EXPECT_EQ(outcome.result, 1000 * 1000);
+  EXPECT_EQ(outcome.progress.bytes_sent, 1000u * 1000u);
+  EXPECT_FALSE(outcome.progress.spliced);
+  EXPECT_EQ(sent, contents);
+  EXPECT_LE(max_queued, 4u);
+}
+
+TEST(FileSenderTest, FailsChunkedSendOnWriteError) {
+  TempFile file(Contents(200 * 1024));
+  std::unique_ptr<FileSender> sender = FileSender::Open(file.path(), 0, 0);
+  ASSERT_NE(sender, nullptr);
+  std::promise<int64_t> finished;
+  sender->StartChunked(
+      [](std::vector<uint8_t>, FileSender::WriteDone done) { done(-EIO); },
+      nullptr, [&finished](int64_t result, const FileSendProgress&) {
+        finished.set_value(result);
+      });
+  EXPECT_EQ(finished.get_future().get(), -EIO);
+}
+
+TEST(FileSenderTest, SendsEmptyRegion) {
+  TempFile file(std::vector<uint8_t>{});
+  PtyPair pty;
+  PortStats stats;
+  std::unique_ptr<FileSender> sender = FileSender::Open(file.path(), 0, 0);
+  ASSERT_NE(sender, nullptr);
+  std::promise<int64_t> finished;
+  sender->StartDirect(pty.slave(), &stats, nullptr,
+                      [&finished](int64_t result, const FileSendProgress&) {
+                        finished.set_value(result);
+                      });
+  EXPECT_EQ(finished.get_future().get(), 0);
+}
+
+}  // namespace test
+}  // namespace serial_com
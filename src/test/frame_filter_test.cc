@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "frame_filter.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+using Frame = std::vector<uint8_t>;
+
+bool Matches(const FrameFilterSpec& spec, const Frame& frame) {
+  return FrameFilter(spec).Matches(frame.data(), frame.size());
+}
+
+MaskMatch Mask(size_t offset, Frame mask, Frame value) {
+  MaskMatch match;
+  match.offset = offset;
+  match.mask = std::move(mask);
+  match.value = std::move(value);
+  return match;
+}
+
+IdRange Range(size_t offset, size_t size, bool big_endian, uint32_t min,
+              uint32_t max) {
+  IdRange range;
+  range.offset = offset;
+  range.size = size;
+  range.big_endian = big_endian;
+  range.min = min;
+  range.max = max;
+  return range;
+}
+
+}  // namespace
+
+TEST(FrameFilterTest, EmptySpecMatchesEverything) {
+  EXPECT_TRUE(Matches(FrameFilterSpec(), {}));
+  EXPECT_TRUE(Matches(FrameFilterSpec(), {1, 2, 3}));
+}
+
+TEST(FrameFilterTest, MatchesMaskedBytes) {
+  FrameFilterSpec spec;
+  // Byte 1 has high nibble 0xA; byte 2 is exactly 0x10.
+  spec.masks.push_back(Mask(1, {0xF0, 0xFF}, {0xA0, 0x10}));
+  EXPECT_TRUE(Matches(spec, {0x00, 0xA7, 0x10}));
+  EXPECT_TRUE(Matches(spec, {0xFF, 0xAF, 0x10, 0x99}));
+  EXPECT_FALSE(Matches(spec, {0x00, 0xB7, 0x10}));
+  EXPECT_FALSE(Matches(spec, {0x00, 0xA7, 0x11}));
+  // Too short to hold the masked bytes.
+  EXPECT_FALSE(Matches(spec, {0x00, 0xA7}));
+}
+
+TEST(FrameFilterTest, MatchesAnyIdRange) {
+  FrameFilterSpec spec;
+  spec.id_ranges.push_back(Range(0, 2, true, 0x100, 0x1FF));
+  spec.id_ranges.push_back(Range(0, 2, true, 0x300, 0x30F));
+  EXPECT_TRUE(Matches(spec, {0x01, 0x00}));
+  EXPECT_TRUE(Matches(spec, {0x01, 0xFF, 0x42}));
+  EXPECT_TRUE(Matches(spec, {0x03, 0x0F}));
+  EXPECT_FALSE(Matches(spec, {0x02, 0x00}));
+  EXPECT_FALSE(Matches(spec, {0x03, 0x10}));
+  EXPECT_FALSE(Matches(spec, {0x01}));
+
+  FrameFilterSpec little;
+  little.id_ranges.push_back(Range(1, 4, false, 0x12345678, 0x12345678));
+  EXPECT_TRUE(Matches(little, {0xEE, 0x78, 0x56, 0x34, 0x12}));
+  EXPECT_FALSE(Matches(little, {0xEE, 0x12, 0x34, 0x56, 0x78}));
+}
+
+TEST(FrameFilterTest, RequiresMasksAndRange) {
+  FrameFilterSpec spec;
+  spec.masks.push_back(Mask(0, {0xFF}, {0x7E}));
+  spec.id_ranges.push_back(Range(1, 1, false, 10, 20));
+  EXPECT_TRUE(Matches(spec, {0x7E, 15}));
+  EXPECT_FALSE(Matches(spec, {0x7F, 15}));
+  EXPECT_FALSE(Matches(spec, {0x7E, 21}));
+}
+
+TEST(FrameFilterTest, ValidatesSpecs) {
+  FrameFilterSpec spec;
+  EXPECT_TRUE(IsValidFrameFilterSpec(spec));
+  spec.masks.push_back(Mask(0, {0xFF, 0xFF}, {0x01}));
+  EXPECT_FALSE(IsValidFrameFilterSpec(spec));
+
+  FrameFilterSpec ranges;
+  ranges.id_ranges.push_back(Range(0, 3, false, 0, 1));
+  EXPECT_FALSE(IsValidFrameFilterSpec(ranges));
+  ranges.id_ranges[0] = Range(0, 2, false, 5, 4);
+  EXPECT_FALSE(IsValidFrameFilterSpec(ranges));
+  ranges.id_ranges[0] = Range(0, 2, false, 4, 5);
+  EXPECT_TRUE(IsValidFrameFilterSpec(ranges));
+}
+
+TEST(FrameRouterTest, DeliversFramesToMatchingSubscribers) {
+  FrameRouter router(16);
+  FrameFilterSpec low;
+  low.id_ranges.push_back(Range(0, 1, false, 0, 9));
+  FrameFilterSpec odd;
+  odd.masks.push_back(Mask(0, {0x01}, {0x01}));
+  int low_id = router.Subscribe(low);
+  int odd_id = router.Subscribe(odd);
+  EXPECT_NE(low_id, 0);
+  EXPECT_NE(low_id, odd_id);
+
+  // The first frame for a subscriber asks for a wakeup; later ones do not.
+  Frame two = {2, 0xAA};
+  Frame three = {3};
+  Frame twelve = {12};
+  Frame thirteen = {13};
+  EXPECT_TRUE(router.Route(two.data(), two.size()));
+  EXPECT_TRUE(router.Route(three.data(), three.size()));
+  EXPECT_FALSE(router.Route(twelve.data(), twelve.size()));
+  EXPECT_FALSE(router.Route(thirteen.data(), thirteen.size()));
+
+  EXPECT_EQ(router.Queued(low_id), 2u);
+  EXPECT_EQ(router.Queued(odd_id), 2u);
+  std::vector<Frame> frames;
+  uint64_t dropped = 1;
+  ASSERT_TRUE(router.Take(low_id, &frames, &dropped));
+  EXPECT_EQ(frames, (std::vector<Frame>{two, three}));
+  EXPECT_EQ(dropped, 0u);
+  frames.clear();
+  ASSERT_TRUE(router.Take(odd_id, &frames, &dropped));
+  EXPECT_EQ(frames, (std::vector<Frame>{three, thirteen}));
+
+  FrameRouterStats stats = router.stats();
+  EXPECT_EQ(stats.frames_routed, 3u);
+  EXPECT_EQ(stats.frames_unmatched, 1u);
+}
+
+TEST(FrameRouterTest, CountsFramesBeyondQueueLimit) {
+  FrameRouter router(2);
+  int id = router.Subscribe(FrameFilterSpec());
+  Frame frame = {1};
+  for (int i = 0; i < 5; i++) router.Route(frame.data(), frame.size());
+
+  std::vector<Frame> frames;
+  uint64_t dropped = 0;
+  ASSERT_TRUE(router.Take(id, &frames, &dropped));
+  EXPECT_EQ(frames.size(), 2u);
+  EXPECT_EQ(dropped, 3u);
+  ASSERT_TRUE(router.Take(id, &frames, &dropped));
+  EXPECT_EQ(dropped, 0u);
+}
+
+TEST(FrameRouterTest, Unsubscribes) {
+  FrameRouter router(2);
+  int id = router.Subscribe(FrameFilterSpec());
+  EXPECT_TRUE(router.Unsubscribe(id));
+  EXPECT_FALSE(router.Unsubscribe(id));
+  std::vector<Frame> frames;
+  uint64_t dropped;
+  EXPECT_FALSE(router.Take(id, &frames, &dropped));
+  Frame frame = {1};
+  EXPECT_FALSE(router.Route(frame.data(), frame.size()));
+  EXPECT_EQ(router.stats().frames_unmatched, 1u);
+}
+
+}  // namespace test
+}  // namespace serial_com
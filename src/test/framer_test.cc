@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "framer.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+std::vector<std::string> PushAll(Framer* framer,
+                                 const std::vector<std::string>& chunks) {
+  std::vector<std::string> frames;
+  for (const std::string& chunk : chunks) {
+    framer->Push(reinterpret_cast<const uint8_t*>(chunk.data()), chunk.size(),
+                 [&frames](const uint8_t* frame, size_t length) {
+                   frames.emplace_back(reinterpret_cast<const char*>(frame),
+                                       length);
+                 });
+  }
+  return frames;
+}
+
+}  // namespace
+
+TEST(DelimiterFramer, SplitsOnDelimiterAcrossChunks) {
+  DelimiterFramer framer('\n', 64);
+  std::vector<std::string> frames =
+      PushAll(&framer, {"one\ntw", "o\n\nthr", "ee"});
+  EXPECT_EQ(frames, (std::vector<std::string>{"one", "two", ""}));
+  frames = PushAll(&framer, {"\n"});
+  EXPECT_EQ(frames, (std::vector<std::string>{"three"}));
+}
+
+TEST(DelimiterFramer, CapsFrameLength) {
+  DelimiterFramer framer('\n', 4);
+  std::vector<std::string> frames = PushAll(&framer, {"abcdefghij\n"});
+  EXPECT_EQ(frames, (std::vector<std::string>{"abcd", "efgh", "ij"}));
+}
+
+TEST(FixedLengthFramer, CarriesPartialFrames) {
+  FixedLengthFramer framer(3);
+  std::vector<std::string> frames = PushAll(&framer, {"ab", "cdefg", "hi"});
+  EXPECT_EQ(frames, (std::vector<std::string>{"abc", "def", "ghi"}));
+}
+
+TEST(FixedLengthFramer, ResetDropsPartialFrame) {
+  FixedLengthFramer framer(3);
+  PushAll(&framer, {"ab"});
+  framer.Reset();
+  std::vector<std::string> frames = PushAll(&framer, {"xyz"});
+  EXPECT_EQ(frames, (std::vector<std::string>{"xyz"}));
+}
+
+TEST(PassThroughFramer, DeliversChunksUnchanged) {
+  PassThroughFramer framer;
+  std::vector<std::string> frames = PushAll(&framer, {"ab", "", "cde"});
+  EXPECT_EQ(frames, (std::vector<std::string>{"ab", "cde"}));
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,467 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io_loop.h"
+#include "link_codec.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+class IoLoopTest : public ::testing::TestWithParam<IoBackendKind> {};
+
+}  // namespace
+
+TEST_P(IoLoopTest, DeliversReceivedData) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  std::promise<void> arrived;
+  port->SetDataCallback([&arrived]() { arrived.set_value(); });
+  ASSERT_TRUE(loop->AddPort(port));
+
+  ASSERT_EQ(write(pty.master(), "hello", 5), 5);
+  ASSERT_EQ(arrived.get_future().wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+
+  std::string received;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (received.size() < 5 && std::chrono::steady_clock::now() < deadline) {
+    uint8_t buffer[16];
+    size_t n = port->Read(buffer, sizeof buffer);
+    received.append(reinterpret_cast<char*>(buffer), n);
+  }
+  EXPECT_EQ(received, "hello");
+  loop->RemovePort(port);
+}
+
+TEST_P(IoLoopTest, HandsFramesToFrameCallback) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  std::promise<std::string> second_frame;
+  int frames = 0;
+  port->SetFrameCallback(
+      std::unique_ptr<Framer>(new DelimiterFramer('\n', 64)),
+      [&frames, &second_frame](const uint8_t* frame, size_t length) {
+        if (++frames == 2) {
+          second_frame.set_value(
+              std::string(reinterpret_cast<const char*>(frame), length));
+        }
+      });
+  ASSERT_TRUE(loop->AddPort(port));
+
+  ASSERT_EQ(write(pty.master(), "first\nsec", 9), 9);
+  ASSERT_EQ(write(pty.master(), "ond\nthi", 7), 7);
+  std::future<std::string> frame = second_frame.get_future();
+  ASSERT_EQ(frame.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(frame.get(), "second");
+  // Framed data does not also land in the receive buffer.
+  EXPECT_EQ(port->Available(), 0u);
+  loop->RemovePort(port);
+}
+
+TEST_P(IoLoopTest, WritesEverythingInOrder) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  ASSERT_TRUE(loop->AddPort(port));
+
+  // Larger than the pty buffer, so the loop has to wait for room.
+  std::vector<uint8_t> first(64 * 1024, 'a');
+  std::vector<uint8_t> second(64 * 1024, 'b');
+  std::promise<ssize_t> first_done;
+  std::promise<ssize_t> second_done;
+  loop->Write(port, first,
+              [&first_done](ssize_t result) { first_done.set_value(result); });
+  loop->Write(port, second, [&second_done](ssize_t result) {
+    second_done.set_value(result);
+  });
+
+  std::vector<uint8_t> received;
+  while (received.size() < first.size() + second.size()) {
+    uint8_t buffer[4096];
+    ssize_t n = read(pty.master(), buffer, sizeof buffer);
+    ASSERT_GT(n, 0);
+    received.insert(received.end(), buffer, buffer + n);
+  }
+  EXPECT_EQ(first_done.get_future().get(), static_cast<ssize_t>(first.size()));
+  EXPECT_EQ(second_done.get_future().get(),
+            static_cast<ssize_t>(second.size()));
+  EXPECT_EQ(received[0], 'a');
+  EXPECT_EQ(received[first.size() - 1], 'a');
+  EXPECT_EQ(received[first.size()], 'b');
+  EXPECT_EQ(port->stats().Snapshot().bytes_sent, received.size());
+  loop->RemovePort(port);
+}
+
+TEST_P(IoLoopTest, TracesReadAndWriteStages) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  TraceBuffer trace(64);
+  trace.Start();
+  auto port = std::make_shared<IoPort>(pty.slave());
+  port->SetTraceBuffer(&trace);
+  std::promise<void> arrived;
+  port->SetDataCallback([&arrived]() { arrived.set_value(); });
+  ASSERT_TRUE(loop->AddPort(port));
+
+  std::promise<ssize_t> written;
+  uint64_t write_chunk = loop->Write(
+      port, {'o', 'u', 't'},
+      [&written](ssize_t result) { written.set_value(result); });
+  EXPECT_NE(write_chunk, 0u);
+  EXPECT_EQ(written.get_future().get(), 3);
+
+  ASSERT_EQ(write(pty.master(), "in", 2), 2);
+  ASSERT_EQ(arrived.get_future().wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  uint8_t buffer[8];
+  std::vector<uint64_t> finished;
+  EXPECT_EQ(port->Read(buffer, sizeof buffer, &finished), 2u);
+  ASSERT_EQ(finished.size(), 1u);
+  loop->RemovePort(port);
+
+  std::vector<TraceStage> write_stages;
+  std::vector<TraceStage> read_stages;
+  for (const TraceEvent& event : trace.Events()) {
+    EXPECT_EQ(event.port, pty.slave());
+    if (event.chunk == write_chunk) write_stages.push_back(event.stage);
+    if (event.chunk == finished[0]) read_stages.push_back(event.stage);
+  }
+  EXPECT_EQ(write_stages,
+            (std::vector<TraceStage>{TraceStage::kWriteQueued,
+                                     TraceStage::kWriteStarted,
+                                     TraceStage::kWriteDone}));
+  EXPECT_EQ(read_stages, (std::vector<TraceStage>{TraceStage::kRead,
+                                                  TraceStage::kBuffered}));
+}
+
+TEST_P(IoLoopTest, RemovePortCancelsQueuedWrites) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  ASSERT_TRUE(loop->AddPort(port));
+
+  // Nobody reads the master side, so this cannot complete.
+  std::promise<ssize_t> done;
+  loop->Write(port, std::vector<uint8_t>(1024 * 1024, 'x'),
+              [&done](ssize_t result) { done.set_value(result); });
+  loop->RemovePort(port);
+  EXPECT_EQ(done.get_future().get(), -ECANCELED);
+}
+
+TEST_P(IoLoopTest, HoldingReceiveStopsReadingUntilReleased) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  ASSERT_TRUE(loop->AddPort(port));
+
+  std::string received;
+  auto read_for = [&port, &received](std::chrono::milliseconds duration,
+                                     size_t wanted) {
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    while (received.size() < wanted &&
+           std::chrono::steady_clock::now() < deadline) {
+      uint8_t buffer[64];
+      size_t n = port->Read(buffer, sizeof buffer);
+      received.append(reinterpret_cast<char*>(buffer), n);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+  ASSERT_EQ(write(pty.master(), "first", 5), 5);
+  read_for(std::chrono::seconds(5), 5);
+  ASSERT_EQ(received, "first");
+
+  loop->SetReceiveHeld(port, true);
+  EXPECT_TRUE(port->receive_held());
+  // A read already posted (io_uring) may still land; nothing after it.
+  ASSERT_EQ(write(pty.master(), "second", 6), 6);
+  read_for(std::chrono::milliseconds(100), 11);
+  ASSERT_EQ(write(pty.master(), "third", 5), 5);
+  read_for(std::chrono::milliseconds(100), 16);
+  EXPECT_EQ(received.find("third"), std::string::npos);
+
+  loop->SetReceiveHeld(port, false);
+  read_for(std::chrono::seconds(5), 16);
+  EXPECT_EQ(received, "firstsecondthird");
+  loop->RemovePort(port);
+}
+
+TEST_P(IoLoopTest, SizesReadsToWhatIsQueued) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  port->read_sizer().SetLimits(256, 64 * 1024);
+  ASSERT_TRUE(loop->AddPort(port));
+
+  // Let a burst pile up in the tty, then take it.
+  loop->SetReceiveHeld(port, true);
+  std::string sent(4000, 'x');
+  ASSERT_EQ(write(pty.master(), sent.data(), sent.size()),
+            static_cast<ssize_t>(sent.size()));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  loop->SetReceiveHeld(port, false);
+
+  std::string received;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (received.size() < sent.size() &&
+         std::chrono::steady_clock::now() < deadline) {
+    uint8_t buffer[1024];
+    size_t n = port->Read(buffer, sizeof buffer);
+    received.append(reinterpret_cast<char*>(buffer), n);
+    if (n == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(received, sent);
+  // A 256-byte read that fills up, then one sized from FIONREAD for the
+  // rest (epoll); or the whole registered buffer at once (io_uring).
+  PortStatsSnapshot stats = port->stats().Snapshot();
+  EXPECT_LE(stats.read_calls, 2u);
+  EXPECT_LE(stats.read_sizing_calls, 1u);
+  EXPECT_GT(ReadSyscallsPerMegabyte(stats), 0);
+  loop->RemovePort(port);
+}
+
+TEST_P(IoLoopTest, WriteManySendsOnePayloadToEveryPort) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  std::unique_ptr<IoLoop> other = IoLoop::Create(IoBackendKind::kEpoll);
+  ASSERT_NE(loop, nullptr);
+  ASSERT_NE(other, nullptr);
+  const int kPorts = 4;
+  PtyPair ptys[kPorts];
+  std::vector<IoLoop::WriteTarget> targets;
+  for (int i = 0; i < kPorts; i++) {
+    IoLoop* target_loop = i == kPorts - 1 ? other.get() : loop.get();
+    auto port = std::make_shared<IoPort>(ptys[i].slave());
+    ASSERT_TRUE(target_loop->AddPort(port));
+    targets.push_back(IoLoop::WriteTarget{target_loop, port});
+  }
+  // A port that is no longer serviced fails without holding up the rest.
+  auto removed = std::make_shared<IoPort>(ptys[0].master());
+  targets.push_back(IoLoop::WriteTarget{loop.get(), removed});
+
+  std::promise<BroadcastResult> done;
+  IoLoop::WriteMany(
+      targets, std::make_shared<const std::vector<uint8_t>>(5, 's'),
+      [&done](const BroadcastResult& result) { done.set_value(result); });
+  std::future<BroadcastResult> future = done.get_future();
+  ASSERT_EQ(future.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  BroadcastResult result = future.get();
+  ASSERT_EQ(result.results.size(), targets.size());
+  for (int i = 0; i < kPorts; i++) {
+    EXPECT_EQ(result.results[i], 5) << i;
+    EXPECT_GT(result.finished_ns[i], 0) << i;
+    char buffer[8];
+    ASSERT_EQ(read(ptys[i].master(), buffer, sizeof buffer), 5) << i;
+    EXPECT_EQ(std::string(buffer, 5), "sssss");
+  }
+  EXPECT_EQ(result.results[kPorts], -EBADF);
+  EXPECT_GE(result.skew_ns, 0);
+  for (int i = 0; i < kPorts; i++) {
+    targets[i].loop->RemovePort(targets[i].port);
+  }
+}
+
+TEST_P(IoLoopTest, UrgentWriteCutsIntoBulkWriteAtAFrameBoundary) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(GetParam());
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  auto port = std::make_shared<IoPort>(pty.slave());
+  port->SetBulkFrameSize(1000);
+  ASSERT_TRUE(loop->AddPort(port));
+
+  // Nobody reads yet, so the bulk write stalls once the pty is full.
+  std::vector<uint8_t> bulk(256 * 1024, 'b');
+  std::promise<ssize_t> bulk_done;
+  loop->Write(
+      port, bulk,
+      [&bulk_done](ssize_t result) { bulk_done.set_value(result); },
+      WriteLane::kBulk);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (port->write_lane_stats(WriteLane::kBulk).bytes_written == 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::promise<ssize_t> urgent_done;
+  loop->Write(
+      port, {'S', 'T', 'O', 'P'},
+      [&urgent_done](ssize_t result) { urgent_done.set_value(result); },
+      WriteLane::kUrgent);
+  WriteLaneStats queued = port->write_lane_stats(WriteLane::kBulk);
+  EXPECT_EQ(queued.queued_writes, 1u);
+  EXPECT_GT(queued.queued_bytes, 0u);
+
+  std::string received;
+  while (received.size() < bulk.size() + 4) {
+    char buffer[4096];
+    ssize_t n = read(pty.master(), buffer, sizeof buffer);
+    ASSERT_GT(n, 0);
+    received.append(buffer, n);
+  }
+  EXPECT_EQ(urgent_done.get_future().get(), 4);
+  EXPECT_EQ(bulk_done.get_future().get(), static_cast<ssize_t>(bulk.size()));
+  size_t stop = received.find("STOP");
+  ASSERT_NE(stop, std::string::npos);
+  EXPECT_LT(stop, bulk.size());
+  EXPECT_EQ(stop % 1000, 0u);
+
+  WriteLaneStats urgent = port->write_lane_stats(WriteLane::kUrgent);
+  EXPECT_EQ(urgent.completed_writes, 1u);
+  EXPECT_EQ(urgent.bytes_written, 4u);
+  EXPECT_EQ(urgent.preemptions, 1u);
+  EXPECT_EQ(urgent.queued_writes, 0u);
+  WriteLaneStats finished = port->write_lane_stats(WriteLane::kBulk);
+  EXPECT_EQ(finished.completed_writes, 1u);
+  EXPECT_EQ(finished.bytes_written, bulk.size());
+  EXPECT_GE(finished.max_latency_us, urgent.max_latency_us);
+  loop->RemovePort(port);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, IoLoopTest,
+                         ::testing::Values(IoBackendKind::kEpoll,
+                                           IoBackendKind::kIoUring),
+                         [](const ::testing::TestParamInfo<IoBackendKind>& info) {
+                           return std::string(
+                               info.param == IoBackendKind::kEpoll ? "Epoll"
+                                                                   : "IoUring");
+                         });
+
+TEST(IoLoop, ParsesBackendNames) {
+  IoBackendKind kind;
+  ASSERT_TRUE(ParseIoBackendKind("io_uring", &kind));
+  EXPECT_EQ(kind, IoBackendKind::kIoUring);
+  ASSERT_TRUE(ParseIoBackendKind("epoll", &kind));
+  EXPECT_EQ(kind, IoBackendKind::kEpoll);
+  EXPECT_FALSE(ParseIoBackendKind("select", &kind));
+  EXPECT_FALSE(ParseIoBackendKind(nullptr, &kind));
+}
+
+TEST(IoLoop, ParsesWriteLaneNames) {
+  WriteLane lane;
+  ASSERT_TRUE(ParseWriteLane("urgent", &lane));
+  EXPECT_EQ(lane, WriteLane::kUrgent);
+  ASSERT_TRUE(ParseWriteLane("bulk", &lane));
+  EXPECT_EQ(lane, WriteLane::kBulk);
+  EXPECT_STREQ(WriteLaneName(WriteLane::kNormal), "normal");
+  EXPECT_FALSE(ParseWriteLane("express", &lane));
+}
+
+TEST(IoLoop, DiscardReceivedDropsBufferedBytesAndPartialFrames) {
+  IoPort port(-1);
+  port.OnReceived(reinterpret_cast<const uint8_t*>("old"), 3);
+  port.DiscardReceived();
+  EXPECT_EQ(port.Available(), 0u);
+
+  std::vector<std::string> frames;
+  port.SetFrameCallback(
+      std::unique_ptr<Framer>(new DelimiterFramer('\n', 64)),
+      [&frames](const uint8_t* frame, size_t length) {
+        frames.emplace_back(reinterpret_cast<const char*>(frame), length);
+      });
+  port.OnReceived(reinterpret_cast<const uint8_t*>("par"), 3);
+  port.DiscardReceived();
+  port.OnReceived(reinterpret_cast<const uint8_t*>("new\n"), 4);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0], "new");
+}
+
+TEST(IoLoop, SpillsBeyondTheMemoryLimitAndReplaysInOrder) {
+  IoPort port(-1);
+  ASSERT_TRUE(port.SetReceiveLimit(8, std::string()).ok());
+  std::string sent;
+  for (int i = 0; i < 10; i++) {
+    std::string piece = "chunk" + std::to_string(i) + ";";
+    port.OnReceived(reinterpret_cast<const uint8_t*>(piece.data()),
+                    piece.size());
+    sent += piece;
+  }
+  ReceiveBufferStats stats = port.receive_buffer_stats();
+  EXPECT_EQ(stats.memory_bytes, 8u);
+  EXPECT_EQ(stats.spill_bytes, sent.size() - 8);
+  EXPECT_EQ(port.Available(), sent.size());
+
+  // Small reads interleaved with arrivals still come out in order.
+  std::string received;
+  uint8_t buffer[5];
+  size_t n = port.Read(buffer, sizeof buffer);
+  received.append(reinterpret_cast<char*>(buffer), n);
+  port.OnReceived(reinterpret_cast<const uint8_t*>("tail"), 4);
+  sent += "tail";
+  while ((n = port.Read(buffer, sizeof buffer)) > 0) {
+    received.append(reinterpret_cast<char*>(buffer), n);
+  }
+  EXPECT_EQ(received, sent);
+
+  stats = port.receive_buffer_stats();
+  EXPECT_EQ(stats.memory_bytes, 0u);
+  EXPECT_EQ(stats.spill_bytes, 0u);
+  EXPECT_EQ(stats.spilled_bytes, sent.size() - 8);
+  EXPECT_EQ(stats.replayed_bytes, sent.size() - 8);
+  EXPECT_EQ(stats.dropped_bytes, 0u);
+}
+
+TEST(IoLoop, RemovingTheReceiveLimitKeepsSpilledBytes) {
+  IoPort port(-1);
+  ASSERT_TRUE(port.SetReceiveLimit(4, std::string()).ok());
+  port.OnReceived(reinterpret_cast<const uint8_t*>("0123456789"), 10);
+  ASSERT_TRUE(port.SetReceiveLimit(0, std::string()).ok());
+  EXPECT_EQ(port.receive_buffer_stats().memory_bytes, 10u);
+
+  uint8_t buffer[16];
+  ASSERT_EQ(port.Read(buffer, sizeof buffer), 10u);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(buffer), 10), "0123456789");
+  EXPECT_FALSE(port.SetReceiveLimit(4, "/nonexistent/dir").ok());
+}
+
+TEST(IoLoop, ReadThroughStopsAtTheDelimiter) {
+  IoPort port(-1);
+  port.OnReceived(reinterpret_cast<const uint8_t*>("OK\r"), 3);
+  std::vector<uint8_t> line;
+  const std::vector<uint8_t> crlf = {'\r', '\n'};
+  EXPECT_FALSE(port.ReadThrough(crlf, 16, &line));
+  port.OnReceived(reinterpret_cast<const uint8_t*>("\nnext"), 5);
+  // Not within the first two bytes.
+  EXPECT_FALSE(port.ReadThrough(crlf, 2, &line));
+  ASSERT_TRUE(port.ReadThrough(crlf, 16, &line));
+  EXPECT_EQ(std::string(line.begin(), line.end()), "OK\r\n");
+  EXPECT_EQ(port.Available(), 4u);
+}
+
+TEST(IoLoop, DecodesBeforeBuffering) {
+  IoPort port(-1);
+  port.SetDecoder(
+      std::unique_ptr<Framer>(new Lz4FrameDecoder(
+          std::make_shared<LinkCodecStats>())));
+  const std::string text = "telemetry telemetry telemetry telemetry";
+  std::vector<uint8_t> wire;
+  EncodeLz4Frames(reinterpret_cast<const uint8_t*>(text.data()), text.size(),
+                  &wire, nullptr);
+  port.OnReceived(wire.data(), 3);
+  EXPECT_EQ(port.Available(), 0u);
+  port.OnReceived(wire.data() + 3, wire.size() - 3);
+
+  std::vector<uint8_t> buffer(text.size());
+  ASSERT_EQ(port.Read(buffer.data(), buffer.size()), text.size());
+  EXPECT_EQ(std::string(buffer.begin(), buffer.end()), text);
+}
+
+}  // namespace test
+}  // namespace serial_com
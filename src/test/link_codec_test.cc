@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "link_codec.h"
+#include "lz4_block.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+std::vector<uint8_t> Bytes(const std::string& text) {
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+std::vector<uint8_t> RoundTripBlock(const std::vector<uint8_t>& input) {
+  std::vector<uint8_t> compressed(Lz4CompressBound(input.size()));
+  compressed.resize(
+      Lz4Compress(input.data(), input.size(), compressed.data()));
+  std::vector<uint8_t> output(input.size());
+  int64_t n = Lz4Decompress(compressed.data(), compressed.size(),
+                            output.data(), output.size());
+  EXPECT_EQ(n, static_cast<int64_t>(input.size()));
+  return output;
+}
+
+// Telemetry-like text: the same fields with slowly changing values.
+std::vector<uint8_t> Telemetry(size_t length) {
+  std::string text;
+  for (int i = 0; text.size() < length; i++) {
+    text += "{\"t\":" + std::to_string(1000 + i) + ",\"temp\":21." +
+            std::to_string(i % 10) + ",\"rssi\":-" +
+            std::to_string(60 + i % 3) + "}\n";
+  }
+  text.resize(length);
+  return Bytes(text);
+}
+
+std::vector<uint8_t> Decode(Lz4FrameDecoder* decoder,
+                            const std::vector<uint8_t>& wire,
+                            size_t piece_length) {
+  std::vector<uint8_t> out;
+  for (size_t i = 0; i < wire.size(); i += piece_length) {
+    size_t n = std::min(piece_length, wire.size() - i);
+    decoder->Push(wire.data() + i, n,
+                  [&out](const uint8_t* data, size_t length) {
+                    out.insert(out.end(), data, data + length);
+                  });
+  }
+  return out;
+}
+
+}  // namespace
+
+TEST(Lz4BlockTest, RoundTripsAssortedInputs) {
+  std::mt19937 random(42);
+  std::vector<uint8_t> noise(3000);
+  for (auto& byte : noise) byte = static_cast<uint8_t>(random());
+
+  std::vector<std::vector<uint8_t>> inputs = {
+      {},
+      Bytes("a"),
+      Bytes("short input"),
+      std::vector<uint8_t>(1000, 'z'),  // Long overlapping match.
+      noise,                            // Long literal runs.
+      Telemetry(4096),
+  };
+  for (const auto& input : inputs) {
+    EXPECT_EQ(RoundTripBlock(input), input) << "length " << input.size();
+  }
+}
+
+TEST(Lz4BlockTest, DecodesReferenceBlock) {
+  // One literal 'a', a match of 8 at offset 1, then five literals, as laid
+  // out in the LZ4 block format description.
+  const uint8_t block[] = {0x14, 'a', 0x01, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f'};
+  uint8_t out[32];
+  ASSERT_EQ(Lz4Decompress(block, sizeof block, out, sizeof out), 14);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(out), 14), "aaaaaaaaabcdef");
+}
+
+TEST(Lz4BlockTest, RejectsMalformedBlocks) {
+  uint8_t out[16];
+  // Offset pointing before the start of the output.
+  const uint8_t bad_offset[] = {0x10, 'a', 0x05, 0x00};
+  EXPECT_EQ(Lz4Decompress(bad_offset, sizeof bad_offset, out, sizeof out), -1);
+  // Literal run longer than the input.
+  const uint8_t truncated[] = {0x50, 'a', 'b'};
+  EXPECT_EQ(Lz4Decompress(truncated, sizeof truncated, out, sizeof out), -1);
+  // Output larger than the buffer.
+  const uint8_t too_long[] = {0x1F, 'a', 0x01, 0x00, 0x40};
+  EXPECT_EQ(Lz4Decompress(too_long, sizeof too_long, out, sizeof out), -1);
+}
+
+TEST(LinkCodecTest, FramesRoundTripInSmallPieces) {
+  std::vector<uint8_t> input = Telemetry(10000);
+  auto stats = std::make_shared<LinkCodecStats>();
+  std::vector<uint8_t> wire;
+  EncodeLz4Frames(input.data(), input.size(), &wire, stats.get());
+  EXPECT_LT(wire.size(), input.size() / 2);
+
+  Lz4FrameDecoder decoder(stats);
+  EXPECT_EQ(Decode(&decoder, wire, 7), input);
+
+  LinkCodecStatsSnapshot snapshot = stats->Snapshot();
+  EXPECT_EQ(snapshot.raw_bytes_sent, input.size());
+  EXPECT_EQ(snapshot.wire_bytes_sent, wire.size());
+  EXPECT_EQ(snapshot.raw_bytes_received, input.size());
+  EXPECT_EQ(snapshot.wire_bytes_received, wire.size());
+  EXPECT_EQ(snapshot.decode_errors, 0u);
+}
+
+TEST(LinkCodecTest, StoresIncompressibleFrames) {
+  std::mt19937 random(7);
+  std::vector<uint8_t> input(100);
+  for (auto& byte : input) byte = static_cast<uint8_t>(random());
+  std::vector<uint8_t> wire;
+  EncodeLz4Frames(input.data(), input.size(), &wire, nullptr);
+  EXPECT_EQ(wire.size(),
+            kLz4FrameHeaderSize + input.size() + kLz4FrameTrailerSize);
+
+  Lz4FrameDecoder decoder(std::make_shared<LinkCodecStats>());
+  EXPECT_EQ(Decode(&decoder, wire, wire.size()), input);
+}
+
+TEST(LinkCodecTest, ResynchronisesAfterCorruption) {
+  std::vector<uint8_t> first = Telemetry(200);
+  std::vector<uint8_t> second = Bytes("second frame");
+  std::vector<uint8_t> wire;
+  EncodeLz4Frames(first.data(), first.size(), &wire, nullptr);
+  wire[1] = 0;  // Zero raw length.
+  EncodeLz4Frames(second.data(), second.size(), &wire, nullptr);
+
+  auto stats = std::make_shared<LinkCodecStats>();
+  Lz4FrameDecoder decoder(stats);
+  EXPECT_EQ(Decode(&decoder, wire, 16), second);
+  EXPECT_GE(stats->Snapshot().decode_errors, 1u);
+}
+
+TEST(LinkCodecTest, DropsFramesFailingTheirCrc) {
+  std::vector<uint8_t> first = Bytes("stored, so any flip still parses");
+  std::vector<uint8_t> second = Telemetry(200);
+  std::vector<uint8_t> wire;
+  EncodeLz4Frames(first.data(), first.size(), &wire, nullptr);
+  ASSERT_EQ(wire[4] & 0x80, 0x80);
+  wire[kLz4FrameHeaderSize + 3] ^= 0x04;
+  EncodeLz4Frames(second.data(), second.size(), &wire, nullptr);
+  // A flip in a compressed frame's last literal, so that it still decodes
+  // to the right length.
+  const size_t third = wire.size();
+  EncodeLz4Frames(second.data(), second.size(), &wire, nullptr);
+  ASSERT_EQ(wire[third + 4] & 0x80, 0);
+  wire[wire.size() - kLz4FrameTrailerSize - 1] ^= 0x01;
+
+  auto stats = std::make_shared<LinkCodecStats>();
+  Lz4FrameDecoder decoder(stats);
+  EXPECT_EQ(Decode(&decoder, wire, 16), second);
+  EXPECT_GE(stats->Snapshot().decode_errors, 2u);
+}
+
+TEST(LinkCodecTest, ParsesCodecNames) {
+  LinkCodec codec;
+  ASSERT_TRUE(ParseLinkCodec("lz4", &codec));
+  EXPECT_EQ(codec, LinkCodec::kLz4);
+  ASSERT_TRUE(ParseLinkCodec("none", &codec));
+  EXPECT_EQ(codec, LinkCodec::kNone);
+  EXPECT_FALSE(ParseLinkCodec("heatshrink", &codec));
+  EXPECT_STREQ(LinkCodecName(LinkCodec::kLz4), "lz4");
+}
+
+}  // namespace test
+}  // namespace serial_com
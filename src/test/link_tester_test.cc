@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "io_loop.h"
+#include "link_tester.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// A loopback plug with faults: whatever the tester sends comes back
+// through its OnReceived(), on the tester's thread, after corrupting and
+// dropping the bytes asked for.
+class FaultyLoopback {
+ public:
+  void Attach(LinkTester* tester) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tester_ = tester;
+  }
+
+  void OnSent(const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint8_t> echoed;
+    for (uint8_t byte : data) {
+      size_t offset = offset_++;
+      if (offset >= drop_from && offset < drop_to) continue;
+      echoed.push_back(offset == corrupt_at ? byte ^ 0x81 : byte);
+    }
+    if (!echoed.empty()) tester_->OnReceived(echoed.data(), echoed.size());
+  }
+
+  size_t corrupt_at = SIZE_MAX;
+  size_t drop_from = SIZE_MAX;
+  size_t drop_to = SIZE_MAX;
+
+ private:
+  std::mutex mutex_;
+  LinkTester* tester_ = nullptr;
+  size_t offset_ = 0;
+};
+
+// Plays a loopback plug on the master side of |pty| until destroyed.
+class PtyEcho {
+ public:
+  explicit PtyEcho(const PtyPair& pty)
+      : master_(pty.master()), stopping_(false) {
+    thread_ = std::thread([this]() {
+      while (!stopping_) {
+        struct pollfd fd = {master_, POLLIN, 0};
+        if (poll(&fd, 1, 10) <= 0) continue;
+        uint8_t buffer[4096];
+        ssize_t n = read(master_, buffer, sizeof buffer);
+        for (ssize_t written = 0; written < n;) {
+          ssize_t m = write(master_, buffer + written, n - written);
+          if (m <= 0) break;
+          written += m;
+        }
+      }
+    });
+  }
+
+  ~PtyEcho() {
+    stopping_ = true;
+    thread_.join();
+  }
+
+ private:
+  const int master_;
+  std::atomic<bool> stopping_;
+  std::thread thread_;
+};
+
+}  // namespace
+
+TEST(LinkTesterTest, ParsesPatternNames) {
+  LinkTestPattern pattern;
+  ASSERT_TRUE(ParseLinkTestPattern("prbs31", &pattern));
+  EXPECT_EQ(pattern, LinkTestPattern::kPrbs31);
+  ASSERT_TRUE(ParseLinkTestPattern("counter", &pattern));
+  EXPECT_EQ(pattern, LinkTestPattern::kCounter);
+  EXPECT_FALSE(ParseLinkTestPattern("prbs9", &pattern));
+  EXPECT_STREQ(LinkTestPatternName(LinkTestPattern::kAlternating),
+               "alternating");
+}
+
+TEST(LinkTesterTest, PrbsPatternsRepeatWithTheirPeriod) {
+  // A PRBS-n repeats every 2^n-1 bits, which is odd, so the bytes repeat
+  // every 2^n-1 bytes.
+  std::vector<uint8_t> prbs7;
+  GenerateLinkTestPattern(LinkTestPattern::kPrbs7, 3 * 127, &prbs7);
+  for (size_t i = 0; i + 127 < prbs7.size(); i++) {
+    ASSERT_EQ(prbs7[i], prbs7[i + 127]) << i;
+  }
+  EXPECT_NE(std::vector<uint8_t>(prbs7.begin(), prbs7.begin() + 16),
+            std::vector<uint8_t>(prbs7.begin() + 63, prbs7.begin() + 79));
+
+  std::vector<uint8_t> prbs15;
+  GenerateLinkTestPattern(LinkTestPattern::kPrbs15, 32767 + 64, &prbs15);
+  for (size_t i = 0; i < 64; i++) {
+    ASSERT_EQ(prbs15[i], prbs15[i + 32767]) << i;
+  }
+  // A maximal length sequence has one more one than zeros per period.
+  size_t ones = 0;
+  for (size_t i = 0; i < 32767; i++) {
+    for (uint8_t byte = prbs15[i]; byte != 0; byte &= byte - 1) ones++;
+  }
+  EXPECT_EQ(ones, 8u * 16384);
+
+  std::vector<uint8_t> counter;
+  GenerateLinkTestPattern(LinkTestPattern::kCounter, 300, &counter);
+  EXPECT_EQ(counter[255], 0xff);
+  EXPECT_EQ(counter[256], 0x00);
+}
+
+TEST(LinkTesterTest, ComparisonSeparatesDropsFromCorruption) {
+  std::vector<uint8_t> sent;
+  GenerateLinkTestPattern(LinkTestPattern::kPrbs15, 10000, &sent);
+
+  EXPECT_EQ(CompareLoopback(sent, sent).byte_errors, 0u);
+
+  std::vector<uint8_t> received = sent;
+  received[100] ^= 0x11;
+  received.erase(received.begin() + 5000, received.begin() + 5007);
+  received.push_back(0x42);
+  received.push_back(0x43);
+  LinkErrorCounts counts = CompareLoopback(sent, received);
+  EXPECT_EQ(counts.byte_errors, 1u);
+  EXPECT_EQ(counts.bit_errors, 2u);
+  EXPECT_EQ(counts.dropped_bytes, 7u);
+  EXPECT_EQ(counts.extra_bytes, 2u);
+
+  // A tail that never came back counts as dropped.
+  received.assign(sent.begin(), sent.begin() + 9000);
+  counts = CompareLoopback(sent, received);
+  EXPECT_EQ(counts.dropped_bytes, 1000u);
+  EXPECT_EQ(counts.byte_errors, 0u);
+}
+
+TEST(LinkTesterTest, ReportsErrorsAndLatency) {
+  FaultyLoopback loopback;
+  loopback.corrupt_at = 1234;
+  loopback.drop_from = 20000;
+  loopback.drop_to = 20010;
+  LinkTestOptions options;
+  options.bytes = 64 * 1024;
+  options.chunk_size = 1000;
+  options.probes = 10;
+  options.probe_size = 4;
+  options.timeout_ms = 200;
+  std::promise<LinkTestReport> finished;
+  {
+    LinkTester tester(
+        options,
+        [&loopback](std::vector<uint8_t> data, LinkTester::WriteDone done) {
+          loopback.OnSent(data);
+          done(static_cast<int64_t>(data.size()));
+        },
+        [&finished](const LinkTestReport& report) {
+          finished.set_value(report);
+        });
+    loopback.Attach(&tester);
+    tester.Start();
+    std::future<LinkTestReport> result = finished.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(10)),
+              std::future_status::ready);
+    LinkTestReport report = result.get();
+    EXPECT_TRUE(report.status.ok()) << report.status.message();
+    EXPECT_EQ(report.bytes_sent, 64u * 1024);
+    EXPECT_EQ(report.bytes_received, 64u * 1024 - 10);
+    EXPECT_EQ(report.errors.byte_errors, 1u);
+    EXPECT_EQ(report.errors.bit_errors, 2u);
+    EXPECT_EQ(report.errors.dropped_bytes, 10u);
+    EXPECT_GT(report.bit_error_rate, 0);
+    EXPECT_EQ(report.probes_sent, 10);
+    EXPECT_EQ(report.probes_lost, 0);
+    EXPECT_LE(report.min_latency_us, report.p50_latency_us);
+    EXPECT_LE(report.p50_latency_us, report.p99_latency_us);
+    EXPECT_LE(report.p99_latency_us, report.max_latency_us);
+  }
+}
+
+TEST(LinkTesterTest, StopsOnWriteErrorsAndCancellation) {
+  std::promise<LinkTestReport> failed;
+  {
+    LinkTester tester(
+        LinkTestOptions(),
+        [](std::vector<uint8_t>, LinkTester::WriteDone done) { done(-EIO); },
+        [&failed](const LinkTestReport& report) { failed.set_value(report); });
+    tester.Start();
+    LinkTestReport report = failed.get_future().get();
+    EXPECT_STREQ(report.status.code(), "WRITE_ERROR");
+  }
+
+  // Nothing ever comes back, and the tester goes away while waiting.
+  std::promise<LinkTestReport> cancelled;
+  LinkTestOptions options;
+  options.timeout_ms = 60000;
+  {
+    LinkTester tester(
+        options,
+        [](std::vector<uint8_t> data, LinkTester::WriteDone done) {
+          done(static_cast<int64_t>(data.size()));
+        },
+        [&cancelled](const LinkTestReport& report) {
+          cancelled.set_value(report);
+        });
+    tester.Start();
+  }
+  EXPECT_STREQ(cancelled.get_future().get().status.code(), "CANCELLED");
+}
+
+TEST(LinkTesterTest, RunsOverAPtyLoopback) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(IoBackendKind::kEpoll);
+  ASSERT_NE(loop, nullptr);
+  PtyPair pty;
+  PtyEcho echo(pty);
+  auto port = std::make_shared<IoPort>(pty.slave());
+  ASSERT_TRUE(loop->AddPort(port));
+
+  LinkTestOptions options;
+  options.bytes = 256 * 1024;
+  options.probes = 20;
+  std::promise<LinkTestReport> finished;
+  IoLoop* io_loop = loop.get();
+  LinkTester tester(
+      options,
+      [io_loop, port](std::vector<uint8_t> data, LinkTester::WriteDone done) {
+        io_loop->Write(port, std::move(data),
+                       [done](ssize_t result) { done(result); });
+      },
+      [&finished](const LinkTestReport& report) {
+        finished.set_value(report);
+      });
+  port->SetFrameCallback(
+      std::unique_ptr<Framer>(new PassThroughFramer()),
+      [&tester](const uint8_t* data, size_t length) {
+        tester.OnReceived(data, length);
+      });
+  tester.Start();
+
+  std::future<LinkTestReport> result = finished.get_future();
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(20)),
+            std::future_status::ready);
+  LinkTestReport report = result.get();
+  EXPECT_TRUE(report.status.ok()) << report.status.message();
+  EXPECT_EQ(report.bytes_received, report.bytes_sent);
+  EXPECT_EQ(report.errors.byte_errors, 0u);
+  EXPECT_EQ(report.errors.dropped_bytes, 0u);
+  EXPECT_EQ(report.bit_error_rate, 0);
+  EXPECT_GT(report.bytes_per_second, 0);
+  EXPECT_EQ(report.probes_lost, 0);
+  EXPECT_GT(report.max_latency_us, 0u);
+  port->SetFrameCallback(nullptr, nullptr);
+  loop->RemovePort(port);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,236 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "modem_lines.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// Lines driven by the test. Wait() blocks until they change, like
+// TIOCMIWAIT, unless |can_wait| is false.
+class FakeModemLineDevice : public ModemLineDevice {
+ public:
+  struct Shared {
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint32_t lines = 0;
+    ModemLineCounts counts;
+    uint64_t generation = 0;
+    bool interrupted = false;
+    bool can_wait = true;
+    int read_error = 0;
+  };
+
+  explicit FakeModemLineDevice(std::shared_ptr<Shared> shared)
+      : shared_(std::move(shared)) {}
+
+  int Read(uint32_t* lines) override {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    if (shared_->read_error != 0) return shared_->read_error;
+    *lines = shared_->lines;
+    return 0;
+  }
+
+  int ReadCounts(ModemLineCounts* counts) override {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    *counts = shared_->counts;
+    return 0;
+  }
+
+  int Wait() override {
+    std::unique_lock<std::mutex> lock(shared_->mutex);
+    if (!shared_->can_wait) return -ENOTTY;
+    uint64_t generation = seen_;
+    shared_->changed.wait(lock, [&] {
+      return shared_->generation != generation || shared_->interrupted;
+    });
+    seen_ = shared_->generation;
+    if (shared_->interrupted) {
+      shared_->interrupted = false;
+      return -EINTR;
+    }
+    return 0;
+  }
+
+  void Interrupt(std::thread*) override {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    shared_->interrupted = true;
+    shared_->changed.notify_all();
+  }
+
+ private:
+  const std::shared_ptr<Shared> shared_;
+  uint64_t seen_ = 0;
+};
+
+class ModemMonitorTest : public ::testing::Test {
+ protected:
+  ModemMonitorTest()
+      : shared_(std::make_shared<FakeModemLineDevice::Shared>()) {}
+
+  void Start() {
+    monitor_.reset(new ModemMonitor(
+        std::unique_ptr<ModemLineDevice>(new FakeModemLineDevice(shared_)),
+        [this](const ModemLineEvent& event) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          events_.push_back(event);
+          arrived_.notify_all();
+        },
+        5));
+  }
+
+  void SetLines(uint32_t lines, const ModemLineCounts& counts) {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    shared_->lines = lines;
+    shared_->counts = counts;
+    shared_->generation++;
+    shared_->changed.notify_all();
+  }
+
+  void SetLines(uint32_t lines) {
+    ModemLineCounts counts;
+    {
+      std::lock_guard<std::mutex> lock(shared_->mutex);
+      counts = shared_->counts;
+    }
+    SetLines(lines, counts);
+  }
+
+  // Waits until |count| events have been reported.
+  std::vector<ModemLineEvent> WaitForEvents(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    arrived_.wait_for(lock, std::chrono::seconds(5),
+                      [&] { return events_.size() >= count; });
+    return events_;
+  }
+
+  std::shared_ptr<FakeModemLineDevice::Shared> shared_;
+  std::unique_ptr<ModemMonitor> monitor_;
+
+  std::mutex mutex_;
+  std::condition_variable arrived_;
+  std::vector<ModemLineEvent> events_;
+};
+
+}  // namespace
+
+TEST_F(ModemMonitorTest, ReportsInitialLines) {
+  shared_->lines = kLineCts | kLineDtr;
+  Start();
+  std::vector<ModemLineEvent> events = WaitForEvents(1);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].lines, kLineCts | kLineDtr);
+  EXPECT_EQ(events[0].changed, 0u);
+  EXPECT_EQ(events[0].error, 0);
+  EXPECT_TRUE(monitor_->interrupt_driven());
+}
+
+TEST_F(ModemMonitorTest, ReportsChangedInputLines) {
+  Start();
+  WaitForEvents(1);
+  SetLines(kLineCts);
+  WaitForEvents(2);
+  SetLines(kLineCts | kLineDcd);
+  std::vector<ModemLineEvent> events = WaitForEvents(3);
+  ASSERT_EQ(events.size(), 3u);
+  EXPECT_EQ(events[1].lines, kLineCts);
+  EXPECT_EQ(events[1].changed, kLineCts);
+  EXPECT_EQ(events[2].changed, kLineDcd);
+  EXPECT_LE(events[1].timestamp_ns, events[2].timestamp_ns);
+}
+
+TEST_F(ModemMonitorTest, IgnoresOutputLineChanges) {
+  Start();
+  WaitForEvents(1);
+  // Not an input line, so no event; the next change carries it.
+  SetLines(kLineRts);
+  SetLines(kLineRts | kLineDsr);
+  std::vector<ModemLineEvent> events = WaitForEvents(2);
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[1].lines, kLineRts | kLineDsr);
+  EXPECT_EQ(events[1].changed, kLineDsr);
+}
+
+TEST_F(ModemMonitorTest, ReportsPulsesSeenOnlyByCounters) {
+  Start();
+  WaitForEvents(1);
+  // RI rang and dropped again before the lines were read.
+  ModemLineCounts counts;
+  counts.ri = 2;
+  SetLines(0, counts);
+  std::vector<ModemLineEvent> events = WaitForEvents(2);
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[1].lines, 0u);
+  EXPECT_EQ(events[1].changed, kLineRi);
+}
+
+TEST_F(ModemMonitorTest, PollsWhenTheDriverCannotWait) {
+  shared_->can_wait = false;
+  Start();
+  WaitForEvents(1);
+  {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    shared_->lines = kLineDsr;
+  }
+  std::vector<ModemLineEvent> events = WaitForEvents(2);
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[1].changed, kLineDsr);
+  EXPECT_FALSE(monitor_->interrupt_driven());
+}
+
+TEST_F(ModemMonitorTest, ReportsReadErrorsAndStops) {
+  Start();
+  WaitForEvents(1);
+  {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    shared_->read_error = -EIO;
+  }
+  SetLines(kLineCts);
+  std::vector<ModemLineEvent> events = WaitForEvents(2);
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[1].error, -EIO);
+}
+
+TEST_F(ModemMonitorTest, StopsWhileWaiting) {
+  Start();
+  WaitForEvents(1);
+  monitor_.reset();
+  EXPECT_EQ(WaitForEvents(1).size(), 1u);
+}
+
+TEST(ModemLinesTest, RejectsNonTerminals) {
+  PtyPair pty;
+  uint32_t lines;
+  // Pseudo-terminals have no modem lines.
+  EXPECT_FALSE(GetModemLines(pty.slave(), &lines).ok());
+  EXPECT_FALSE(GetModemLines(-1, &lines).ok());
+  EXPECT_TRUE(SetModemLines(-1, 0, true).ok());
+  EXPECT_FALSE(SetModemLines(-1, kLineDtr, true).ok());
+  EXPECT_FALSE(SetBreak(-1, true).ok());
+}
+
+TEST(ModemLinesTest, TtyDeviceFallsBackOnPseudoTerminals) {
+  PtyPair pty;
+  std::unique_ptr<ModemLineDevice> device =
+      CreateTtyModemLineDevice(pty.slave());
+  int result = device->Wait();
+  EXPECT_TRUE(result == -ENOTTY || result == -EINVAL) << result;
+}
+
+TEST(ModemLinesTest, NamesLines) {
+  EXPECT_STREQ(ModemLineName(kLineCts), "cts");
+  EXPECT_STREQ(ModemLineName(kLineRi), "ri");
+  EXPECT_STREQ(ModemLineName(kLineCts | kLineRi), "unknown");
+}
+
+}  // namespace test
+}  // namespace serial_com
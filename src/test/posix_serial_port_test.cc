@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "posix_serial_port.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+TEST(PosixSerialPort, MapsBaudRates) {
+  speed_t speed;
+  ASSERT_TRUE(BaudRateToSpeed(115200, &speed));
+  EXPECT_EQ(speed, static_cast<speed_t>(B115200));
+  EXPECT_FALSE(BaudRateToSpeed(12345, &speed));
+}
+
+TEST(PosixSerialPort, RejectsUnsupportedBaudRate) {
+  PtyPair pty;
+  PortConfig config;
+  config.path = pty.slave_path();
+  config.baud_rate = 12345;
+  PosixSerialPort port;
+  Status status = port.Open(config);
+  EXPECT_FALSE(status.ok());
+  EXPECT_STREQ(status.code(), "CONFIG_ERROR");
+  EXPECT_FALSE(port.IsOpen());
+}
+
+TEST(PosixSerialPort, ReportsMissingDevice) {
+  PortConfig config;
+  config.path = "/dev/serial_com_does_not_exist";
+  PosixSerialPort port;
+  Status status = port.Open(config);
+  EXPECT_STREQ(status.code(), "OPEN_ERROR");
+}
+
+TEST(PosixSerialPort, WritesAndReadsThroughPty) {
+  PtyPair pty;
+  PortConfig config;
+  config.path = pty.slave_path();
+  config.baud_rate = 115200;
+  config.parity = Parity::kEven;
+  PosixSerialPort port;
+  ASSERT_TRUE(port.Open(config).ok());
+
+  const std::string out = "ping";
+  ASSERT_TRUE(
+      port.Write(reinterpret_cast<const uint8_t*>(out.data()), out.size())
+          .ok());
+  char echo[16];
+  ASSERT_EQ(read(pty.master(), echo, sizeof echo), 4);
+  EXPECT_EQ(std::string(echo, 4), out);
+
+  ASSERT_EQ(write(pty.master(), "pong", 4), 4);
+  // The pty hands input to the line discipline asynchronously.
+  struct pollfd readable = {port.fd(), POLLIN, 0};
+  ASSERT_EQ(poll(&readable, 1, 5000), 1);
+  size_t queued = 0;
+  ASSERT_TRUE(port.Queued(&queued).ok());
+  EXPECT_EQ(queued, 4u);
+  std::vector<uint8_t> in;
+  ASSERT_TRUE(port.Read(64, &in).ok());
+  EXPECT_EQ(std::string(in.begin(), in.end()), "pong");
+
+  PortStatsSnapshot stats = port.stats().Snapshot();
+  EXPECT_EQ(stats.bytes_sent, 4u);
+  EXPECT_EQ(stats.bytes_received, 4u);
+  EXPECT_EQ(stats.write_calls, 1u);
+  EXPECT_EQ(stats.read_calls, 1u);
+  EXPECT_EQ(stats.read_sizing_calls, 1u);
+  EXPECT_EQ(ReadSyscallsPerMegabyte(stats), 2 * 1048576.0 / 4);
+}
+
+TEST(PosixSerialPort, ParsesFlushQueues) {
+  FlushQueue queue;
+  ASSERT_TRUE(ParseFlushQueue("rx", &queue));
+  EXPECT_EQ(queue, FlushQueue::kReceive);
+  ASSERT_TRUE(ParseFlushQueue("tx", &queue));
+  EXPECT_EQ(queue, FlushQueue::kTransmit);
+  ASSERT_TRUE(ParseFlushQueue("both", &queue));
+  EXPECT_EQ(queue, FlushQueue::kBoth);
+  EXPECT_FALSE(ParseFlushQueue("all", &queue));
+  EXPECT_FALSE(ParseFlushQueue(nullptr, &queue));
+}
+
+TEST(PosixSerialPort, FlushDiscardsUnreadInput) {
+  PtyPair pty;
+  ASSERT_EQ(write(pty.master(), "stale", 5), 5);
+  // Let the pty move the bytes to the slave's input queue.
+  usleep(20000);
+  ASSERT_TRUE(FlushPosixPort(pty.slave(), FlushQueue::kReceive).ok());
+
+  ASSERT_EQ(write(pty.master(), "fresh", 5), 5);
+  char in[16];
+  ssize_t n = read(pty.slave(), in, sizeof in);
+  ASSERT_GT(n, 0);
+  EXPECT_EQ(std::string(in, n), "fresh");
+
+  Status status = FlushPosixPort(-1, FlushQueue::kBoth);
+  EXPECT_STREQ(status.code(), "FLUSH_ERROR");
+}
+
+}  // namespace test
+}  // namespace serial_com
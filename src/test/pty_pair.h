@@ -0,0 +1,52 @@
+#ifndef SERIAL_COM_CORE_TEST_PTY_PAIR_H_
+#define SERIAL_COM_CORE_TEST_PTY_PAIR_H_
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace serial_com {
+namespace test {
+
+// A pseudo-terminal standing in for a serial device. Code under test gets
+// the slave side; the test plays the device on the master side.
+class PtyPair {
+ public:
+  PtyPair() {
+    master_ = posix_openpt(O_RDWR | O_NOCTTY);
+    grantpt(master_);
+    unlockpt(master_);
+    slave_path_ = ptsname(master_);
+    slave_ = open(slave_path_.c_str(), O_RDWR | O_NOCTTY);
+    struct termios tty;
+    tcgetattr(slave_, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave_, TCSANOW, &tty);
+  }
+
+  ~PtyPair() {
+    if (slave_ >= 0) close(slave_);
+    close(master_);
+  }
+
+  // Disallow copy and assign.
+  PtyPair(const PtyPair&) = delete;
+  PtyPair& operator=(const PtyPair&) = delete;
+
+  int master() const { return master_; }
+  int slave() const { return slave_; }
+  const std::string& slave_path() const { return slave_path_; }
+
+ private:
+  int master_;
+  int slave_;
+  std::string slave_path_;
+};
+
+}  // namespace test
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_TEST_PTY_PAIR_H_
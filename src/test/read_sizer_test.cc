@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+#include "read_sizer.h"
+
+namespace serial_com {
+namespace test {
+
+TEST(ReadSizerTest, CoversQueuedBytesWithinTheLimits) {
+  ReadSizer sizer;
+  EXPECT_EQ(sizer.NextReadSize(0), ReadSizer::kDefaultMinReadSize);
+  EXPECT_EQ(sizer.NextReadSize(3000), 4096u);
+  EXPECT_EQ(sizer.NextReadSize(1 << 20), ReadSizer::kDefaultMaxReadSize);
+
+  sizer.SetLimits(100, 50);
+  EXPECT_EQ(sizer.min_read_size(), 100u);
+  EXPECT_EQ(sizer.max_read_size(), 100u);
+  EXPECT_EQ(sizer.NextReadSize(0), 100u);
+  sizer.SetLimits(0, 8192);
+  EXPECT_EQ(sizer.NextReadSize(0), 1u);
+  EXPECT_EQ(sizer.stats().read_size, 1u);
+}
+
+TEST(ReadSizerTest, GrowsWithTheArrivalRateAndDecaysAfter) {
+  ReadSizer sizer;
+  ReadSizer::Clock::time_point now = ReadSizer::Clock::now();
+  // 1 MB/s: 10 KB per 10 ms window.
+  for (int i = 0; i <= 10; i++) {
+    sizer.OnRead(i == 0 ? 0 : 10000, now + std::chrono::milliseconds(10 * i));
+  }
+  EXPECT_EQ(sizer.stats().bytes_per_second, 1000000u);
+  // 10 ms worth, rounded up to a power of two.
+  EXPECT_EQ(sizer.NextReadSize(0), 16384u);
+
+  // A lull lowers the estimate gradually...
+  now += std::chrono::milliseconds(100);
+  sizer.OnRead(100, now + std::chrono::milliseconds(20));
+  EXPECT_EQ(sizer.stats().bytes_per_second, 751250u);
+  // ...and a long pause forgets it.
+  sizer.OnRead(100, now + std::chrono::seconds(3));
+  EXPECT_LT(sizer.stats().bytes_per_second, 100u);
+  EXPECT_EQ(sizer.NextReadSize(0), ReadSizer::kDefaultMinReadSize);
+}
+
+TEST(ReadSizerTest, FitsTheBufferWithHysteresis) {
+  ReadSizer sizer;
+  std::vector<uint8_t> buffer;
+  sizer.FitBuffer(4096, &buffer);
+  EXPECT_EQ(buffer.size(), 4096u);
+  sizer.FitBuffer(1024, &buffer);
+  EXPECT_EQ(buffer.size(), 4096u);
+  sizer.FitBuffer(512, &buffer);
+  EXPECT_EQ(buffer.size(), 512u);
+  EXPECT_EQ(sizer.stats().buffer_bytes, 512u);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "receive_buffer.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+void Append(ReceiveBuffer* buffer, const std::string& data) {
+  buffer->Append(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+std::string Read(ReceiveBuffer* buffer, size_t max_length) {
+  std::string out(max_length, '\0');
+  size_t n = buffer->Read(reinterpret_cast<uint8_t*>(&out[0]), max_length);
+  out.resize(n);
+  return out;
+}
+
+}  // namespace
+
+TEST(ReceiveBuffer, ReadsInArrivalOrder) {
+  ReceiveBuffer buffer;
+  Append(&buffer, "hello ");
+  Append(&buffer, "world");
+  EXPECT_EQ(buffer.size(), 11u);
+  EXPECT_EQ(Read(&buffer, 4), "hell");
+  Append(&buffer, "!");
+  EXPECT_EQ(Read(&buffer, 100), "o world!");
+  EXPECT_TRUE(buffer.empty());
+}
+
+TEST(ReceiveBuffer, SurvivesManySmallReads) {
+  ReceiveBuffer buffer;
+  std::string expected;
+  std::string received;
+  for (int i = 0; i < 1000; i++) {
+    std::string chunk = std::to_string(i) + ",";
+    expected += chunk;
+    Append(&buffer, chunk);
+    received += Read(&buffer, 3);
+  }
+  received += Read(&buffer, expected.size());
+  EXPECT_EQ(received, expected);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "receive_fanout.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+SharedChunk MakeChunk(const std::string& text) {
+  return std::make_shared<const std::vector<uint8_t>>(text.begin(),
+                                                      text.end());
+}
+
+std::string Contents(const ChunkQueue& queue) {
+  std::vector<ChunkSegment> segments;
+  queue.Peek(16, &segments);
+  std::string text;
+  for (const ChunkSegment& segment : segments) {
+    text.append(reinterpret_cast<const char*>(segment.data), segment.length);
+  }
+  return text;
+}
+
+}  // namespace
+
+TEST(ChunkQueue, PeeksAndConsumesAcrossChunks) {
+  ChunkQueue queue;
+  queue.Push(MakeChunk("abc"));
+  queue.Push(MakeChunk(""));
+  queue.Push(MakeChunk("defg"));
+  EXPECT_EQ(queue.bytes(), 7u);
+  EXPECT_EQ(Contents(queue), "abcdefg");
+
+  queue.Consume(4);
+  EXPECT_EQ(Contents(queue), "efg");
+  std::vector<ChunkSegment> segments;
+  EXPECT_EQ(queue.Peek(1, &segments), 3u);
+  ASSERT_EQ(segments.size(), 1u);
+
+  queue.Consume(10);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(queue.dropped_bytes(), 0u);
+}
+
+TEST(ChunkQueue, DropsOldestBytesPastLimit) {
+  ChunkQueue queue(5);
+  queue.Push(MakeChunk("abc"));
+  queue.Push(MakeChunk("def"));
+  EXPECT_EQ(Contents(queue), "bcdef");
+  queue.Push(MakeChunk("ghijkl"));
+  EXPECT_EQ(Contents(queue), "hijkl");
+  EXPECT_EQ(queue.dropped_bytes(), 7u);
+}
+
+TEST(ReceiveFanout, SharesOneChunkBetweenSinks) {
+  ReceiveFanout fanout;
+  // Nothing is allocated, or delivered, without sinks.
+  fanout.Publish(reinterpret_cast<const uint8_t*>("lost"), 4);
+
+  std::vector<SharedChunk> first;
+  std::vector<SharedChunk> second;
+  int first_id = fanout.AddSink(
+      [&first](const SharedChunk& chunk) { first.push_back(chunk); });
+  fanout.AddSink(
+      [&second](const SharedChunk& chunk) { second.push_back(chunk); });
+
+  fanout.Publish(reinterpret_cast<const uint8_t*>("data"), 4);
+  ASSERT_EQ(first.size(), 1u);
+  ASSERT_EQ(second.size(), 1u);
+  EXPECT_EQ(first[0].get(), second[0].get());
+  EXPECT_EQ(std::string(first[0]->begin(), first[0]->end()), "data");
+
+  fanout.RemoveSink(first_id);
+  fanout.Publish(reinterpret_cast<const uint8_t*>("more"), 4);
+  EXPECT_EQ(first.size(), 1u);
+  EXPECT_EQ(second.size(), 2u);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "record_decoder.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// u32 ts, i16 ax, i16 ay, f32 temp, all little endian.
+RecordSchema ImuSchema() {
+  RecordSchema schema;
+  schema.record_size = 12;
+  schema.fields = {
+      {"ts", FieldType::kU32, 0, false},
+      {"ax", FieldType::kI16, 4, false},
+      {"ay", FieldType::kI16, 6, false},
+      {"temp", FieldType::kF32, 8, false},
+  };
+  return schema;
+}
+
+std::vector<uint8_t> ImuRecord(uint32_t ts, int16_t ax, int16_t ay,
+                               float temp) {
+  std::vector<uint8_t> record(12);
+  for (int i = 0; i < 4; i++) record[i] = static_cast<uint8_t>(ts >> (8 * i));
+  record[4] = static_cast<uint8_t>(ax);
+  record[5] = static_cast<uint8_t>(static_cast<uint16_t>(ax) >> 8);
+  record[6] = static_cast<uint8_t>(ay);
+  record[7] = static_cast<uint8_t>(static_cast<uint16_t>(ay) >> 8);
+  uint32_t bits;
+  memcpy(&bits, &temp, sizeof bits);
+  for (int i = 0; i < 4; i++) {
+    record[8 + i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+  return record;
+}
+
+}  // namespace
+
+TEST(RecordDecoderTest, DecodesRecordsIntoColumns) {
+  RecordDecoder decoder(ImuSchema(), 100);
+  std::vector<uint8_t> first = ImuRecord(4000000000u, -5, 300, 21.5f);
+  std::vector<uint8_t> second = ImuRecord(4000000001u, 7, -300, -1.25f);
+  EXPECT_TRUE(decoder.Decode(first.data(), first.size()));
+  EXPECT_FALSE(decoder.Decode(second.data(), second.size()));
+
+  RecordBatch batch = decoder.TakeBatch();
+  ASSERT_EQ(batch.rows, 2u);
+  ASSERT_EQ(batch.columns.size(), 4u);
+  EXPECT_EQ(batch.columns[0].type, ColumnType::kInt64);
+  EXPECT_EQ(batch.columns[0].values<int64_t>()[0], 4000000000);
+  EXPECT_EQ(batch.columns[0].values<int64_t>()[1], 4000000001);
+  EXPECT_EQ(batch.columns[1].type, ColumnType::kInt32);
+  EXPECT_EQ(batch.columns[1].values<int32_t>()[0], -5);
+  EXPECT_EQ(batch.columns[2].values<int32_t>()[1], -300);
+  EXPECT_EQ(batch.columns[3].type, ColumnType::kFloat32);
+  EXPECT_EQ(batch.columns[3].values<float>()[0], 21.5f);
+  EXPECT_EQ(batch.columns[3].values<float>()[1], -1.25f);
+
+  EXPECT_EQ(decoder.rows(), 0u);
+  EXPECT_TRUE(decoder.Decode(first.data(), first.size()));
+}
+
+TEST(RecordDecoderTest, HonoursBigEndianFields) {
+  RecordSchema schema;
+  schema.record_size = 10;
+  schema.fields = {{"word", FieldType::kU16, 0, true},
+                   {"value", FieldType::kF64, 2, true}};
+  RecordDecoder decoder(schema, 10);
+  const uint8_t record[] = {0x12, 0x34, 0x40, 0x09, 0x21, 0xFB,
+                            0x54, 0x44, 0x2D, 0x18};
+  decoder.Decode(record, sizeof record);
+  RecordBatch batch = decoder.TakeBatch();
+  EXPECT_EQ(batch.columns[0].values<int32_t>()[0], 0x1234);
+  EXPECT_DOUBLE_EQ(batch.columns[1].values<double>()[0], 3.141592653589793);
+}
+
+TEST(RecordDecoderTest, DropsWrongSizedAndExcessRecords) {
+  RecordDecoder decoder(ImuSchema(), 1);
+  std::vector<uint8_t> record = ImuRecord(1, 2, 3, 4.0f);
+  decoder.Decode(record.data(), record.size() - 1);
+  decoder.Decode(record.data(), record.size());
+  decoder.Decode(record.data(), record.size());
+  RecordBatch batch = decoder.TakeBatch();
+  EXPECT_EQ(batch.rows, 1u);
+  EXPECT_EQ(batch.dropped, 2u);
+}
+
+TEST(RecordDecoderTest, ValidatesSchemas) {
+  EXPECT_TRUE(IsValidRecordSchema(ImuSchema()));
+  RecordSchema schema = ImuSchema();
+  schema.fields[3].offset = 9;  // f32 would end past byte 12.
+  EXPECT_FALSE(IsValidRecordSchema(schema));
+  EXPECT_FALSE(IsValidRecordSchema(RecordSchema()));
+
+  FieldType type;
+  ASSERT_TRUE(ParseFieldType("i16", &type));
+  EXPECT_EQ(type, FieldType::kI16);
+  EXPECT_FALSE(ParseFieldType("i64", &type));
+}
+
+}  // namespace test
+}  // namespace serial_com
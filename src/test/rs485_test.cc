@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "rs485.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+using Clock = Rs485Stats::Clock;
+
+Clock::time_point At(int64_t us) {
+  return Clock::time_point(std::chrono::microseconds(us));
+}
+
+}  // namespace
+
+TEST(Rs485Test, ParsesModeNames) {
+  Rs485Mode mode;
+  ASSERT_TRUE(ParseRs485Mode("kernel", &mode));
+  EXPECT_EQ(mode, Rs485Mode::kKernel);
+  ASSERT_TRUE(ParseRs485Mode("software", &mode));
+  EXPECT_EQ(mode, Rs485Mode::kSoftware);
+  EXPECT_FALSE(ParseRs485Mode("rts", &mode));
+  EXPECT_STREQ(Rs485ModeName(Rs485Mode::kAuto), "auto");
+}
+
+TEST(Rs485Test, RefusesPseudoTerminals) {
+  PtyPair pty;
+  Rs485Config config;
+  Rs485Mode applied = Rs485Mode::kAuto;
+  // A pty has neither a kernel RS-485 mode nor an RTS line to fall back
+  // on.
+  Status status = EnableRs485(pty.slave(), config, Rs485Mode::kKernel,
+                              &applied);
+  EXPECT_STREQ(status.code(), "CONFIG_ERROR");
+  EXPECT_FALSE(EnableRs485(pty.slave(), config, Rs485Mode::kAuto, &applied)
+                   .ok());
+  EXPECT_EQ(applied, Rs485Mode::kAuto);
+
+  config.delay_after_send_us = -1;
+  EXPECT_FALSE(IsValidRs485Config(config));
+  EXPECT_EQ(EnableRs485(pty.slave(), config, Rs485Mode::kSoftware, &applied)
+                .message(),
+            "RS-485 delays must not be negative");
+}
+
+TEST(Rs485Test, TimesTurnarounds) {
+  Rs485Stats stats;
+  // A reply arriving before anything was sent is not a turnaround.
+  stats.OnReceived(At(50));
+  stats.OnTransmitted(At(1000), At(1200));
+  stats.OnReceived(At(1700));
+  // Only the first arrival after a transmission counts.
+  stats.OnReceived(At(1800));
+  stats.OnTransmitted(At(3000), At(3100));
+  stats.OnReceived(At(3400));
+  // No reply to this one.
+  stats.OnTransmitted(At(5000), At(5400));
+
+  Rs485StatsSnapshot snapshot = stats.Snapshot();
+  EXPECT_EQ(snapshot.transmissions, 3u);
+  EXPECT_EQ(snapshot.replies, 2u);
+  EXPECT_EQ(snapshot.total_release_us, 700u);
+  EXPECT_EQ(snapshot.max_release_us, 400u);
+  EXPECT_EQ(snapshot.total_turnaround_us, 800u);
+  EXPECT_EQ(snapshot.min_turnaround_us, 300u);
+  EXPECT_EQ(snapshot.max_turnaround_us, 500u);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,276 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io_loop.h"
+#include "posix_serial_port.h"
+#include "serial_bridge.h"
+#include "test/pty_pair.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// The bridge's opening telnet negotiation.
+const std::string kGreeting(
+    "\xff\xfb\x00\xff\xfd\x00\xff\xfb\x03\xff\xfd\x03\xff\xfd\x2c", 15);
+
+// A blocking TCP client with a two second receive timeout.
+class TestClient {
+ public:
+  explicit TestClient(int port, int receive_buffer = 0) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (receive_buffer > 0) {
+      setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &receive_buffer,
+                 sizeof receive_buffer);
+    }
+    struct timeval timeout = {2, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connected_ = connect(fd_, reinterpret_cast<struct sockaddr*>(&address),
+                         sizeof address) == 0;
+  }
+
+  ~TestClient() { close(fd_); }
+
+  bool connected() const { return connected_; }
+
+  void Send(const std::string& data) {
+    ASSERT_EQ(send(fd_, data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+  }
+
+  // Reads |length| bytes, or fewer on timeout or hangup.
+  std::string Receive(size_t length) {
+    std::string received;
+    char buffer[65536];
+    while (received.size() < length) {
+      size_t wanted = std::min(sizeof buffer, length - received.size());
+      ssize_t n = recv(fd_, buffer, wanted, 0);
+      if (n <= 0) break;
+      received.append(buffer, n);
+    }
+    return received;
+  }
+
+ private:
+  int fd_;
+  bool connected_;
+};
+
+// Reads |length| bytes from the device side of |pty|.
+std::string ReadDevice(const PtyPair& pty, size_t length) {
+  std::string received;
+  char buffer[256];
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (received.size() < length &&
+         std::chrono::steady_clock::now() < deadline) {
+    struct pollfd pfd = {pty.master(), POLLIN, 0};
+    if (poll(&pfd, 1, 100) <= 0) continue;
+    ssize_t n = read(pty.master(), buffer, sizeof buffer);
+    if (n > 0) received.append(buffer, n);
+  }
+  return received;
+}
+
+class SerialBridgeTest : public ::testing::Test {
+ protected:
+  void Start(BridgeProtocol protocol, size_t client_buffer_limit = 1 << 20) {
+    config_.path = pty_.slave_path();
+    config_.baud_rate = 115200;
+    ASSERT_TRUE(ConfigurePosixPort(pty_.slave(), config_).ok());
+    fanout_ = std::make_shared<ReceiveFanout>();
+    BridgeOptions options;
+    options.protocol = protocol;
+    options.client_buffer_limit = client_buffer_limit;
+    int fd = pty_.slave();
+    Status status = SerialBridge::Start(
+        fd, config_, fanout_,
+        [fd](std::vector<uint8_t> data) {
+          ssize_t ignored = write(fd, data.data(), data.size());
+          (void)ignored;
+        },
+        options, &bridge_);
+    ASSERT_TRUE(status.ok()) << status.message();
+    ASSERT_GT(bridge_->port(), 0);
+  }
+
+  void Publish(const std::string& data) {
+    fanout_->Publish(reinterpret_cast<const uint8_t*>(data.data()),
+                     data.size());
+  }
+
+  // Publishing only reaches clients the bridge has accepted.
+  void WaitForClients(uint32_t clients) {
+    for (int i = 0; i < 200 && bridge_->stats().clients < clients; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ASSERT_EQ(bridge_->stats().clients, clients);
+  }
+
+  PtyPair pty_;
+  PortConfig config_;
+  std::shared_ptr<ReceiveFanout> fanout_;
+  std::unique_ptr<SerialBridge> bridge_;
+};
+
+}  // namespace
+
+TEST(SerialBridge, ParsesProtocols) {
+  BridgeProtocol protocol;
+  ASSERT_TRUE(ParseBridgeProtocol("raw", &protocol));
+  EXPECT_EQ(protocol, BridgeProtocol::kRaw);
+  ASSERT_TRUE(ParseBridgeProtocol("rfc2217", &protocol));
+  EXPECT_EQ(protocol, BridgeProtocol::kRfc2217);
+  EXPECT_FALSE(ParseBridgeProtocol("telnet", &protocol));
+}
+
+TEST(SerialBridge, RejectsBadAddress) {
+  PtyPair pty;
+  BridgeOptions options;
+  options.address = "localhost";
+  std::unique_ptr<SerialBridge> bridge;
+  Status status = SerialBridge::Start(
+      pty.slave(), PortConfig(), std::make_shared<ReceiveFanout>(),
+      [](std::vector<uint8_t>) {}, options, &bridge);
+  EXPECT_STREQ(status.code(), "INVALID_ARGUMENT");
+}
+
+TEST_F(SerialBridgeTest, FansOutToEveryClientAndForwardsWrites) {
+  Start(BridgeProtocol::kRaw);
+  TestClient first(bridge_->port());
+  TestClient second(bridge_->port());
+  ASSERT_TRUE(first.connected());
+  ASSERT_TRUE(second.connected());
+  WaitForClients(2);
+
+  Publish("hello");
+  EXPECT_EQ(first.Receive(5), "hello");
+  EXPECT_EQ(second.Receive(5), "hello");
+
+  first.Send("from first");
+  EXPECT_EQ(ReadDevice(pty_, 10), "from first");
+
+  BridgeStats stats = bridge_->stats();
+  EXPECT_EQ(stats.connections, 2u);
+  EXPECT_EQ(stats.bytes_to_clients, 10u);
+  EXPECT_EQ(stats.bytes_from_clients, 10u);
+}
+
+TEST_F(SerialBridgeTest, IsolatesSlowClients) {
+  Start(BridgeProtocol::kRaw, 64 << 10);
+  TestClient fast(bridge_->port());
+  // Never reads, and can buffer little in the kernel.
+  TestClient slow(bridge_->port(), 4096);
+  WaitForClients(2);
+
+  const std::string chunk(16 << 10, 'x');
+  const int kChunks = 1024;
+  for (int i = 0; i < kChunks; i++) {
+    Publish(chunk);
+    ASSERT_EQ(fast.Receive(chunk.size()).size(), chunk.size()) << i;
+  }
+  BridgeStats stats = bridge_->stats();
+  EXPECT_GT(stats.dropped_bytes, 0u);
+  EXPECT_GE(stats.bytes_to_clients,
+            static_cast<uint64_t>(kChunks) * chunk.size());
+}
+
+TEST_F(SerialBridgeTest, NegotiatesAndEscapesTelnet) {
+  Start(BridgeProtocol::kRfc2217);
+  TestClient client(bridge_->port());
+  EXPECT_EQ(client.Receive(kGreeting.size()), kGreeting);
+  WaitForClients(1);
+
+  // Agreeing to what the bridge asked for needs no answer; refusing an
+  // option it does not support does.
+  client.Send(std::string("\xff\xfb\x2c\xff\xfd\x01", 6));
+  EXPECT_EQ(client.Receive(3), std::string("\xff\xfc\x01", 3));
+
+  Publish(std::string("A\xff" "B", 3));
+  EXPECT_EQ(client.Receive(4), std::string("A\xff\xff" "B", 4));
+
+  client.Send(std::string("1\xff\xff" "2", 4));
+  EXPECT_EQ(ReadDevice(pty_, 3), std::string("1\xff" "2", 3));
+}
+
+TEST_F(SerialBridgeTest, AppliesComPortSettings) {
+  Start(BridgeProtocol::kRfc2217);
+  TestClient client(bridge_->port());
+  ASSERT_EQ(client.Receive(kGreeting.size()), kGreeting);
+
+  // SET-BAUDRATE 9600.
+  client.Send(std::string("\xff\xfa\x2c\x01\x00\x00\x25\x80\xff\xf0", 10));
+  EXPECT_EQ(client.Receive(10),
+            std::string("\xff\xfa\x2c\x65\x00\x00\x25\x80\xff\xf0", 10));
+  struct termios tty;
+  ASSERT_EQ(tcgetattr(pty_.slave(), &tty), 0);
+  EXPECT_EQ(cfgetospeed(&tty), static_cast<speed_t>(B9600));
+
+  // SET-STOPSIZE 2 (a pty ignores parity and data size), then an
+  // unsupported rate, which leaves 9600.
+  client.Send(std::string("\xff\xfa\x2c\x04\x02\xff\xf0", 7));
+  EXPECT_EQ(client.Receive(7), std::string("\xff\xfa\x2c\x68\x02\xff\xf0", 7));
+  client.Send(std::string("\xff\xfa\x2c\x01\x00\x00\x30\x39\xff\xf0", 10));
+  EXPECT_EQ(client.Receive(10),
+            std::string("\xff\xfa\x2c\x65\x00\x00\x25\x80\xff\xf0", 10));
+
+  PortConfig config = bridge_->config();
+  EXPECT_EQ(config.baud_rate, 9600);
+  EXPECT_EQ(config.stop_bits, StopBits::kTwo);
+  EXPECT_EQ(bridge_->stats().control_requests, 3u);
+}
+
+TEST_F(SerialBridgeTest, ServesIoPortReceivedData) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(IoBackendKind::kEpoll);
+  ASSERT_NE(loop, nullptr);
+  auto io = std::make_shared<IoPort>(pty_.slave());
+  ASSERT_TRUE(loop->AddPort(io));
+
+  BridgeOptions options;
+  options.protocol = BridgeProtocol::kRaw;
+  std::unique_ptr<SerialBridge> bridge;
+  config_.path = pty_.slave_path();
+  ASSERT_TRUE(SerialBridge::Start(
+                  pty_.slave(), config_, io->receive_fanout(),
+                  [&loop, io](std::vector<uint8_t> data) {
+                    loop->Write(io, std::move(data), nullptr);
+                  },
+                  options, &bridge)
+                  .ok());
+  TestClient client(bridge->port());
+  for (int i = 0; i < 200 && bridge->stats().clients < 1; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+  ASSERT_EQ(write(pty_.master(), "device", 6), 6);
+  EXPECT_EQ(client.Receive(6), "device");
+  // The bridge does not take the data away from ordinary reads.
+  uint8_t buffer[16];
+  EXPECT_EQ(io->Read(buffer, sizeof buffer), 6u);
+
+  client.Send("remote");
+  EXPECT_EQ(ReadDevice(pty_, 6), "remote");
+
+  bridge.reset();
+  loop->RemovePort(io);
+}
+
+}  // namespace test
+}  // namespace serial_com
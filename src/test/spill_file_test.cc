@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "spill_file.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+class SpillFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char dir[] = "/tmp/spill_file_test_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    dir_ = dir;
+  }
+
+  void TearDown() override { rmdir(dir_.c_str()); }
+
+  std::string dir_;
+};
+
+}  // namespace
+
+TEST_F(SpillFileTest, ReadsBackInOrderAcrossWriteBatches) {
+  std::unique_ptr<SpillFile> spill = SpillFile::Create(dir_);
+  ASSERT_NE(spill, nullptr);
+
+  std::vector<uint8_t> sent(300 * 1024);
+  for (size_t i = 0; i < sent.size(); i++) {
+    sent[i] = static_cast<uint8_t>(i * 7);
+  }
+  for (size_t offset = 0; offset < sent.size(); offset += 1000) {
+    size_t length = std::min<size_t>(1000, sent.size() - offset);
+    spill->Append(sent.data() + offset, length);
+  }
+  EXPECT_EQ(spill->size(), sent.size());
+
+  std::vector<uint8_t> received;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = spill->Read(buffer, sizeof buffer)) > 0) {
+    received.insert(received.end(), buffer, buffer + n);
+  }
+  EXPECT_EQ(received, sent);
+  EXPECT_TRUE(spill->empty());
+  EXPECT_EQ(spill->dropped_bytes(), 0u);
+}
+
+TEST_F(SpillFileTest, InterleavesAppendsAndReads) {
+  std::unique_ptr<SpillFile> spill = SpillFile::Create(dir_);
+  ASSERT_NE(spill, nullptr);
+  spill->Append(reinterpret_cast<const uint8_t*>("abc"), 3);
+  uint8_t buffer[2];
+  ASSERT_EQ(spill->Read(buffer, sizeof buffer), 2u);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(buffer), 2), "ab");
+  spill->Append(reinterpret_cast<const uint8_t*>("de"), 2);
+  EXPECT_EQ(spill->size(), 3u);
+  std::string rest;
+  size_t n;
+  while ((n = spill->Read(buffer, sizeof buffer)) > 0) {
+    rest.append(reinterpret_cast<char*>(buffer), n);
+  }
+  EXPECT_EQ(rest, "cde");
+}
+
+TEST_F(SpillFileTest, LeavesNothingInTheDirectory) {
+  std::unique_ptr<SpillFile> spill = SpillFile::Create(dir_);
+  ASSERT_NE(spill, nullptr);
+  // The directory can only be removed if it is empty.
+  EXPECT_EQ(rmdir(dir_.c_str()), 0);
+  ASSERT_EQ(mkdir(dir_.c_str(), 0700), 0);
+}
+
+TEST_F(SpillFileTest, FailsForMissingDirectory) {
+  EXPECT_EQ(SpillFile::Create(dir_ + "/missing"), nullptr);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "stream_subscribers.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+class StreamSubscribersTest : public ::testing::Test {
+ protected:
+  StreamSubscribersTest()
+      : fanout_(std::make_shared<ReceiveFanout>()),
+        subscribers_(
+            fanout_, [this](int id) { notified_.push_back(id); },
+            [this](bool held) { holds_.push_back(held); }) {}
+
+  int Subscribe(BackpressurePolicy policy, size_t limit) {
+    SubscriberOptions options;
+    options.policy = policy;
+    options.limit = limit;
+    int id = 0;
+    Status status = subscribers_.Subscribe(options, &id);
+    EXPECT_TRUE(status.ok()) << status.message();
+    return id;
+  }
+
+  void Publish(const std::string& data) {
+    fanout_->Publish(reinterpret_cast<const uint8_t*>(data.data()),
+                     data.size());
+  }
+
+  std::string Read(int id, size_t max_length) {
+    std::vector<uint8_t> buffer(max_length);
+    size_t n = subscribers_.Read(id, buffer.data(), max_length);
+    return std::string(buffer.begin(), buffer.begin() + n);
+  }
+
+  std::shared_ptr<ReceiveFanout> fanout_;
+  std::vector<int> notified_;
+  std::vector<bool> holds_;
+  StreamSubscribers subscribers_;
+};
+
+}  // namespace
+
+TEST(StreamSubscribers, ParsesPolicies) {
+  BackpressurePolicy policy;
+  ASSERT_TRUE(ParseBackpressurePolicy("dropOldest", &policy));
+  EXPECT_EQ(policy, BackpressurePolicy::kDropOldest);
+  ASSERT_TRUE(ParseBackpressurePolicy("block", &policy));
+  EXPECT_EQ(policy, BackpressurePolicy::kBlock);
+  ASSERT_TRUE(ParseBackpressurePolicy("spill", &policy));
+  EXPECT_STREQ(BackpressurePolicyName(policy), "spill");
+  EXPECT_FALSE(ParseBackpressurePolicy("wait", &policy));
+}
+
+TEST_F(StreamSubscribersTest, RejectsBadOptions) {
+  SubscriberOptions options;
+  options.limit = 0;
+  int id;
+  EXPECT_STREQ(subscribers_.Subscribe(options, &id).code(),
+               "INVALID_ARGUMENT");
+  options.limit = 16;
+  options.policy = BackpressurePolicy::kSpill;
+  options.spill_directory = "/nonexistent/dir";
+  EXPECT_STREQ(subscribers_.Subscribe(options, &id).code(), "CONFIG_ERROR");
+  EXPECT_TRUE(subscribers_.ids().empty());
+}
+
+TEST_F(StreamSubscribersTest, EverySubscriberReadsEveryByteIndependently) {
+  int first = Subscribe(BackpressurePolicy::kDropOldest, 1024);
+  Publish("early");
+  int second = Subscribe(BackpressurePolicy::kDropOldest, 1024);
+  Publish("late");
+  // Only a subscriber whose backlog was empty is announced.
+  EXPECT_EQ(notified_, std::vector<int>({first, second}));
+
+  EXPECT_EQ(Read(first, 3), "ear");
+  EXPECT_EQ(Read(second, 100), "late");
+  EXPECT_EQ(Read(first, 100), "lylate");
+  EXPECT_EQ(subscribers_.Queued(first), 0u);
+
+  ASSERT_TRUE(subscribers_.Unsubscribe(first));
+  EXPECT_FALSE(subscribers_.Unsubscribe(first));
+  Publish("after");
+  EXPECT_EQ(Read(first, 100), "");
+  EXPECT_EQ(Read(second, 100), "after");
+
+  SubscriberStats stats;
+  ASSERT_TRUE(subscribers_.Stats(second, &stats));
+  EXPECT_EQ(stats.received_bytes, 9u);
+  EXPECT_EQ(stats.read_bytes, 9u);
+  EXPECT_EQ(stats.dropped_bytes, 0u);
+}
+
+TEST_F(StreamSubscribersTest, DropOldestOnlyCostsTheSlowSubscriber) {
+  int slow = Subscribe(BackpressurePolicy::kDropOldest, 4);
+  int fast = Subscribe(BackpressurePolicy::kDropOldest, 1024);
+  Publish("0123");
+  Publish("4567");
+  EXPECT_EQ(Read(slow, 100), "4567");
+  EXPECT_EQ(Read(fast, 100), "01234567");
+
+  SubscriberStats stats;
+  ASSERT_TRUE(subscribers_.Stats(slow, &stats));
+  EXPECT_EQ(stats.dropped_bytes, 4u);
+  EXPECT_TRUE(holds_.empty());
+}
+
+TEST_F(StreamSubscribersTest, SpillsPastTheLimitAndReadsBackInOrder) {
+  int id = Subscribe(BackpressurePolicy::kSpill, 8);
+  std::string sent;
+  for (int i = 0; i < 10; i++) {
+    std::string piece = "chunk" + std::to_string(i) + ";";
+    Publish(piece);
+    sent += piece;
+  }
+  EXPECT_EQ(subscribers_.Queued(id), sent.size());
+
+  // Reads interleaved with arrivals still come out in order.
+  std::string received = Read(id, 5);
+  Publish("tail");
+  sent += "tail";
+  std::string piece;
+  while (!(piece = Read(id, 5)).empty()) received += piece;
+  EXPECT_EQ(received, sent);
+
+  SubscriberStats stats;
+  ASSERT_TRUE(subscribers_.Stats(id, &stats));
+  EXPECT_EQ(stats.spilled_bytes, sent.size() - 7);
+  EXPECT_EQ(stats.queued_bytes, 0u);
+  EXPECT_EQ(stats.dropped_bytes, 0u);
+}
+
+TEST_F(StreamSubscribersTest, BlockHoldsThePortUntilHalfDrained) {
+  int first = Subscribe(BackpressurePolicy::kBlock, 8);
+  int second = Subscribe(BackpressurePolicy::kBlock, 8);
+  Publish("01234");
+  EXPECT_TRUE(holds_.empty());
+  Publish("56789");
+  // Both are full, but the port is only held once, and nothing is lost.
+  EXPECT_EQ(holds_, std::vector<bool>({true}));
+  SubscriberStats stats;
+  ASSERT_TRUE(subscribers_.Stats(first, &stats));
+  EXPECT_TRUE(stats.holding);
+  EXPECT_EQ(stats.queued_bytes, 10u);
+
+  EXPECT_EQ(Read(first, 6), "012345");
+  EXPECT_EQ(holds_.size(), 1u);
+  EXPECT_EQ(Read(second, 2), "01");
+  EXPECT_EQ(holds_.size(), 1u);
+  // Dropping the last holder releases the port too.
+  ASSERT_TRUE(subscribers_.Unsubscribe(second));
+  EXPECT_EQ(holds_, std::vector<bool>({true, false}));
+  EXPECT_EQ(Read(first, 100), "6789");
+}
+
+}  // namespace test
+}  // namespace serial_com
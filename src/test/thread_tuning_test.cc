@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstring>
+#include <thread>
+
+#include "io_loop.h"
+#include "thread_tuning.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+// Runs |body| on a fresh thread, so tuning does not leak into other tests.
+template <typename Body>
+void OnNewThread(Body body) {
+  std::thread thread(body);
+  thread.join();
+}
+
+}  // namespace
+
+TEST(ThreadTuningTest, RejectsUnknownCpusAndPriorities) {
+  ThreadTuning tuning;
+  tuning.cpus = {-1};
+  EXPECT_STREQ(ValidateThreadTuning(tuning).code(), "INVALID_ARGUMENT");
+  tuning.cpus = {CPU_SETSIZE};
+  EXPECT_STREQ(ApplyThreadTuning(tuning, ThreadCpus()).code(),
+               "INVALID_ARGUMENT");
+
+  tuning.cpus.clear();
+  tuning.realtime_priority = 1000;
+  EXPECT_STREQ(ValidateThreadTuning(tuning).code(), "INVALID_ARGUMENT");
+  tuning.realtime_priority = 0;
+  EXPECT_TRUE(ValidateThreadTuning(tuning).ok());
+}
+
+TEST(ThreadTuningTest, PinsTheCallingThread) {
+  OnNewThread([]() {
+    ThreadTuning tuning;
+    tuning.cpus = {0};
+    Status status = ApplyThreadTuning(tuning, ThreadCpus());
+    // CPU 0 may be outside a restricted cpuset.
+    if (!status.ok()) {
+      EXPECT_STREQ(status.code(), "PERMISSION_ERROR");
+      return;
+    }
+    cpu_set_t cpus;
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof cpus, &cpus), 0);
+    EXPECT_EQ(CPU_COUNT(&cpus), 1);
+    EXPECT_TRUE(CPU_ISSET(0, &cpus));
+  });
+}
+
+TEST(ThreadTuningTest, EmptyCpuListUnpinsTheThread) {
+  OnNewThread([]() {
+    cpu_set_t startup = ThreadCpus();
+    ThreadTuning tuning;
+    tuning.cpus = {0};
+    Status status = ApplyThreadTuning(tuning, startup);
+    if (!status.ok()) {
+      EXPECT_STREQ(status.code(), "PERMISSION_ERROR");
+      return;
+    }
+    tuning.cpus.clear();
+    ASSERT_TRUE(ApplyThreadTuning(tuning, startup).ok());
+    cpu_set_t cpus;
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof cpus, &cpus), 0);
+    EXPECT_TRUE(CPU_EQUAL(&cpus, &startup));
+  });
+}
+
+TEST(ThreadTuningTest, KeepsTheAffinityWhenSchedulingFails) {
+  OnNewThread([]() {
+    cpu_set_t startup = ThreadCpus();
+    ThreadTuning tuning;
+    tuning.cpus = {0};
+    tuning.realtime_priority = sched_get_priority_max(SCHED_FIFO);
+    Status status = ApplyThreadTuning(tuning, startup);
+    if (status.ok()) return;  // Allowed real-time scheduling.
+    cpu_set_t cpus;
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof cpus, &cpus), 0);
+    EXPECT_TRUE(CPU_EQUAL(&cpus, &startup));
+  });
+}
+
+TEST(ThreadTuningTest, RunsFifoOrReportsPermission) {
+  OnNewThread([]() {
+    ThreadTuning tuning;
+    tuning.realtime_priority = 10;
+    Status status = ApplyThreadTuning(tuning, ThreadCpus());
+    if (!status.ok()) {
+      EXPECT_STREQ(status.code(), "PERMISSION_ERROR");
+      EXPECT_NE(strstr(status.message().c_str(), "RLIMIT_RTPRIO"), nullptr);
+      return;
+    }
+    int policy;
+    struct sched_param param;
+    ASSERT_EQ(pthread_getschedparam(pthread_self(), &policy, &param), 0);
+    EXPECT_EQ(policy, SCHED_FIFO);
+    EXPECT_EQ(param.sched_priority, 10);
+
+    // Priority 0 goes back to time sharing.
+    tuning.realtime_priority = 0;
+    ASSERT_TRUE(ApplyThreadTuning(tuning, ThreadCpus()).ok());
+    ASSERT_EQ(pthread_getschedparam(pthread_self(), &policy, &param), 0);
+    EXPECT_EQ(policy, SCHED_OTHER);
+  });
+}
+
+TEST(ThreadTuningTest, TunesTheIoLoopThread) {
+  std::unique_ptr<IoLoop> loop = IoLoop::Create(IoBackendKind::kEpoll);
+  ASSERT_NE(loop, nullptr);
+  ThreadTuning tuning;
+  tuning.cpus = {0};
+  Status status = loop->Tune(tuning);
+  EXPECT_TRUE(status.ok() || strcmp(status.code(), "PERMISSION_ERROR") == 0)
+      << status.message();
+  tuning.cpus.clear();
+  EXPECT_TRUE(loop->Tune(tuning).ok());
+  tuning.cpus = {-1};
+  EXPECT_STREQ(loop->Tune(tuning).code(), "INVALID_ARGUMENT");
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace_buffer.h"
+
+namespace serial_com {
+namespace test {
+
+TEST(TraceBufferTest, RecordsOnlyWhileStarted) {
+  TraceBuffer trace(16);
+  EXPECT_EQ(trace.NewChunk(), 0u);
+  trace.Record(TraceStage::kRead, 3, 1, 10);
+  EXPECT_TRUE(trace.Events().empty());
+
+  trace.Start();
+  uint64_t chunk = trace.NewChunk();
+  ASSERT_NE(chunk, 0u);
+  trace.Record(TraceStage::kRead, 3, chunk, 10);
+  trace.Record(TraceStage::kBuffered, 3, chunk, 10);
+  trace.Stop();
+  trace.Record(TraceStage::kEncoded, 3, chunk, 10);
+
+  std::vector<TraceEvent> events = trace.Events();
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[0].stage, TraceStage::kRead);
+  EXPECT_EQ(events[0].port, 3);
+  EXPECT_EQ(events[0].bytes, 10u);
+  EXPECT_EQ(events[1].stage, TraceStage::kBuffered);
+  EXPECT_LE(events[0].timestamp_ns, events[1].timestamp_ns);
+
+  // Starting again discards the previous session.
+  trace.Start();
+  EXPECT_TRUE(trace.Events().empty());
+}
+
+TEST(TraceBufferTest, KeepsNewestEventsWhenFull) {
+  TraceBuffer trace(4);
+  trace.Start();
+  for (uint64_t chunk = 1; chunk <= 10; chunk++) {
+    trace.Record(TraceStage::kRead, 0, chunk, 1);
+  }
+  std::vector<TraceEvent> events = trace.Events();
+  ASSERT_EQ(events.size(), 4u);
+  EXPECT_EQ(events.front().chunk, 7u);
+  EXPECT_EQ(events.back().chunk, 10u);
+}
+
+TEST(TraceBufferTest, AcceptsConcurrentWriters) {
+  TraceBuffer trace(1 << 16);
+  trace.Start();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&trace, t]() {
+      for (int i = 0; i < 1000; i++) {
+        trace.Record(TraceStage::kWriteQueued, t, trace.NewChunk(), i);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(trace.Events().size(), 4000u);
+}
+
+TEST(TraceBufferTest, ExportsStageGapsAsCompleteEvents) {
+  TraceBuffer trace(16);
+  trace.Start();
+  uint64_t chunk = trace.NewChunk();
+  trace.Record(TraceStage::kWriteQueued, 5, chunk, 4);
+  trace.Record(TraceStage::kWriteStarted, 5, chunk, 4);
+  trace.Record(TraceStage::kWriteDone, 5, chunk, 4);
+
+  std::string json = trace.ToChromeTraceJson();
+  EXPECT_NE(json.find("\"name\":\"port 5 tx\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"write_queued -> write_started\""),
+            std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"write_started -> write_done\""),
+            std::string::npos);
+  EXPECT_NE(json.find("\"ph\":\"X\""), std::string::npos);
+  EXPECT_EQ(json.find("write_done -> "), std::string::npos);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "test/pty_pair.h"
+#include "transmit_pacer.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Reads |count| bytes from the device side, noting when each one arrived.
+std::vector<Clock::time_point> ReadArrivals(int fd, size_t count) {
+  std::vector<Clock::time_point> arrivals;
+  while (arrivals.size() < count) {
+    struct pollfd readable = {fd, POLLIN, 0};
+    if (poll(&readable, 1, 5000) != 1) break;
+    uint8_t buffer[256];
+    ssize_t n = read(fd, buffer, sizeof buffer);
+    if (n <= 0) break;
+    Clock::time_point now = Clock::now();
+    for (ssize_t i = 0; i < n; i++) arrivals.push_back(now);
+  }
+  return arrivals;
+}
+
+int64_t Micros(Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+}  // namespace
+
+TEST(TransmitPacerTest, SpacesCharactersByInterByteGap) {
+  PtyPair pty;
+  PortStats stats;
+  PacingConfig config;
+  config.inter_byte_gap_us = 2000;
+  TransmitPacer pacer(pty.slave(), config, &stats);
+
+  std::promise<int64_t> done;
+  pacer.Write(std::vector<uint8_t>(10, 'x'),
+              [&done](int64_t result) { done.set_value(result); });
+  std::vector<Clock::time_point> arrivals = ReadArrivals(pty.master(), 10);
+  ASSERT_EQ(arrivals.size(), 10u);
+  EXPECT_EQ(done.get_future().get(), 10);
+
+  // Individual spacings are at the mercy of when this thread wakes up, so
+  // only check the span, with some room for a late first wakeup.
+  EXPECT_GE(Micros(arrivals.back() - arrivals.front()), 9 * 2000 - 1000);
+  EXPECT_EQ(stats.Snapshot().write_calls, 10u);
+}
+
+TEST(TransmitPacerTest, SeparatesWritesByInterFrameGap) {
+  PtyPair pty;
+  PortStats stats;
+  PacingConfig config;
+  config.inter_frame_gap_us = 20000;
+  TransmitPacer pacer(pty.slave(), config, &stats);
+
+  std::promise<int64_t> done;
+  pacer.Write({'a', 'b'}, nullptr);
+  pacer.Write({'c', 'd'},
+              [&done](int64_t result) { done.set_value(result); });
+  std::vector<Clock::time_point> arrivals = ReadArrivals(pty.master(), 4);
+  ASSERT_EQ(arrivals.size(), 4u);
+  EXPECT_EQ(done.get_future().get(), 2);
+  EXPECT_GE(Micros(arrivals[2] - arrivals[1]), 20000 - 1000);
+  // Bytes within a frame are not spaced out.
+  EXPECT_EQ(stats.Snapshot().write_calls, 2u);
+}
+
+TEST(TransmitPacerTest, CapsAverageRate) {
+  PtyPair pty;
+  PortStats stats;
+  PacingConfig config;
+  config.max_bytes_per_second = 10000;
+  TransmitPacer pacer(pty.slave(), config, &stats);
+
+  std::promise<int64_t> done;
+  Clock::time_point start = Clock::now();
+  pacer.Write(std::vector<uint8_t>(1000, 'x'),
+              [&done](int64_t result) { done.set_value(result); });
+  ASSERT_EQ(ReadArrivals(pty.master(), 1000).size(), 1000u);
+  EXPECT_EQ(done.get_future().get(), 1000);
+  // The first chunk goes out immediately; the other 950 bytes take 95 ms.
+  EXPECT_GE(Micros(Clock::now() - start), 95000);
+}
+
+TEST(TransmitPacerTest, HoldsWritesUntilReleased) {
+  PtyPair pty;
+  PortStats stats;
+  TransmitPacer pacer(pty.slave(), PacingConfig(), &stats);
+  pacer.Hold();
+  pacer.Hold();
+
+  std::promise<int64_t> done;
+  pacer.Write({'a', 'b'},
+              [&done](int64_t result) { done.set_value(result); });
+  std::future<int64_t> result = done.get_future();
+  pacer.Release();
+  EXPECT_EQ(result.wait_for(std::chrono::milliseconds(50)),
+            std::future_status::timeout);
+  struct pollfd readable = {pty.master(), POLLIN, 0};
+  EXPECT_EQ(poll(&readable, 1, 0), 0);
+
+  pacer.Release();
+  EXPECT_EQ(result.get(), 2);
+  EXPECT_EQ(ReadArrivals(pty.master(), 2).size(), 2u);
+}
+
+TEST(TransmitPacerTest, CancelsQueuedWritesOnDestruction) {
+  PtyPair pty;
+  PortStats stats;
+  PacingConfig config;
+  config.max_bytes_per_second = 100;
+  std::vector<int64_t> results;
+  {
+    TransmitPacer pacer(pty.slave(), config, &stats);
+    for (int i = 0; i < 2; i++) {
+      pacer.Write(std::vector<uint8_t>(100, 'x'),
+                  [&results](int64_t result) { results.push_back(result); });
+    }
+  }
+  EXPECT_EQ(results, std::vector<int64_t>(2, -ECANCELED));
+}
+
+TEST(TransmitPacerTest, TurnsHalfDuplexLineAroundEachWrite) {
+  PtyPair pty;
+  PortStats stats;
+  struct Switch {
+    bool transmit;
+    Clock::time_point when;
+    // Bytes waiting on the device side when the line was switched.
+    int queued;
+  };
+  std::mutex mutex;
+  std::vector<Switch> switches;
+  HalfDuplexConfig half_duplex;
+  half_duplex.enabled = true;
+  const int master = pty.master();
+  half_duplex.set_direction = [&mutex, &switches, master](bool transmit) {
+    int queued = 0;
+    ioctl(master, FIONREAD, &queued);
+    std::lock_guard<std::mutex> lock(mutex);
+    switches.push_back(Switch{transmit, Clock::now(), queued});
+    return Status::Ok();
+  };
+  half_duplex.delay_before_send_us = 2000;
+  half_duplex.delay_after_send_us = 5000;
+  half_duplex.stats = std::make_shared<Rs485Stats>();
+  std::shared_ptr<Rs485Stats> rs485 = half_duplex.stats;
+  TransmitPacer pacer(pty.slave(), PacingConfig(), &stats);
+  pacer.SetHalfDuplex(half_duplex);
+
+  std::promise<int64_t> done;
+  pacer.Write({'a', 'b', 'c'}, nullptr);
+  // Barriers do not touch the line.
+  pacer.Write({}, nullptr);
+  pacer.Write({'d'}, [&done](int64_t result) { done.set_value(result); });
+  EXPECT_EQ(done.get_future().get(), 1);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(switches.size(), 4u);
+  EXPECT_TRUE(switches[0].transmit);
+  EXPECT_EQ(switches[0].queued, 0);
+  EXPECT_FALSE(switches[1].transmit);
+  // Released only once every byte was out, and the after-send delay over.
+  EXPECT_EQ(switches[1].queued, 3);
+  EXPECT_GE(Micros(switches[1].when - switches[0].when), 2000 + 5000);
+  EXPECT_TRUE(switches[2].transmit);
+  EXPECT_FALSE(switches[3].transmit);
+  EXPECT_EQ(switches[3].queued, 4);
+
+  Rs485StatsSnapshot snapshot = rs485->Snapshot();
+  EXPECT_EQ(snapshot.transmissions, 2u);
+  EXPECT_GE(snapshot.max_release_us, 5000u);
+}
+
+TEST(TransmitPacerTest, RejectsNegativeGaps) {
+  PacingConfig config;
+  EXPECT_TRUE(IsValidPacingConfig(config));
+  EXPECT_FALSE(config.enabled());
+  config.inter_byte_gap_us = -1;
+  EXPECT_FALSE(IsValidPacingConfig(config));
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,413 @@
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "crc16.h"
+#include "mapped_file.h"
+#include "upload_engine.h"
+
+namespace serial_com {
+namespace test {
+
+namespace {
+
+constexpr uint8_t kSoh = 0x01;
+constexpr uint8_t kStx = 0x02;
+constexpr uint8_t kEot = 0x04;
+constexpr uint8_t kAck = 0x06;
+constexpr uint8_t kNak = 0x15;
+constexpr uint8_t kCan = 0x18;
+
+// Writes |contents| to a temporary file that is removed on destruction.
+class TempFile {
+ public:
+  explicit TempFile(const std::vector<uint8_t>& contents) {
+    char path[] = "/tmp/serial_com_upload_XXXXXX";
+    int fd = mkstemp(path);
+    path_ = path;
+    if (!contents.empty()) {
+      EXPECT_EQ(write(fd, contents.data(), contents.size()),
+                static_cast<ssize_t>(contents.size()));
+    }
+    close(fd);
+  }
+  ~TempFile() { unlink(path_.c_str()); }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+std::vector<uint8_t> Image(size_t size) {
+  std::vector<uint8_t> image(size);
+  for (size_t i = 0; i < size; i++) image[i] = static_cast<uint8_t>(i * 7);
+  return image;
+}
+
+// A scripted XMODEM/YMODEM receiver. It sees whatever the engine sends and
+// answers through the engine's OnReceived(), on the engine's thread.
+class Receiver {
+ public:
+  // Start request: 'C', 'G' or NAK.
+  explicit Receiver(uint8_t start) : start_(start) {}
+
+  void Attach(UploadEngine* engine) {
+    engine_ = engine;
+    Reply(start_);
+  }
+
+  void OnSent(const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sent_.insert(sent_.end(), data.begin(), data.end());
+    pending_.insert(pending_.end(), data.begin(), data.end());
+    Parse();
+  }
+
+  // Responses to override, by block number (after the first NAK only).
+  int nak_block = -1;
+  bool nak_first_eot = false;
+  int cancel_block = -1;
+
+  std::vector<uint8_t> data;
+  std::string header;
+  std::vector<size_t> block_sizes;
+  int eots = 0;
+  bool batch_ended = false;
+  bool checksum_ok = true;
+
+  std::vector<uint8_t> sent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sent_;
+  }
+
+ private:
+  void Reply(uint8_t byte) { engine_->OnReceived(&byte, 1); }
+
+  void Parse() {
+    while (!pending_.empty()) {
+      uint8_t type = pending_[0];
+      if (type == kEot) {
+        pending_.erase(pending_.begin());
+        eots++;
+        if (nak_first_eot && eots == 1) {
+          Reply(kNak);
+        } else {
+          Reply(kAck);
+          // YMODEM asks for the next file, which is the empty header.
+          if (header_seen_) Reply(start_);
+        }
+        continue;
+      }
+      if (type == kCan) {
+        pending_.erase(pending_.begin());
+        continue;
+      }
+      size_t size = type == kStx ? 1024 : 128;
+      size_t trailer = start_ == kNak ? 1 : 2;
+      if (pending_.size() < 3 + size + trailer) return;
+      std::vector<uint8_t> block(pending_.begin(),
+                                 pending_.begin() + 3 + size + trailer);
+      pending_.erase(pending_.begin(), pending_.begin() + block.size());
+      Handle(block, size, trailer);
+    }
+  }
+
+  void Handle(const std::vector<uint8_t>& block, size_t size,
+              size_t trailer) {
+    uint8_t number = block[1];
+    EXPECT_EQ(static_cast<uint8_t>(~number), block[2]);
+    const uint8_t* payload = block.data() + 3;
+    if (trailer == 2) {
+      uint16_t crc = Crc16Xmodem(payload, size);
+      checksum_ok &= block[3 + size] == (crc >> 8) &&
+                     block[4 + size] == (crc & 0xFF);
+    } else {
+      uint8_t sum = 0;
+      for (size_t i = 0; i < size; i++) sum += payload[i];
+      checksum_ok &= block[3 + size] == sum;
+    }
+    if (number == cancel_block) {
+      Reply(kCan);
+      Reply(kCan);
+      return;
+    }
+    if (number == nak_block) {
+      nak_block = -1;
+      Reply(kNak);
+      return;
+    }
+    const bool streaming = start_ == 'G';
+    if (number == 0 && !header_seen_) {
+      header_seen_ = true;
+      header.assign(reinterpret_cast<const char*>(payload), size);
+      if (!streaming) Reply(kAck);
+      Reply(start_);
+      return;
+    }
+    if (number == 0) {
+      batch_ended = payload[0] == 0;
+      if (!streaming) Reply(kAck);
+      return;
+    }
+    block_sizes.push_back(size);
+    data.insert(data.end(), payload, payload + size);
+    if (!streaming) Reply(kAck);
+  }
+
+  const uint8_t start_;
+  UploadEngine* engine_ = nullptr;
+  bool header_seen_ = false;
+
+  std::mutex mutex_;
+  std::vector<uint8_t> sent_;
+  std::vector<uint8_t> pending_;
+};
+
+struct Result {
+  UploadStatus status;
+  UploadProgress progress;
+};
+
+// Uploads |image| to |receiver| and returns how it ended.
+Result Upload(const std::vector<uint8_t>& image, const UploadOptions& options,
+              Receiver* receiver, bool attach = true,
+              std::vector<UploadProgress>* progress_reports = nullptr) {
+  TempFile file(image);
+  std::unique_ptr<MappedFile> mapped = MappedFile::Open(file.path());
+  EXPECT_NE(mapped, nullptr);
+  std::promise<Result> finished;
+  UploadEngine engine(
+      std::move(mapped), options,
+      [receiver](std::vector<uint8_t> data, UploadEngine::WriteDone done) {
+        receiver->OnSent(data);
+        done(static_cast<int64_t>(data.size()));
+      },
+      [progress_reports](const UploadProgress& progress) {
+        if (progress_reports != nullptr) progress_reports->push_back(progress);
+      },
+      [&finished](UploadStatus status, const UploadProgress& progress) {
+        finished.set_value(Result{status, progress});
+      });
+  if (attach) receiver->Attach(&engine);
+  engine.Start();
+  std::future<Result> result = finished.get_future();
+  EXPECT_EQ(result.wait_for(std::chrono::seconds(10)),
+            std::future_status::ready);
+  return result.get();
+}
+
+}  // namespace
+
+TEST(UploadEngineTest, ComputesXmodemCrc) {
+  const std::string check = "123456789";
+  EXPECT_EQ(Crc16Xmodem(reinterpret_cast<const uint8_t*>(check.data()),
+                        check.size()),
+            0x31C3);
+}
+
+TEST(UploadEngineTest, ParsesNames) {
+  UploadProtocol protocol;
+  EXPECT_TRUE(ParseUploadProtocol("ymodem", &protocol));
+  EXPECT_EQ(protocol, UploadProtocol::kYmodem);
+  EXPECT_TRUE(ParseUploadProtocol("xmodem1k", &protocol));
+  EXPECT_EQ(protocol, UploadProtocol::kXmodem1k);
+  EXPECT_FALSE(ParseUploadProtocol("zmodem", &protocol));
+  EXPECT_STREQ(UploadProtocolName(UploadProtocol::kYmodem), "ymodem");
+  EXPECT_STREQ(UploadStatusName(UploadStatus::kRetriesExhausted),
+               "retriesExhausted");
+}
+
+TEST(UploadEngineTest, Xmodem1kTransfersImage) {
+  std::vector<uint8_t> image = Image(2148);
+  Receiver receiver('C');
+  std::vector<UploadProgress> reports;
+  Result result = Upload(image, UploadOptions(), &receiver, true, &reports);
+
+  EXPECT_EQ(result.status, UploadStatus::kOk);
+  EXPECT_TRUE(receiver.checksum_ok);
+  // Two long blocks, and a short one for the 100-byte tail.
+  EXPECT_EQ(receiver.block_sizes, (std::vector<size_t>{1024, 1024, 128}));
+  ASSERT_EQ(receiver.data.size(), 2176u);
+  EXPECT_TRUE(std::equal(image.begin(), image.end(), receiver.data.begin()));
+  for (size_t i = image.size(); i < receiver.data.size(); i++) {
+    EXPECT_EQ(receiver.data[i], 0x1A);
+  }
+  EXPECT_EQ(receiver.eots, 1);
+  EXPECT_EQ(result.progress.bytes_sent, 2148u);
+  EXPECT_EQ(result.progress.total_bytes, 2148u);
+  EXPECT_EQ(result.progress.blocks_sent, 3u);
+  EXPECT_EQ(result.progress.retransmits, 0u);
+  ASSERT_EQ(reports.size(), 3u);
+  EXPECT_EQ(reports[0].bytes_sent, 1024u);
+}
+
+TEST(UploadEngineTest, ResendsRejectedBlocksAndEot) {
+  std::vector<uint8_t> image = Image(3000);
+  Receiver receiver('C');
+  receiver.nak_block = 2;
+  receiver.nak_first_eot = true;
+  Result result = Upload(image, UploadOptions(), &receiver);
+
+  EXPECT_EQ(result.status, UploadStatus::kOk);
+  EXPECT_EQ(result.progress.retransmits, 1u);
+  EXPECT_EQ(receiver.eots, 2);
+  EXPECT_EQ(receiver.block_sizes.size(), 3u);
+  EXPECT_TRUE(std::equal(image.begin(), image.end(), receiver.data.begin()));
+}
+
+TEST(UploadEngineTest, FallsBackToClassicXmodem) {
+  std::vector<uint8_t> image = Image(300);
+  Receiver receiver(kNak);
+  Result result = Upload(image, UploadOptions(), &receiver);
+
+  EXPECT_EQ(result.status, UploadStatus::kOk);
+  EXPECT_TRUE(receiver.checksum_ok);
+  EXPECT_EQ(receiver.block_sizes, (std::vector<size_t>{128, 128, 128}));
+  EXPECT_TRUE(std::equal(image.begin(), image.end(), receiver.data.begin()));
+}
+
+TEST(UploadEngineTest, YmodemSendsHeaderAndEndsBatch) {
+  std::vector<uint8_t> image = Image(5000);
+  Receiver receiver('C');
+  UploadOptions options;
+  options.protocol = UploadProtocol::kYmodem;
+  options.file_name = "fw.bin";
+  Result result = Upload(image, options, &receiver);
+
+  EXPECT_EQ(result.status, UploadStatus::kOk);
+  EXPECT_TRUE(receiver.checksum_ok);
+  EXPECT_EQ(receiver.header.substr(0, 12), std::string("fw.bin\0005000\0", 12));
+  EXPECT_TRUE(receiver.batch_ended);
+  EXPECT_TRUE(std::equal(image.begin(), image.end(), receiver.data.begin()));
+}
+
+TEST(UploadEngineTest, YmodemGStreamsWithoutAcks) {
+  std::vector<uint8_t> image = Image(20000);
+  Receiver receiver('G');
+  UploadOptions options;
+  options.protocol = UploadProtocol::kYmodem;
+  options.file_name = "fw.bin";
+  // Any wait for a block acknowledgement would time out.
+  options.response_timeout_ms = 100;
+  options.max_retries = 1;
+  Result result = Upload(image, options, &receiver);
+
+  EXPECT_EQ(result.status, UploadStatus::kOk);
+  EXPECT_EQ(result.progress.retransmits, 0u);
+  EXPECT_TRUE(receiver.batch_ended);
+  EXPECT_TRUE(std::equal(image.begin(), image.end(), receiver.data.begin()));
+}
+
+TEST(UploadEngineTest, ReportsReceiverCancel) {
+  Receiver receiver('C');
+  receiver.cancel_block = 2;
+  Result result = Upload(Image(4096), UploadOptions(), &receiver);
+  EXPECT_EQ(result.status, UploadStatus::kCancelled);
+  EXPECT_EQ(result.progress.bytes_sent, 1024u);
+}
+
+TEST(UploadEngineTest, GivesUpOnSilentReceiver) {
+  Receiver receiver('C');
+  UploadOptions options;
+  options.start_timeout_ms = 50;
+  Result result = Upload(Image(10), options, &receiver, false);
+  EXPECT_EQ(result.status, UploadStatus::kTimeout);
+}
+
+TEST(UploadEngineTest, AbortCancelsOnTheWire) {
+  TempFile file(Image(10));
+  Receiver receiver('C');
+  std::promise<UploadStatus> finished;
+  {
+    UploadEngine engine(
+        MappedFile::Open(file.path()), UploadOptions(),
+        [&receiver](std::vector<uint8_t> data, UploadEngine::WriteDone done) {
+          receiver.OnSent(data);
+          done(static_cast<int64_t>(data.size()));
+        },
+        nullptr,
+        [&finished](UploadStatus status, const UploadProgress&) {
+          finished.set_value(status);
+        });
+    engine.Start();
+  }
+  EXPECT_EQ(finished.get_future().get(), UploadStatus::kAborted);
+  EXPECT_EQ(receiver.sent(), std::vector<uint8_t>(3, kCan));
+}
+
+TEST(UploadEngineTest, DestructionDoesNotWaitForStuckWrites) {
+  TempFile file(Image(10));
+  std::promise<UploadStatus> finished;
+  std::vector<UploadEngine::WriteDone> stuck;
+  std::promise<void> first_write;
+  std::chrono::steady_clock::time_point start;
+  {
+    // Writes never complete, as with output held back by flow control.
+    UploadEngine engine(
+        MappedFile::Open(file.path()), UploadOptions(),
+        [&stuck, &first_write](std::vector<uint8_t>,
+                               UploadEngine::WriteDone done) {
+          if (stuck.empty()) first_write.set_value();
+          stuck.push_back(std::move(done));
+        },
+        nullptr,
+        [&finished](UploadStatus status, const UploadProgress&) {
+          finished.set_value(status);
+        });
+    engine.Start();
+    uint8_t request = 'C';
+    engine.OnReceived(&request, 1);
+    first_write.get_future().wait();
+    start = std::chrono::steady_clock::now();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(1));
+  EXPECT_EQ(finished.get_future().get(), UploadStatus::kAborted);
+}
+
+TEST(UploadEngineTest, ReportsWriteErrors) {
+  TempFile file(Image(10));
+  std::promise<UploadStatus> finished;
+  UploadEngine engine(
+      MappedFile::Open(file.path()), UploadOptions(),
+      [](std::vector<uint8_t>, UploadEngine::WriteDone done) { done(-EIO); },
+      nullptr, [&finished](UploadStatus status, const UploadProgress&) {
+        finished.set_value(status);
+      });
+  engine.Start();
+  uint8_t start = 'C';
+  engine.OnReceived(&start, 1);
+  EXPECT_EQ(finished.get_future().get(), UploadStatus::kWriteError);
+}
+
+TEST(MappedFileTest, MapsFiles) {
+  std::vector<uint8_t> image = Image(100);
+  TempFile file(image);
+  std::unique_ptr<MappedFile> mapped = MappedFile::Open(file.path());
+  ASSERT_NE(mapped, nullptr);
+  ASSERT_EQ(mapped->size(), 100u);
+  EXPECT_TRUE(std::equal(image.begin(), image.end(), mapped->data()));
+
+  TempFile empty(std::vector<uint8_t>{});
+  mapped = MappedFile::Open(empty.path());
+  ASSERT_NE(mapped, nullptr);
+  EXPECT_EQ(mapped->size(), 0u);
+
+  EXPECT_EQ(MappedFile::Open("/nonexistent/image.bin"), nullptr);
+  EXPECT_EQ(MappedFile::Open("/tmp"), nullptr);
+}
+
+}  // namespace test
+}  // namespace serial_com
@@ -0,0 +1,100 @@
+#include "thread_tuning.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+namespace serial_com {
+
+namespace {
+
+// PERMISSION_ERROR naming what is missing if |denied|, CONFIG_ERROR
+// otherwise.
+Status TuningError(int error, bool denied, const char* what,
+                   const char* needs) {
+  std::string message = std::string(what) + " failed: " + strerror(error);
+  if (!denied) return Status::Error("CONFIG_ERROR", message);
+  return Status::Error("PERMISSION_ERROR",
+                       message + " (needs " + needs + ")");
+}
+
+}  // namespace
+
+Status ValidateThreadTuning(const ThreadTuning& tuning) {
+  long online = sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu : tuning.cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE || (online > 0 && cpu >= online)) {
+      return Status::Error("INVALID_ARGUMENT",
+                           "No such CPU: " + std::to_string(cpu));
+    }
+  }
+  if (tuning.realtime_priority != 0 &&
+      (tuning.realtime_priority < sched_get_priority_min(SCHED_FIFO) ||
+       tuning.realtime_priority > sched_get_priority_max(SCHED_FIFO))) {
+    return Status::Error(
+        "INVALID_ARGUMENT",
+        "Unsupported SCHED_FIFO priority: " +
+            std::to_string(tuning.realtime_priority));
+  }
+  return Status::Ok();
+}
+
+cpu_set_t ThreadCpus() {
+  cpu_set_t cpus;
+  if (pthread_getaffinity_np(pthread_self(), sizeof cpus, &cpus) != 0) {
+    CPU_ZERO(&cpus);
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu = 0; cpu < configured && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  return cpus;
+}
+
+Status ApplyThreadTuning(const ThreadTuning& tuning,
+                         const cpu_set_t& startup_cpus) {
+  Status status = ValidateThreadTuning(tuning);
+  if (!status.ok()) return status;
+
+  cpu_set_t previous = ThreadCpus();
+  cpu_set_t cpus = startup_cpus;
+  if (!tuning.cpus.empty()) {
+    CPU_ZERO(&cpus);
+    for (int cpu : tuning.cpus) CPU_SET(cpu, &cpus);
+  }
+  int error = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+  if (error != 0) {
+    // EINVAL: none of the CPUs is in the process's cpuset.
+    return TuningError(error, error == EPERM || error == EINVAL,
+                       "CPU affinity", "CPUs in this process's cpuset");
+  }
+
+  struct sched_param param;
+  memset(&param, 0, sizeof param);
+  param.sched_priority = tuning.realtime_priority;
+  int policy = tuning.realtime_priority != 0 ? SCHED_FIFO : SCHED_OTHER;
+  error = pthread_setschedparam(pthread_self(), policy, &param);
+  if (error != 0) {
+    pthread_setaffinity_np(pthread_self(), sizeof previous, &previous);
+    return TuningError(error, error == EPERM, "SCHED_FIFO",
+                       "CAP_SYS_NICE or a sufficient RLIMIT_RTPRIO");
+  }
+  return Status::Ok();
+}
+
+Status LockProcessMemory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    int error = errno;
+    // An RLIMIT_MEMLOCK too small for the process shows up as ENOMEM.
+    return TuningError(error, error == EPERM || error == ENOMEM, "mlockall",
+                       "CAP_IPC_LOCK or a sufficient RLIMIT_MEMLOCK");
+  }
+  return Status::Ok();
+}
+
+}  // namespace serial_com
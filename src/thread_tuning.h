@@ -0,0 +1,43 @@
+#ifndef SERIAL_COM_CORE_THREAD_TUNING_H_
+#define SERIAL_COM_CORE_THREAD_TUNING_H_
+
+#include <sched.h>
+
+#include <vector>
+
+#include "status.h"
+
+namespace serial_com {
+
+// Scheduling for a latency-sensitive thread, such as an I/O loop's.
+struct ThreadTuning {
+  // CPUs the thread may run on. Empty restores the CPUs it started with.
+  std::vector<int> cpus;
+  // SCHED_FIFO priority (1-99), or 0 for the default time-sharing policy.
+  int realtime_priority = 0;
+};
+
+// Returns INVALID_ARGUMENT if |tuning| names a CPU that does not exist or a
+// priority SCHED_FIFO does not support.
+Status ValidateThreadTuning(const ThreadTuning& tuning);
+
+// Returns the CPUs the calling thread may run on. Threads that tune
+// themselves save this when they start, to undo pinning later.
+cpu_set_t ThreadCpus();
+
+// Applies |tuning| to the calling thread, using |startup_cpus| when it names
+// no CPUs. Fails with PERMISSION_ERROR when the process may not use
+// real-time scheduling (it needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at
+// least the priority) or the requested CPUs are outside its cpuset. On
+// failure the thread keeps its previous affinity.
+Status ApplyThreadTuning(const ThreadTuning& tuning,
+                         const cpu_set_t& startup_cpus);
+
+// Locks the process's current and future memory, so that port buffers and
+// thread stacks never page fault. Fails with PERMISSION_ERROR without
+// CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+Status LockProcessMemory();
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_THREAD_TUNING_H_
@@ -0,0 +1,170 @@
+#include "trace_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) result <<= 1;
+  return result;
+}
+
+bool IsWriteStage(TraceStage stage) {
+  return stage >= TraceStage::kWriteQueued;
+}
+
+// Tracks are per port and direction.
+int TrackId(const TraceEvent& event) {
+  return event.port * 2 + (IsWriteStage(event.stage) ? 1 : 0);
+}
+
+}  // namespace
+
+const char* TraceStageName(TraceStage stage) {
+  switch (stage) {
+    case TraceStage::kRead:
+      return "read";
+    case TraceStage::kBuffered:
+      return "buffered";
+    case TraceStage::kEncoded:
+      return "encoded";
+    case TraceStage::kResponded:
+      return "responded";
+    case TraceStage::kWriteQueued:
+      return "write_queued";
+    case TraceStage::kWriteStarted:
+      return "write_started";
+    case TraceStage::kWriteDone:
+      return "write_done";
+    case TraceStage::kWriteResponded:
+      return "write_responded";
+  }
+  return "unknown";
+}
+
+TraceBuffer::TraceBuffer(size_t capacity)
+    : mask_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 2)) - 1),
+      slots_(new Slot[mask_ + 1]) {}
+
+void TraceBuffer::Start() {
+  start_.store(head_.load(std::memory_order_relaxed),
+               std::memory_order_relaxed);
+  enabled_.store(true, std::memory_order_release);
+}
+
+void TraceBuffer::Stop() { enabled_.store(false, std::memory_order_release); }
+
+uint64_t TraceBuffer::NewChunk() {
+  if (!enabled()) return 0;
+  return next_chunk_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TraceBuffer::Record(TraceStage stage, int port, uint64_t chunk,
+                         size_t bytes) {
+  if (chunk == 0 || !enabled()) return;
+  const uint64_t timestamp = NowNs();
+  const uint64_t index = head_.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = slots_[index & mask_];
+  slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.timestamp_ns.store(timestamp, std::memory_order_relaxed);
+  slot.chunk.store(chunk, std::memory_order_relaxed);
+  slot.packed.store(
+      static_cast<uint64_t>(std::min<size_t>(bytes, UINT32_MAX)) << 32 |
+          (static_cast<uint64_t>(port) & 0xFFFFFF) << 8 |
+          static_cast<uint8_t>(stage),
+      std::memory_order_relaxed);
+  slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+std::vector<TraceEvent> TraceBuffer::Events() const {
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  const uint64_t capacity = mask_ + 1;
+  uint64_t first = start_.load(std::memory_order_relaxed);
+  if (head - first > capacity) first = head - capacity;
+
+  std::vector<TraceEvent> events;
+  events.reserve(head - first);
+  for (uint64_t index = first; index < head; index++) {
+    const Slot& slot = slots_[index & mask_];
+    const uint64_t expected = 2 * index + 2;
+    if (slot.sequence.load(std::memory_order_acquire) != expected) continue;
+    TraceEvent event;
+    event.timestamp_ns = slot.timestamp_ns.load(std::memory_order_relaxed);
+    event.chunk = slot.chunk.load(std::memory_order_relaxed);
+    const uint64_t packed = slot.packed.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // A writer that lapped the ring mid-copy changes the sequence.
+    if (slot.sequence.load(std::memory_order_relaxed) != expected) continue;
+    event.bytes = static_cast<uint32_t>(packed >> 32);
+    event.port = static_cast<int32_t>((packed >> 8) & 0xFFFFFF);
+    event.stage = static_cast<TraceStage>(packed & 0xFF);
+    events.push_back(event);
+  }
+  return events;
+}
+
+std::string TraceBuffer::ToChromeTraceJson() const {
+  std::map<uint64_t, std::vector<TraceEvent>> chunks;
+  std::set<int> tracks;
+  for (const TraceEvent& event : Events()) {
+    chunks[event.chunk].push_back(event);
+    tracks.insert(TrackId(event));
+  }
+
+  std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  char line[256];
+  for (int track : tracks) {
+    snprintf(line, sizeof line,
+             "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+             "\"tid\":%d,\"args\":{\"name\":\"port %d %s\"}}",
+             first ? "" : ",", track, track / 2, track % 2 ? "tx" : "rx");
+    json += line;
+    first = false;
+  }
+  for (auto& it : chunks) {
+    std::vector<TraceEvent>& stages = it.second;
+    std::sort(stages.begin(), stages.end(),
+              [](const TraceEvent& a, const TraceEvent& b) {
+                return a.stage < b.stage;
+              });
+    for (size_t i = 1; i < stages.size(); i++) {
+      const TraceEvent& from = stages[i - 1];
+      const TraceEvent& to = stages[i];
+      const uint64_t duration =
+          to.timestamp_ns > from.timestamp_ns
+              ? to.timestamp_ns - from.timestamp_ns
+              : 0;
+      snprintf(line, sizeof line,
+               "%s\n{\"name\":\"%s -> %s\",\"cat\":\"%s\",\"ph\":\"X\","
+               "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+               "\"args\":{\"chunk\":%" PRIu64 ",\"bytes\":%u}}",
+               first ? "" : ",", TraceStageName(from.stage),
+               TraceStageName(to.stage), IsWriteStage(to.stage) ? "tx" : "rx",
+               from.timestamp_ns / 1e3, duration / 1e3, TrackId(from),
+               it.first, std::max(from.bytes, to.bytes));
+      json += line;
+      first = false;
+    }
+  }
+  json += "\n]}\n";
+  return json;
+}
+
+}  // namespace serial_com
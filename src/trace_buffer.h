@@ -0,0 +1,102 @@
+#ifndef SERIAL_COM_CORE_TRACE_BUFFER_H_
+#define SERIAL_COM_CORE_TRACE_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace serial_com {
+
+// Points in the life of a chunk of data that tracing timestamps. Received
+// chunks go kRead -> kBuffered -> kEncoded -> kResponded; writes go
+// kWriteQueued -> kWriteStarted -> kWriteDone -> kWriteResponded.
+enum class TraceStage : uint8_t {
+  // read() (or its io_uring completion) returned the chunk.
+  kRead,
+  // The chunk was appended to the port's receive buffer.
+  kBuffered,
+  // The chunk was copied into an FlValue for a read response.
+  kEncoded,
+  // fl_method_call_respond() returned for that response.
+  kResponded,
+  // A write was queued by its method handler.
+  kWriteQueued,
+  // The I/O thread began writing it.
+  kWriteStarted,
+  // The last byte was accepted by the kernel.
+  kWriteDone,
+  // fl_method_call_respond() returned for the write.
+  kWriteResponded,
+};
+
+const char* TraceStageName(TraceStage stage);
+
+struct TraceEvent {
+  uint64_t timestamp_ns;  // steady_clock
+  uint64_t chunk;
+  uint32_t bytes;
+  int32_t port;
+  TraceStage stage;
+};
+
+// A fixed-size ring of trace events that any thread can record into
+// without taking a lock. Once full, the oldest events are overwritten.
+//
+// Recording is a relaxed load when tracing is stopped, so ports can keep a
+// pointer to the buffer permanently.
+class TraceBuffer {
+ public:
+  // |capacity| is rounded up to a power of two.
+  explicit TraceBuffer(size_t capacity);
+
+  // Disallow copy and assign.
+  TraceBuffer(const TraceBuffer&) = delete;
+  TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+  // Discards recorded events and starts recording.
+  void Start();
+  void Stop();
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // Returns a new chunk id to correlate the stages of one chunk, or 0 when
+  // tracing is stopped.
+  uint64_t NewChunk();
+
+  // Records |stage| for |chunk| now. Does nothing for chunk 0.
+  void Record(TraceStage stage, int port, uint64_t chunk, size_t bytes);
+
+  // The events currently in the ring, oldest first. Events overwritten
+  // while being copied are skipped.
+  std::vector<TraceEvent> Events() const;
+
+  // Renders the recorded events in the Chrome trace-event format (load it
+  // in chrome://tracing or Perfetto). Each pair of consecutive stages of a
+  // chunk becomes one complete ("X") event, on a track per port and
+  // direction, so gaps show where the time went.
+  std::string ToChromeTraceJson() const;
+
+ private:
+  // Each slot is guarded by a per-slot sequence number: odd while a writer
+  // fills it, 2 * (index + 1) once event |index| is complete.
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<uint64_t> timestamp_ns{0};
+    std::atomic<uint64_t> chunk{0};
+    // bytes << 32 | port << 8 | stage
+    std::atomic<uint64_t> packed{0};
+  };
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> head_{0};
+  std::atomic<uint64_t> start_{0};
+  std::atomic<uint64_t> next_chunk_{1};
+  std::atomic<bool> enabled_{false};
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_TRACE_BUFFER_H_
@@ -0,0 +1,229 @@
+#include "transmit_pacer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace serial_com {
+
+namespace {
+
+// How long a blocked write waits for room before rechecking for shutdown.
+constexpr int kWritablePollMs = 50;
+
+// With only a rate cap, bytes go out in chunks worth this many
+// milliseconds of transmit time rather than one syscall per byte.
+constexpr int kRateChunkMs = 5;
+
+// Waits until everything written to |fd| has left the UART.
+void Drain(int fd) {
+  while (tcdrain(fd) != 0 && errno == EINTR) {
+  }
+}
+
+}  // namespace
+
+bool IsValidPacingConfig(const PacingConfig& config) {
+  return config.inter_byte_gap_us >= 0 && config.inter_frame_gap_us >= 0 &&
+         config.max_bytes_per_second >= 0;
+}
+
+TransmitPacer::TransmitPacer(int fd, const PacingConfig& config,
+                             PortStats* stats)
+    : fd_(fd),
+      stats_(stats),
+      config_(config),
+      holds_(0),
+      stopping_(false),
+      next_send_(Clock::now()) {
+  thread_ = std::thread(&TransmitPacer::Run, this);
+}
+
+TransmitPacer::~TransmitPacer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  tcflush(fd_, TCOFLUSH);
+  thread_.join();
+  for (auto& request : queue_) {
+    if (request.callback) request.callback(-ECANCELED);
+  }
+}
+
+void TransmitPacer::SetConfig(const PacingConfig& config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_ = config;
+}
+
+PacingConfig TransmitPacer::config() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return config_;
+}
+
+void TransmitPacer::SetHalfDuplex(HalfDuplexConfig half_duplex) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  half_duplex_ = std::move(half_duplex);
+}
+
+void TransmitPacer::Write(std::vector<uint8_t> data, WriteCallback callback) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(WriteRequest{std::move(data), std::move(callback)});
+  }
+  changed_.notify_all();
+}
+
+void TransmitPacer::Hold() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  holds_++;
+}
+
+void TransmitPacer::Release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    holds_--;
+  }
+  changed_.notify_all();
+}
+
+void TransmitPacer::CancelQueued() {
+  std::deque<WriteRequest> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled.swap(queue_);
+  }
+  for (auto& request : cancelled) {
+    if (request.callback) request.callback(-ECANCELED);
+  }
+}
+
+void TransmitPacer::Run() {
+  // The default 50 us timer slack would swamp short gaps.
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+  while (true) {
+    WriteRequest request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [this]() {
+        return stopping_ || (!queue_.empty() && holds_ == 0);
+      });
+      if (stopping_) return;
+      request = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    int64_t result = Transmit(request);
+    if (request.callback) request.callback(result);
+  }
+}
+
+int64_t TransmitPacer::Transmit(const WriteRequest& request) {
+  HalfDuplexConfig half_duplex;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (half_duplex_.enabled) half_duplex = half_duplex_;
+  }
+  if (!half_duplex.enabled || request.data.empty()) return Send(request);
+
+  if (half_duplex.set_direction) {
+    if (!half_duplex.set_direction(true).ok()) return -EIO;
+    if (!SleepUntil(Clock::now() + std::chrono::microseconds(
+                                       half_duplex.delay_before_send_us))) {
+      half_duplex.set_direction(false);
+      return -ECANCELED;
+    }
+  }
+  int64_t result = Send(request);
+  // The line must not be released before the last stop bit is out, error
+  // or not.
+  Drain(fd_);
+  const Clock::time_point drained = Clock::now();
+  Clock::time_point released =
+      drained + std::chrono::microseconds(half_duplex.delay_after_send_us);
+  if (half_duplex.set_direction) {
+    // Released early if shutting down.
+    SleepUntil(released);
+    Status status = half_duplex.set_direction(false);
+    released = Clock::now();
+    if (!status.ok() && result >= 0) result = -EIO;
+  }
+  if (half_duplex.stats && result > 0) {
+    half_duplex.stats->OnTransmitted(drained, released);
+  }
+  return result;
+}
+
+int64_t TransmitPacer::Send(const WriteRequest& request) {
+  const PacingConfig config = this->config();
+  const std::chrono::microseconds byte_gap(config.inter_byte_gap_us);
+  const std::chrono::microseconds frame_gap(config.inter_frame_gap_us);
+
+  size_t chunk = request.data.size();
+  if (config.inter_byte_gap_us > 0) {
+    chunk = 1;
+  } else if (config.max_bytes_per_second > 0) {
+    chunk = static_cast<size_t>(std::max<int64_t>(
+        1, int64_t{config.max_bytes_per_second} * kRateChunkMs / 1000));
+  }
+
+  size_t sent = 0;
+  while (sent < request.data.size()) {
+    if (!SleepUntil(next_send_)) return -ECANCELED;
+    const Clock::time_point started = Clock::now();
+    int64_t n = WriteSome(request.data.data() + sent,
+                          std::min(chunk, request.data.size() - sent));
+    if (n < 0) return n;
+    sent += n;
+
+    next_send_ = started;
+    if (config.max_bytes_per_second > 0) {
+      next_send_ += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(
+              static_cast<double>(n) / config.max_bytes_per_second));
+    }
+    if (config.inter_byte_gap_us > 0) {
+      Drain(fd_);
+      next_send_ = std::max(next_send_, Clock::now() + byte_gap);
+    }
+  }
+
+  if (config.inter_frame_gap_us > 0) {
+    Drain(fd_);
+    next_send_ = std::max(next_send_, Clock::now() + frame_gap);
+  }
+  return sent;
+}
+
+int64_t TransmitPacer::WriteSome(const uint8_t* data, size_t length) {
+  while (true) {
+    ssize_t n = write(fd_, data, length);
+    if (n >= 0) {
+      stats_->RecordWrite(n);
+      return n;
+    }
+    if (errno == EINTR) continue;
+    if (errno != EAGAIN) {
+      int error = errno;
+      stats_->RecordWrite(-error);
+      return -error;
+    }
+    struct pollfd writable = {fd_, POLLOUT, 0};
+    poll(&writable, 1, kWritablePollMs);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) return -ECANCELED;
+  }
+}
+
+bool TransmitPacer::SleepUntil(Clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait_until(lock, deadline, [this]() { return stopping_; });
+  return !stopping_;
+}
+
+}  // namespace serial_com
@@ -0,0 +1,134 @@
+#ifndef SERIAL_COM_CORE_TRANSMIT_PACER_H_
+#define SERIAL_COM_CORE_TRANSMIT_PACER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "port_stats.h"
+#include "rs485.h"
+#include "status.h"
+
+namespace serial_com {
+
+// Timing rules for devices that lose data when it arrives back to back.
+// A zero field disables that rule.
+struct PacingConfig {
+  // Idle time on the wire between two characters.
+  int inter_byte_gap_us = 0;
+  // Idle time on the wire after each write, i.e. between frames.
+  int inter_frame_gap_us = 0;
+  // Average transmit rate cap.
+  int max_bytes_per_second = 0;
+
+  bool enabled() const {
+    return inter_byte_gap_us > 0 || inter_frame_gap_us > 0 ||
+           max_bytes_per_second > 0;
+  }
+};
+
+// Returns false if any field is negative.
+bool IsValidPacingConfig(const PacingConfig& config);
+
+// Turns a half-duplex (RS-485) line around for each write: the driver is
+// enabled before the first byte and released once the last one has left
+// the UART.
+struct HalfDuplexConfig {
+  bool enabled = false;
+  // Switches the transceiver to transmit (true) or receive. Null when the
+  // kernel does it (Rs485Mode::kKernel); writes are then still drained, so
+  // turnarounds can be timed.
+  std::function<Status(bool transmit)> set_direction;
+  int delay_before_send_us = 0;
+  int delay_after_send_us = 0;
+  // Records each turnaround if set.
+  std::shared_ptr<Rs485Stats> stats;
+};
+
+// Transmits queued writes on a tty while enforcing a PacingConfig.
+//
+// Gaps are measured from the moment the previous character or frame has
+// physically left the UART (tcdrain), not from when it was handed to the
+// kernel, so they hold regardless of driver buffering. Waiting happens on a
+// thread owned by the pacer with high-resolution absolute timers; callers
+// only queue and get a callback.
+class TransmitPacer {
+ public:
+  // Invoked on the pacer thread with the number of bytes written or a
+  // negative errno.
+  using WriteCallback = std::function<void(int64_t result)>;
+
+  // |fd| may be non-blocking. Writes are recorded in |stats|, which must
+  // outlive the pacer.
+  TransmitPacer(int fd, const PacingConfig& config, PortStats* stats);
+  // Fails queued writes with ECANCELED and discards whatever is still in
+  // the tty's output queue, so a drain stalled by flow control cannot block
+  // shutdown.
+  ~TransmitPacer();
+
+  // Disallow copy and assign.
+  TransmitPacer(const TransmitPacer&) = delete;
+  TransmitPacer& operator=(const TransmitPacer&) = delete;
+
+  // Takes effect from the next write that starts transmitting.
+  void SetConfig(const PacingConfig& config);
+  PacingConfig config();
+  // Takes effect from the next write that starts transmitting. Empty
+  // writes do not turn the line around.
+  void SetHalfDuplex(HalfDuplexConfig half_duplex);
+
+  void Write(std::vector<uint8_t> data, WriteCallback callback);
+  // While held, queued writes wait instead of starting to transmit; for
+  // letting writes already handed to another path reach the tty first.
+  // Holds nest.
+  void Hold();
+  void Release();
+  // Fails the writes that have not started transmitting with ECANCELED.
+  void CancelQueued();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct WriteRequest {
+    std::vector<uint8_t> data;
+    WriteCallback callback;
+  };
+
+  void Run();
+  // Sends |request|, turning the line around for it if half-duplex, and
+  // returns the byte count or a negative errno.
+  int64_t Transmit(const WriteRequest& request);
+  // Sends |request| with pacing.
+  int64_t Send(const WriteRequest& request);
+  // Writes up to |length| bytes, waiting for room in the tty's output
+  // queue if necessary.
+  int64_t WriteSome(const uint8_t* data, size_t length);
+  // Sleeps until |deadline|. Returns false if the pacer is shutting down.
+  bool SleepUntil(Clock::time_point deadline);
+
+  const int fd_;
+  PortStats* const stats_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  PacingConfig config_;
+  HalfDuplexConfig half_duplex_;
+  std::deque<WriteRequest> queue_;
+  int holds_;
+  bool stopping_;
+
+  // Earliest time the next byte may be written. Only used on the thread.
+  Clock::time_point next_send_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_TRANSMIT_PACER_H_
@@ -0,0 +1,367 @@
+#include "upload_engine.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "crc16.h"
+
+namespace serial_com {
+
+namespace {
+
+constexpr uint8_t kSoh = 0x01;
+constexpr uint8_t kStx = 0x02;
+constexpr uint8_t kEot = 0x04;
+constexpr uint8_t kAck = 0x06;
+constexpr uint8_t kNak = 0x15;
+constexpr uint8_t kCan = 0x18;
+constexpr uint8_t kCrcRequest = 'C';
+constexpr uint8_t kStreamRequest = 'G';
+// Pads the last block of a file.
+constexpr uint8_t kPad = 0x1A;
+
+constexpr size_t kShortBlock = 128;
+constexpr size_t kLongBlock = 1024;
+
+// Writes allowed in flight. Acknowledged transfers only ever have one
+// block outstanding; streaming ones are limited to this many.
+constexpr int kWriteWindow = 8;
+// How long to wait for the second CAN of a cancel request.
+constexpr int kCancelTimeoutMs = 1000;
+// How long to let the last writes drain before reporting the result.
+constexpr int kDrainTimeoutMs = 5000;
+
+}  // namespace
+
+const char* UploadProtocolName(UploadProtocol protocol) {
+  switch (protocol) {
+    case UploadProtocol::kXmodem1k:
+      return "xmodem1k";
+    case UploadProtocol::kYmodem:
+      return "ymodem";
+  }
+  return "unknown";
+}
+
+bool ParseUploadProtocol(const char* name, UploadProtocol* protocol) {
+  if (name == nullptr) return false;
+  if (strcmp(name, "xmodem1k") == 0) {
+    *protocol = UploadProtocol::kXmodem1k;
+    return true;
+  }
+  if (strcmp(name, "ymodem") == 0) {
+    *protocol = UploadProtocol::kYmodem;
+    return true;
+  }
+  return false;
+}
+
+const char* UploadStatusName(UploadStatus status) {
+  switch (status) {
+    case UploadStatus::kOk:
+      return "ok";
+    case UploadStatus::kCancelled:
+      return "cancelled";
+    case UploadStatus::kTimeout:
+      return "timeout";
+    case UploadStatus::kRetriesExhausted:
+      return "retriesExhausted";
+    case UploadStatus::kWriteError:
+      return "writeError";
+    case UploadStatus::kAborted:
+      return "aborted";
+  }
+  return "unknown";
+}
+
+UploadEngine::UploadEngine(std::unique_ptr<MappedFile> image,
+                           UploadOptions options, SendFn send,
+                           ProgressFn progress, DoneFn done)
+    : image_(std::move(image)),
+      options_(std::move(options)),
+      send_(std::move(send)),
+      progress_(std::move(progress)),
+      done_(std::move(done)),
+      state_(std::make_shared<State>()) {
+  progress_state_.total_bytes = image_->size();
+}
+
+UploadEngine::~UploadEngine() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->destroying = true;
+  }
+  Abort();
+  if (thread_.joinable()) thread_.join();
+}
+
+void UploadEngine::Start() { thread_ = std::thread(&UploadEngine::Run, this); }
+
+void UploadEngine::OnReceived(const uint8_t* data, size_t length) {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->received.insert(state_->received.end(), data, data + length);
+  }
+  state_->changed.notify_all();
+}
+
+void UploadEngine::Abort() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->aborted = true;
+  }
+  state_->changed.notify_all();
+}
+
+void UploadEngine::Run() {
+  UploadStatus status = Transfer();
+  if (status == UploadStatus::kAborted) {
+    // Tell the receiver, so it does not sit waiting for the next block.
+    std::vector<uint8_t> cancel(3, kCan);
+    send_(std::move(cancel), [](int64_t) {});
+  }
+  Drain(kDrainTimeoutMs);
+  if (done_) done_(status, progress_state_);
+}
+
+UploadStatus UploadEngine::Transfer() {
+  UploadStatus status = UploadStatus::kOk;
+  int start = WaitForStart(&status);
+  if (start < 0) return status;
+  crc_ = start != kNak;
+  bool streaming = start == kStreamRequest;
+
+  const bool ymodem = options_.protocol == UploadProtocol::kYmodem;
+  if (ymodem) {
+    // Block 0: "name\0size\0", zero padded.
+    std::vector<uint8_t> header(kShortBlock, 0);
+    std::string info = options_.file_name;
+    info.push_back('\0');
+    info += std::to_string(image_->size());
+    memcpy(header.data(), info.data(),
+           std::min(info.size(), header.size() - 1));
+    status = SendBlock(0, header.data(), header.size(), kShortBlock, streaming);
+    if (status != UploadStatus::kOk) return status;
+    // The receiver asks again before the data.
+    start = WaitForStart(&status);
+    if (start < 0) return status;
+  }
+
+  const uint8_t* data = image_->data();
+  const size_t size = image_->size();
+  uint8_t number = 1;
+  for (size_t offset = 0; offset < size;) {
+    size_t remaining = size - offset;
+    // Short blocks for classic XMODEM and for a small tail, where a long
+    // block would be mostly padding.
+    size_t block_size =
+        !crc_ || remaining <= kShortBlock ? kShortBlock : kLongBlock;
+    size_t length = std::min(remaining, block_size);
+    status = SendBlock(number++, data + offset, length, block_size, streaming);
+    if (status != UploadStatus::kOk) return status;
+    offset += length;
+    progress_state_.bytes_sent = offset;
+    progress_state_.blocks_sent++;
+    ReportProgress();
+  }
+
+  status = SendEndOfTransmission();
+  if (status != UploadStatus::kOk || !ymodem) return status;
+
+  // An empty header ends the batch.
+  start = WaitForStart(&status);
+  if (start < 0) return status;
+  std::vector<uint8_t> empty(kShortBlock, 0);
+  return SendBlock(0, empty.data(), empty.size(), kShortBlock,
+                   start == kStreamRequest);
+}
+
+int UploadEngine::WaitForStart(UploadStatus* status) {
+  const Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(options_.start_timeout_ms);
+  while (true) {
+    int remaining = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline -
+                                                              Clock::now())
+            .count());
+    int byte = ReadByte(std::max(remaining, 0));
+    if (byte == kStopped) {
+      *status = stopped() ? UploadStatus::kAborted : UploadStatus::kWriteError;
+      return -1;
+    }
+    if (byte == kTimedOut) {
+      *status = UploadStatus::kTimeout;
+      return -1;
+    }
+    if (byte == kCrcRequest || byte == kNak ||
+        (byte == kStreamRequest &&
+         options_.protocol == UploadProtocol::kYmodem)) {
+      return byte;
+    }
+    if (byte == kCan && ReceiverCancelled(byte)) {
+      *status = UploadStatus::kCancelled;
+      return -1;
+    }
+    // Anything else is line noise or a late ACK; keep waiting.
+  }
+}
+
+UploadStatus UploadEngine::SendBlock(uint8_t number, const uint8_t* data,
+                                     size_t length, size_t block_size,
+                                     bool streaming) {
+  std::vector<uint8_t> block;
+  block.reserve(3 + block_size + 2);
+  block.push_back(block_size == kLongBlock ? kStx : kSoh);
+  block.push_back(number);
+  block.push_back(static_cast<uint8_t>(~number));
+  block.insert(block.end(), data, data + length);
+  block.resize(3 + block_size, kPad);
+  if (crc_) {
+    uint16_t crc = Crc16Xmodem(block.data() + 3, block_size);
+    block.push_back(static_cast<uint8_t>(crc >> 8));
+    block.push_back(static_cast<uint8_t>(crc));
+  } else {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < block_size; i++) sum += block[3 + i];
+    block.push_back(sum);
+  }
+
+  if (streaming) {
+    // YMODEM-g receivers never acknowledge blocks; they cancel on error.
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (!state_->received.empty() && state_->received.front() == kCan) {
+        return UploadStatus::kCancelled;
+      }
+    }
+    return Send(std::move(block)) ? UploadStatus::kOk
+                                  : (stopped() ? UploadStatus::kAborted
+                                               : UploadStatus::kWriteError);
+  }
+
+  for (int attempt = 0; attempt < options_.max_retries; attempt++) {
+    if (attempt > 0) {
+      progress_state_.retransmits++;
+      // Drop repeated NAKs and noise so they are not read as the answer
+      // to the resent block.
+      Purge();
+    }
+    if (!Send(block)) {
+      return stopped() ? UploadStatus::kAborted : UploadStatus::kWriteError;
+    }
+    bool acked = false;
+    UploadStatus status = AwaitAck(&acked);
+    if (status != UploadStatus::kOk) return status;
+    if (acked) return UploadStatus::kOk;
+  }
+  return UploadStatus::kRetriesExhausted;
+}
+
+UploadStatus UploadEngine::SendEndOfTransmission() {
+  for (int attempt = 0; attempt < options_.max_retries; attempt++) {
+    // Receivers commonly NAK the first EOT to make sure it is not noise.
+    if (!Send(std::vector<uint8_t>(1, kEot))) {
+      return stopped() ? UploadStatus::kAborted : UploadStatus::kWriteError;
+    }
+    bool acked = false;
+    UploadStatus status = AwaitAck(&acked);
+    if (status != UploadStatus::kOk) return status;
+    if (acked) return UploadStatus::kOk;
+  }
+  return UploadStatus::kRetriesExhausted;
+}
+
+UploadStatus UploadEngine::AwaitAck(bool* acked) {
+  const Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(options_.response_timeout_ms);
+  while (true) {
+    int remaining = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline -
+                                                              Clock::now())
+            .count());
+    int byte = ReadByte(std::max(remaining, 0));
+    if (byte == kStopped) {
+      return stopped() ? UploadStatus::kAborted : UploadStatus::kWriteError;
+    }
+    if (byte == kTimedOut || byte == kNak) {
+      *acked = false;
+      return UploadStatus::kOk;
+    }
+    if (byte == kAck) {
+      *acked = true;
+      return UploadStatus::kOk;
+    }
+    if (byte == kCan && ReceiverCancelled(byte)) {
+      return UploadStatus::kCancelled;
+    }
+  }
+}
+
+int UploadEngine::ReadByte(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  state_->changed.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+    return !state_->received.empty() || state_->aborted ||
+           state_->write_failed;
+  });
+  if (state_->aborted || state_->write_failed) return kStopped;
+  if (state_->received.empty()) return kTimedOut;
+  int byte = state_->received.front();
+  state_->received.pop_front();
+  return byte;
+}
+
+bool UploadEngine::ReceiverCancelled(int first) {
+  if (first != kCan) return false;
+  // A single CAN may be noise; the protocol requires two in a row.
+  return ReadByte(kCancelTimeoutMs) == kCan;
+}
+
+void UploadEngine::Purge() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->received.clear();
+}
+
+bool UploadEngine::Send(std::vector<uint8_t> data) {
+  std::shared_ptr<State> state = state_;
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->changed.wait(lock, [&state] {
+      return state->writes_in_flight < kWriteWindow || state->aborted ||
+             state->write_failed;
+    });
+    if (state->aborted || state->write_failed) return false;
+    state->writes_in_flight++;
+  }
+  send_(std::move(data), [state](int64_t result) {
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->writes_in_flight--;
+      if (result < 0) state->write_failed = true;
+    }
+    state->changed.notify_all();
+  });
+  return true;
+}
+
+void UploadEngine::Drain(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  state_->changed.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                           [this] {
+                             return state_->writes_in_flight == 0 ||
+                                    state_->destroying;
+                           });
+}
+
+bool UploadEngine::stopped() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->aborted;
+}
+
+void UploadEngine::ReportProgress() {
+  if (progress_) progress_(progress_state_);
+}
+
+}  // namespace serial_com
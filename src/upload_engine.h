@@ -0,0 +1,177 @@
+#ifndef SERIAL_COM_CORE_UPLOAD_ENGINE_H_
+#define SERIAL_COM_CORE_UPLOAD_ENGINE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace serial_com {
+
+// File transfer protocols spoken by serial bootloaders.
+enum class UploadProtocol {
+  // XMODEM with 1024-byte blocks and CRC-16, falling back to 128-byte
+  // blocks with an arithmetic checksum if the receiver asks for classic
+  // XMODEM (NAK instead of 'C').
+  kXmodem1k,
+  // YMODEM batch transfer of a single file: a header block with the file
+  // name and size, XMODEM-1K data, and an empty header to end the batch.
+  // A receiver that starts with 'G' gets YMODEM-g, where blocks are
+  // streamed without waiting for acknowledgements.
+  kYmodem,
+};
+
+const char* UploadProtocolName(UploadProtocol protocol);
+
+// Parses "xmodem1k" or "ymodem". Returns false for anything else.
+bool ParseUploadProtocol(const char* name, UploadProtocol* protocol);
+
+struct UploadOptions {
+  UploadProtocol protocol = UploadProtocol::kXmodem1k;
+  // Sent in the YMODEM header block.
+  std::string file_name;
+  // How long to wait for the receiver to ask for the transfer to start.
+  int start_timeout_ms = 60000;
+  // How long to wait for each block to be acknowledged before resending
+  // it.
+  int response_timeout_ms = 10000;
+  // Attempts per block (and per end-of-transmission) before giving up.
+  int max_retries = 10;
+};
+
+enum class UploadStatus {
+  kOk,
+  // The receiver cancelled the transfer (CAN CAN).
+  kCancelled,
+  // The receiver never asked for the transfer to start.
+  kTimeout,
+  // A block was rejected or unanswered max_retries times.
+  kRetriesExhausted,
+  // Writing to the port failed.
+  kWriteError,
+  // Abort() was called.
+  kAborted,
+};
+
+const char* UploadStatusName(UploadStatus status);
+
+struct UploadProgress {
+  // Bytes of the image the receiver has acknowledged (or, when streaming,
+  // that have been written).
+  uint64_t bytes_sent = 0;
+  uint64_t total_bytes = 0;
+  uint32_t blocks_sent = 0;
+  uint32_t retransmits = 0;
+};
+
+// Runs a bootloader upload on its own thread.
+//
+// The engine only produces bytes and consumes responses: writes go out
+// through |send|, which must eventually call its completion, and whatever
+// the port receives is fed in with OnReceived(). That keeps the protocol
+// state machine native, so each block costs one wire round trip rather
+// than several platform-channel round trips.
+class UploadEngine {
+ public:
+  // Called with the number of bytes written or a negative errno.
+  using WriteDone = std::function<void(int64_t result)>;
+  using SendFn = std::function<void(std::vector<uint8_t> data, WriteDone done)>;
+  // Called on the engine thread after every acknowledged block.
+  using ProgressFn = std::function<void(const UploadProgress& progress)>;
+  // Called once on the engine thread when the upload has ended.
+  using DoneFn =
+      std::function<void(UploadStatus status, const UploadProgress& progress)>;
+
+  UploadEngine(std::unique_ptr<MappedFile> image, UploadOptions options,
+               SendFn send, ProgressFn progress, DoneFn done);
+  // Aborts the upload if it is still running and waits for the thread,
+  // without waiting for outstanding writes (such as the CAN that tells
+  // the receiver) to complete.
+  ~UploadEngine();
+
+  // Disallow copy and assign.
+  UploadEngine(const UploadEngine&) = delete;
+  UploadEngine& operator=(const UploadEngine&) = delete;
+
+  // Starts uploading. Whatever the port receives must be fed in by then,
+  // since the receiver may already be asking for the first block.
+  void Start();
+
+  // Feeds bytes received from the port. May be called from any thread.
+  void OnReceived(const uint8_t* data, size_t length);
+
+  // Cancels the transfer on the wire and ends it with kAborted.
+  void Abort();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // Shared with write completions, which may outlive the engine.
+  struct State {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<uint8_t> received;
+    int writes_in_flight = 0;
+    bool write_failed = false;
+    bool aborted = false;
+    // Set by the destructor, which may run on a UI thread: the final drain
+    // is skipped rather than waited out.
+    bool destroying = false;
+  };
+
+  // A receiver byte, or one of these.
+  static constexpr int kTimedOut = -1;
+  static constexpr int kStopped = -2;
+
+  void Run();
+  UploadStatus Transfer();
+  // Waits for the receiver's start request and returns it ('C', 'G' or
+  // NAK), or a status through |status|.
+  int WaitForStart(UploadStatus* status);
+  // Sends one block and, unless |streaming|, waits for it to be
+  // acknowledged, resending it as needed.
+  UploadStatus SendBlock(uint8_t number, const uint8_t* data, size_t length,
+                         size_t block_size, bool streaming);
+  UploadStatus SendEndOfTransmission();
+  // Waits for ACK; NAK and timeouts count as a failed attempt.
+  UploadStatus AwaitAck(bool* acked);
+
+  // Returns the next received byte, kTimedOut or kStopped.
+  int ReadByte(int timeout_ms);
+  // Returns true if the receiver sent CAN CAN. Consumes what it reads.
+  bool ReceiverCancelled(int first);
+  void Purge();
+  // Queues |data|, first waiting for the write window to have room.
+  bool Send(std::vector<uint8_t> data);
+  // Waits for every write to complete, up to |timeout_ms| or until the
+  // engine is being destroyed.
+  void Drain(int timeout_ms);
+  bool stopped();
+  void ReportProgress();
+
+  const std::unique_ptr<MappedFile> image_;
+  const UploadOptions options_;
+  const SendFn send_;
+  const ProgressFn progress_;
+  const DoneFn done_;
+
+  std::shared_ptr<State> state_;
+  // Engine thread only.
+  bool crc_ = true;
+  UploadProgress progress_state_;
+
+  std::thread thread_;
+};
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_UPLOAD_ENGINE_H_
@@ -0,0 +1,170 @@
+#include "win32_serial_port.h"
+
+#include <winreg.h>
+
+namespace serial_com {
+
+namespace {
+
+std::string LastErrorMessage(const char* what) {
+  return std::string(what) + ": error " + std::to_string(GetLastError());
+}
+
+}  // namespace
+
+Win32SerialPort::Win32SerialPort() : handle_(INVALID_HANDLE_VALUE) {}
+
+Win32SerialPort::~Win32SerialPort() { Close(); }
+
+Status Win32SerialPort::Open(const PortConfig& config) {
+  Close();
+  if (!IsValidPortConfig(config)) {
+    return Status::Error("CONFIG_ERROR", "Invalid port configuration");
+  }
+
+  handle_ = CreateFileA(config.path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle_ == INVALID_HANDLE_VALUE) {
+    return Status::Error("OPEN_ERROR", LastErrorMessage("Error opening port"));
+  }
+
+  DCB dcb = {0};
+  dcb.DCBlength = sizeof(DCB);
+  if (!GetCommState(handle_, &dcb)) {
+    Close();
+    return Status::Error("CONFIG_ERROR", "Error from GetCommState");
+  }
+
+  dcb.BaudRate = static_cast<DWORD>(config.baud_rate);
+  dcb.ByteSize = static_cast<BYTE>(config.data_bits);
+  switch (config.parity) {
+    case Parity::kNone:
+      dcb.Parity = NOPARITY;
+      break;
+    case Parity::kOdd:
+      dcb.Parity = ODDPARITY;
+      break;
+    case Parity::kEven:
+      dcb.Parity = EVENPARITY;
+      break;
+  }
+  dcb.fParity = config.parity != Parity::kNone;
+  dcb.StopBits = config.stop_bits == StopBits::kTwo ? TWOSTOPBITS : ONESTOPBIT;
+  bool hardware = config.flow_control == FlowControl::kHardware;
+  bool software = config.flow_control == FlowControl::kSoftware;
+  dcb.fOutxCtsFlow = hardware;
+  dcb.fRtsControl = hardware ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+  dcb.fOutX = software;
+  dcb.fInX = software;
+
+  if (!SetCommState(handle_, &dcb)) {
+    Close();
+    return Status::Error("CONFIG_ERROR", "Error from SetCommState");
+  }
+
+  COMMTIMEOUTS timeouts = {0};
+  timeouts.ReadIntervalTimeout = 50;
+  timeouts.ReadTotalTimeoutConstant = 50;
+  timeouts.ReadTotalTimeoutMultiplier = 10;
+  timeouts.WriteTotalTimeoutConstant = 50;
+  timeouts.WriteTotalTimeoutMultiplier = 10;
+
+  if (!SetCommTimeouts(handle_, &timeouts)) {
+    Close();
+    return Status::Error("CONFIG_ERROR", "Error from SetCommTimeouts");
+  }
+
+  return Status::Ok();
+}
+
+void Win32SerialPort::Close() {
+  if (handle_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+  }
+}
+
+Status Win32SerialPort::Write(const uint8_t* data, size_t length) {
+  if (!IsOpen()) return Status::Error("WRITE_ERROR", "Port is not open");
+  DWORD bytes_written = 0;
+  BOOL ok = WriteFile(handle_, data, static_cast<DWORD>(length),
+                      &bytes_written, NULL);
+  stats_.RecordWrite(ok ? static_cast<int64_t>(bytes_written) : -1);
+  if (!ok) {
+    return Status::Error("WRITE_ERROR",
+                         LastErrorMessage("Error writing to port"));
+  }
+  if (bytes_written != length) {
+    return Status::Error("WRITE_ERROR", "Write timed out");
+  }
+  return Status::Ok();
+}
+
+Status Win32SerialPort::Read(size_t max_length, std::vector<uint8_t>* data) {
+  if (!IsOpen()) return Status::Error("READ_ERROR", "Port is not open");
+  data->resize(max_length);
+  DWORD bytes_read = 0;
+  BOOL ok = ReadFile(handle_, data->data(), static_cast<DWORD>(max_length),
+                     &bytes_read, NULL);
+  stats_.RecordRead(ok ? static_cast<int64_t>(bytes_read) : -1);
+  if (!ok) {
+    data->clear();
+    return Status::Error("READ_ERROR",
+                         LastErrorMessage("Error reading from port"));
+  }
+  data->resize(bytes_read);
+  return Status::Ok();
+}
+
+Status Win32SerialPort::Queued(size_t* bytes) {
+  if (!IsOpen()) return Status::Error("READ_ERROR", "Port is not open");
+  DWORD errors = 0;
+  COMSTAT comstat = {0};
+  stats_.RecordReadSizing();
+  if (!ClearCommError(handle_, &errors, &comstat)) {
+    return Status::Error("READ_ERROR",
+                         LastErrorMessage("Error querying the port"));
+  }
+  *bytes = comstat.cbInQue;
+  return Status::Ok();
+}
+
+std::vector<std::string> ListWin32SerialDevices() {
+  std::vector<std::string> devices;
+  HKEY hKey;
+  LONG result = RegOpenKeyExA(HKEY_LOCAL_MACHINE, "HARDWARE\\DEVICEMAP\\SERIALCOMM", 0, KEY_READ, &hKey);
+
+  if (result != ERROR_SUCCESS) {
+    return devices;
+  }
+
+  char valueName[MAX_PATH];
+  char data[MAX_PATH];
+  DWORD valueNameSize, dataSize, valueType;
+  DWORD index = 0;
+
+  while (true) {
+    valueNameSize = MAX_PATH;
+    dataSize = MAX_PATH;
+    result = RegEnumValueA(hKey, index, valueName, &valueNameSize, NULL, &valueType, (LPBYTE)data, &dataSize);
+
+    if (result == ERROR_NO_MORE_ITEMS) {
+      break;
+    }
+
+    if (result == ERROR_SUCCESS && valueType == REG_SZ) {
+      devices.push_back(data);
+    }
+
+    index++;
+  }
+
+  RegCloseKey(hKey);
+  return devices;
+}
+
+std::unique_ptr<SerialPort> SerialPort::Create() {
+  return std::unique_ptr<SerialPort>(new Win32SerialPort());
+}
+
+}  // namespace serial_com
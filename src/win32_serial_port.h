@@ -0,0 +1,39 @@
+#ifndef SERIAL_COM_CORE_WIN32_SERIAL_PORT_H_
+#define SERIAL_COM_CORE_WIN32_SERIAL_PORT_H_
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+#include "serial_port.h"
+
+namespace serial_com {
+
+class Win32SerialPort : public SerialPort {
+ public:
+  Win32SerialPort();
+  ~Win32SerialPort() override;
+
+  // Disallow copy and assign.
+  Win32SerialPort(const Win32SerialPort&) = delete;
+  Win32SerialPort& operator=(const Win32SerialPort&) = delete;
+
+  Status Open(const PortConfig& config) override;
+  void Close() override;
+  bool IsOpen() const override { return handle_ != INVALID_HANDLE_VALUE; }
+
+  Status Write(const uint8_t* data, size_t length) override;
+  Status Read(size_t max_length, std::vector<uint8_t>* data) override;
+  Status Queued(size_t* bytes) override;
+
+ private:
+  HANDLE handle_;
+};
+
+// Lists the COM ports registered under HARDWARE\DEVICEMAP\SERIALCOMM.
+std::vector<std::string> ListWin32SerialDevices();
+
+}  // namespace serial_com
+
+#endif  // SERIAL_COM_CORE_WIN32_SERIAL_PORT_H_
@@ -1,208 +1,174 @@
 #include "serial_com_plugin.h"
+
+// This must be included before many other Windows headers.
 #include <windows.h>
+
+// For getPlatformVersion; remove unless needed for your plugin implementation.
+#include <VersionHelpers.h>
+
 #include <flutter/method_channel.h>
 #include <flutter/plugin_registrar_windows.h>
 #include <flutter/standard_method_codec.h>
+
+#include <chrono>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <vector>
-#include <winreg.h>
 
-namespace serial_com {
+#include "port_config.h"
+#include "win32_serial_port.h"
 
-class SerialPort {
- public:
-  SerialPort() : handle_(INVALID_HANDLE_VALUE) {}
-  ~SerialPort() { Close(); }
-
-  bool Open(const std::string& port, int baudRate) {
-    Close();
-    handle_ = CreateFileA(port.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
-                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (handle_ == INVALID_HANDLE_VALUE) return false;
-
-    DCB dcb = {0};
-    dcb.DCBlength = sizeof(DCB);
-    if (!GetCommState(handle_, &dcb)) {
-      Close();
-      return false;
-    }
-
-    dcb.BaudRate = baudRate;
-    dcb.ByteSize = 8;
-    dcb.Parity = NOPARITY;
-    dcb.StopBits = ONESTOPBIT;
+namespace serial_com {
 
-    if (!SetCommState(handle_, &dcb)) {
-      Close();
+namespace {
+
+// Reads the connect arguments into |config|. Everything but the port and
+// baud rate is optional and defaults to 8N1 without flow control.
+bool ParsePortConfig(const flutter::EncodableMap& arguments,
+                     PortConfig* config) {
+  auto port = arguments.find(flutter::EncodableValue("port"));
+  auto baud_rate = arguments.find(flutter::EncodableValue("baudRate"));
+  if (port == arguments.end() || baud_rate == arguments.end()) return false;
+  const auto* path = std::get_if<std::string>(&port->second);
+  const auto* rate = std::get_if<int>(&baud_rate->second);
+  if (path == nullptr || rate == nullptr) return false;
+  config->path = *path;
+  config->baud_rate = *rate;
+
+  auto it = arguments.find(flutter::EncodableValue("dataBits"));
+  if (it != arguments.end()) {
+    const auto* data_bits = std::get_if<int>(&it->second);
+    if (data_bits == nullptr) return false;
+    config->data_bits = *data_bits;
+  }
+  it = arguments.find(flutter::EncodableValue("stopBits"));
+  if (it != arguments.end()) {
+    const auto* stop_bits = std::get_if<int>(&it->second);
+    if (stop_bits == nullptr) return false;
+    config->stop_bits = *stop_bits == 2 ? StopBits::kTwo : StopBits::kOne;
+  }
+  it = arguments.find(flutter::EncodableValue("parity"));
+  if (it != arguments.end()) {
+    const auto* parity = std::get_if<std::string>(&it->second);
+    if (parity == nullptr || !ParseParity(parity->c_str(), &config->parity)) {
       return false;
     }
-
-    COMMTIMEOUTS timeouts = {0};
-    timeouts.ReadIntervalTimeout = 50;
-    timeouts.ReadTotalTimeoutConstant = 50;
-    timeouts.ReadTotalTimeoutMultiplier = 10;
-    timeouts.WriteTotalTimeoutConstant = 50;
-    timeouts.WriteTotalTimeoutMultiplier = 10;
-
-    if (!SetCommTimeouts(handle_, &timeouts)) {
-      Close();
+  }
+  it = arguments.find(flutter::EncodableValue("flowControl"));
+  if (it != arguments.end()) {
+    const auto* flow = std::get_if<std::string>(&it->second);
+    if (flow == nullptr ||
+        !ParseFlowControl(flow->c_str(), &config->flow_control)) {
       return false;
     }
-
-    return true;
   }
+  return true;
+}
 
-  void Close() {
-    if (handle_ != INVALID_HANDLE_VALUE) {
-      CloseHandle(handle_);
-      handle_ = INVALID_HANDLE_VALUE;
-    }
-  }
+}  // namespace
 
-  bool IsConnected() const { return handle_ != INVALID_HANDLE_VALUE; }
+// static
+void SerialComPlugin::RegisterWithRegistrar(
+    flutter::PluginRegistrarWindows* registrar) {
+  auto channel =
+      std::make_unique<flutter::MethodChannel<flutter::EncodableValue>>(
+          registrar->messenger(), "serial_com",
+          &flutter::StandardMethodCodec::GetInstance());
 
-  bool Write(const std::vector<uint8_t>& data) {
-    if (!IsConnected()) return false;
-    DWORD bytesWritten;
-    return WriteFile(handle_, data.data(), data.size(), &bytesWritten, NULL) &&
-           bytesWritten == data.size();
-  }
+  auto plugin = std::make_unique<SerialComPlugin>();
 
-  std::vector<uint8_t> Read() {
-    if (!IsConnected()) return {};
-    std::vector<uint8_t> buffer(1024);
-    DWORD bytesRead;
-    if (ReadFile(handle_, buffer.data(), buffer.size(), &bytesRead, NULL)) {
-      buffer.resize(bytesRead);
-      return buffer;
-    }
-    return {};
-  }
+  channel->SetMethodCallHandler(
+      [plugin_pointer = plugin.get()](const auto& call, auto result) {
+        plugin_pointer->HandleMethodCall(call, std::move(result));
+      });
 
-  bool requestPermission() {
-    // Windows doesn't require explicit permission for serial ports
-    return true;
-  }
+  registrar->AddPlugin(std::move(plugin));
+}
 
-  std::vector<std::string> listAvailableDevices() {
-    std::vector<std::string> devices;
-    HKEY hKey;
-    LONG result = RegOpenKeyExA(HKEY_LOCAL_MACHINE, "HARDWARE\\DEVICEMAP\\SERIALCOMM", 0, KEY_READ, &hKey);
-    
-    if (result != ERROR_SUCCESS) {
-      return devices;
+SerialComPlugin::SerialComPlugin() : serial_port_(SerialPort::Create()) {}
+
+SerialComPlugin::~SerialComPlugin() {}
+
+void SerialComPlugin::HandleMethodCall(
+    const flutter::MethodCall<flutter::EncodableValue>& method_call,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  if (method_call.method_name().compare("getPlatformVersion") == 0) {
+    std::ostringstream version_stream;
+    version_stream << "Windows ";
+    if (IsWindows10OrGreater()) {
+      version_stream << "10+";
+    } else if (IsWindows8OrGreater()) {
+      version_stream << "8";
+    } else if (IsWindows7OrGreater()) {
+      version_stream << "7";
     }
-
-    char valueName[MAX_PATH];
-    char data[MAX_PATH];
-    DWORD valueNameSize, dataSize, valueType;
-    DWORD index = 0;
-
-    while (true) {
-      valueNameSize = MAX_PATH;
-      dataSize = MAX_PATH;
-      result = RegEnumValueA(hKey, index, valueName, &valueNameSize, NULL, &valueType, (LPBYTE)data, &dataSize);
-      
-      if (result == ERROR_NO_MORE_ITEMS) {
-        break;
-      }
-      
-      if (result == ERROR_SUCCESS && valueType == REG_SZ) {
-        devices.push_back(data);
-      }
-      
-      index++;
+    result->Success(flutter::EncodableValue(version_stream.str()));
+  } else if (method_call.method_name().compare("isConnected") == 0) {
+    result->Success(flutter::EncodableValue(serial_port_->IsOpen()));
+  } else if (method_call.method_name().compare("connect") == 0) {
+    const auto* arguments = std::get_if<flutter::EncodableMap>(method_call.arguments());
+    PortConfig config;
+    if (arguments && ParsePortConfig(*arguments, &config)) {
+      result->Success(flutter::EncodableValue(serial_port_->Open(config).ok()));
+    } else {
+      result->Error("InvalidArguments", "Invalid arguments for connect");
     }
-
-    RegCloseKey(hKey);
-    return devices;
-  }
-
- private:
-  HANDLE handle_;
-};
-
-class SerialComPlugin : public flutter::Plugin {
- public:
-  static void RegisterWithRegistrar(flutter::PluginRegistrarWindows* registrar) {
-    auto channel = std::make_unique<flutter::MethodChannel<flutter::EncodableValue>>(
-        registrar->messenger(), "serial_com",
-        &flutter::StandardMethodCodec::GetInstance());
-
-    auto plugin = std::make_unique<SerialComPlugin>();
-
-    channel->SetMethodCallHandler(
-        [plugin_pointer = plugin.get()](const auto& call, auto result) {
-          plugin_pointer->HandleMethodCall(call, std::move(result));
-        });
-
-    registrar->AddPlugin(std::move(plugin));
-  }
-
-  SerialComPlugin() {}
-
-  virtual ~SerialComPlugin() {}
-
- private:
-  SerialPort serial_port_;
-
-  void HandleMethodCall(
-      const flutter::MethodCall<flutter::EncodableValue>& method_call,
-      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
-    if (method_call.method_name().compare("getPlatformVersion") == 0) {
-      std::ostringstream version_stream;
-      version_stream << "Windows ";
-      if (IsWindows10OrGreater()) {
-        version_stream << "10+";
-      } else if (IsWindows8OrGreater()) {
-        version_stream << "8";
-      } else if (IsWindows7OrGreater()) {
-        version_stream << "7";
-      }
-      result->Success(flutter::EncodableValue(version_stream.str()));
-    } else if (method_call.method_name().compare("isConnected") == 0) {
-      result->Success(flutter::EncodableValue(serial_port_.IsConnected()));
-    } else if (method_call.method_name().compare("connect") == 0) {
-      const auto* arguments = std::get_if<flutter::EncodableMap>(method_call.arguments());
-      if (arguments) {
-        auto port = std::get<std::string>(arguments->at(flutter::EncodableValue("port")));
-        auto baudRate = std::get<int>(arguments->at(flutter::EncodableValue("baudRate")));
-        result->Success(flutter::EncodableValue(serial_port_.Open(port, baudRate)));
-      } else {
-        result->Error("InvalidArguments", "Invalid arguments for connect");
-      }
-    } else if (method_call.method_name().compare("disconnect") == 0) {
-      serial_port_.Close();
-      result->Success(flutter::EncodableValue(true));
-    } else if (method_call.method_name().compare("write") == 0) {
-      const auto* arguments = std::get_if<std::vector<uint8_t>>(method_call.arguments());
-      if (arguments) {
-        result->Success(flutter::EncodableValue(serial_port_.Write(*arguments)));
-      } else {
-        result->Error("InvalidArguments", "Invalid arguments for write");
-      }
-    } else if (method_call.method_name().compare("read") == 0) {
-      auto data = serial_port_.Read();
-      result->Success(flutter::EncodableValue(data));
-    } else if (method_call.method_name().compare("listDevices") == 0) {
-      auto devices = serial_port_.listAvailableDevices();
-      flutter::EncodableList deviceList;
-      for (const auto& device : devices) {
-        deviceList.push_back(flutter::EncodableValue(device));
-      }
-      result->Success(flutter::EncodableValue(deviceList));
-    } else if (method_call.method_name().compare("requestPermission") == 0) {
-      result->Success(flutter::EncodableValue(serial_port_.requestPermission()));
+  } else if (method_call.method_name().compare("disconnect") == 0) {
+    serial_port_->Close();
+    result->Success(flutter::EncodableValue(true));
+  } else if (method_call.method_name().compare("write") == 0) {
+    const auto* arguments = std::get_if<std::vector<uint8_t>>(method_call.arguments());
+    if (arguments) {
+      Status status = serial_port_->Write(arguments->data(), arguments->size());
+      result->Success(flutter::EncodableValue(status.ok()));
     } else {
-      result->NotImplemented();
+      result->Error("InvalidArguments", "Invalid arguments for write");
     }
+  } else if (method_call.method_name().compare("read") == 0) {
+    size_t queued = 0;
+    serial_port_->Queued(&queued);
+    std::vector<uint8_t> data;
+    serial_port_->Read(read_sizer_.NextReadSize(queued), &data);
+    read_sizer_.OnRead(data.size(), std::chrono::steady_clock::now());
+    result->Success(flutter::EncodableValue(data));
+  } else if (method_call.method_name().compare("getPortStats") == 0) {
+    PortStatsSnapshot stats = serial_port_->stats().Snapshot();
+    flutter::EncodableMap map;
+    map[flutter::EncodableValue("bytesReceived")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.bytes_received));
+    map[flutter::EncodableValue("bytesSent")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.bytes_sent));
+    map[flutter::EncodableValue("readCalls")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.read_calls));
+    map[flutter::EncodableValue("writeCalls")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.write_calls));
+    map[flutter::EncodableValue("readErrors")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.read_errors));
+    map[flutter::EncodableValue("writeErrors")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.write_errors));
+    map[flutter::EncodableValue("readSizingCalls")] =
+        flutter::EncodableValue(static_cast<int64_t>(stats.read_sizing_calls));
+    map[flutter::EncodableValue("readSyscallsPerMB")] =
+        flutter::EncodableValue(ReadSyscallsPerMegabyte(stats));
+    ReadSizerStats sizing = read_sizer_.stats();
+    map[flutter::EncodableValue("readSize")] =
+        flutter::EncodableValue(static_cast<int64_t>(sizing.read_size));
+    map[flutter::EncodableValue("arrivalBytesPerSecond")] =
+        flutter::EncodableValue(static_cast<int64_t>(sizing.bytes_per_second));
+    result->Success(flutter::EncodableValue(map));
+  } else if (method_call.method_name().compare("listDevices") == 0) {
+    flutter::EncodableList deviceList;
+    for (const auto& device : ListWin32SerialDevices()) {
+      deviceList.push_back(flutter::EncodableValue(device));
+    }
+    result->Success(flutter::EncodableValue(deviceList));
+  } else if (method_call.method_name().compare("requestPermission") == 0) {
+    // Windows doesn't require explicit permission for serial ports
+    result->Success(flutter::EncodableValue(true));
+  } else {
+    result->NotImplemented();
   }
-};
-
-void SerialComPlugin::RegisterWithRegistrar(
-    flutter::PluginRegistrarWindows* registrar) {
-  SerialComPlugin::RegisterWithRegistrar(registrar);
 }
 
 }  // namespace serial_com
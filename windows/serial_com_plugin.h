@@ -6,6 +6,9 @@
 
 #include <memory>
 
+#include "read_sizer.h"
+#include "serial_port.h"
+
 namespace serial_com {
 
 class SerialComPlugin : public flutter::Plugin {
@@ -24,6 +27,11 @@ class SerialComPlugin : public flutter::Plugin {
   void HandleMethodCall(
       const flutter::MethodCall<flutter::EncodableValue> &method_call,
       std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+ private:
+  std::unique_ptr<SerialPort> serial_port_;
+  // Sizes each read from the driver's input queue and the arrival rate.
+  ReadSizer read_sizer_;
 };
 
 }  // namespace serial_com